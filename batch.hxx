@@ -0,0 +1,254 @@
+#ifndef __batch_hxx
+#define __batch_hxx
+
+// Batch mode for json2bson and bson2json: many files converted in one
+// process, on a pool of threads. Each thread starts on a share of the
+// files of its own and, once that runs out, steals half of what is left
+// of the largest share, so a few large files don't leave the rest of the
+// pool idle. Each thread keeps its buffers from one file to the next.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+// One file of a batch, and how its conversion went.
+struct BatchFile
+{
+  std::string input;
+  std::string output;
+  int status;          // the exit status converting it alone would give
+  const char* message; // why it failed, when status is nonzero
+};
+
+// Read all of \a fid into \a buf, which keeps its size from one call to
+// the next, putting the number of bytes in \a len.
+inline bool readFile(FILE* fid, std::vector<char>* buf, size_t* len)
+{
+  *len = 0;
+  for (;;)
+    {
+    if (buf->size() < *len + (1 << 16))
+      buf->resize(2 * buf->size() > *len + (1 << 16) ? 2 * buf->size() : *len + (1 << 16));
+    size_t got = fread(&(*buf)[*len], 1, buf->size() - *len, fid);
+    if (!got)
+      break;
+    *len += got;
+    }
+  return !ferror(fid);
+}
+
+struct Batch
+{
+  Batch() : enabled(false), valid(true)
+  {
+    this->jobs = std::thread::hardware_concurrency();
+    if (!this->jobs)
+      this->jobs = 1;
+  }
+
+  // Take \a arg if it is --batch or --jobs=N.
+  bool parse(const char* arg)
+  {
+    if (!strcmp(arg, "--batch"))
+      this->enabled = true;
+    else if (!strncmp(arg, "--jobs=", 7))
+      {
+      char* end;
+      unsigned long val = strtoul(arg + 7, &end, 10);
+      if (arg[7] < '0' || arg[7] > '9' || *end || val < 1 || val > 1024)
+        this->valid = false;
+      else
+        this->jobs = (size_t)val;
+      }
+    else
+      return false;
+    return true;
+  }
+
+  // Add the files \a arg names: those in a directory ending in \a ext,
+  // those listed one per line in a file named after an "@", or itself.
+  bool add(const char* arg, const char* ext)
+  {
+    if (arg[0] == '@')
+      {
+      std::ifstream list(arg + 1);
+      if (!list)
+        return false;
+      std::string line;
+      while (std::getline(list, line))
+        {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+          line.erase(line.size() - 1);
+        if (!line.empty())
+          this->push(line);
+        }
+      return !list.bad();
+      }
+#ifndef _WIN32
+    struct stat st;
+    if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode))
+      {
+      DIR* dir = opendir(arg);
+      if (!dir)
+        return false;
+      std::vector<std::string> names;
+      size_t elen = strlen(ext);
+      while (struct dirent* entry = readdir(dir))
+        {
+        size_t nlen = strlen(entry->d_name);
+        if (nlen > elen && !strcmp(entry->d_name + nlen - elen, ext))
+          names.push_back(std::string(arg) + "/" + entry->d_name);
+        }
+      closedir(dir);
+      std::sort(names.begin(), names.end()); // readdir's order is arbitrary
+      for (size_t i = 0; i < names.size(); ++i)
+        this->push(names[i]);
+      return true;
+      }
+#endif
+    this->push(arg);
+    return true;
+  }
+
+  void push(const std::string& input)
+  {
+    BatchFile file;
+    file.input = input;
+    file.status = 0;
+    file.message = NULL;
+    this->files.push_back(file);
+  }
+
+  // Name each output after its input, in \a dir and with \a to in place
+  // of the input's extension \a from. Inputs whose outputs would collide
+  // with an earlier one's fail rather than overwrite it.
+  bool name(const char* dir, const char* from, const char* to)
+  {
+#ifndef _WIN32
+    mkdir(dir, 0777); // an existing directory is fine
+#endif
+    std::set<std::string> taken;
+    for (size_t i = 0; i < this->files.size(); ++i)
+      {
+      BatchFile& file = this->files[i];
+      std::string base = file.input.substr(file.input.find_last_of("/\\") + 1);
+      if (base.size() > strlen(from) && !base.compare(base.size() - strlen(from), strlen(from), from))
+        base.erase(base.size() - strlen(from));
+      file.output = std::string(dir) + "/" + base + to;
+      if (!taken.insert(file.output).second)
+        {
+        file.status = 7;
+        file.message = "Another input has the same output file.";
+        }
+      }
+    return !this->files.empty();
+  }
+
+  // Convert every file with a copy of \a prototype per thread.
+  template <typename Worker>
+  void run(const Worker& prototype)
+  {
+    size_t count = this->files.size();
+    size_t threads = this->jobs < count ? this->jobs : count;
+    std::vector<std::atomic<uint64_t> > shares(threads);
+    for (size_t p = 0; p < threads; ++p)
+      shares[p] = pack(count * p / threads, count * (p + 1) / threads);
+    std::vector<std::thread> pool;
+    for (size_t p = 1; p < threads; ++p)
+      pool.push_back(std::thread(&Batch::work<Worker>, this, &shares, p, &prototype));
+    this->work(&shares, 0, &prototype);
+    for (size_t p = 0; p < pool.size(); ++p)
+      pool[p].join();
+  }
+
+  // Print how many files were converted and why each of the others was
+  // not, returning 0 if all were and 11 otherwise.
+  int report()
+  {
+    size_t failed = 0;
+    for (size_t i = 0; i < this->files.size(); ++i)
+      if (this->files[i].status)
+        ++failed;
+    std::cerr << (this->files.size() - failed) << " of " << this->files.size() << " files converted.\n";
+    for (size_t i = 0; i < this->files.size(); ++i)
+      if (this->files[i].status)
+        std::cerr << "  " << this->files[i].input << ": " << this->files[i].message << "\n";
+    return failed ? 11 : 0;
+  }
+
+  // A share is the range [begin, end) of files, packed into one word so
+  // its owner (taking from the front) and thieves (taking the back half)
+  // can each change it with a single compare-and-swap.
+  static uint64_t pack(uint64_t begin, uint64_t end) { return begin << 32 | end; }
+
+  template <typename Worker>
+  void work(std::vector<std::atomic<uint64_t> >* shares, size_t self, const Worker* prototype)
+  {
+    Worker worker(*prototype);
+    std::atomic<uint64_t>& mine((*shares)[self]);
+    for (;;)
+      {
+      uint64_t cur = mine;
+      while ((cur >> 32) < (cur & 0xffffffff) && !mine.compare_exchange_weak(cur, cur + (uint64_t(1) << 32)))
+        ;
+      if ((cur >> 32) < (cur & 0xffffffff))
+        {
+        BatchFile& file = this->files[cur >> 32];
+        if (!file.status)
+          worker.convert(file);
+        continue;
+        }
+      if (!this->steal(shares, self))
+        break;
+      }
+  }
+
+  bool steal(std::vector<std::atomic<uint64_t> >* shares, size_t self)
+  {
+    for (;;)
+      {
+      size_t victim = self;
+      uint64_t most = 0;
+      for (size_t p = 0; p < shares->size(); ++p)
+        {
+        uint64_t cur = (*shares)[p];
+        if ((cur & 0xffffffff) - (cur >> 32) > most && (cur >> 32) < (cur & 0xffffffff))
+          most = (cur & 0xffffffff) - (cur >> 32), victim = p;
+        }
+      if (victim == self)
+        return false;
+      uint64_t cur = (*shares)[victim];
+      uint64_t begin = cur >> 32, end = cur & 0xffffffff;
+      if (begin >= end)
+        continue;
+      uint64_t mid = begin + (end - begin) / 2;
+      if ((*shares)[victim].compare_exchange_strong(cur, pack(begin, mid)))
+        {
+        (*shares)[self] = pack(mid, end);
+        return true;
+        }
+      }
+  }
+
+  std::vector<BatchFile> files;
+  size_t jobs;
+  bool enabled;
+  bool valid;
+};
+
+#endif /* __batch_hxx */
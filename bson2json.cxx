@@ -3,16 +3,41 @@
 #include <string.h>
 
 #include "cJSON_BSON.h"
+#include "batch.hxx"
+#include "pipeline.hxx"
 
 #include <vector>
 #include <iostream>
+#include <thread>
 
 int usage(int argc, char* argv[], const char* msg, int status)
 {
   std::cerr
     << "\nUsage\n"
     << "=====\n\n"
-    << "  " << (argc > 0 ? argv[0] : "bson2json") << " input.bson output.json\n"
+    << "  " << (argc > 0 ? argv[0] : "bson2json") << " [options] input.bson output.json\n"
+    << "  " << (argc > 0 ? argv[0] : "bson2json") << " [options] --batch [--jobs=N] input... output-directory\n"
+    << "\n"
+    << "  Each BSON document in the input becomes one formatted JSON value,\n"
+    << "  spread over as many lines as it needs. Several documents are\n"
+    << "  written one after another, each starting on a new line, and\n"
+    << "  json2bson reads such a file back as the same documents.\n"
+    << "\n"
+    << "  With --extended-json, the output is MongoDB Extended JSON (v2):\n"
+    << "  binary data, ObjectIds, dates and 64-bit integers are written as\n"
+    << "  {\"$binary\": ...}, {\"$oid\": ...}, {\"$date\": ...} and so on\n"
+    << "  rather than as plain strings and numbers. Relaxed mode (the\n"
+    << "  default) keeps numbers plain; canonical mode wraps them all.\n"
+    << "\n"
+    << "  Reading, converting and writing run on threads of their own,\n"
+    << "  passing --buffers=N blocks (default 4) of --buffer-size=BYTES\n"
+    << "  (default 1M; k and M suffixes allowed) between each other.\n"
+    << "\n"
+    << "  With --batch, each input (a file, a directory whose .bson files\n"
+    << "  are all converted, or @list naming files one per line) becomes\n"
+    << "  a .json file in the output directory. --jobs=N threads (default\n"
+    << "  one per core) share the files, and the ones that could not be\n"
+    << "  converted are listed at the end.\n"
     << "\n";
   if (msg)
     std::cerr
@@ -23,35 +48,264 @@ int usage(int argc, char* argv[], const char* msg, int status)
   return status;
 }
 
+// Splits the bytes read into documents and writes the JSON for each
+// into blocks, which go on to the writing stage as they fill (or,
+// without a writing stage, into one block that grows to hold it all).
+struct Converter
+{
+  Channel* out;            // NULL in batch mode
+  Block* block;            // being filled
+  int extended;            // the cBSON_ExtJSON mode, or -1 for plain JSON
+  size_t docs;             // documents converted
+  std::vector<char> carry; // a document begun in an earlier block
+  bool writeFailed;
+
+  // Hand the block on to be written, and start another.
+  bool flush()
+  {
+    this->block->data = &this->block->buf[0];
+    if (!this->out->put(this->block) || !(this->block = this->out->get()))
+      {
+      this->block = NULL;
+      this->writeFailed = true;
+      }
+    return this->block != NULL;
+  }
+
+  bool write(const char* text, size_t n)
+  {
+    size_t limit = this->out ? this->out->size : (size_t)-1;
+    while (n && this->block)
+      {
+      if (this->block->len == this->block->buf.size())
+        {
+        if (this->out && this->block->len >= limit)
+          this->flush();
+        else
+          this->block->reserve(this->block->len + n, limit);
+        continue;
+        }
+      size_t room = this->block->buf.size() - this->block->len;
+      size_t len = n < room ? n : room;
+      memcpy(&this->block->buf[this->block->len], text, len);
+      this->block->len += len;
+      text += len;
+      n -= len;
+      }
+    if (!this->block)
+      this->writeFailed = true;
+    return this->block != NULL;
+  }
+
+  static int sink(void* ctx, const char* data, size_t len)
+  {
+    return static_cast<Converter*>(ctx)->write(data, len);
+  }
+
+  bool convert(const char* bson, size_t bson_size)
+  {
+    if (this->docs++ && !this->write("\n", 1))
+      return false;
+    if (this->extended >= 0)
+      {
+      size_t len;
+      char* json = cBSON_PrintExtendedJSON(bson, bson_size, cJSON_NULL, this->extended, 1, &len);
+      if (!json)
+        return false;
+      bool ok = this->write(json, len);
+      cJSON_DeleteBSON(json);
+      return ok;
+      }
+    cJSON* node = cJSON_ParseBSON(bson, bson_size, cJSON_NULL);
+    if (!node)
+      return false;
+    if (!cJSON_PrintToSink(node, 1, 0, sink, this))
+      this->writeFailed = true;
+    cJSON_Delete(node);
+    return !this->writeFailed;
+  }
+
+  // Convert each document in \a data, keeping any that runs past its
+  // end until the rest arrives.
+  bool feed(const char* data, size_t len)
+  {
+    int32_t size;
+    while (len)
+      {
+      if (this->carry.empty() && len >= 4)
+        {
+        memcpy(&size, data, sizeof(size));
+        if (size < 5)
+          return false;
+        if ((size_t)size <= len)
+          {
+          if (!this->convert(data, (size_t)size))
+            return false;
+          data += size;
+          len -= size;
+          continue;
+          }
+        }
+      size_t want = 4;
+      if (this->carry.size() >= 4)
+        {
+        memcpy(&size, &this->carry[0], sizeof(size));
+        if (size < 5)
+          return false;
+        want = (size_t)size;
+        }
+      size_t n = want - this->carry.size() < len ? want - this->carry.size() : len;
+      this->carry.insert(this->carry.end(), data, data + n);
+      data += n;
+      len -= n;
+      if (this->carry.size() == want && want > 4)
+        {
+        if (!this->convert(&this->carry[0], want))
+          return false;
+        this->carry.clear();
+        }
+      }
+    return true;
+  }
+};
+
+// Converts the files of a batch one at a time, keeping its buffers from
+// one file to the next.
+struct BatchWorker
+{
+  BatchWorker()
+  {
+    this->conv.out = NULL;
+    this->conv.block = NULL;
+    this->conv.extended = -1;
+    this->conv.docs = 0;
+    this->conv.writeFailed = false;
+  }
+
+  void convert(BatchFile& file)
+  {
+    size_t len;
+    FILE* fid = fopen(file.input.c_str(), "rb");
+    if (!fid)
+      return fail(file, "Unable to open input file.", 3);
+    bool read = readFile(fid, &this->bson, &len);
+    fclose(fid);
+
+    this->block.len = 0;
+    this->conv.out = NULL;
+    this->conv.block = &this->block;
+    this->conv.docs = 0;
+    this->conv.carry.clear();
+    this->conv.writeFailed = false;
+    bool ok = read && (!len || this->conv.feed(&this->bson[0], len));
+    if (this->conv.writeFailed)
+      return fail(file, "Unable to write output file.", 9);
+    if (!ok || !this->conv.carry.empty() || !this->conv.docs)
+      return fail(file, "Unable to parse input file.", 5);
+
+    // As in a single conversion, an earlier output is only replaced once
+    // the new one is complete.
+    Output output;
+    if (!output.open(file.output.c_str()))
+      return fail(file, "Unable to open output file.", 7);
+    bool wrote = output.write(&this->block.buf[0], this->block.len);
+    if (!output.close(wrote) || !wrote)
+      return fail(file, "Unable to write output file.", 9);
+  }
+
+  static void fail(BatchFile& file, const char* message, int status)
+  {
+    file.message = message;
+    file.status = status;
+  }
+
+  Converter conv;
+  Block block;
+  std::vector<char> bson;
+};
+
 int main(int argc, char* argv[])
 {
-  if (argc < 3)
+  int extended = -1; // the cBSON_ExtJSON mode, or -1 for plain JSON
+  PipelineOptions opts;
+  Batch batch;
+  int arg = 1;
+  for (; arg < argc && !strncmp(argv[arg], "--", 2); ++arg)
+    {
+    if (!strcmp(argv[arg], "--extended-json") || !strcmp(argv[arg], "--extended-json=relaxed"))
+      extended = cBSON_ExtJSONRelaxed;
+    else if (!strcmp(argv[arg], "--extended-json=canonical"))
+      extended = cBSON_ExtJSONCanonical;
+    else if (!opts.parse(argv[arg]) && !batch.parse(argv[arg]))
+      return usage(argc, argv, "Unknown option.", 1);
+    }
+  if (!opts.valid)
+    return usage(argc, argv, "Buffer sizes and counts must be between 1 and 2^30.", 1);
+  if (!batch.valid)
+    return usage(argc, argv, "Jobs must number between 1 and 1024.", 1);
+  if (argc - arg < 2)
     return usage(argc, argv, "Please specify input and output filenames.", 1);
+  const char* inputName = argv[arg];
+  const char* outputName = argv[arg + 1];
+
+  if (batch.enabled)
+    {
+    for (; arg < argc - 1; ++arg)
+      if (!batch.add(argv[arg], ".bson"))
+        return usage(argc, argv, "Unable to open input file.", 3);
+    if (!batch.name(argv[argc - 1], ".bson", ".json"))
+      return usage(argc, argv, "No input files.", 3);
+    BatchWorker prototype;
+    prototype.conv.extended = extended;
+    batch.run(prototype);
+    return batch.report();
+    }
+  if (argc - arg > 2)
+    return usage(argc, argv, "Please specify one input and one output filename, or --batch.", 1);
 
-  // Read in the BSON data.
-  FILE* fid = fopen(argv[1], "rb");
-  if (!fid)
+  Source input;
+  if (!input.open(inputName))
     return usage(argc, argv, "Unable to open input file.", 3);
-  fseek(fid, 0L, SEEK_END);
-  size_t bson_size = ftell(fid);
-  std::vector<char> bson;
-  bson.resize(bson_size);
-  fseek(fid, 0L, SEEK_SET);
-  fread(&bson[0], bson_size, 1, fid);
-  fclose(fid);
+  Output output;
+  if (!output.open(outputName))
+    {
+    input.close();
+    return usage(argc, argv, "Unable to open output file.", 7);
+    }
 
-  cJSON* node = cJSON_ParseBSON(&bson[0], bson_size, cJSON_NULL);
-  if (!node)
-    return usage(argc, argv, "Unable to parse input file.", 5);
-  char* json = cJSON_Print(node);
-  cJSON_Delete(node);
+  Channel inbound(opts.buffers, opts.bufferSize);
+  Channel outbound(opts.buffers, opts.bufferSize);
+  Converter conv;
+  conv.out = &outbound;
+  conv.block = outbound.get();
+  conv.extended = extended;
+  conv.docs = 0;
+  conv.writeFailed = false;
+  std::thread reader(&Source::run, &input, &inbound);
+  std::thread writer(&Output::run, &output, &outbound);
 
-  fid = fopen(argv[2], "w");
-  if (!fid)
-    return usage(argc, argv, "Unable to open output file.", 7);
-  fwrite(json, strlen(json), 1, fid);
-  fclose(fid);
-  free(json);
+  bool ok = true;
+  Block* block;
+  while (ok && (block = inbound.take()))
+    {
+    ok = conv.feed(block->data, block->len);
+    inbound.give(block);
+    }
+  inbound.abort();
+  reader.join();
+  ok = ok && !input.failed && conv.carry.empty() && conv.docs > 0;
+  if (conv.block && conv.block->len)
+    conv.flush();
+  outbound.finish();
+  writer.join();
+  input.close();
+
+  // The output only replaces the file named once all of it is written.
+  bool wrote = !output.failed && !conv.writeFailed;
+  if (!output.close(ok && wrote) || !wrote)
+    return usage(argc, argv, "Unable to write output file.", 9);
+  if (!ok)
+    return usage(argc, argv, "Unable to parse input file.", 5);
 
   return 0;
 }
@@ -30,9 +30,41 @@
 #include <float.h>
 #include <limits.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#define cJSON_write(fd,buf,len) _write(fd,buf,(unsigned)(len))
+#else
+#include <unistd.h>
+#define cJSON_write(fd,buf,len) write(fd,buf,len)
+#endif
 #include "cJSON.h"
 
+/* Frozen items are counted atomically so copies can be made and deleted from any thread. */
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define cJSON_frozen(item) (*(volatile long*)&(item)->refcount>0)
+#define cJSON_retain(item) _InterlockedIncrement((volatile long*)&(item)->refcount)
+#define cJSON_release(item) _InterlockedDecrement((volatile long*)&(item)->refcount)
+#elif defined(__GNUC__)
+#define cJSON_frozen(item) (__atomic_load_n(&(item)->refcount,__ATOMIC_RELAXED)>0)
+#define cJSON_retain(item) __atomic_add_fetch(&(item)->refcount,1,__ATOMIC_RELAXED)
+#define cJSON_release(item) __atomic_sub_fetch(&(item)->refcount,1,__ATOMIC_ACQ_REL)
+#else
+#define cJSON_frozen(item) ((item)->refcount>0)
+#define cJSON_retain(item) (++(item)->refcount)
+#define cJSON_release(item) (--(item)->refcount)
+#endif
+
+/* The error pointer is per thread, so parses on several threads at once don't trample each other's. */
+#if defined(_MSC_VER)
+static __declspec(thread) const char *ep;
+#elif defined(__GNUC__)
+static __thread const char *ep;
+#else
 static const char *ep;
+#endif
 
 const char *cJSON_GetErrorPtr(void) {return ep;}
 
@@ -46,17 +78,38 @@ static int cJSON_strcasecmp(const char *s1,const char *s2)
 static void *(*cJSON_malloc)(size_t sz) = malloc;
 static void (*cJSON_free)(void *ptr) = free;
 
-static char* cJSON_strdup(const char* str)
+static char* cJSON_strndup(const char* str,size_t len)
 {
-      size_t len;
       char* copy;
 
-      len = strlen(str) + 1;
-      if (!(copy = (char*)cJSON_malloc(len))) return 0;
+      if (!(copy = (char*)cJSON_malloc(len + 1))) return 0;
       memcpy(copy,str,len);
+      copy[len] = 0;
       return copy;
 }
 
+/* Strings with NULs in them are counted: their length sits in the size_t before them, and their item is flagged with
+cJSON_ValueHasLength (or cJSON_StringHasLength for a key). Every other string is measured, so code that swaps in a new
+valuestring (or string) without knowing about lengths still works for ordinary strings. */
+#define counted_length(str)	(((size_t*)(str))[-1])
+static size_t value_length(cJSON *item)		{return (item->type&cJSON_ValueHasLength)?counted_length(item->valuestring):item->valuestring?strlen(item->valuestring):0;}
+static size_t string_length(cJSON *item)	{return (item->type&cJSON_StringHasLength)?counted_length(item->string):item->string?strlen(item->string):0;}
+size_t cJSON_GetValueLength(cJSON *item)	{return item?value_length(item):0;}
+size_t cJSON_GetKeyLength(cJSON *item)		{return item?string_length(item):0;}
+
+/* Copy len bytes of str, counted if there is a NUL among them, which sets *counted. */
+static char *copy_string(const char *str,size_t len,int *counted)
+{
+	size_t *block;
+	if (!(*counted=memchr(str,0,len)!=0)) return cJSON_strndup(str,len);
+	if (!(block=(size_t*)cJSON_malloc(sizeof(size_t)+len+1))) return 0;
+	*block=len;memcpy(block+1,str,len);((char*)(block+1))[len]=0;
+	return (char*)(block+1);
+}
+static void free_string(char *str,int counted)	{cJSON_free(counted?(void*)((size_t*)str-1):(void*)str);}
+/* Set an item's type as its value is parsed, keeping the flag of the key parsed before it. */
+#define set_type(item,t)	((item)->type=((item)->type&cJSON_StringHasLength)|(t))
+
 void cJSON_InitHooks(cJSON_Hooks* hooks)
 {
     if (!hooks) { /* Reset hooks */
@@ -77,16 +130,55 @@ static cJSON *cJSON_New_Item(void)
 	return node;
 }
 
-/* Delete a cJSON structure. */
+/* Arrays and objects are walked on an explicit stack rather than by recursion, so nesting is bounded by
+cJSON_nesting_limit instead of by the C stack. Frames start in a small local array and move to the heap as the stack deepens. */
+static int cJSON_nesting_limit=CJSON_NESTING_LIMIT;
+void cJSON_SetNestingLimit(int depth)	{cJSON_nesting_limit=depth>0?depth:CJSON_NESTING_LIMIT;}
+int cJSON_GetNestingLimit(void)			{return cJSON_nesting_limit;}
+
+typedef struct {char *frames,*local;size_t size;int depth,capacity;} walk_stack;
+#define walk_init(s,localframes) ((s)->frames=(s)->local=(char*)(localframes),(s)->size=sizeof(*(localframes)),(s)->depth=0,(s)->capacity=(int)(sizeof(localframes)/sizeof(*(localframes))))
+#define walk_top(s,type) ((type*)(s)->frames+(s)->depth-1)
+static void walk_free(walk_stack *s)	{if (s->frames!=s->local) cJSON_free(s->frames);}
+
+/* Push a frame; 0 when the nesting limit is reached or memory runs out. */
+static void *walk_push(walk_stack *s)
+{
+	char *grown;
+	if (s->depth>=cJSON_nesting_limit) return 0;
+	if (s->depth==s->capacity)
+	{
+		if (!(grown=(char*)cJSON_malloc(2*s->capacity*s->size))) return 0;
+		memcpy(grown,s->frames,s->depth*s->size);
+		walk_free(s);
+		s->frames=grown;s->capacity*=2;
+	}
+	return s->frames+(s->depth++)*s->size;
+}
+
+/* Drop one hold on a frozen item. Once the last one goes it is an ordinary item again, returned for deleting. */
+static cJSON *frozen_release(cJSON *item)	{return cJSON_release(item)?0:item;}
+
+/* A key is freed with its item unless it is const or borrowed from the frozen item a copy shares. */
+static void free_key(cJSON *item)	{if (item->string && !(item->type&cJSON_StringIsConst) && !(item->shared && item->string==item->shared->string)) free_string(item->string,item->type&cJSON_StringHasLength);}
+
+/* Delete a cJSON structure. Each item's children are spliced into the chain after it, so no stack is needed at all.
+A frozen item is only freed by whoever drops its last hold; a copy sharing one drops its hold when it goes. */
 void cJSON_Delete(cJSON *c)
 {
-	cJSON *next;
+	cJSON *next,*tail,*dead;
 	while (c)
 	{
 		next=c->next;
-		if (!(c->type&cJSON_IsReference) && c->child) cJSON_Delete(c->child);
-		if (!(c->type&cJSON_IsReference) && c->valuestring) cJSON_free(c->valuestring);
-		if (!(c->type&cJSON_StringIsConst) && c->string) cJSON_free(c->string);
+		if (cJSON_frozen(c) && !frozen_release(c)) {c=next;continue;}
+		free_key(c);
+		if (!(c->type&cJSON_IsReference) && !c->shared && c->child)
+		{
+			for (tail=c->child;tail->next;tail=tail->next);
+			tail->next=next;next=c->child;
+		}
+		if (c->shared && (dead=frozen_release(c->shared))) {dead->next=next;next=dead;}
+		if (!(c->type&cJSON_IsReference) && !c->shared && c->valuestring) free_string(c->valuestring,c->type&cJSON_ValueHasLength);
 		cJSON_free(c);
 		c=next;
 	}
@@ -110,68 +202,63 @@ static const char *parse_number(cJSON *item,const char *num)
 	
 	item->valuedouble=n;
 	item->valueint=(int)n;
-	item->type=cJSON_Number;
+	set_type(item,cJSON_Number);
 	return num;
 }
 
-static int pow2gt (int x)	{	--x;	x|=x>>1;	x|=x>>2;	x|=x>>4;	x|=x>>8;	x|=x>>16;	return x+1;	}
+#ifndef CJSON_PRINT_HIGHWATER
+#define CJSON_PRINT_HIGHWATER 65536	/* default buffer size for printing to a sink */
+#endif
+
+typedef struct {
+	char *buffer;size_t length,offset;	/* output buffer, its size, and the number of bytes written to it */
+	cJSON_Sink sink;void *ctx;			/* if set, a full buffer is handed to sink and then reused */
+} printbuffer;
+
+static size_t pow2gt (size_t x)	{	size_t n=1;	while (n<x) n<<=1;	return n;	}
 
-typedef struct {char *buffer; int length; int offset; } printbuffer;
+/* Hand everything written so far to the sink and start over at the beginning of the buffer. */
+static int flush(printbuffer *p)
+{
+	if (p->offset && !p->sink(p->ctx,p->buffer,p->offset)) return 0;
+	p->offset=0;
+	return 1;
+}
 
-static char* ensure(printbuffer *p,int needed)
+/* Make room for needed more bytes. A buffer with a sink is flushed when it fills up; it only grows for a single piece larger than itself. */
+static char* ensure(printbuffer *p,size_t needed)
 {
-	char *newbuffer;int newsize;
-	if (!p || !p->buffer) return 0;
-	needed+=p->offset;
-	if (needed<=p->length) return p->buffer+p->offset;
+	char *newbuffer;size_t newsize;
+	if (!p->buffer) return 0;
+	if (p->offset+needed<=p->length) return p->buffer+p->offset;
+	if (p->sink && !flush(p)) return 0;
+	if (p->offset+needed<=p->length) return p->buffer+p->offset;
 
-	newsize=pow2gt(needed);
+	newsize=pow2gt(p->offset+needed);
 	newbuffer=(char*)cJSON_malloc(newsize);
 	if (!newbuffer) {cJSON_free(p->buffer);p->length=0,p->buffer=0;return 0;}
-	if (newbuffer) memcpy(newbuffer,p->buffer,p->length);
+	memcpy(newbuffer,p->buffer,p->offset);
 	cJSON_free(p->buffer);
 	p->length=newsize;
 	p->buffer=newbuffer;
 	return newbuffer+p->offset;
 }
 
-static int update(printbuffer *p)
-{
-	char *str;
-	if (!p || !p->buffer) return 0;
-	str=p->buffer+p->offset;
-	return p->offset+strlen(str);
-}
+static int append(printbuffer *p,const char *str,size_t len)	{char *out=ensure(p,len);if (!out) return 0;memcpy(out,str,len);p->offset+=len;return 1;}
+static int append_tabs(printbuffer *p,int count)				{char *out;if (count<=0) return 1;if (!(out=ensure(p,count))) return 0;memset(out,'\t',count);p->offset+=count;return 1;}
 
-/* Render the number nicely from the given item into a string. */
-static char *print_number(cJSON *item,printbuffer *p)
+/* Render the number nicely from the given item into the buffer. */
+static int print_number(cJSON *item,printbuffer *p)
 {
-	char *str=0;
+	char *str=ensure(p,64);	/* Enough for any of the formats below, and sprintf's terminator. */
 	double d=item->valuedouble;
-	if (d==0)
-	{
-		if (p)	str=ensure(p,2);
-		else	str=(char*)cJSON_malloc(2);	/* special case for 0. */
-		if (str) strcpy(str,"0");
-	}
-	else if (fabs(((double)item->valueint)-d)<=DBL_EPSILON && d<=INT_MAX && d>=INT_MIN)
-	{
-		if (p)	str=ensure(p,21);
-		else	str=(char*)cJSON_malloc(21);	/* 2^64+1 can be represented in 21 chars. */
-		if (str)	sprintf(str,"%d",item->valueint);
-	}
-	else
-	{
-		if (p)	str=ensure(p,64);
-		else	str=(char*)cJSON_malloc(64);	/* This is a nice tradeoff. */
-		if (str)
-		{
-			if (fabs(floor(d)-d)<=DBL_EPSILON && fabs(d)<1.0e60)sprintf(str,"%.0f",d);
-			else if (fabs(d)<1.0e-6 || fabs(d)>1.0e9)			sprintf(str,"%e",d);
-			else												sprintf(str,"%f",d);
-		}
-	}
-	return str;
+	if (!str) return 0;
+	if (d==0)																	p->offset+=sprintf(str,"0");
+	else if (fabs(((double)item->valueint)-d)<=DBL_EPSILON && d<=INT_MAX && d>=INT_MIN)	p->offset+=sprintf(str,"%d",item->valueint);
+	else if (fabs(floor(d)-d)<=DBL_EPSILON && fabs(d)<1.0e60)					p->offset+=sprintf(str,"%.0f",d);
+	else if (fabs(d)<1.0e-6 || fabs(d)>1.0e9)									p->offset+=sprintf(str,"%e",d);
+	else																		p->offset+=sprintf(str,"%f",d);
+	return 1;
 }
 
 static unsigned parse_hex4(const char *str)
@@ -187,25 +274,20 @@ static unsigned parse_hex4(const char *str)
 	return h;
 }
 
-/* Parse the input text into an unescaped cstring, and populate item. */
 static const unsigned char firstByteMark[7] = { 0x00, 0x00, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
-static const char *parse_string(cJSON *item,const char *str)
+/* Unescape the string whose opening quote is at str into out, which has room for it plus a terminator.
+Returns the end of the string and puts the unescaped length in *length. */
+static const char *unescape_string(const char *str,char *out,size_t *length)
 {
-	const char *ptr=str+1;char *ptr2;char *out;int len=0;unsigned uc,uc2;
-	if (*str!='\"') {ep=str;return 0;}	/* not a string! */
-	
-	while (*ptr!='\"' && *ptr && ++len) if (*ptr++ == '\\') ptr++;	/* Skip escaped quotes. */
-	
-	out=(char*)cJSON_malloc(len+1);	/* This is how long we need for the string, roughly. */
-	if (!out) return 0;
-	
-	ptr=str+1;ptr2=out;
+	const char *ptr=str+1;char *ptr2=out;int len;unsigned uc,uc2;
+
 	while (*ptr!='\"' && *ptr)
 	{
 		if (*ptr!='\\') *ptr2++=*ptr++;
 		else
 		{
 			ptr++;
+			if (!*ptr) break;	/* a trailing backslash. */
 			switch (*ptr)
 			{
 				case 'b': *ptr2++='\b';	break;
@@ -214,15 +296,18 @@ static const char *parse_string(cJSON *item,const char *str)
 				case 'r': *ptr2++='\r';	break;
 				case 't': *ptr2++='\t';	break;
 				case 'u':	 /* transcode utf16 to utf8. */
-					uc=parse_hex4(ptr+1);ptr+=4;	/* get the unicode char. */
+					uc=parse_hex4(ptr+1);	/* get the unicode char. */
+					if (!uc && strncmp(ptr+1,"0000",4))	break;	/* not four hex digits. */
+					ptr+=4;
 
-					if ((uc>=0xDC00 && uc<=0xDFFF) || uc==0)	break;	/* check for invalid.	*/
+					if (uc>=0xDC00 && uc<=0xDFFF)	break;	/* check for invalid. \u0000 is kept: strings carry their length.	*/
 
 					if (uc>=0xD800 && uc<=0xDBFF)	/* UTF16 surrogate pairs.	*/
 					{
 						if (ptr[1]!='\\' || ptr[2]!='u')	break;	/* missing second-half of surrogate.	*/
-						uc2=parse_hex4(ptr+3);ptr+=6;
+						uc2=parse_hex4(ptr+3);
 						if (uc2<0xDC00 || uc2>0xDFFF)		break;	/* invalid second-half of surrogate.	*/
+						ptr+=6;
 						uc=0x10000 + (((uc&0x3FF)<<10) | (uc2&0x3FF));
 					}
 
@@ -243,91 +328,183 @@ static const char *parse_string(cJSON *item,const char *str)
 	}
 	*ptr2=0;
 	if (*ptr=='\"') ptr++;
-	item->valuestring=out;
-	item->type=cJSON_String;
+	*length=ptr2-out;
 	return ptr;
 }
 
-/* Render the cstring provided to an escaped version that can be printed. */
-static char *print_string_ptr(const char *str,printbuffer *p)
+/* Parse the input text into an unescaped cstring, and populate item. */
+static const char *parse_string(cJSON *item,const char *str)
 {
-	const char *ptr;char *ptr2,*out;int len=0,flag=0;unsigned char token;
+	const char *ptr=str+1;char *out,*copy;int len=0,counted=0;size_t length;
+	if (*str!='\"') {ep=str;return 0;}	/* not a string! */
 	
-	for (ptr=str;*ptr;ptr++) flag|=((*ptr>0 && *ptr<32)||(*ptr=='\"')||(*ptr=='\\'))?1:0;
-	if (!flag)
-	{
-		len=ptr-str;
-		if (p) out=ensure(p,len+3);
-		else		out=(char*)cJSON_malloc(len+3);
-		if (!out) return 0;
-		ptr2=out;*ptr2++='\"';
-		strcpy(ptr2,str);
-		ptr2[len]='\"';
-		ptr2[len+1]=0;
-		return out;
-	}
+	while (*ptr!='\"' && *ptr && ++len) if (*ptr++ == '\\' && *ptr) ptr++;	/* Skip escaped quotes. */
 	
-	if (!str)
+	out=(char*)cJSON_malloc(len+1);	/* This is how long we need for the string, roughly. */
+	if (!out) return 0;
+	
+	ptr=unescape_string(str,out,&length);
+	if (memchr(out,0,length))	/* a \u0000: keep the length. */
 	{
-		if (p)	out=ensure(p,3);
-		else	out=(char*)cJSON_malloc(3);
-		if (!out) return 0;
-		strcpy(out,"\"\"");
-		return out;
+		copy=copy_string(out,length,&counted);
+		cJSON_free(out);
+		if (!(out=copy)) return 0;
 	}
-	ptr=str;while ((token=*ptr) && ++len) {if (strchr("\"\\\b\f\n\r\t",token)) len++; else if (token<32) len+=5;ptr++;}
-	
-	if (p)	out=ensure(p,len+3);
-	else	out=(char*)cJSON_malloc(len+3);
-	if (!out) return 0;
+	item->valuestring=out;
+	set_type(item,cJSON_String|(counted?cJSON_ValueHasLength:0));
+	return ptr;
+}
+
+/* Render the len bytes of str provided to an escaped version that can be printed. */
+static int print_string_ptr(const char *str,size_t len,printbuffer *p)
+{
+	static const char hex[]="0123456789abcdef";
+	const char *ptr,*end=str+len;char *out;unsigned char token;
+
+	if (!str) return append(p,"\"\"",2);
+	for (ptr=str,len=0;ptr<end;ptr++) token=*ptr,len+=(token=='\"' || token=='\\' || token=='\b' || token=='\f' || token=='\n' || token=='\r' || token=='\t')?2:(token<32)?6:1;
+
+	if (!(out=ensure(p,len+2))) return 0;
+	p->offset+=len+2;
+	*out++='\"';
+	if (len==(size_t)(ptr-str)) {memcpy(out,str,len);out[len]='\"';return 1;}	/* nothing to escape */
 
-	ptr2=out;ptr=str;
-	*ptr2++='\"';
-	while (*ptr)
+	for (ptr=str;ptr<end;ptr++)
 	{
-		if ((unsigned char)*ptr>31 && *ptr!='\"' && *ptr!='\\') *ptr2++=*ptr++;
-		else
+		token=*ptr;
+		if (token>31 && token!='\"' && token!='\\') {*out++=token;continue;}
+		*out++='\\';
+		switch (token)
 		{
-			*ptr2++='\\';
-			switch (token=*ptr++)
-			{
-				case '\\':	*ptr2++='\\';	break;
-				case '\"':	*ptr2++='\"';	break;
-				case '\b':	*ptr2++='b';	break;
-				case '\f':	*ptr2++='f';	break;
-				case '\n':	*ptr2++='n';	break;
-				case '\r':	*ptr2++='r';	break;
-				case '\t':	*ptr2++='t';	break;
-				default: sprintf(ptr2,"u%04x",token);ptr2+=5;	break;	/* escape and print */
-			}
+			case '\\':	*out++='\\';	break;
+			case '\"':	*out++='\"';	break;
+			case '\b':	*out++='b';	break;
+			case '\f':	*out++='f';	break;
+			case '\n':	*out++='n';	break;
+			case '\r':	*out++='r';	break;
+			case '\t':	*out++='t';	break;
+			default: *out++='u';*out++='0';*out++='0';*out++=hex[token>>4];*out++=hex[token&15];	break;	/* escape and print */
 		}
 	}
-	*ptr2++='\"';*ptr2++=0;
-	return out;
+	*out='\"';
+	return 1;
 }
 /* Invote print_string_ptr (which is useful) on an item. */
-static char *print_string(cJSON *item,printbuffer *p)	{return print_string_ptr(item->valuestring,p);}
+static int print_string(cJSON *item,printbuffer *p)	{return print_string_ptr(item->valuestring,value_length(item),p);}
 
-/* Predeclare these prototypes. */
-static const char *parse_value(cJSON *item,const char *value);
-static char *print_value(cJSON *item,int depth,int fmt,printbuffer *p);
-static const char *parse_array(cJSON *item,const char *value);
-static char *print_array(cJSON *item,int depth,int fmt,printbuffer *p);
-static const char *parse_object(cJSON *item,const char *value);
-static char *print_object(cJSON *item,int depth,int fmt,printbuffer *p);
+/* The types past cJSON_Object are BSON's, read with extended types on (see cJSON_BSON.h). The ones holding a number
+print as it; binary data, UUIDs and ObjectIds print as their bytes in hex, as strings, the way they read with them off. */
+static int print_extended(cJSON *item,printbuffer *p)
+{
+	static const char hex[]="0123456789abcdef";
+	const unsigned char *in=(const unsigned char*)item->valuestring;char *out;
+	size_t i,len=value_length(item);int type=item->type&255,uuid=(type==17 && len==16)?4:0;
+	if (type>=19 && type<=22) return print_number(item,p);
+	if (type<16 || type>18 || !in || !(out=ensure(p,2*len+uuid+2))) return 0;
+	p->offset+=2*len+uuid+2;
+	*out++='\"';
+	for (i=0;i<len;i++) {if (uuid && (i==4 || i==6 || i==8 || i==10)) *out++='-';*out++=hex[in[i]>>4];*out++=hex[in[i]&15];}
+	*out='\"';
+	return 1;
+}
 
 /* Utility to jump whitespace and cr/lf */
 static const char *skip(const char *in) {while (in && *in && (unsigned char)*in<=32) in++; return in;}
 
+typedef struct {cJSON *item,*last;} parse_frame;
+
+/* Append a new, empty item to the container in frame f. */
+static cJSON *parse_frame_child(parse_frame *f)
+{
+	cJSON *child=cJSON_New_Item();
+	if (!child) return 0;
+	if (f->last) {f->last->next=child;child->prev=f->last;} else f->item->child=child;
+	return f->last=child;
+}
+
+/* Parse a value that is not an array or object. */
+static const char *parse_scalar(cJSON *item,const char *value)
+{
+	if (!strncmp(value,"null",4))	{ set_type(item,cJSON_NULL);  return value+4; }
+	if (!strncmp(value,"false",5))	{ set_type(item,cJSON_False); return value+5; }
+	if (!strncmp(value,"true",4))	{ set_type(item,cJSON_True); item->valueint=1;	return value+4; }
+	if (*value=='\"')				{ return parse_string(item,value); }
+	if (*value=='-' || (*value>='0' && *value<='9'))	{ return parse_number(item,value); }
+
+	ep=value;return 0;	/* failure. */
+}
+
+/* Parse the "key": prefix of an object member into item; returns the start of its value. */
+static const char *parse_key(cJSON *item,const char *value)
+{
+	value=skip(parse_string(item,value));
+	if (!value) return 0;
+	item->string=item->valuestring;item->type=(item->type&cJSON_ValueHasLength)?cJSON_StringHasLength:0;
+	item->valuestring=0;
+	if (*value!=':') {ep=value;return 0;}	/* fail! */
+	return skip(value+1);
+}
+
+static int intern_item(cJSON_InternPool *pool,cJSON *item);
+
+/* Parser core - when encountering text, process appropriately. With a pool, each value is interned as soon as it is complete. */
+static const char *parse_value(cJSON *item,const char *value,cJSON_InternPool *pool)
+{
+	parse_frame local[16],*f;walk_stack s;char close;
+	walk_init(&s,local);
+	for (;;)
+	{
+		/* Parse the value starting at value into item, or open it if it is an array or object. */
+		if (!value) goto fail;
+		if (*value=='[' || *value=='{')
+		{
+			if (!(f=(parse_frame*)walk_push(&s))) {ep=value;goto fail;}	/* too deep. */
+			set_type(item,(*value=='[')?cJSON_Array:cJSON_Object);
+			f->item=item;f->last=0;
+			value=skip(value+1);
+			if (*value==(((item->type&255)==cJSON_Array)?']':'}')) {s.depth--;value++;}	/* empty. */
+			else
+			{
+				if (!(item=parse_frame_child(f))) goto fail;	/* memory fail */
+				if ((f->item->type&255)==cJSON_Object && !(value=parse_key(item,value))) goto fail;
+				continue;
+			}
+		}
+		else if (!(value=parse_scalar(item,value))) goto fail;
+		if (pool && !intern_item(pool,item)) goto fail;
+
+		/* The value is complete: close finished containers, then start the next member. */
+		for (;;)
+		{
+			if (!s.depth) {walk_free(&s);return value;}
+			f=walk_top(&s,parse_frame);close=((f->item->type&255)==cJSON_Array)?']':'}';
+			value=skip(value);
+			if (*value==close)
+			{
+				if (pool && !intern_item(pool,f->item)) goto fail;
+				s.depth--;value++;continue;
+			}
+			if (*value!=',')	{ep=value;goto fail;}	/* malformed. */
+			if (!(item=parse_frame_child(f))) goto fail;
+			value=skip(value+1);
+			if ((f->item->type&255)==cJSON_Object && !(value=parse_key(item,value))) goto fail;
+			break;
+		}
+	}
+fail:
+	walk_free(&s);
+	return 0;
+}
+
 /* Parse an object - create a new root, and populate. */
-cJSON *cJSON_ParseWithOpts(const char *value,const char **return_parse_end,int require_null_terminated)
+static cJSON *parse_with_opts(const char *value,const char **return_parse_end,int require_null_terminated,cJSON_InternPool *pool)
 {
 	const char *end=0;
 	cJSON *c=cJSON_New_Item();
 	ep=0;
 	if (!c) return 0;       /* memory fail */
 
-	end=parse_value(c,skip(value));
+	end=parse_value(c,skip(value),pool);
 	if (!end)	{cJSON_Delete(c);return 0;}	/* parse failure. ep is set. */
 
 	/* if we require null-terminated JSON without appended garbage, skip and then check for a null terminator */
@@ -335,327 +512,857 @@ cJSON *cJSON_ParseWithOpts(const char *value,const char **return_parse_end,int r
 	if (return_parse_end) *return_parse_end=end;
 	return c;
 }
+cJSON *cJSON_ParseWithOpts(const char *value,const char **return_parse_end,int require_null_terminated)	{return parse_with_opts(value,return_parse_end,require_null_terminated,0);}
 /* Default options for cJSON_Parse */
 cJSON *cJSON_Parse(const char *value) {return cJSON_ParseWithOpts(value,0,0);}
+cJSON *cJSON_ParseInterned(const char *value,cJSON_InternPool *pool)	{return pool?parse_with_opts(value,0,0,pool):0;}
+
+/* Structural-index parser.
+ *
+ * Stage 1 classifies the input 64 bytes at a time into bitmasks of quotes, backslashes,
+ * structural characters and whitespace, and turns them into the offsets of every structural
+ * character, string start and scalar start that lies outside a string. The classifier is
+ * vectorized where the CPU allows it and chosen at runtime.
+ * Stage 2 walks those offsets to build the tree with the same string and scalar routines as
+ * the reference parser, so it accepts exactly what cJSON_ParseWithOpts accepts.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define CJSON_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#define CJSON_INDEX_WINDOW 4096	/* offsets produced per refill; stage 1 runs at most this far ahead of stage 2. */
+
+typedef void (*json_classifier)(const unsigned char *in,uint64_t *quote,uint64_t *bs,uint64_t *op,uint64_t *ws);
+
+typedef struct {
+	const char *json;size_t len,pos;			/* input, and the start of the next unclassified block */
+	uint64_t escape_carry,string_carry,scalar_carry;	/* state carried from one block to the next */
+	size_t *index;size_t count,next;			/* offsets found in the current window, and the next one to hand out */
+} json_indexer;
+
+static int json_ctz(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(x);
+#else
+	int n=0;while (!(x&1)) x>>=1,n++;return n;
+#endif
+}
 
-/* Render a cJSON item/entity/structure to text. */
-char *cJSON_Print(cJSON *item)				{return print_value(item,0,1,0);}
-char *cJSON_PrintUnformatted(cJSON *item)	{return print_value(item,0,0,0);}
+static int json_popcount(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(x);
+#else
+	int n=0;while (x) x&=x-1,n++;return n;
+#endif
+}
 
-char *cJSON_PrintBuffered(cJSON *item,int prebuffer,int fmt)
+static void json_classify_scalar(const unsigned char *in,uint64_t *quote,uint64_t *bs,uint64_t *op,uint64_t *ws)
 {
-	printbuffer p;
-	p.buffer=(char*)cJSON_malloc(prebuffer);
-	p.length=prebuffer;
-	p.offset=0;
-	return print_value(item,0,fmt,&p);
-	return p.buffer;
+	uint64_t q=0,b=0,o=0,w=0,bit;int i;unsigned char c;
+	for (i=0;i<64;i++)
+	{
+		c=in[i];bit=(uint64_t)1<<i;
+		if (c<=32)											w|=bit;
+		else if (c=='\"')									q|=bit;
+		else if (c=='\\')									b|=bit;
+		else if (c=='{' || c=='}' || c=='[' || c==']' || c==':' || c==',')	o|=bit;
+	}
+	*quote=q;*bs=b;*op=o;*ws=w;
 }
 
+#ifdef CJSON_X86_KERNELS
+/* '[' and ']' differ from '{' and '}' only in bit 5, so or-ing 0x20 in lets two compares find all four. */
+static void json_classify_sse2(const unsigned char *in,uint64_t *quote,uint64_t *bs,uint64_t *op,uint64_t *ws)
+{
+	const __m128i q=_mm_set1_epi8('\"'),b=_mm_set1_epi8('\\'),colon=_mm_set1_epi8(':'),comma=_mm_set1_epi8(',');
+	const __m128i open=_mm_set1_epi8('{'),close=_mm_set1_epi8('}'),space=_mm_set1_epi8(' ');
+	uint64_t mq=0,mb=0,mo=0,mw=0;int i;
+	for (i=0;i<64;i+=16)
+	{
+		__m128i v=_mm_loadu_si128((const __m128i*)(in+i)),l=_mm_or_si128(v,space);
+		__m128i o=_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(l,open),_mm_cmpeq_epi8(l,close)),_mm_or_si128(_mm_cmpeq_epi8(v,colon),_mm_cmpeq_epi8(v,comma)));
+		mq|=(uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v,q))<<i;
+		mb|=(uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v,b))<<i;
+		mo|=(uint64_t)(unsigned)_mm_movemask_epi8(o)<<i;
+		mw|=(uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v,space),space))<<i;
+	}
+	*quote=mq;*bs=mb;*op=mo;*ws=mw;
+}
 
-/* Parser core - when encountering text, process appropriately. */
-static const char *parse_value(cJSON *item,const char *value)
+__attribute__((target("avx2")))
+static void json_classify_avx2(const unsigned char *in,uint64_t *quote,uint64_t *bs,uint64_t *op,uint64_t *ws)
 {
-	if (!value)						return 0;	/* Fail on null. */
-	if (!strncmp(value,"null",4))	{ item->type=cJSON_NULL;  return value+4; }
-	if (!strncmp(value,"false",5))	{ item->type=cJSON_False; return value+5; }
-	if (!strncmp(value,"true",4))	{ item->type=cJSON_True; item->valueint=1;	return value+4; }
-	if (*value=='\"')				{ return parse_string(item,value); }
-	if (*value=='-' || (*value>='0' && *value<='9'))	{ return parse_number(item,value); }
-	if (*value=='[')				{ return parse_array(item,value); }
-	if (*value=='{')				{ return parse_object(item,value); }
+	const __m256i q=_mm256_set1_epi8('\"'),b=_mm256_set1_epi8('\\'),colon=_mm256_set1_epi8(':'),comma=_mm256_set1_epi8(',');
+	const __m256i open=_mm256_set1_epi8('{'),close=_mm256_set1_epi8('}'),space=_mm256_set1_epi8(' ');
+	uint64_t mq=0,mb=0,mo=0,mw=0;int i;
+	for (i=0;i<64;i+=32)
+	{
+		__m256i v=_mm256_loadu_si256((const __m256i*)(in+i)),l=_mm256_or_si256(v,space);
+		__m256i o=_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(l,open),_mm256_cmpeq_epi8(l,close)),_mm256_or_si256(_mm256_cmpeq_epi8(v,colon),_mm256_cmpeq_epi8(v,comma)));
+		mq|=(uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,q))<<i;
+		mb|=(uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,b))<<i;
+		mo|=(uint64_t)(uint32_t)_mm256_movemask_epi8(o)<<i;
+		mw|=(uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v,space),space))<<i;
+	}
+	*quote=mq;*bs=mb;*op=mo;*ws=mw;
+}
+#endif
 
-	ep=value;return 0;	/* failure. */
+#ifdef CJSON_X86_KERNELS
+/* Chosen once, at load time, before any thread can be parsing. */
+static json_classifier json_classify=json_classify_scalar;
+
+__attribute__((constructor))
+static void json_select_classifier(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))			json_classify=json_classify_avx2;
+	else if (__builtin_cpu_supports("sse2"))	json_classify=json_classify_sse2;
 }
+#else
+#define json_classify json_classify_scalar
+#endif
 
-/* Render a value to text. */
-static char *print_value(cJSON *item,int depth,int fmt,printbuffer *p)
+/* Characters preceded by an odd run of backslashes. Backslashes are rare, so walk them one by one. */
+static uint64_t json_escaped(uint64_t bs,uint64_t *carry)
 {
-	char *out=0;
-	if (!item) return 0;
-	if (p)
+	uint64_t escaped=*carry;int i;
+	bs&=~escaped;*carry=0;
+	while (bs)
 	{
-		switch ((item->type)&255)
-		{
-			case cJSON_NULL:	{out=ensure(p,5);	if (out) strcpy(out,"null");	break;}
-			case cJSON_False:	{out=ensure(p,6);	if (out) strcpy(out,"false");	break;}
-			case cJSON_True:	{out=ensure(p,5);	if (out) strcpy(out,"true");	break;}
-			case cJSON_Number:	out=print_number(item,p);break;
-			case cJSON_String:	out=print_string(item,p);break;
-			case cJSON_Array:	out=print_array(item,depth,fmt,p);break;
-			case cJSON_Object:	out=print_object(item,depth,fmt,p);break;
-		}
+		i=json_ctz(bs);bs&=bs-1;
+		if (i==63) {*carry=1;break;}
+		escaped|=(uint64_t)1<<(i+1);bs&=~((uint64_t)1<<(i+1));
 	}
-	else
+	return escaped;
+}
+
+/* Bit i of the result is the parity of bits 0..i of x: set from an opening quote up to (not including) its closing quote. */
+static uint64_t json_prefix_xor(uint64_t x)	{x^=x<<1;x^=x<<2;x^=x<<4;x^=x<<8;x^=x<<16;x^=x<<32;return x;}
+
+static void json_index_block(json_indexer *ix)
+{
+	unsigned char tail[64];const unsigned char *in=(const unsigned char*)ix->json+ix->pos;size_t n=ix->len-ix->pos;
+	uint64_t quote,bs,op,ws,instring,scalar,found;size_t *out=ix->index+ix->count,base=ix->pos;
+
+	if (n<64) {memset(tail,' ',64);memcpy(tail,in,n);in=tail;}	/* pad the last block with whitespace */
+	json_classify(in,&quote,&bs,&op,&ws);
+
+	quote&=~json_escaped(bs,&ix->escape_carry);
+	instring=json_prefix_xor(quote)^ix->string_carry;
+	ix->string_carry=(uint64_t)0-(instring>>63);
+	scalar=~(op|ws|quote)&~instring;
+	found=(op&~instring)|(quote&instring)|(scalar&~((scalar<<1)|ix->scalar_carry));
+	ix->scalar_carry=scalar>>63;
+
+	ix->count+=json_popcount(found);
+	while (found) {*out++=base+json_ctz(found);found&=found-1;}
+	ix->pos+=64;
+}
+
+static int json_index_fill(json_indexer *ix)
+{
+	ix->count=ix->next=0;
+	while (ix->pos<ix->len && ix->count<=CJSON_INDEX_WINDOW-64) json_index_block(ix);
+	return ix->count!=0;
+}
+
+/* The next structural position, or 0 at the end of the input. */
+static const char *json_next_token(json_indexer *ix)
+{
+	if (ix->next==ix->count && !json_index_fill(ix)) return 0;
+	return ix->json+ix->index[ix->next++];
+}
+
+/* The next structural position without consuming it, or the end of the input. */
+static const char *json_peek_token(json_indexer *ix)
+{
+	if (ix->next==ix->count && !json_index_fill(ix)) return ix->json+ix->len;
+	return ix->json+ix->index[ix->next];
+}
+
+/* The closing quote lies before the next structural position, so a string without escapes is found with
+   two memchr calls and copied in one go. Anything else goes through parse_string. */
+static const char *parse_indexed_string(json_indexer *ix,cJSON *item,const char *str)
+{
+	const char *limit=json_peek_token(ix),*quote=(const char*)memchr(str+1,'\"',limit-str-1);char *out;size_t len;
+	if (!quote || memchr(str+1,'\\',quote-str-1)) return parse_string(item,str);
+	len=quote-str-1;
+	out=(char*)cJSON_malloc(len+1);
+	if (!out) return 0;
+	memcpy(out,str+1,len);out[len]=0;
+	item->valuestring=out;
+	set_type(item,cJSON_String);
+	return quote+1;
+}
+
+/* Parse the "key": prefix of an object member starting at tok into item; returns the token of its value. */
+static const char *parse_indexed_key(json_indexer *ix,cJSON *item,const char *tok)
+{
+	const char *end;
+	if (!tok || *tok!='\"')				{ep=tok?tok:ix->json+ix->len;return 0;}
+	if (!(end=parse_indexed_string(ix,item,tok)))	return 0;
+	item->string=item->valuestring;item->type=(item->type&cJSON_ValueHasLength)?cJSON_StringHasLength:0;
+	item->valuestring=0;
+	end=skip(end);tok=json_next_token(ix);
+	if (tok!=end || *tok!=':')			{ep=end;return 0;}
+	return json_next_token(ix);
+}
+
+cJSON *cJSON_ParseIndexedWithOpts(const char *value,const char **return_parse_end,int require_null_terminated)
+{
+	json_indexer ix;parse_frame local[32],*f;walk_stack s;
+	cJSON *root,*item;const char *tok,*end=0;
+
+	ep=0;
+	if (!value) return 0;
+	memset(&ix,0,sizeof(ix));
+	ix.json=value;ix.len=strlen(value);
+	walk_init(&s,local);
+	ix.index=(size_t*)cJSON_malloc(CJSON_INDEX_WINDOW*sizeof(size_t));
+	root=cJSON_New_Item();
+	if (!ix.index || !root) goto fail;
+
+	item=root;tok=json_next_token(&ix);
+	for (;;)
 	{
-		switch ((item->type)&255)
+		/* Parse the value starting at tok into item. */
+		if (!tok) {ep=value+ix.len;goto fail;}
+		if (*tok=='{' || *tok=='[')
 		{
-			case cJSON_NULL:	out=cJSON_strdup("null");	break;
-			case cJSON_False:	out=cJSON_strdup("false");break;
-			case cJSON_True:	out=cJSON_strdup("true"); break;
-			case cJSON_Number:	out=print_number(item,0);break;
-			case cJSON_String:	out=print_string(item,0);break;
-			case cJSON_Array:	out=print_array(item,depth,fmt,0);break;
-			case cJSON_Object:	out=print_object(item,depth,fmt,0);break;
+			if (!(f=(parse_frame*)walk_push(&s))) {ep=tok;goto fail;}	/* too deep. */
+			set_type(item,(*tok=='{')?cJSON_Object:cJSON_Array);
+			f->item=item;f->last=0;
+			tok=json_next_token(&ix);
+			if (tok && *tok==(((item->type&255)==cJSON_Object)?'}':']')) {s.depth--;end=tok+1;}
+			else
+			{
+				if (!(item=parse_frame_child(f))) goto fail;
+				if ((f->item->type&255)==cJSON_Object && !(tok=parse_indexed_key(&ix,item,tok))) goto fail;
+				continue;
+			}
+		}
+		else if (*tok=='\"')	{if (!(end=parse_indexed_string(&ix,item,tok))) goto fail;}
+		else if (*tok=='-' || (*tok>='0' && *tok<='9'))	end=parse_number(item,tok);
+		else if (!(end=parse_scalar(item,tok)))	goto fail;
+
+		/* The value ended at end: close finished containers, then start the next member. */
+		for (;;)
+		{
+			if (!s.depth) goto done;
+			end=skip(end);f=walk_top(&s,parse_frame);
+			tok=json_next_token(&ix);
+			if (tok!=end)					{ep=end;goto fail;}
+			if (*tok==(((f->item->type&255)==cJSON_Object)?'}':']'))	{s.depth--;end=tok+1;continue;}
+			if (*tok!=',')					{ep=tok;goto fail;}
+			if (!(item=parse_frame_child(f)))	goto fail;
+			tok=json_next_token(&ix);
+			if ((f->item->type&255)==cJSON_Object && !(tok=parse_indexed_key(&ix,item,tok))) goto fail;
+			break;
 		}
 	}
-	return out;
+
+done:
+	walk_free(&s);
+	cJSON_free(ix.index);
+	if (require_null_terminated) {end=skip(end);if (*end) {cJSON_Delete(root);ep=end;return 0;}}
+	if (return_parse_end) *return_parse_end=end;
+	return root;
+
+fail:
+	walk_free(&s);
+	if (ix.index) cJSON_free(ix.index);
+	cJSON_Delete(root);
+	return 0;
+}
+/* Default options for cJSON_ParseIndexed */
+cJSON *cJSON_ParseIndexed(const char *value) {return cJSON_ParseIndexedWithOpts(value,0,0);}
+
+/* Tapes.
+A tape is a read-only document flattened into one array of 64-bit words and one string arena. Each word keeps its tag in
+the top byte and a payload in the low 56 bits; numbers keep their value in the word that follows. Arrays and objects point
+past their end, so a whole subtree is skipped in one step, and nothing is allocated per value. Word 0 is a header, so the
+root value is item 1 and item 0 can mean "none". */
+#define TAPE_WORD(tag,payload)	(((uint64_t)(unsigned char)(tag)<<56)|((uint64_t)(payload)&0x00FFFFFFFFFFFFFFull))
+#define TAPE_TAG(word)			((int)((word)>>56))
+#define TAPE_PAYLOAD(word)		((size_t)((word)&0x00FFFFFFFFFFFFFFull))
+
+/* Make room for needed more words and stringbytes more bytes of strings. */
+static int tape_reserve(cJSON_Tape *tape,size_t needed,size_t stringbytes)
+{
+	size_t capacity;
+	if (tape->count+needed>tape->capacity)
+	{
+		uint64_t *grown=(uint64_t*)cJSON_malloc((capacity=pow2gt(tape->count+needed))*sizeof(uint64_t));
+		if (!grown) return 0;
+		if (tape->words) {memcpy(grown,tape->words,tape->count*sizeof(uint64_t));cJSON_free(tape->words);}
+		tape->words=grown;tape->capacity=capacity;
+	}
+	if (tape->stringsize+stringbytes>tape->stringcapacity)
+	{
+		char *grown=(char*)cJSON_malloc(capacity=pow2gt(tape->stringsize+stringbytes));
+		if (!grown) return 0;
+		if (tape->strings) {memcpy(grown,tape->strings,tape->stringsize);cJSON_free(tape->strings);}
+		tape->strings=grown;tape->stringcapacity=capacity;
+	}
+	return 1;
 }
 
-/* Build an array from input text. */
-static const char *parse_array(cJSON *item,const char *value)
+cJSON_Tape *cJSON_CreateTape(void)
 {
-	cJSON *child;
-	if (*value!='[')	{ep=value;return 0;}	/* not an array! */
+	cJSON_Tape *tape=(cJSON_Tape*)cJSON_malloc(sizeof(cJSON_Tape));
+	if (!tape) return 0;
+	memset(tape,0,sizeof(cJSON_Tape));
+	if (!tape_reserve(tape,64,256)) {cJSON_DeleteTape(tape);return 0;}
+	tape->words[tape->count++]=TAPE_WORD(cJSON_TapeRoot,1);
+	return tape;
+}
 
-	item->type=cJSON_Array;
-	value=skip(value+1);
-	if (*value==']') return value+1;	/* empty array. */
+void cJSON_DeleteTape(cJSON_Tape *tape)
+{
+	if (!tape) return;
+	if (tape->words) cJSON_free(tape->words);
+	if (tape->strings) cJSON_free(tape->strings);
+	cJSON_free(tape);
+}
 
-	item->child=child=cJSON_New_Item();
-	if (!item->child) return 0;		 /* memory fail */
-	value=skip(parse_value(child,skip(value)));	/* skip any spacing, get the value. */
-	if (!value) return 0;
+size_t cJSON_TapeAppend(cJSON_Tape *tape,int tag,size_t payload)
+{
+	if (!tape_reserve(tape,1,0)) return 0;
+	tape->words[tape->count]=TAPE_WORD(tag,payload);
+	return tape->count++;
+}
+
+static size_t tape_append_number(cJSON_Tape *tape,int tag,const void *value)
+{
+	if (!tape_reserve(tape,2,0)) return 0;
+	tape->words[tape->count]=TAPE_WORD(tag,0);
+	memcpy(&tape->words[tape->count+1],value,sizeof(uint64_t));
+	tape->count+=2;
+	return tape->count-2;
+}
+size_t cJSON_TapeAppendDouble(cJSON_Tape *tape,double value)	{return tape_append_number(tape,cJSON_TapeDouble,&value);}
+size_t cJSON_TapeAppendInt64(cJSON_Tape *tape,int64_t value)	{return tape_append_number(tape,cJSON_TapeInt64,&value);}
+
+/* Strings are stored as a 32-bit length, the bytes and a terminator. Reserve room for up to maxlen bytes, to be written at
+the returned pointer and then committed with their actual length. */
+static char *tape_begin_string(cJSON_Tape *tape,size_t maxlen)
+{
+	if (maxlen>0xFFFFFFFFu || !tape_reserve(tape,1,maxlen+5)) return 0;
+	return tape->strings+tape->stringsize+4;
+}
+static size_t tape_commit_string(cJSON_Tape *tape,int tag,size_t len)
+{
+	uint32_t n=(uint32_t)len;size_t at=tape->stringsize;
+	memcpy(tape->strings+at,&n,4);tape->strings[at+4+len]=0;
+	tape->stringsize+=len+5;
+	tape->words[tape->count]=TAPE_WORD(tag,at);
+	return tape->count++;
+}
+size_t cJSON_TapeAppendString(cJSON_Tape *tape,int tag,const char *string,size_t length)
+{
+	char *out=tape_begin_string(tape,length);
+	if (!out) return 0;
+	if (length) memcpy(out,string,length);
+	return tape_commit_string(tape,tag,length);
+}
+
+size_t cJSON_TapeAppendEnd(cJSON_Tape *tape,size_t open)
+{
+	int tag=TAPE_TAG(tape->words[open]);
+	size_t end=cJSON_TapeAppend(tape,(tag==cJSON_TapeArray)?cJSON_TapeArrayEnd:cJSON_TapeObjectEnd,open);
+	if (end) tape->words[open]=TAPE_WORD(tag,end+1);
+	return end;
+}
+
+/* The tag of item, or 0 if it is not on the tape. */
+static int tape_tag(const cJSON_Tape *tape,size_t item)	{return (tape && item && item<tape->count)?TAPE_TAG(tape->words[item]):0;}
+
+/* The word after item and everything inside it. */
+static size_t tape_skip(const cJSON_Tape *tape,size_t item)
+{
+	switch (TAPE_TAG(tape->words[item]))
+	{
+		case cJSON_TapeDouble: case cJSON_TapeInt64:	return item+2;
+		case cJSON_TapeArray: case cJSON_TapeObject:	return TAPE_PAYLOAD(tape->words[item]);
+	}
+	return item+1;
+}
 
-	while (*value==',')
+/* The value at word at, stepping over an object member's key; 0 at the end of a container. */
+static size_t tape_value_at(const cJSON_Tape *tape,size_t at)
+{
+	switch (tape_tag(tape,at))
 	{
-		cJSON *new_item;
-		if (!(new_item=cJSON_New_Item())) return 0; 	/* memory fail */
-		child->next=new_item;new_item->prev=child;child=new_item;
-		value=skip(parse_value(child,skip(value+1)));
-		if (!value) return 0;	/* memory fail */
+		case cJSON_TapeKey:	return at+1;
+		case 0: case cJSON_TapeRoot: case cJSON_TapeArrayEnd: case cJSON_TapeObjectEnd:	return 0;
 	}
+	return at;
+}
 
-	if (*value==']') return value+1;	/* end of array */
-	ep=value;return 0;	/* malformed. */
+static const char *tape_string(const cJSON_Tape *tape,size_t item,size_t *length)
+{
+	uint32_t n;const char *at=tape->strings+TAPE_PAYLOAD(tape->words[item]);
+	memcpy(&n,at,4);
+	if (length) *length=n;
+	return at+4;
 }
 
-/* Render an array to text */
-static char *print_array(cJSON *item,int depth,int fmt,printbuffer *p)
+int cJSON_TapeType(const cJSON_Tape *tape,size_t item)
 {
-	char **entries;
-	char *out=0,*ptr,*ret;int len=5;
-	cJSON *child=item->child;
-	int numentries=0,i=0,fail=0;
-	size_t tmplen=0;
-	
-	/* How many entries in the array? */
-	while (child) numentries++,child=child->next;
-	/* Explicitly handle numentries==0 */
-	if (!numentries)
+	switch (tape_tag(tape,item))
 	{
-		if (p)	out=ensure(p,3);
-		else	out=(char*)cJSON_malloc(3);
-		if (out) strcpy(out,"[]");
-		return out;
+		case cJSON_TapeNull:	return cJSON_NULL;
+		case cJSON_TapeFalse:	return cJSON_False;
+		case cJSON_TapeTrue:	return cJSON_True;
+		case cJSON_TapeDouble: case cJSON_TapeInt64:	return cJSON_Number;
+		case cJSON_TapeString:	return cJSON_String;
+		case cJSON_TapeArray:	return cJSON_Array;
+		case cJSON_TapeObject:	return cJSON_Object;
 	}
+	return -1;
+}
+
+size_t cJSON_TapeChild(const cJSON_Tape *tape,size_t item)
+{
+	int tag=tape_tag(tape,item);
+	return (tag==cJSON_TapeArray || tag==cJSON_TapeObject)?tape_value_at(tape,item+1):0;
+}
+size_t cJSON_TapeNext(const cJSON_Tape *tape,size_t item)	{return tape_tag(tape,item)?tape_value_at(tape,tape_skip(tape,item)):0;}
+
+int    cJSON_TapeGetArraySize(const cJSON_Tape *tape,size_t array)			{size_t c=cJSON_TapeChild(tape,array);int i=0;while(c)i++,c=cJSON_TapeNext(tape,c);return i;}
+size_t cJSON_TapeGetArrayItem(const cJSON_Tape *tape,size_t array,int item)	{size_t c=cJSON_TapeChild(tape,array);while (c && item>0) item--,c=cJSON_TapeNext(tape,c);return c;}
+size_t cJSON_TapeGetObjectItem(const cJSON_Tape *tape,size_t object,const char *string)
+{
+	size_t c=(tape_tag(tape,object)==cJSON_TapeObject)?cJSON_TapeChild(tape,object):0;
+	while (c && cJSON_strcasecmp(tape_string(tape,c-1,0),string)) c=cJSON_TapeNext(tape,c);
+	return c;
+}
+
+const char *cJSON_TapeGetString(const cJSON_Tape *tape,size_t item,size_t *length)	{return (tape_tag(tape,item)==cJSON_TapeString)?tape_string(tape,item,length):0;}
+const char *cJSON_TapeGetKey(const cJSON_Tape *tape,size_t item,size_t *length)		{return (item>1 && tape_tag(tape,item) && tape_tag(tape,item-1)==cJSON_TapeKey)?tape_string(tape,item-1,length):0;}
 
-	if (p)
+double cJSON_TapeGetNumber(const cJSON_Tape *tape,size_t item)
+{
+	double d;int64_t l;
+	switch (tape_tag(tape,item))
 	{
-		/* Compose the output array. */
-		i=p->offset;
-		ptr=ensure(p,1);if (!ptr) return 0;	*ptr='[';	p->offset++;
-		child=item->child;
-		while (child && !fail)
-		{
-			print_value(child,depth+1,fmt,p);
-			p->offset=update(p);
-			if (child->next) {len=fmt?2:1;ptr=ensure(p,len+1);if (!ptr) return 0;*ptr++=',';if(fmt)*ptr++=' ';*ptr=0;p->offset+=len;}
-			child=child->next;
-		}
-		ptr=ensure(p,2);if (!ptr) return 0;	*ptr++=']';*ptr=0;
-		out=(p->buffer)+i;
+		case cJSON_TapeDouble:	memcpy(&d,&tape->words[item+1],sizeof(d));return d;
+		case cJSON_TapeInt64:	memcpy(&l,&tape->words[item+1],sizeof(l));return (double)l;
 	}
-	else
+	return 0;
+}
+int cJSON_TapeGetInt(const cJSON_Tape *tape,size_t item)
+{
+	int64_t l;
+	if (tape_tag(tape,item)!=cJSON_TapeInt64) return (int)cJSON_TapeGetNumber(tape,item);
+	memcpy(&l,&tape->words[item+1],sizeof(l));
+	return (int)l;
+}
+
+/* Append the string at str to the tape, returning its end. Escapes only ever shrink text, so the raw span up to the next
+structural character bounds the unescaped length. */
+static const char *tape_indexed_string(json_indexer *ix,cJSON_Tape *tape,int tag,const char *str)
+{
+	const char *limit=json_peek_token(ix),*quote=(const char*)memchr(str+1,'\"',limit-str-1),*end;char *out;size_t len;
+	if (quote && !memchr(str+1,'\\',quote-str-1)) return cJSON_TapeAppendString(tape,tag,str+1,quote-str-1)?quote+1:0;
+	if (!(out=tape_begin_string(tape,limit-str))) return 0;
+	end=unescape_string(str,out,&len);
+	tape_commit_string(tape,tag,len);
+	return end;
+}
+
+/* Append the "key": prefix of an object member starting at tok; returns the token of its value. */
+static const char *tape_indexed_key(json_indexer *ix,cJSON_Tape *tape,const char *tok)
+{
+	const char *end;
+	if (!tok || *tok!='\"')				{ep=tok?tok:ix->json+ix->len;return 0;}
+	if (!(end=tape_indexed_string(ix,tape,cJSON_TapeKey,tok)))	return 0;
+	end=skip(end);tok=json_next_token(ix);
+	if (tok!=end || *tok!=':')			{ep=end;return 0;}
+	return json_next_token(ix);
+}
+
+typedef struct {size_t open;int object;} tape_frame;
+
+cJSON_Tape *cJSON_ParseTapeWithOpts(const char *value,const char **return_parse_end,int require_null_terminated)
+{
+	json_indexer ix;tape_frame local[32],*f;walk_stack s;
+	cJSON_Tape *tape;cJSON num;const char *tok,*end=0;
+
+	ep=0;
+	if (!value) return 0;
+	memset(&ix,0,sizeof(ix));memset(&num,0,sizeof(num));
+	ix.json=value;ix.len=strlen(value);
+	walk_init(&s,local);
+	ix.index=(size_t*)cJSON_malloc(CJSON_INDEX_WINDOW*sizeof(size_t));
+	tape=cJSON_CreateTape();
+	if (!ix.index || !tape) goto fail;
+
+	tok=json_next_token(&ix);
+	for (;;)
 	{
-		/* Allocate an array to hold the values for each */
-		entries=(char**)cJSON_malloc(numentries*sizeof(char*));
-		if (!entries) return 0;
-		memset(entries,0,numentries*sizeof(char*));
-		/* Retrieve all the results: */
-		child=item->child;
-		while (child && !fail)
+		/* Append the value starting at tok. */
+		if (!tok) {ep=value+ix.len;goto fail;}
+		if (*tok=='{' || *tok=='[')
 		{
-			ret=print_value(child,depth+1,fmt,0);
-			entries[i++]=ret;
-			if (ret) len+=strlen(ret)+2+(fmt?1:0); else fail=1;
-			child=child->next;
+			if (!(f=(tape_frame*)walk_push(&s))) {ep=tok;goto fail;}	/* too deep. */
+			f->object=(*tok=='{');
+			if (!(f->open=cJSON_TapeAppend(tape,f->object?cJSON_TapeObject:cJSON_TapeArray,0))) goto fail;
+			tok=json_next_token(&ix);
+			if (tok && *tok==(f->object?'}':']')) {s.depth--;if (!cJSON_TapeAppendEnd(tape,f->open)) goto fail;end=tok+1;}
+			else
+			{
+				if (f->object && !(tok=tape_indexed_key(&ix,tape,tok))) goto fail;
+				continue;
+			}
 		}
-		
-		/* If we didn't fail, try to malloc the output string */
-		if (!fail)	out=(char*)cJSON_malloc(len);
-		/* If that fails, we fail. */
-		if (!out) fail=1;
-
-		/* Handle failure. */
-		if (fail)
+		else if (*tok=='\"')	{if (!(end=tape_indexed_string(&ix,tape,cJSON_TapeString,tok))) goto fail;}
+		else
 		{
-			for (i=0;i<numentries;i++) if (entries[i]) cJSON_free(entries[i]);
-			cJSON_free(entries);
-			return 0;
+			if (!(end=parse_scalar(&num,tok))) goto fail;
+			if (num.type==cJSON_Number)	{if (!cJSON_TapeAppendDouble(tape,num.valuedouble)) goto fail;}
+			else if (!cJSON_TapeAppend(tape,(num.type==cJSON_NULL)?cJSON_TapeNull:(num.type==cJSON_True)?cJSON_TapeTrue:cJSON_TapeFalse,0)) goto fail;
 		}
-		
-		/* Compose the output array. */
-		*out='[';
-		ptr=out+1;*ptr=0;
-		for (i=0;i<numentries;i++)
+
+		/* The value ended at end: close finished containers, then start the next member. */
+		for (;;)
 		{
-			tmplen=strlen(entries[i]);memcpy(ptr,entries[i],tmplen);ptr+=tmplen;
-			if (i!=numentries-1) {*ptr++=',';if(fmt)*ptr++=' ';*ptr=0;}
-			cJSON_free(entries[i]);
+			if (!s.depth) goto done;
+			end=skip(end);f=walk_top(&s,tape_frame);
+			tok=json_next_token(&ix);
+			if (tok!=end)					{ep=end;goto fail;}
+			if (*tok==(f->object?'}':']'))	{s.depth--;if (!cJSON_TapeAppendEnd(tape,f->open)) goto fail;end=tok+1;continue;}
+			if (*tok!=',')					{ep=tok;goto fail;}
+			tok=json_next_token(&ix);
+			if (f->object && !(tok=tape_indexed_key(&ix,tape,tok))) goto fail;
+			break;
 		}
-		cJSON_free(entries);
-		*ptr++=']';*ptr++=0;
 	}
-	return out;	
+
+done:
+	walk_free(&s);
+	cJSON_free(ix.index);
+	if (require_null_terminated) {end=skip(end);if (*end) {cJSON_DeleteTape(tape);ep=end;return 0;}}
+	if (return_parse_end) *return_parse_end=end;
+	return tape;
+
+fail:
+	walk_free(&s);
+	if (ix.index) cJSON_free(ix.index);
+	cJSON_DeleteTape(tape);
+	return 0;
+}
+/* Default options for cJSON_ParseTape */
+cJSON_Tape *cJSON_ParseTape(const char *value) {return cJSON_ParseTapeWithOpts(value,0,0);}
+
+/* Streaming parser.
+ * Text arrives in chunks of any size and is scanned one byte at a time with just enough state to find where each value ends:
+ * bracket depth and whether we are inside a string. The text of one value at a time is kept, and handed to parse_value once
+ * it is complete, so memory use is bounded by the largest value rather than by the whole document. When splitting, the
+ * top-level array or object itself is never built; each element (or "key":value member) is captured and emitted on its own. */
+enum {stream_value,stream_first,stream_member,stream_key,stream_colon,stream_member_value,stream_scan,stream_next,stream_failed};
+
+struct cJSON_Stream {
+	cJSON_StreamHandler handler;void *ctx;
+	int split,splitting;		/* whether to split top-level containers, and whether we are inside one */
+	int state,depth,instring,escaped,scalar;
+	cJSON container;			/* passed with cJSON_StreamOpen/Close; only its type is set */
+	char *buffer;size_t length,capacity;	/* text captured for the value being scanned */
+};
+
+cJSON_Stream *cJSON_CreateStream(int split,cJSON_StreamHandler handler,void *ctx)
+{
+	cJSON_Stream *s;
+	if (!handler || !(s=(cJSON_Stream*)cJSON_malloc(sizeof(cJSON_Stream)))) return 0;
+	memset(s,0,sizeof(cJSON_Stream));
+	s->handler=handler;s->ctx=ctx;s->split=split;
+	return s;
 }
 
-/* Build an object from the text. */
-static const char *parse_object(cJSON *item,const char *value)
+void cJSON_DeleteStream(cJSON_Stream *s)	{if (!s) return;if (s->buffer) cJSON_free(s->buffer);cJSON_free(s);}
+void cJSON_ResetStream(cJSON_Stream *s)	{char *buffer=s->buffer;size_t capacity=s->capacity;cJSON_StreamHandler handler=s->handler;void *ctx=s->ctx;int split=s->split;
+	memset(s,0,sizeof(cJSON_Stream));s->handler=handler;s->ctx=ctx;s->split=split;s->buffer=buffer;s->capacity=capacity;}
+
+/* Append len bytes to the captured text, leaving room for a terminator. */
+static int stream_capture(cJSON_Stream *s,const char *data,size_t len)
 {
-	cJSON *child;
-	if (*value!='{')	{ep=value;return 0;}	/* not an object! */
-	
-	item->type=cJSON_Object;
-	value=skip(value+1);
-	if (*value=='}') return value+1;	/* empty array. */
-	
-	item->child=child=cJSON_New_Item();
-	if (!item->child) return 0;
-	value=skip(parse_string(child,skip(value)));
-	if (!value) return 0;
-	child->string=child->valuestring;child->valuestring=0;
-	if (*value!=':') {ep=value;return 0;}	/* fail! */
-	value=skip(parse_value(child,skip(value+1)));	/* skip any spacing, get the value. */
-	if (!value) return 0;
-	
-	while (*value==',')
-	{
-		cJSON *new_item;
-		if (!(new_item=cJSON_New_Item()))	return 0; /* memory fail */
-		child->next=new_item;new_item->prev=child;child=new_item;
-		value=skip(parse_string(child,skip(value+1)));
-		if (!value) return 0;
-		child->string=child->valuestring;child->valuestring=0;
-		if (*value!=':') {ep=value;return 0;}	/* fail! */
-		value=skip(parse_value(child,skip(value+1)));	/* skip any spacing, get the value. */
-		if (!value) return 0;
+	if (s->length+len+1>s->capacity)
+	{
+		size_t capacity=pow2gt(s->length+len+1);char *grown=(char*)cJSON_malloc(capacity);
+		if (!grown) return 0;
+		if (s->buffer) {memcpy(grown,s->buffer,s->length);cJSON_free(s->buffer);}
+		s->buffer=grown;s->capacity=capacity;
 	}
-	
-	if (*value=='}') return value+1;	/* end of array */
-	ep=value;return 0;	/* malformed. */
-}
-
-/* Render an object to text. */
-static char *print_object(cJSON *item,int depth,int fmt,printbuffer *p)
-{
-	char **entries=0,**names=0;
-	char *out=0,*ptr,*ret,*str;int len=7,i=0,j;
-	cJSON *child=item->child;
-	int numentries=0,fail=0;
-	size_t tmplen=0;
-	/* Count the number of entries. */
-	while (child) numentries++,child=child->next;
-	/* Explicitly handle empty object case */
-	if (!numentries)
-	{
-		if (p) out=ensure(p,fmt?depth+4:3);
-		else	out=(char*)cJSON_malloc(fmt?depth+4:3);
-		if (!out)	return 0;
-		ptr=out;*ptr++='{';
-		if (fmt) {*ptr++='\n';for (i=0;i<depth-1;i++) *ptr++='\t';}
-		*ptr++='}';*ptr++=0;
-		return out;
-	}
-	if (p)
-	{
-		/* Compose the output: */
-		i=p->offset;
-		len=fmt?2:1;	ptr=ensure(p,len+1);	if (!ptr) return 0;
-		*ptr++='{';	if (fmt) *ptr++='\n';	*ptr=0;	p->offset+=len;
-		child=item->child;depth++;
-		while (child)
+	memcpy(s->buffer+s->length,data,len);s->length+=len;
+	return 1;
+}
+
+/* Begin scanning the value whose first character is c. */
+static int stream_start(cJSON_Stream *s,unsigned char c)
+{
+	if (c==',' || c==':' || c==']' || c=='}') return 0;
+	s->scalar=(c!='\"' && c!='[' && c!='{');
+	s->depth=s->instring=s->escaped=0;
+	s->state=stream_scan;
+	return 1;
+}
+
+/* Scan from p; returns just past the end of the value (or key) if it ends before end, else 0 with the state kept for the next chunk. */
+static const char *stream_find_end(cJSON_Stream *s,const char *p,const char *end)
+{
+	for (;p<end;p++)
+	{
+		unsigned char c=*p;
+		if (s->instring)
 		{
-			if (fmt)
-			{
-				ptr=ensure(p,depth);	if (!ptr) return 0;
-				for (j=0;j<depth;j++) *ptr++='\t';
-				p->offset+=depth;
-			}
-			print_string_ptr(child->string,p);
-			p->offset=update(p);
-			
-			len=fmt?2:1;
-			ptr=ensure(p,len);	if (!ptr) return 0;
-			*ptr++=':';if (fmt) *ptr++='\t';
-			p->offset+=len;
-			
-			print_value(child,depth,fmt,p);
-			p->offset=update(p);
-
-			len=(fmt?1:0)+(child->next?1:0);
-			ptr=ensure(p,len+1); if (!ptr) return 0;
-			if (child->next) *ptr++=',';
-			if (fmt) *ptr++='\n';*ptr=0;
-			p->offset+=len;
-			child=child->next;
+			if (s->escaped)			s->escaped=0;
+			else if (c=='\\')		s->escaped=1;
+			else if (c=='\"')		{s->instring=0;if (!s->depth) return p+1;}
 		}
-		ptr=ensure(p,fmt?(depth+1):2);	 if (!ptr) return 0;
-		if (fmt)	for (i=0;i<depth-1;i++) *ptr++='\t';
-		*ptr++='}';*ptr=0;
-		out=(p->buffer)+i;
+		else if (s->scalar)			{if (c<=32 || strchr(",:[]{}\"",c)) return p;}	/* the delimiter belongs to what follows. */
+		else if (c=='\"')			s->instring=1;
+		else if (c=='[' || c=='{')	s->depth++;
+		else if ((c==']' || c=='}') && !--s->depth) return p+1;
 	}
-	else
+	return 0;
+}
+
+static const char *skip_bounded(const char *in,const char *end) {while (in<end && (unsigned char)*in<=32) in++; return in;}
+
+/* Parse the text of a value (or member) running up to end and hand it over. The parser reads no further than the character
+that ends a value, so text found by stream_find_end is parsed where it lies; only a value split across chunks is captured. */
+static int stream_emit(cJSON_Stream *s,const char *text,const char *end)
+{
+	cJSON *item=cJSON_New_Item();
+	ep=0;
+	if (!item) return 0;
+	s->length=0;
+	if (s->splitting && s->container.type==cJSON_Object) text=parse_key(item,text);
+	text=parse_value(item,text,0);
+	if (!text || skip_bounded(text,end)!=end) {cJSON_Delete(item);return 0;}
+	s->state=s->splitting?stream_next:stream_value;
+	return s->handler(s->ctx,s->splitting?cJSON_StreamItem:cJSON_StreamValue,item);
+}
+static int stream_emit_captured(cJSON_Stream *s)	{s->buffer[s->length]=0;return stream_emit(s,s->buffer,s->buffer+s->length);}
+
+/* The character that ends the container being split, and ending it. */
+static char stream_closer(cJSON_Stream *s)	{return (s->container.type==cJSON_Array)?']':'}';}
+static int stream_close(cJSON_Stream *s)	{s->splitting=0;s->state=stream_value;return s->handler(s->ctx,cJSON_StreamClose,&s->container);}
+
+int cJSON_StreamFeed(cJSON_Stream *s,const char *data,size_t len)
+{
+	const char *p=data,*end=data+len,*run=data;unsigned char c;
+	if (s->state==stream_failed) return 0;
+	while (p<end)
 	{
-		/* Allocate space for the names and the objects */
-		entries=(char**)cJSON_malloc(numentries*sizeof(char*));
-		if (!entries) return 0;
-		names=(char**)cJSON_malloc(numentries*sizeof(char*));
-		if (!names) {cJSON_free(entries);return 0;}
-		memset(entries,0,sizeof(char*)*numentries);
-		memset(names,0,sizeof(char*)*numentries);
-
-		/* Collect all the results into our arrays: */
-		child=item->child;depth++;if (fmt) len+=depth;
-		while (child)
+		if (s->state==stream_scan || s->state==stream_key)
 		{
-			names[i]=str=print_string_ptr(child->string,0);
-			entries[i++]=ret=print_value(child,depth,fmt,0);
-			if (str && ret) len+=strlen(ret)+strlen(str)+2+(fmt?2+depth:0); else fail=1;
-			child=child->next;
+			const char *stop=stream_find_end(s,p,end);
+			if (!stop) {p=end;break;}
+			p=stop;
+			if (s->state==stream_key) {s->state=stream_colon;continue;}	/* the key stays with its value. */
+			if (!s->length)	{if (!stream_emit(s,run,stop)) goto fail;}
+			else if (!stream_capture(s,run,stop-run) || !stream_emit_captured(s)) goto fail;
+			run=stop;
+			continue;
 		}
-		
-		/* Try to allocate the output string */
-		if (!fail)	out=(char*)cJSON_malloc(len);
-		if (!out) fail=1;
+		c=*p;
+		if (c<=32) {p++;continue;}
+		switch (s->state)
+		{
+			case stream_value:
+				if (s->split && (c=='[' || c=='{'))
+				{
+					s->splitting=1;s->container.type=(c=='[')?cJSON_Array:cJSON_Object;
+					s->state=stream_first;p++;
+					if (!s->handler(s->ctx,cJSON_StreamOpen,&s->container)) goto fail;
+					continue;
+				}
+				if (!stream_start(s,c)) goto fail;
+				run=p;continue;
+			case stream_first:
+				if (c==stream_closer(s)) {p++;if (!stream_close(s)) goto fail;continue;}
+				/* fall through */
+			case stream_member:
+				run=p;
+				if (s->container.type==cJSON_Array)	{if (!stream_start(s,c)) goto fail;continue;}
+				if (c!='\"') goto fail;
+				s->state=stream_key;s->depth=s->instring=s->escaped=s->scalar=0;
+				continue;
+			case stream_colon:
+				if (c!=':') goto fail;
+				s->state=stream_member_value;p++;continue;
+			case stream_member_value:
+				if (!stream_start(s,c)) goto fail;
+				continue;
+			case stream_next:
+				p++;
+				if (c==',')					s->state=stream_member;
+				else if (c!=stream_closer(s) || !stream_close(s))	goto fail;
+				continue;
+			default:
+				goto fail;
+		}
+	}
+	/* Keep the part of a value that runs on into the next chunk. */
+	if ((s->state==stream_scan || s->state==stream_key || s->state==stream_colon || s->state==stream_member_value) && !stream_capture(s,run,end-run)) goto fail;
+	return 1;
+fail:
+	s->state=stream_failed;
+	return 0;
+}
+
+int cJSON_StreamFinish(cJSON_Stream *s)
+{
+	if (s->state==stream_scan && s->scalar && !s->splitting && !stream_emit_captured(s)) s->state=stream_failed;	/* a number or literal ends with the text. */
+	return s->state==stream_value;
+}
+
+/* Parse the first value in the length bytes at value, reading nothing past them: the end of a container or string is found
+by the stream's scan, and a number, literal (or unterminated string) running to the very end is copied so it can be
+terminated. A container running to the end is unbalanced, which the parser would reject anyway. */
+static const char *parse_bounded(cJSON *item,const char *value,const char *end)
+{
+	cJSON_Stream scan;char local[64],*copy;const char *stop;size_t len=end-value;
+	memset(&scan,0,sizeof(scan));
+	if (value>=end || !stream_start(&scan,*value)) {ep=value;return 0;}
+	if ((stop=stream_find_end(&scan,value,end))) return parse_value(item,value,0);
+	if (*value=='[' || *value=='{') {ep=end-1;return 0;}	/* unterminated. */
+	copy=(len<sizeof(local))?local:(char*)cJSON_malloc(len+1);
+	if (!copy) return 0;
+	memcpy(copy,value,len);copy[len]=0;
+	stop=parse_value(item,copy,0);
+	stop=stop?value+(stop-copy):0;
+	if (!stop) ep=value;
+	if (copy!=local) cJSON_free(copy);
+	return stop;
+}
+
+cJSON *cJSON_ParseWithLengthOpts(const char *value,size_t length,const char **return_parse_end,int require_null_terminated)
+{
+	const char *end=value+length,*stop;
+	cJSON *c=cJSON_New_Item();
+	ep=0;
+	if (!c) return 0;
+	stop=parse_bounded(c,skip_bounded(value,end),end);
+	if (!stop) {cJSON_Delete(c);return 0;}
+	if (require_null_terminated) {stop=skip_bounded(stop,end);if (stop<end && *stop) {cJSON_Delete(c);ep=stop;return 0;}}
+	if (return_parse_end) *return_parse_end=stop;
+	return c;
+}
+cJSON *cJSON_ParseWithLength(const char *value,size_t length)	{return cJSON_ParseWithLengthOpts(value,length,0,0);}
+
+typedef struct {cJSON *item,*child;} print_frame;
+
+/* Render the indented "key": prefix of an object member. */
+static int print_key(cJSON *item,int depth,int fmt,printbuffer *p)
+{
+	return (!fmt || append_tabs(p,depth)) && print_string_ptr(item->string,string_length(item),p) && append(p,":\t",fmt?2:1);
+}
 
-		/* Handle failure */
-		if (fail)
+/* Render a value to text. Arrays and objects are opened on the way down and closed as their last member finishes. */
+static int print_value(cJSON *item,int fmt,printbuffer *p)
+{
+	print_frame local[16],*f;walk_stack s;cJSON *next;int ok=0;
+	walk_init(&s,local);
+	if (!item) return 0;
+	for (;;)
+	{
+		switch ((item->type)&255)
 		{
-			for (i=0;i<numentries;i++) {if (names[i]) cJSON_free(names[i]);if (entries[i]) cJSON_free(entries[i]);}
-			cJSON_free(names);cJSON_free(entries);
-			return 0;
+			case cJSON_NULL:	if (!append(p,"null",4)) goto done;break;
+			case cJSON_False:	if (!append(p,"false",5)) goto done;break;
+			case cJSON_True:	if (!append(p,"true",4)) goto done;break;
+			case cJSON_Number:	if (!print_number(item,p)) goto done;break;
+			case cJSON_String:	if (!print_string(item,p)) goto done;break;
+			case cJSON_Array:
+				if (!item->child) {if (!append(p,"[]",2)) goto done;break;}
+				if (!(f=(print_frame*)walk_push(&s)) || !append(p,"[",1)) goto done;
+				f->item=item;item=f->child=item->child;
+				continue;
+			case cJSON_Object:
+				if (!append(p,"{\n",fmt?2:1)) goto done;
+				/* An empty object closes one level further out than a populated one. */
+				if (!item->child) {if ((fmt && !append_tabs(p,s.depth-1)) || !append(p,"}",1)) goto done;break;}
+				if (!(f=(print_frame*)walk_push(&s))) goto done;
+				f->item=item;item=f->child=item->child;
+				if (!print_key(item,s.depth,fmt,p)) goto done;
+				continue;
+			default:			if (!print_extended(item,p)) goto done;break;
 		}
-		
-		/* Compose the output: */
-		*out='{';ptr=out+1;if (fmt)*ptr++='\n';*ptr=0;
-		for (i=0;i<numentries;i++)
+
+		/* item is finished: move on to its next sibling, closing containers whose last member it was. */
+		for (;;)
 		{
-			if (fmt) for (j=0;j<depth;j++) *ptr++='\t';
-			tmplen=strlen(names[i]);memcpy(ptr,names[i],tmplen);ptr+=tmplen;
-			*ptr++=':';if (fmt) *ptr++='\t';
-			strcpy(ptr,entries[i]);ptr+=strlen(entries[i]);
-			if (i!=numentries-1) *ptr++=',';
-			if (fmt) *ptr++='\n';*ptr=0;
-			cJSON_free(names[i]);cJSON_free(entries[i]);
+			if (!s.depth) {ok=1;goto done;}
+			f=walk_top(&s,print_frame);next=f->child->next;
+			if ((f->item->type&255)==cJSON_Array)
+			{
+				if (next) {if (!append(p,", ",fmt?2:1)) goto done;break;}
+				if (!append(p,"]",1)) goto done;
+			}
+			else
+			{
+				if ((next && !append(p,",",1)) || (fmt && !append(p,"\n",1))) goto done;
+				if (next) {if (!print_key(next,s.depth,fmt,p)) goto done;break;}
+				if ((fmt && !append_tabs(p,s.depth-1)) || !append(p,"}",1)) goto done;
+			}
+			s.depth--;
 		}
-		
-		cJSON_free(names);cJSON_free(entries);
-		if (fmt) for (i=0;i<depth-1;i++) *ptr++='\t';
-		*ptr++='}';*ptr++=0;
+		item=f->child=next;
+	}
+done:
+	walk_free(&s);
+	return ok;
+}
+
+/* Render a cJSON item/entity/structure to text. */
+static char *print_buffered(cJSON *item,int fmt,size_t prebuffer)
+{
+	printbuffer p;
+	memset(&p,0,sizeof(p));
+	p.length=prebuffer?prebuffer:1;
+	if (!(p.buffer=(char*)cJSON_malloc(p.length))) return 0;
+	if (!print_value(item,fmt,&p) || !ensure(&p,1)) {if (p.buffer) cJSON_free(p.buffer);return 0;}
+	p.buffer[p.offset]=0;
+	return p.buffer;
+}
+
+char *cJSON_Print(cJSON *item)								{return print_buffered(item,1,256);}
+char *cJSON_PrintUnformatted(cJSON *item)					{return print_buffered(item,0,256);}
+char *cJSON_PrintBuffered(cJSON *item,int prebuffer,int fmt)	{return print_buffered(item,fmt,prebuffer>0?prebuffer:0);}
+
+int cJSON_PrintToSink(cJSON *item,int fmt,size_t highwater,cJSON_Sink sink,void *ctx)
+{
+	printbuffer p;int ok;
+	memset(&p,0,sizeof(p));
+	p.length=highwater?highwater:CJSON_PRINT_HIGHWATER;
+	p.sink=sink;p.ctx=ctx;
+	if (!sink || !(p.buffer=(char*)cJSON_malloc(p.length))) return 0;
+	ok=print_value(item,fmt,&p) && flush(&p);
+	if (p.buffer) cJSON_free(p.buffer);
+	return ok;
+}
+
+static int file_sink(void *ctx,const char *data,size_t len)	{return fwrite(data,1,len,(FILE*)ctx)==len;}
+static int fd_sink(void *ctx,const char *data,size_t len)
+{
+	int fd=*(int*)ctx;
+	while (len)
+	{
+		long n=(long)cJSON_write(fd,data,len);
+		if (n<0 && errno==EINTR) continue;
+		if (n<=0) return 0;
+		data+=n;len-=(size_t)n;
 	}
-	return out;	
+	return 1;
 }
+int cJSON_PrintToFile(cJSON *item,int fmt,FILE *file)		{return file && cJSON_PrintToSink(item,fmt,0,file_sink,file);}
+int cJSON_PrintToFd(cJSON *item,int fmt,int fd)				{return cJSON_PrintToSink(item,fmt,0,fd_sink,&fd);}
 
 /* Get Array size/item / object item. */
 int    cJSON_GetArraySize(cJSON *array)							{cJSON *c=array->child;int i=0;while(c)i++,c=c->next;return i;}
@@ -665,28 +1372,48 @@ cJSON *cJSON_GetObjectItem(cJSON *object,const char *string)	{cJSON *c=object->c
 /* Utility for array list handling. */
 static void suffix_object(cJSON *prev,cJSON *item) {prev->next=item;item->prev=prev;}
 /* Utility for handling references. */
-static cJSON *create_reference(cJSON *item) {cJSON *ref=cJSON_New_Item();if (!ref) return 0;memcpy(ref,item,sizeof(cJSON));ref->string=0;ref->type|=cJSON_IsReference;ref->next=ref->prev=0;return ref;}
+static cJSON *share_item(cJSON *item,int withkey);
+static cJSON *create_reference(cJSON *item) {cJSON *ref;if (cJSON_frozen(item) || item->shared) return share_item(item,0);
+	ref=cJSON_New_Item();if (!ref) return 0;memcpy(ref,item,sizeof(cJSON));ref->string=0;ref->type=(ref->type&~(cJSON_StringIsConst|cJSON_StringHasLength))|cJSON_IsReference;ref->next=ref->prev=0;return ref;}
+/* A frozen item can't be linked into another chain, so one being added is swapped for a copy that takes over the caller's hold. */
+static cJSON *adopt_item(cJSON *item) {cJSON *copy;if (!item || !cJSON_frozen(item)) return item;if ((copy=share_item(item,1))) cJSON_release(item); else cJSON_Delete(item);return copy;}
+/* The functions that add an item own it from then on, so one they can't add is deleted rather than left to leak. */
+static int reject_item(cJSON *item) {cJSON_Delete(item);return 0;}
 
 /* Add item to array/object. */
-void   cJSON_AddItemToArray(cJSON *array, cJSON *item)						{cJSON *c=array->child;if (!item) return; if (!c) {array->child=item;} else {while (c && c->next) c=c->next; suffix_object(c,item);}}
-void   cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item)	{if (!item) return; if (item->string) cJSON_free(item->string);item->string=cJSON_strdup(string);cJSON_AddItemToArray(object,item);}
-void   cJSON_AddItemToObjectCS(cJSON *object,const char *string,cJSON *item)	{if (!item) return; if (!(item->type&cJSON_StringIsConst) && item->string) cJSON_free(item->string);item->string=(char*)string;item->type|=cJSON_StringIsConst;cJSON_AddItemToArray(object,item);}
-void	cJSON_AddItemReferenceToArray(cJSON *array, cJSON *item)						{cJSON_AddItemToArray(array,create_reference(item));}
-void	cJSON_AddItemReferenceToObject(cJSON *object,const char *string,cJSON *item)	{cJSON_AddItemToObject(object,string,create_reference(item));}
+int    cJSON_AddItemToArray(cJSON *array, cJSON *item)						{cJSON *c;if (!(item=adopt_item(item))) return 0;if (!(array=cJSON_Thaw(array))) return reject_item(item);c=array->child; if (!c) {array->child=item;} else {while (c && c->next) c=c->next; suffix_object(c,item);}return 1;}
+int    cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item)	{if (!(item=adopt_item(item))) return 0; free_key(item);item->string=cJSON_strndup(string,strlen(string));item->type&=~(cJSON_StringIsConst|cJSON_StringHasLength);return cJSON_AddItemToArray(object,item);}
+int    cJSON_AddItemToObjectCS(cJSON *object,const char *string,cJSON *item)	{if (!(item=adopt_item(item))) return 0; free_key(item);item->string=(char*)string;item->type=(item->type&~cJSON_StringHasLength)|cJSON_StringIsConst;return cJSON_AddItemToArray(object,item);}
+int    cJSON_AddItemReferenceToArray(cJSON *array, cJSON *item)						{return cJSON_AddItemToArray(array,create_reference(item));}
+int    cJSON_AddItemReferenceToObject(cJSON *object,const char *string,cJSON *item)	{return cJSON_AddItemToObject(object,string,create_reference(item));}
 
-cJSON *cJSON_DetachItemFromArray(cJSON *array,int which)			{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return 0;
+cJSON *cJSON_DetachItemFromArray(cJSON *array,int which)			{cJSON *c;if (!(array=cJSON_Thaw(array))) return 0;c=array->child;while (c && which>0) c=c->next,which--;if (!c) return 0;
 	if (c->prev) c->prev->next=c->next;if (c->next) c->next->prev=c->prev;if (c==array->child) array->child=c->next;c->prev=c->next=0;return c;}
 void   cJSON_DeleteItemFromArray(cJSON *array,int which)			{cJSON_Delete(cJSON_DetachItemFromArray(array,which));}
 cJSON *cJSON_DetachItemFromObject(cJSON *object,const char *string) {int i=0;cJSON *c=object->child;while (c && cJSON_strcasecmp(c->string,string)) i++,c=c->next;if (c) return cJSON_DetachItemFromArray(object,i);return 0;}
 void   cJSON_DeleteItemFromObject(cJSON *object,const char *string) {cJSON_Delete(cJSON_DetachItemFromObject(object,string));}
 
 /* Replace array/object items with new ones. */
-void   cJSON_InsertItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) {cJSON_AddItemToArray(array,newitem);return;}
-	newitem->next=c;newitem->prev=c->prev;c->prev=newitem;if (c==array->child) array->child=newitem; else newitem->prev->next=newitem;}
-void   cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return;
+int    cJSON_InsertItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c;if (!(newitem=adopt_item(newitem))) return 0;if (!(array=cJSON_Thaw(array))) return reject_item(newitem);c=array->child;while (c && which>0) c=c->next,which--;if (!c) return cJSON_AddItemToArray(array,newitem);
+	newitem->next=c;newitem->prev=c->prev;c->prev=newitem;if (c==array->child) array->child=newitem; else newitem->prev->next=newitem;return 1;}
+int    cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c;if (!(newitem=adopt_item(newitem))) return 0;if (!(array=cJSON_Thaw(array))) return reject_item(newitem);c=array->child;while (c && which>0) c=c->next,which--;if (!c) return reject_item(newitem);
 	newitem->next=c->next;newitem->prev=c->prev;if (newitem->next) newitem->next->prev=newitem;
-	if (c==array->child) array->child=newitem; else newitem->prev->next=newitem;c->next=c->prev=0;cJSON_Delete(c);}
-void   cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem){int i=0;cJSON *c=object->child;while(c && cJSON_strcasecmp(c->string,string))i++,c=c->next;if(c){newitem->string=cJSON_strdup(string);cJSON_ReplaceItemInArray(object,i,newitem);}}
+	if (c==array->child) array->child=newitem; else newitem->prev->next=newitem;c->next=c->prev=0;cJSON_Delete(c);return 1;}
+int    cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem){int i=0;cJSON *c=object->child;while(c && cJSON_strcasecmp(c->string,string))i++,c=c->next;if (!(newitem=adopt_item(newitem))) return 0;if (!c) return reject_item(newitem);
+	free_key(newitem);newitem->string=cJSON_strndup(string,strlen(string));newitem->type&=~(cJSON_StringIsConst|cJSON_StringHasLength);return cJSON_ReplaceItemInArray(object,i,newitem);}
+
+/* Change a string. The old one is freed unless it is borrowed, which thawing a copy takes care of. */
+int cJSON_SetValuestringWithLength(cJSON *item,const char *string,size_t length)
+{
+	char *copy;int counted;
+	if (!item || (item->type&cJSON_IsReference) || !(item=cJSON_Thaw(item)) || !(copy=copy_string(string,length,&counted))) return 0;
+	if (item->valuestring) free_string(item->valuestring,item->type&cJSON_ValueHasLength);
+	item->valuestring=copy;item->type=(item->type&~cJSON_ValueHasLength)|(counted?cJSON_ValueHasLength:0);
+	return 1;
+}
+
+/* Change a number. A frozen item may be shared by any number of trees, so it is left as it is, and NaN says so. */
+double cJSON_SetNumberHelper(cJSON *object,double number)	{if (cJSON_frozen(object)) return NAN;object->valuedouble=number;object->valueint=(int)number;return number;}
 
 /* Create basic types: */
 cJSON *cJSON_CreateNull(void)					{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_NULL;return item;}
@@ -694,7 +1421,8 @@ cJSON *cJSON_CreateTrue(void)					{cJSON *item=cJSON_New_Item();if(item)item->ty
 cJSON *cJSON_CreateFalse(void)					{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_False;return item;}
 cJSON *cJSON_CreateBool(int b)					{cJSON *item=cJSON_New_Item();if(item)item->type=b?cJSON_True:cJSON_False;return item;}
 cJSON *cJSON_CreateNumber(double num)			{cJSON *item=cJSON_New_Item();if(item){item->type=cJSON_Number;item->valuedouble=num;item->valueint=(int)num;}return item;}
-cJSON *cJSON_CreateString(const char *string)	{cJSON *item=cJSON_New_Item();if(item){item->type=cJSON_String;item->valuestring=cJSON_strdup(string);}return item;}
+cJSON *cJSON_CreateString(const char *string)	{return cJSON_CreateStringWithLength(string,strlen(string));}
+cJSON *cJSON_CreateStringWithLength(const char *string,size_t length)	{cJSON *item=cJSON_New_Item();if(item){item->type=cJSON_String;cJSON_SetValuestringWithLength(item,string,length);}return item;}
 cJSON *cJSON_CreateArray(void)					{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_Array;return item;}
 cJSON *cJSON_CreateObject(void)					{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_Object;return item;}
 
@@ -705,33 +1433,296 @@ cJSON *cJSON_CreateDoubleArray(const double *numbers,int count)	{int i;cJSON *n=
 cJSON *cJSON_CreateStringArray(const char **strings,int count)	{int i;cJSON *n=0,*p=0,*a=cJSON_CreateArray();for(i=0;a && i<count;i++){n=cJSON_CreateString(strings[i]);if(!i)a->child=n;else suffix_object(p,n);p=n;}return a;}
 
 /* Duplication */
+/* Copy one item's own fields, leaving its children alone. */
+static cJSON *duplicate_item(cJSON *item)
+{
+	cJSON *newitem=cJSON_New_Item();int counted;
+	if (!newitem) return 0;
+	/* Copy over all vars */
+	newitem->type=item->type&(~(cJSON_IsReference|cJSON_StringIsConst|cJSON_ValueHasLength|cJSON_StringHasLength)),newitem->valueint=item->valueint,newitem->valuedouble=item->valuedouble;
+	if (item->valuestring)	{newitem->valuestring=copy_string(item->valuestring,value_length(item),&counted);	if (!newitem->valuestring)	{cJSON_Delete(newitem);return 0;}	if (counted) newitem->type|=cJSON_ValueHasLength;}
+	if (item->string)		{newitem->string=copy_string(item->string,string_length(item),&counted);			if (!newitem->string)		{cJSON_Delete(newitem);return 0;}	if (counted) newitem->type|=cJSON_StringHasLength;}
+	return newitem;
+}
+
+typedef struct {cJSON *from,*to,*last;} duplicate_frame;
+
 cJSON *cJSON_Duplicate(cJSON *item,int recurse)
 {
-	cJSON *newitem,*cptr,*nptr=0,*newchild;
+	duplicate_frame local[16],*f;walk_stack s;cJSON *newitem,*cptr,*newchild;
 	/* Bail on bad ptr */
 	if (!item) return 0;
-	/* Create new item */
-	newitem=cJSON_New_Item();
-	if (!newitem) return 0;
-	/* Copy over all vars */
-	newitem->type=item->type&(~cJSON_IsReference),newitem->valueint=item->valueint,newitem->valuedouble=item->valuedouble;
-	if (item->valuestring)	{newitem->valuestring=cJSON_strdup(item->valuestring);	if (!newitem->valuestring)	{cJSON_Delete(newitem);return 0;}}
-	if (item->string)		{newitem->string=cJSON_strdup(item->string);			if (!newitem->string)		{cJSON_Delete(newitem);return 0;}}
+	if (!(newitem=duplicate_item(item))) return 0;
 	/* If non-recursive, then we're done! */
-	if (!recurse) return newitem;
-	/* Walk the ->next chain for the child. */
-	cptr=item->child;
-	while (cptr)
+	if (!recurse || !item->child) return newitem;
+	/* Each frame walks one ->child chain, appending copies to its parent's copy. */
+	walk_init(&s,local);
+	f=(duplicate_frame*)walk_push(&s);f->from=item->child;f->to=newitem;f->last=0;
+	while (s.depth)
 	{
-		newchild=cJSON_Duplicate(cptr,1);		/* Duplicate (with recurse) each item in the ->next chain */
-		if (!newchild) {cJSON_Delete(newitem);return 0;}
-		if (nptr)	{nptr->next=newchild,newchild->prev=nptr;nptr=newchild;}	/* If newitem->child already set, then crosswire ->prev and ->next and move on */
-		else		{newitem->child=newchild;nptr=newchild;}					/* Set newitem->child and move to it */
-		cptr=cptr->next;
+		f=walk_top(&s,duplicate_frame);
+		if (!(cptr=f->from)) {s.depth--;continue;}
+		f->from=cptr->next;
+		if (!(newchild=duplicate_item(cptr))) goto fail;
+		if (f->last)	{f->last->next=newchild;newchild->prev=f->last;}
+		else			f->to->child=newchild;
+		f->last=newchild;
+		if (cptr->child)
+		{
+			if (!(f=(duplicate_frame*)walk_push(&s))) goto fail;	/* too deep. */
+			f->from=cptr->child;f->to=newchild;f->last=0;
+		}
 	}
+	walk_free(&s);
 	return newitem;
+fail:
+	walk_free(&s);
+	cJSON_Delete(newitem);
+	return 0;
 }
 
+/* Copy-on-write sharing. */
+/* A private copy of a frozen item, or of another copy: it borrows the children and strings of the frozen item
+(which it holds until it is deleted or thawed), and only the fields of the copy itself are its own. A copy of a
+copy (even a frozen one) borrows from the same frozen item, so ->shared never leads more than one step. */
+static cJSON *share_item(cJSON *item,int withkey)
+{
+	cJSON *from=item->shared?item->shared:item,*copy=cJSON_New_Item();int counted;
+	if (!copy) return 0;
+	copy->type=item->type;
+	copy->valueint=item->valueint;copy->valuedouble=item->valuedouble;
+	copy->valuestring=item->valuestring;copy->child=item->child;
+	if (withkey && item->string)
+	{
+		if ((item->type&cJSON_StringIsConst) || item->string==from->string)	copy->string=item->string;
+		else if (!(copy->string=copy_string(item->string,string_length(item),&counted)))	{cJSON_free(copy);return 0;}
+	}
+	else copy->type&=~(cJSON_StringIsConst|cJSON_StringHasLength);
+	copy->shared=from;cJSON_retain(from);
+	return copy;
+}
+
+cJSON *cJSON_Share(cJSON *item)	{return item && (cJSON_frozen(item) || item->shared)?share_item(item,1):cJSON_Duplicate(item,1);}
+
+cJSON *cJSON_Freeze(cJSON *item)
+{
+	cJSON *local[16],**f,*c;walk_stack s;int pass;
+	if (!item || cJSON_frozen(item)) return 0;
+	walk_init(&s,local);
+	/* The first pass only checks that the walk fits, so a tree too deep to freeze is left as it was. */
+	for (pass=0;pass<2;pass++)
+	{
+		if (pass) item->refcount=1;
+		if ((item->type&cJSON_IsReference) || item->shared || !item->child) break;
+		s.depth=0;f=(cJSON**)walk_push(&s);*f=item->child;
+		while (s.depth)
+		{
+			f=walk_top(&s,cJSON*);
+			if (!(c=*f)) {s.depth--;continue;}
+			*f=c->next;
+			if (cJSON_frozen(c)) continue;
+			if (pass) c->refcount=1;	/* held by its parent. */
+			if (!(c->type&cJSON_IsReference) && !c->shared && c->child)
+			{
+				if (!(f=(cJSON**)walk_push(&s))) {walk_free(&s);return 0;}	/* too deep. */
+				*f=c->child;
+			}
+		}
+	}
+	walk_free(&s);
+	return item;
+}
+
+cJSON *cJSON_Thaw(cJSON *item)
+{
+	cJSON *from,*c,*copy,*first=0,*last=0;char *value,*key;int counted;
+	if (!item || cJSON_frozen(item)) return 0;
+	if (!(from=item->shared)) return item;
+	for (c=item->child;c;c=c->next)
+	{
+		if (!(copy=share_item(c,1))) {cJSON_Delete(first);return 0;}
+		if (last) suffix_object(last,copy); else first=copy;
+		last=copy;
+	}
+	value=item->valuestring;key=item->string;
+	if (value && !(value=copy_string(value,value_length(item),&counted)))								{cJSON_Delete(first);return 0;}
+	if (key && key==from->string && !(item->type&cJSON_StringIsConst) && !(key=copy_string(key,string_length(item),&counted)))	{if (value) free_string(value,item->type&cJSON_ValueHasLength);cJSON_Delete(first);return 0;}
+	item->child=first;item->valuestring=value;item->string=key;item->shared=0;
+	if ((from=frozen_release(from))) {from->next=0;cJSON_Delete(from);}
+	return item;
+}
+
+/* Interning. Each distinct string and subtree is kept once, as a canonical item that is frozen with one hold belonging
+to the pool, and every item interned turns into a copy sharing it (see share_item), which also borrows its key when the
+names match. An item is interned after its children, so theirs are canonical already and two subtrees are equal exactly
+when their members have the same keys, the same scalars and the same canonical items: comparing them is never recursive. */
+#define cJSON_IsInterned 1024	/* Marks canonical items, which are only ever reached through ->shared. */
+typedef struct {cJSON item;size_t hash;} intern_node;
+struct cJSON_InternPool {intern_node **slots;size_t mask,count;};
+
+cJSON_InternPool *cJSON_CreateInternPool(void)
+{
+	cJSON_InternPool *pool=(cJSON_InternPool*)cJSON_malloc(sizeof(cJSON_InternPool));
+	if (!pool) return 0;
+	pool->mask=255;pool->count=0;
+	if (!(pool->slots=(intern_node**)cJSON_malloc((pool->mask+1)*sizeof(intern_node*)))) {cJSON_free(pool);return 0;}
+	memset(pool->slots,0,(pool->mask+1)*sizeof(intern_node*));
+	return pool;
+}
+
+void cJSON_DeleteInternPool(cJSON_InternPool *pool)
+{
+	size_t i;cJSON *dead;
+	if (!pool) return;
+	for (i=0;i<=pool->mask;i++) if (pool->slots[i] && (dead=frozen_release(&pool->slots[i]->item))) {dead->next=0;cJSON_Delete(dead);}
+	cJSON_free(pool->slots);cJSON_free(pool);
+}
+
+static size_t intern_bytes(size_t h,const char *str,size_t len)	{while (len--) h=(h^(unsigned char)*str++)*16777619u;return h;}
+
+/* Hash of a member of a subtree being interned; 0 if it is neither a plain scalar nor a copy of a canonical item. */
+static int intern_member_hash(cJSON *c,size_t *h)
+{
+	if (c->type&cJSON_IsReference) return 0;
+	switch (c->type&0xff)
+	{
+		case cJSON_NULL: case cJSON_False: case cJSON_True: *h=c->type&0xff;return 1;
+		case cJSON_Number: *h=intern_bytes(intern_bytes(cJSON_Number,(const char*)&c->valuedouble,sizeof(double)),(const char*)&c->valueint,sizeof(int));return 1;
+	}
+	if (!c->shared || !(c->shared->type&cJSON_IsInterned)) return 0;
+	*h=((intern_node*)c->shared)->hash;return 1;
+}
+
+/* Hash of item: of its bytes for a string (or any other item holding a valuestring), or of its members. 0 if it can't be interned. */
+static int intern_hash(cJSON *item,size_t *h)
+{
+	cJSON *c;size_t ch;
+	*h=intern_bytes(2166136261u^(size_t)(item->type&0xff),(const char*)&item->valueint,sizeof(int));
+	if (item->valuestring) {*h=intern_bytes(*h,item->valuestring,value_length(item));return 1;}
+	for (c=item->child;c;c=c->next)
+	{
+		if (!intern_member_hash(c,&ch)) return 0;
+		*h=(intern_bytes(*h,c->string,string_length(c))^ch)*16777619u;
+	}
+	return 1;
+}
+
+static int intern_same(cJSON *a,cJSON *b)
+{
+	size_t len;
+	if ((a->type&0xff)!=(b->type&0xff) || a->valueint!=b->valueint) return 0;
+	if (a->valuestring) return b->valuestring && (len=value_length(a))==value_length(b) && !memcmp(a->valuestring,b->valuestring,len);
+	for (a=a->child,b=b->child;a && b;a=a->next,b=b->next)
+	{
+		if ((a->type&0xff)!=(b->type&0xff) || (len=string_length(a))!=string_length(b) || (len && memcmp(a->string,b->string,len))) return 0;
+		if ((a->type&0xff)==cJSON_Number) {if (memcmp(&a->valuedouble,&b->valuedouble,sizeof(double)) || a->valueint!=b->valueint) return 0;}
+		else if (a->shared!=b->shared) return 0;
+	}
+	return !a && !b;
+}
+
+static int intern_grow(cJSON_InternPool *pool)
+{
+	size_t i,j,mask=2*pool->mask+1;intern_node **slots=(intern_node**)cJSON_malloc((mask+1)*sizeof(intern_node*));
+	if (!slots) return 0;
+	memset(slots,0,(mask+1)*sizeof(intern_node*));
+	for (i=0;i<=pool->mask;i++) if (pool->slots[i])
+	{
+		for (j=pool->slots[i]->hash&mask;slots[j];j=(j+1)&mask);
+		slots[j]=pool->slots[i];
+	}
+	cJSON_free(pool->slots);
+	pool->slots=slots;pool->mask=mask;
+	return 1;
+}
+
+/* Move the value and children of item into the new frozen item c, which holds the children from then on. */
+static void move_content(cJSON *item,cJSON *c)
+{
+	c->valuestring=item->valuestring;c->type|=item->type&cJSON_ValueHasLength;c->valueint=item->valueint;c->valuedouble=item->valuedouble;
+	for (c->child=item->child;item->child;item->child=item->child->next) item->child->refcount=1;
+}
+
+/* Let item borrow everything of c but its own key, holding c until it is deleted or thawed. */
+static void become_copy(cJSON *item,cJSON *c)
+{
+	item->valuestring=c->valuestring;item->child=c->child;
+	item->shared=c;cJSON_retain(c);
+}
+
+/* Turn item into a copy of the canonical item equal to it, making item's content canonical if there is none yet.
+Items that aren't strings, arrays or objects (or that hold something that can't be interned) are left as they are. Returns 0 if memory runs out. */
+static int intern_item(cJSON_InternPool *pool,cJSON *item)
+{
+	intern_node *n;cJSON *c;size_t h,i,len;
+	if (item->shared || cJSON_frozen(item) || (item->type&cJSON_IsReference) || (item->valuestring && item->child)) return 1;
+	if (!item->valuestring && (item->type&0xff)!=cJSON_Array && (item->type&0xff)!=cJSON_Object) return 1;
+	if (!intern_hash(item,&h)) return 1;
+	for (i=h&pool->mask;(n=pool->slots[i]);i=(i+1)&pool->mask) if (n->hash==h && intern_same(&n->item,item)) break;
+	if (n)
+	{
+		c=&n->item;
+		if (item->valuestring) free_string(item->valuestring,item->type&cJSON_ValueHasLength);
+		cJSON_Delete(item->child);
+	}
+	else
+	{
+		if (2*(pool->count+1)>pool->mask && !intern_grow(pool)) return 0;
+		if (!(n=(intern_node*)cJSON_malloc(sizeof(intern_node)))) return 0;
+		for (i=h&pool->mask;pool->slots[i];i=(i+1)&pool->mask);
+		memset(n,0,sizeof(intern_node));
+		pool->slots[i]=n;pool->count++;n->hash=h;c=&n->item;
+		c->type=(item->type&0xff)|cJSON_IsInterned;c->refcount=1;
+		if (item->string && !(item->type&cJSON_StringIsConst)) {c->string=item->string;c->type|=item->type&cJSON_StringHasLength;}
+		move_content(item,c);
+	}
+	if (item->string && c->string && item->string!=c->string && !(item->type&cJSON_StringIsConst) &&
+		(len=string_length(item))==string_length(c) && !memcmp(item->string,c->string,len)) {free_string(item->string,item->type&cJSON_StringHasLength);item->string=c->string;}
+	become_copy(item,c);
+	return 1;
+}
+
+/* Make item (an array or object that isn't shared yet) a copy of a new frozen item holding what it held. */
+static int snapshot_item(cJSON_InternPool *pool,cJSON *item)
+{
+	cJSON *c;(void)pool;
+	if (!item->child || item->shared || cJSON_frozen(item) || (item->type&cJSON_IsReference) || ((item->type&0xff)!=cJSON_Array && (item->type&0xff)!=cJSON_Object)) return 1;
+	if (!(c=cJSON_New_Item())) return 0;
+	c->type=item->type&0xff;
+	move_content(item,c);
+	become_copy(item,c);
+	return 1;
+}
+
+typedef struct {cJSON *item,*next;} intern_frame;
+
+/* Apply share (intern_item or snapshot_item) to each item of the tree that isn't shared already, children first. */
+static cJSON *share_tree(cJSON *item,cJSON_InternPool *pool,int (*share)(cJSON_InternPool*,cJSON*))
+{
+	intern_frame local[16],*f;walk_stack s;cJSON *c;
+	if (!item || cJSON_frozen(item)) return 0;
+	walk_init(&s,local);
+	f=(intern_frame*)walk_push(&s);f->item=item;f->next=0;
+	if (!item->shared && !(item->type&cJSON_IsReference)) f->next=item->child;
+	while (s.depth)
+	{
+		f=walk_top(&s,intern_frame);
+		if (!(c=f->next)) {if (!share(pool,f->item)) break;s.depth--;continue;}
+		f->next=c->next;
+		if (c->child && !c->shared && !(c->type&cJSON_IsReference))
+		{
+			if (!(f=(intern_frame*)walk_push(&s))) break;	/* too deep. */
+			f->item=c;f->next=c->child;
+		}
+		else if (!share(pool,c)) break;
+	}
+	walk_free(&s);
+	return s.depth?0:item;
+}
+
+cJSON *cJSON_Intern(cJSON_InternPool *pool,cJSON *item)	{return pool?share_tree(item,pool,intern_item):0;}
+cJSON *cJSON_Snapshot(cJSON *item)							{return share_tree(item,0,snapshot_item);}
+
 void cJSON_Minify(char *json)
 {
 	char *into=json;
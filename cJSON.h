@@ -23,11 +23,21 @@
 #ifndef cJSON__h
 #define cJSON__h
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+/* struct cJSON grew ->shared and ->refcount in 2.0 (72 bytes on 64-bit systems, up from 64), so code built against
+an older cJSON.h must be rebuilt rather than linked with this library; the shared library's SOVERSION changed with it. */
+#define CJSON_VERSION_MAJOR 2
+#define CJSON_VERSION_MINOR 0
+#define CJSON_VERSION_PATCH 0
+
 /* cJSON Types: */
 #define cJSON_False 0
 #define cJSON_True 1
@@ -39,6 +49,11 @@ extern "C"
 	
 #define cJSON_IsReference 256
 #define cJSON_StringIsConst 512
+/* A valuestring (or string, the key) with NULs in it keeps its length in the size_t just before its first byte, and its
+item is flagged to say so; read such lengths with cJSON_GetValueLength and cJSON_GetKeyLength. Any other string is plain
+NUL-terminated text, so one you set directly works as ever, but clear the flag if you replace a string that had it. */
+#define cJSON_ValueHasLength 2048
+#define cJSON_StringHasLength 4096
 
 /* The cJSON structure: */
 typedef struct cJSON {
@@ -46,12 +61,15 @@ typedef struct cJSON {
 	struct cJSON *child;		/* An array or object item will have a child pointer pointing to a chain of the items in the array/object. */
 
 	int type;					/* The type of the item, as above. */
+	int refcount;				/* Holders of a frozen item, or 0 if it isn't frozen; see cJSON_Freeze. Kept beside type, in what was padding. */
 
 	char *valuestring;			/* The item's string, if type==cJSON_String */
 	int valueint;				/* The item's number, if type==cJSON_Number */
 	double valuedouble;			/* The item's number, if type==cJSON_Number */
 
 	char *string;				/* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
+
+	struct cJSON *shared;		/* The frozen item whose children and strings this copy borrows until it is thawed. */
 } cJSON;
 
 typedef struct cJSON_Hooks {
@@ -59,9 +77,21 @@ typedef struct cJSON_Hooks {
       void (*free_fn)(void *ptr);
 } cJSON_Hooks;
 
+/* Receives printed text in pieces. Return 0 to stop printing. */
+typedef int (*cJSON_Sink)(void *ctx,const char *data,size_t len);
+
 /* Supply malloc, realloc and free functions to cJSON */
 extern void cJSON_InitHooks(cJSON_Hooks* hooks);
 
+/* Arrays and objects may nest this deeply by default. */
+#ifndef CJSON_NESTING_LIMIT
+#define CJSON_NESTING_LIMIT 1000
+#endif
+/* Set the deepest nesting that parsing, printing, duplicating and BSON encoding will follow; anything deeper fails
+instead of exhausting the stack. A depth <= 0 restores CJSON_NESTING_LIMIT. */
+extern void cJSON_SetNestingLimit(int depth);
+extern int cJSON_GetNestingLimit(void);
+
 
 /* Supply a block of JSON, and this returns a cJSON object you can interrogate. Call cJSON_Delete when finished. */
 extern cJSON *cJSON_Parse(const char *value);
@@ -71,6 +101,12 @@ extern char  *cJSON_Print(cJSON *item);
 extern char  *cJSON_PrintUnformatted(cJSON *item);
 /* Render a cJSON entity to text using a buffered strategy. prebuffer is a guess at the final size. guessing well reduces reallocation. fmt=0 gives unformatted, =1 gives formatted */
 extern char *cJSON_PrintBuffered(cJSON *item,int prebuffer,int fmt);
+/* Render a cJSON entity into one reused buffer of highwater bytes (0 picks a default), handing it to sink each time it fills.
+Memory use stays constant however large the output. Returns 0 on failure, in which case part of the text may already have reached the sink. */
+extern int cJSON_PrintToSink(cJSON *item,int fmt,size_t highwater,cJSON_Sink sink,void *ctx);
+/* cJSON_PrintToSink into a stdio stream or a file descriptor. */
+extern int cJSON_PrintToFile(cJSON *item,int fmt,FILE *file);
+extern int cJSON_PrintToFd(cJSON *item,int fmt,int fd);
 /* Delete a cJSON entity and all subentities. */
 extern void   cJSON_Delete(cJSON *c);
 
@@ -80,8 +116,11 @@ extern int	  cJSON_GetArraySize(cJSON *array);
 extern cJSON *cJSON_GetArrayItem(cJSON *array,int item);
 /* Get item "string" from object. Case insensitive. */
 extern cJSON *cJSON_GetObjectItem(cJSON *object,const char *string);
+/* The length of item's valuestring (or of its key), counting any NULs in it; 0 if it has none. */
+extern size_t cJSON_GetValueLength(cJSON *item);
+extern size_t cJSON_GetKeyLength(cJSON *item);
 
-/* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when cJSON_Parse() succeeds. */
+/* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when cJSON_Parse() succeeds. Each thread has its own. */
 extern const char *cJSON_GetErrorPtr(void);
 	
 /* These calls create a cJSON item of the appropriate type. */
@@ -91,6 +130,7 @@ extern cJSON *cJSON_CreateFalse(void);
 extern cJSON *cJSON_CreateBool(int b);
 extern cJSON *cJSON_CreateNumber(double num);
 extern cJSON *cJSON_CreateString(const char *string);
+extern cJSON *cJSON_CreateStringWithLength(const char *string,size_t length);	/* string may contain NULs */
 extern cJSON *cJSON_CreateArray(void);
 extern cJSON *cJSON_CreateObject(void);
 
@@ -100,13 +140,14 @@ extern cJSON *cJSON_CreateFloatArray(const float *numbers,int count);
 extern cJSON *cJSON_CreateDoubleArray(const double *numbers,int count);
 extern cJSON *cJSON_CreateStringArray(const char **strings,int count);
 
-/* Append item to the specified array/object. */
-extern void cJSON_AddItemToArray(cJSON *array, cJSON *item);
-extern void	cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item);
-extern void	cJSON_AddItemToObjectCS(cJSON *object,const char *string,cJSON *item);	/* Use this when string is definitely const (i.e. a literal, or as good as), and will definitely survive the cJSON object */
+/* Append item to the specified array/object. These (and Insert/Replace below) take over item, returning 1, or 0 if they
+couldn't add it (the array is frozen, or the item to replace isn't there), in which case item has been deleted. */
+extern int  cJSON_AddItemToArray(cJSON *array, cJSON *item);
+extern int	cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item);
+extern int	cJSON_AddItemToObjectCS(cJSON *object,const char *string,cJSON *item);	/* Use this when string is definitely const (i.e. a literal, or as good as), and will definitely survive the cJSON object */
 /* Append reference to item to the specified array/object. Use this when you want to add an existing cJSON to a new cJSON, but don't want to corrupt your existing cJSON. */
-extern void cJSON_AddItemReferenceToArray(cJSON *array, cJSON *item);
-extern void	cJSON_AddItemReferenceToObject(cJSON *object,const char *string,cJSON *item);
+extern int  cJSON_AddItemReferenceToArray(cJSON *array, cJSON *item);
+extern int	cJSON_AddItemReferenceToObject(cJSON *object,const char *string,cJSON *item);
 
 /* Remove/Detatch items from Arrays/Objects. */
 extern cJSON *cJSON_DetachItemFromArray(cJSON *array,int which);
@@ -115,9 +156,9 @@ extern cJSON *cJSON_DetachItemFromObject(cJSON *object,const char *string);
 extern void   cJSON_DeleteItemFromObject(cJSON *object,const char *string);
 	
 /* Update array items. */
-extern void cJSON_InsertItemInArray(cJSON *array,int which,cJSON *newitem);	// Shifts pre-existing items to the right.
-extern void cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem);
-extern void cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem);
+extern int  cJSON_InsertItemInArray(cJSON *array,int which,cJSON *newitem);	// Shifts pre-existing items to the right.
+extern int  cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem);
+extern int  cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem);
 
 /* Duplicate a cJSON item */
 extern cJSON *cJSON_Duplicate(cJSON *item,int recurse);
@@ -125,9 +166,121 @@ extern cJSON *cJSON_Duplicate(cJSON *item,int recurse);
 need to be released. With recurse!=0, it will duplicate any children connected to the item.
 The item->next and ->prev pointers are always zero on return from Duplicate. */
 
+/* Freeze makes a tree read-only so that copies of it can share its memory: cJSON_Share of a frozen item (or of a copy
+of one) takes O(1) time and space, and cJSON_Delete only frees the shared nodes once no copy uses them. Duplicate still
+copies everything, so its copies are private all the way down. The counts are atomic, so one frozen tree can be read,
+shared and its copies deleted from many threads at once. Returns item, or 0 if it was already frozen. The tree is yours
+to delete as before; don't change it afterwards (cJSON_SetNumberValue refuses to, returning NaN). */
+extern cJSON *cJSON_Freeze(cJSON *item);
+/* A copy sharing the children and strings of item if it is frozen or a copy of a frozen item; otherwise cJSON_Duplicate(item,1). */
+extern cJSON *cJSON_Share(cJSON *item);
+/* A copy's children are still shared, so change it a level at a time: Thaw gives the item private copies of its
+children (each sharing its own children in turn) and of its strings, and returns it. The Add/Insert/Replace/Detach
+functions thaw the array or object they change, so cJSON_GetObjectItem(cJSON_Thaw(copy),"a") is the way down.
+Returns 0 for a frozen item (or when memory runs out), which the functions that change items leave alone, failing. */
+extern cJSON *cJSON_Thaw(cJSON *item);
+
+/* Interning stores each distinct string and subtree once: the items interned become copies (as cJSON_Share makes of
+frozen items) of canonical ones kept by the pool, so repeated subobjects and strings cost one item each however large they
+are. cJSON_ParseInterned interns values as they are parsed; cJSON_Intern does it in place to any tree, returning 0 if it is
+too deep (or memory runs out), which leaves it partly interned. Interned trees are deleted and changed like any copies, and
+outlive the pool, which holds on to what it has seen until cJSON_DeleteInternPool. A pool is not safe to use from several
+threads at once; the trees are, as with cJSON_Freeze. */
+typedef struct cJSON_InternPool cJSON_InternPool;
+extern cJSON_InternPool *cJSON_CreateInternPool(void);
+extern void cJSON_DeleteInternPool(cJSON_InternPool *pool);
+extern cJSON *cJSON_ParseInterned(const char *value,cJSON_InternPool *pool);
+extern cJSON *cJSON_Intern(cJSON_InternPool *pool,cJSON *item);
+
+/* Snapshot freezes what item holds while leaving item itself changeable: every array or object in the tree that isn't
+shared already becomes a copy of a frozen item with its contents, so it is walked once and later changes (made the way
+copies are changed, thawing on the way down) unshare only the path to them. The arrays and objects still shared are
+exactly the parts unchanged since the snapshot. Returns item, or 0 if it is frozen or too deep. */
+extern cJSON *cJSON_Snapshot(cJSON *item);
+
 /* ParseWithOpts allows you to require (and check) that the JSON is null terminated, and to retrieve the pointer to the final byte parsed. */
 extern cJSON *cJSON_ParseWithOpts(const char *value,const char **return_parse_end,int require_null_terminated);
 
+/* Parse the first length bytes at value, which need not be null terminated (an mmap'ed file, say); nothing past them is read. */
+extern cJSON *cJSON_ParseWithLength(const char *value,size_t length);
+extern cJSON *cJSON_ParseWithLengthOpts(const char *value,size_t length,const char **return_parse_end,int require_null_terminated);
+
+/* Two-stage parser: a vectorized pass (picked at runtime for this CPU) indexes the structural characters, then the tree is built from that index.
+Accepts the same input and builds the same tree as cJSON_Parse/cJSON_ParseWithOpts, which remain the reference implementation. */
+extern cJSON *cJSON_ParseIndexed(const char *value);
+extern cJSON *cJSON_ParseIndexedWithOpts(const char *value,const char **return_parse_end,int require_null_terminated);
+
+/* Tapes: a compact, read-only alternative to a tree of cJSON items. The document is one array of 64-bit words, each tagged
+in its top byte, plus one arena of strings. Items are word indices: the root value is item 1, and 0 means "no item". */
+#define cJSON_TapeRoot		'r'	/* word 0 */
+#define cJSON_TapeNull		'n'
+#define cJSON_TapeTrue		't'
+#define cJSON_TapeFalse		'f'
+#define cJSON_TapeDouble	'd'	/* the next word holds the double */
+#define cJSON_TapeInt64		'l'	/* the next word holds the int64_t */
+#define cJSON_TapeString	'"'	/* payload is the offset in strings of a 32-bit length, the bytes and a terminator */
+#define cJSON_TapeKey		'k'	/* an object member's name, laid out like a string; its value follows */
+#define cJSON_TapeArray		'['	/* payload is the index of the word after the matching end */
+#define cJSON_TapeArrayEnd	']'	/* payload is the index of the matching start */
+#define cJSON_TapeObject	'{'
+#define cJSON_TapeObjectEnd	'}'
+
+typedef struct cJSON_Tape {
+	uint64_t *words;			/* tag<<56 | payload */
+	size_t count,capacity;
+	char *strings;
+	size_t stringsize,stringcapacity;
+} cJSON_Tape;
+
+/* Parse text straight to a tape, accepting the same input as cJSON_Parse/cJSON_ParseWithOpts. Call cJSON_DeleteTape when finished. */
+extern cJSON_Tape *cJSON_ParseTape(const char *value);
+extern cJSON_Tape *cJSON_ParseTapeWithOpts(const char *value,const char **return_parse_end,int require_null_terminated);
+extern void cJSON_DeleteTape(cJSON_Tape *tape);
+
+/* Reading a tape. cJSON_TapeType gives the cJSON type of item (-1 if there is none). Child and Next walk arrays and objects,
+returning 0 at the end; a subtree is stepped over in one go. GetKey is only meaningful for members of an object. */
+extern int    cJSON_TapeType(const cJSON_Tape *tape,size_t item);
+extern size_t cJSON_TapeChild(const cJSON_Tape *tape,size_t item);
+extern size_t cJSON_TapeNext(const cJSON_Tape *tape,size_t item);
+extern int    cJSON_TapeGetArraySize(const cJSON_Tape *tape,size_t array);
+extern size_t cJSON_TapeGetArrayItem(const cJSON_Tape *tape,size_t array,int item);
+extern size_t cJSON_TapeGetObjectItem(const cJSON_Tape *tape,size_t object,const char *string);	/* Case insensitive, like cJSON_GetObjectItem. */
+extern const char *cJSON_TapeGetString(const cJSON_Tape *tape,size_t item,size_t *length);
+extern const char *cJSON_TapeGetKey(const cJSON_Tape *tape,size_t item,size_t *length);
+extern double cJSON_TapeGetNumber(const cJSON_Tape *tape,size_t item);
+extern int    cJSON_TapeGetInt(const cJSON_Tape *tape,size_t item);
+
+/* Building a tape, for parsers of other formats. Appends return the index of the new word, or 0 when out of memory.
+Open a container by appending cJSON_TapeArray or cJSON_TapeObject, then close it with cJSON_TapeAppendEnd. */
+extern cJSON_Tape *cJSON_CreateTape(void);
+extern size_t cJSON_TapeAppend(cJSON_Tape *tape,int tag,size_t payload);
+extern size_t cJSON_TapeAppendDouble(cJSON_Tape *tape,double value);
+extern size_t cJSON_TapeAppendInt64(cJSON_Tape *tape,int64_t value);
+extern size_t cJSON_TapeAppendString(cJSON_Tape *tape,int tag,const char *string,size_t length);
+extern size_t cJSON_TapeAppendEnd(cJSON_Tape *tape,size_t open);
+
+/* Streaming: feed text in chunks of any size, and each value is handed to handler as soon as it is complete. The stream
+may hold any number of top-level values one after another. With split!=0 a top-level array or object is not built as a
+whole: handler sees cJSON_StreamOpen, then each element or member (key in item->string) as a cJSON_StreamItem, then
+cJSON_StreamClose, so memory use stays bounded by the largest element. The handler owns the items it receives with
+cJSON_StreamValue and cJSON_StreamItem; the container passed with Open and Close belongs to the stream and is always empty.
+Returning 0 from the handler stops the stream. */
+#define cJSON_StreamValue	0
+#define cJSON_StreamOpen	1
+#define cJSON_StreamItem	2
+#define cJSON_StreamClose	3
+typedef int (*cJSON_StreamHandler)(void *ctx,int event,cJSON *item);
+typedef struct cJSON_Stream cJSON_Stream;
+
+extern cJSON_Stream *cJSON_CreateStream(int split,cJSON_StreamHandler handler,void *ctx);
+/* Returns 0 once the text is malformed or the handler has stopped the stream; later calls then fail too. */
+extern int  cJSON_StreamFeed(cJSON_Stream *stream,const char *data,size_t len);
+/* Call at the end of the text. Returns 0 if it ended in the middle of a value. */
+extern int  cJSON_StreamFinish(cJSON_Stream *stream);
+extern void cJSON_DeleteStream(cJSON_Stream *stream);
+/* Start over on a new text, keeping the memory the stream has grown (to convert many files with one stream, say). */
+extern void cJSON_ResetStream(cJSON_Stream *stream);
+
 extern void cJSON_Minify(char *json);
 
 /* Macros for creating things quickly. */
@@ -138,9 +291,15 @@ extern void cJSON_Minify(char *json);
 #define cJSON_AddNumberToObject(object,name,n)	cJSON_AddItemToObject(object, name, cJSON_CreateNumber(n))
 #define cJSON_AddStringToObject(object,name,s)	cJSON_AddItemToObject(object, name, cJSON_CreateString(s))
 
-/* When assigning an integer value, it needs to be propagated to valuedouble too. */
-#define cJSON_SetIntValue(object,val)			((object)?(object)->valueint=(object)->valuedouble=(val):(val))
-#define cJSON_SetNumberValue(object,val)		((object)?(object)->valueint=(object)->valuedouble=(val):(val))
+/* Give item a copy of the length bytes at string (which may contain NULs) as its valuestring, freeing the one it had.
+A copy (see cJSON_Share) is thawed first. Returns 0, leaving item as it was, if it is frozen or a reference or memory runs out. */
+extern int cJSON_SetValuestringWithLength(cJSON *item,const char *string,size_t length);
+
+/* When assigning an integer value, it needs to be propagated to valuedouble too. A frozen item is left as it is and NaN
+returned instead of the number, so thaw the array or object holding it first; a copy's (or an interned item's) number is its own to change. */
+extern double cJSON_SetNumberHelper(cJSON *object,double number);
+#define cJSON_SetIntValue(object,val)			((object)?cJSON_SetNumberHelper(object,(double)(val)):(val))
+#define cJSON_SetNumberValue(object,val)		((object)?cJSON_SetNumberHelper(object,(double)(val)):(val))
 
 #ifdef __cplusplus
 }
@@ -32,11 +32,18 @@
 #include <float.h>
 #include <limits.h>
 #include <ctype.h>
+#include <errno.h>
 #include "cJSON.h"
 #include "cJSON_BSON.h"
+#include "cJSON_Utils.h"
+#include "cJSON_Utils_private.h"
 
 #include <assert.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
+/* \a prev points at the slot holding the last sibling so far. */
 #define cBSON_LinkSibling(prev, cur) \
   if (!**prev) \
     { \
@@ -46,13 +53,15 @@
     { \
     (**prev)->next = cur; \
     cur->prev = **prev; \
-    *prev = &cur->next; \
+    *prev = &(**prev)->next; \
     }
 
 static void *(*cJSON_malloc)(size_t sz) = malloc;
 static void (*cJSON_free)(void *ptr) = free;
 static int shouldDetectUUIDsInStrings = 0; /* do not try this by default; it adds overhead. */
 static int shouldUseExtendedTypes = 0; /* do not do this by default; it is incompatible. */
+static int shouldReadExtendedJSON = 0; /* do not do this by default; "$"-keyed objects are legal JSON. */
+static int shouldCompactIntegers = 0; /* do not do this by default; readers may expect every integer to be an int64. */
 
 /* Duplicate the string using cJSON's malloc.
  * May return null if nullOK and given an empty \a str.
@@ -82,20 +91,18 @@ static char* cJSON_strdup(const char* str, size_t* len, int nullOK)
   */
 char* cJSON_PrintBSON(cJSON *item, size_t* bufSizeOut)
 {
+  char small[256]; /* most documents are encoded here in one walk, then copied */
   char* bsonVal;
-  if (item->type != cJSON_Array)
-    {
-    *bufSizeOut = bson_get_doc_size(item);
-    bsonVal = (char*) cJSON_malloc(*bufSizeOut);
-    bson_doc_value(item->child, bsonVal, *bufSizeOut, NULL);
-    }
+  size_t bsonSize;
+  size_t written = cJSON_PrintBSONInto(item, small, sizeof(small), &bsonSize);
+  *bufSizeOut = 0;
+  if (!bsonSize || !(bsonVal = (char*) cJSON_malloc(bsonSize)))
+    return NULL; /* nested too deeply, or out of memory */
+  if (written)
+    memcpy(bsonVal, small, bsonSize);
   else
-    {
-    *bufSizeOut = bson_get_array_size(item) - 8;
-    bsonVal = (char*) cJSON_malloc(*bufSizeOut);
-    ptrdiff_t idx = 0;
-    bson_doc_value(item->child, bsonVal, *bufSizeOut, &idx);
-    }
+    cJSON_PrintBSONInto(item, bsonVal, bsonSize, &bsonSize);
+  *bufSizeOut = bsonSize;
   return bsonVal;
 }
 
@@ -215,639 +222,4475 @@ int cJSON_BSON_WillUseExtendedTypes()
   return shouldUseExtendedTypes;
 }
 
-/* Return the size of the item treating it as the top-level
- * entry in a BSON document.
- */
-size_t bson_get_doc_size(cJSON* item)
+/**\brief Call with non-zero value to have cJSON_PrintBSON read MongoDB Extended JSON.
+  *
+  * If set, objects that are Extended JSON (v2) wrappers, such as
+  * {"$oid": "..."}, {"$date": ...}, {"$numberLong": "..."} and
+  * {"$binary": {"base64": "...", "subType": "..."}}, are written as
+  * the BSON values they stand for rather than as documents. An object
+  * that does not hold exactly what its wrapper calls for is written
+  * as the document it is.
+  */
+void cJSON_BSON_SetReadExtendedJSON(int yes)
 {
-  /* 5 = 4 byte length + item size + 1-byte null terminator */
-  size_t result = 5;
-  cJSON* kid;
-  for (kid = item->child; kid; kid = kid->next)
-    result += bson_get_size(kid);
-  return result;
+  shouldReadExtendedJSON = yes ? 1 : 0;
 }
 
-/* Return the size of an item's contents (not including
- * its type byte or name.
- */
-size_t bson_get_array_item_size(cJSON* item)
+/**\brief Returns non-zero when cJSON_PrintBSON will read Extended JSON wrappers.
+  */
+int cJSON_BSON_WillReadExtendedJSON()
 {
-  size_t result = 0;
-	if (!item) return result;
-	switch ((item->type)&255)
-	{
-		case cJSON_NULL:
-                      return 0; break; /* nothing */
-		case cJSON_False:
-		case cJSON_True:
-                      return 1; break; /* bool(char) */
-		case cJSON_Number:
-                      return 8; break; /* double */
-		case cJSON_String:
-                      return item->valuestring ?
-                        (shouldDetectUUIDsInStrings && bson_is_string_uuid(item->valuestring) ?
-                         21 : /* size(4) + subtype(1) + UUID(16 bytes) */
-                         5 + strlen(item->valuestring)) : /* size + value + terminator */
-                        5; /* size + terminator */
-                      break;
-		case cJSON_Array:
-                      return bson_get_array_size(item->child); break;
-		case cJSON_Object: return bson_get_object_size(item->child); break;
-	}
-  /* TODO: Generate error of some sort. */
-	return result;
+  return shouldReadExtendedJSON;
 }
 
-/* Return the size of the arrays's contents (not including
- * its type byte or name.
- */
-size_t bson_get_array_size(cJSON* item)
+/**\brief Call with non-zero value to encode integers that fit in 32 bits as cBSON_Int32.
+  *
+  * By default every integral cJSON_Number is written as an 8-byte
+  * cBSON_Int; with this set, those from INT32_MIN to INT32_MAX take
+  * 4 bytes instead. cJSON_ParseBSON reads either kind as a number.
+  */
+void cJSON_BSON_SetCompactIntegers(int yes)
 {
-  /* arrays are tricky because BSON requires the keys to
-   * be null-terminated, integer-valued strings (e.g., "0",
-   * "1", ..., "42", ...), which vary in length depending
-   * on the size of the array.
-   */
-  size_t numentries = 0;
-  size_t valsize = 5; /* document size + terminator = 5 bytes */
-  cJSON* kid;
-  /* count the number of child items in the array and
-   * calculate the size of the items' values without looking
-   * at their item->string values. This is different than
-   * dictionaries which use item->string as a key.
-   */
-  for (kid = item; kid; kid = kid->next, ++numentries)
-    valsize += bson_get_array_item_size(kid);
-  /* calculate the number of digits in all the keys.
-   * The  first  10 (or fewer) have 1 digit (0-9).
-   *     second  90 (or fewer) have 2 digits (10-99).
-   *      third 900 (or fewer) have 3 digits (100-999).
-   */
-  /* every item has a type-byte plus a null terminator: */
-  size_t keysize = 2 * numentries;
-  size_t ndig = 10;
-  size_t digitc = numentries;
-  do
-  {
-    keysize += digitc;
-    digitc -= (digitc > ndig ? ndig : digitc);
-    ndig *= (ndig == 10 ? 9 : 10);
-  } while (digitc > 0);
-  return keysize + valsize;
-}
-
-/* Return the size of the object's contents (not including
- * its type byte or name.
- */
-size_t bson_get_object_size(cJSON* item)
+  shouldCompactIntegers = yes ? 1 : 0;
+}
+
+/**\brief Returns non-zero when small integers will be encoded as cBSON_Int32.
+  */
+int cJSON_BSON_WillCompactIntegers()
 {
-  size_t numentries = 0;
-  size_t valsize = 4; /* 4 bytes for int32 record size */
-  cJSON* kid;
-  for (kid = item; kid; kid = kid->next, ++numentries)
-    {
-    /* TODO: Generate error when kid->string is NULL */
-    valsize += bson_get_size(kid);
-    }
-  ++valsize; /* null terminator */
-  return valsize;
+  return shouldCompactIntegers;
 }
 
-/* Return the size of an item, including its type byte
- * and "C"-string name.
+/* The encoder walks the cJSON tree on an explicit stack, so nesting
+ * is limited by cJSON_GetNestingLimit() rather than by the C stack.
+ * All output goes through a bson_writer: bytes beyond its capacity
+ * are counted but not stored, so a writer without a buffer measures
+ * an item and the very same walk then encodes it.
+ *
+ * A writer gathering pieces for writev (see cJSON_PrintBSONVec) keeps
+ * large strings where they are: \a len still counts them, while
+ * \a buf only holds the bytes in between, \a skipped fewer.
  */
-size_t bson_get_size(cJSON* item)
+typedef struct bson_gather bson_gather;
+
+typedef struct bson_writer
 {
-  size_t result = 0;
-	if (!item) return result;
-  /* All elements have a type byte plus an optional name
-   * string (which is always terminated): */
-  result = 2 + (item->string ? strlen(item->string) : 0);
-	switch ((item->type)&255)
-	{
-		case cJSON_NULL:	break;
-		case cJSON_False:	++result; break;
-		case cJSON_True:	++result; break;
-		case cJSON_Number: result += sizeof(double); break;
-		case cJSON_String:
-      if (shouldDetectUUIDsInStrings && bson_is_string_uuid(item->valuestring))
-        /* UUIDs are encoded as "binary" data with a subtype.
-         * size(4) + subtype(1) + UUID(16 bytes) */
-        result += 21;
-      else
-        /* UTF-8 strings are preceded by 4 bytes specifying length and
-         * followed by a null-terminator. The length does not include
-         * the item type or itself in the count, but does include the
-         * null terminator. */
-        result += item->valuestring ?
-          strlen(item->valuestring) + 5 : 5;
-      break;
-		case cJSON_Array: result += bson_get_array_size(item->child); break;
-		case cJSON_Object: result += bson_get_object_size(item->child); break;
-	}
-	return result;
+  char* buf;
+  size_t cap;
+  size_t len;
+  size_t skipped;
+  bson_gather* gather;
+} bson_writer;
+
+static void bson_put(bson_writer* w, const void* src, size_t n)
+{
+  if (n && w->len - w->skipped + n <= w->cap)
+    memcpy(w->buf + w->len - w->skipped, src, n);
+  w->len += n;
 }
 
-/* Given an adequately sized buffer, encode the JSON \a item
- * in \a buf as a BSON document.
- */
-char* bson_doc_value(cJSON* item, char* buf, size_t bufsize, ptrdiff_t* idxName)
+static void bson_put_byte(bson_writer* w, char c)
 {
-  char* loc = buf;
-  cJSON* cur;
-  if (bufsize < 5)
-    return NULL;
+  if (w->len - w->skipped < w->cap)
+    w->buf[w->len - w->skipped] = c;
+  ++w->len;
+}
 
-  /* set aside space for the byte count */
-  loc += 4;
-  for (cur = item; cur; cur = cur->next)
+struct bson_gather
+{
+  cBSON_IOVec* vec;  /* NULL while measuring */
+  size_t count;      /* pieces so far */
+  size_t flushed;    /* where in the buffer the next piece starts */
+  size_t minRef;     /* payloads this long or longer are referenced */
+};
+
+/* End the current piece of the buffer, if it has any bytes. */
+static void bson_gather_flush(bson_writer* w)
+{
+  bson_gather* g = w->gather;
+  size_t at = w->len - w->skipped;
+  if (at == g->flushed)
+    return;
+  if (g->vec)
     {
-    size_t delta = loc - buf + 1;
-    if (delta > bufsize)
-      { /* FIXME: error, not enough space. should do something more than this. */
-      continue;
-      }
-    loc += bson_item_value(cur, loc, bufsize - (loc - buf) - 1, idxName);
+    g->vec[g->count].iov_base = w->buf + g->flushed;
+    g->vec[g->count].iov_len = at - g->flushed;
     }
-  /* add null terminator */
-  *loc = 0x00;
-  ++loc;
-  /* go back and record the total size */
-  ((int32_t*)buf)[0] = (int32_t)(loc - buf);
-  /* unlike other XXX_value() methods, return the end pointer */
-  return loc;
+  ++g->count;
+  g->flushed = at;
 }
 
-/* Print the item's name into the buffer at \a buf
- * and return the number of characters used (including
- * the null terminator.
- * If \a idxName is non-NULL, then it is used to generate
- * the name. Otherwise, the item's name is used.
- * A return value of 1 indicates that the item had no name.
- */
-size_t bson_item_name(cJSON* item, char* buf, size_t bufsize, ptrdiff_t* idxName)
+/* Write a string or blob, as a piece of its own if it is large enough. */
+static void bson_put_payload(bson_writer* w, const char* src, size_t n)
 {
-  size_t result = 0;
-  if (idxName)
+  if (!w->gather || n < w->gather->minRef)
     {
-    result = snprintf(buf, bufsize, "%" PRIuPTR, *idxName);
-    if (result > bufsize)
-      result = bufsize - 1; /* Prevent overruns */
-    (*idxName) ++; /* increment the index for the next item. */
+    bson_put(w, src, n);
+    return;
     }
-  if (item->string)
+  bson_gather_flush(w);
+  if (w->gather->vec)
     {
-    result = snprintf(buf, bufsize, "%s", item->string);
-    if (result > bufsize)
-      result = bufsize - 1; /* Prevent overruns */
+    w->gather->vec[w->gather->count].iov_base = (void*)src;
+    w->gather->vec[w->gather->count].iov_len = n;
     }
-  /* always null terminate */
-  buf[result++] = 0x00;
-  return result;
+  ++w->gather->count;
+  w->len += n;
+  w->skipped += n;
 }
 
-int countkids(cJSON* item)
+static void bson_put_int32(bson_writer* w, int32_t val)
 {
-  int c;
-  for (c = 0; item; item = item->next)
-    ++c;
-  return c;
+  bson_put(w, &val, sizeof(val));
 }
 
-/* Given an adequately sized buffer, encode the JSON \a item
- * in \a buf as a BSON subitem.
- * This returns the number of bytes used from the start of
- * \a buf to encode the item.
- */
-size_t bson_item_value(cJSON* item, char* buf, size_t bufsize, ptrdiff_t* idxName)
+/* Fill in a length written earlier as a placeholder. */
+static void bson_patch_int32(bson_writer* w, size_t at, int32_t val)
 {
-  size_t result = 0;
-  if (!item || bufsize < 2)
-    return result;
-  char* loc = buf;
-  switch ((item->type)&0xff)
-    {
-  case cJSON_NULL:
-      {
-      *(loc++) = cBSON_NULL;
-      loc += bson_item_name(item, loc, bufsize - 1, idxName);
-      }
-    break;
-  case cJSON_False:
-      {
-      *(loc++) = cBSON_Bool;
-      loc += bson_item_name(item, loc, bufsize - 1, idxName);
-      *(loc++) = 0x00;
-      }
-    break;
-  case cJSON_True:
-      {
-      *(loc++) = cBSON_Bool;
-      loc += bson_item_name(item, loc, bufsize - 1, idxName);
-      *(loc++) = 0x01;
-      }
-    break;
-  case cJSON_Number:
-      {
-      int isInt = (fmod(item->valuedouble, 1.0) == 0);
-      *(loc++) = isInt ? cBSON_Int : cBSON_Float;
-      loc += bson_item_name(item, loc, bufsize - 1, idxName);
-      if (isInt)
-        { /* item->valueint may only be a 32-bit integer. Promote it. */
-        int64_t tmpVal = item->valueint;
-        *((int64_t*)loc) = tmpVal;
-        }
-      else
-        {
-        *((double*)loc) = item->valuedouble;
-        }
-      loc += sizeof(double);
-      }
-    break;
-  case cJSON_String:
-    if (shouldDetectUUIDsInStrings && bson_is_string_uuid(item->valuestring))
-      {
-      *(loc++) = cBSON_Binary;
-      loc += bson_item_name(item, loc, bufsize - 1, idxName);
-      loc = bson_uuid_value_from_string(loc, item->valuestring);
-      }
-    else
-      {
-      char* lenptr;
-      *(loc++) = cBSON_String;
-      loc += bson_item_name(item, loc, bufsize - 1, idxName);
-      lenptr = loc;
-      loc += 4; /* skip the string length entry */
-      loc = stpncpy(loc, item->valuestring, bufsize - 1);
-      *(loc++) = 0x00;
-      *((int32_t*)lenptr) = loc - (lenptr + 4); /* fill in the string length (inc. terminator) */
-      }
-    break;
-  case cJSON_Array:
-      {
-      ptrdiff_t idx = 0;
-      *(loc++) = cBSON_Array;
-      loc += bson_item_name(item, loc, bufsize - 1, idxName);
-      loc = bson_doc_value(item->child, loc, bufsize - (loc  - buf) - 1, &idx);
-      }
-    break;
-  case cJSON_Object:
-      {
-      /*no gen name*/  *(loc++) = cBSON_Document;
-      loc += bson_item_name(item, loc, bufsize - 1, idxName);
-      loc = bson_doc_value(item->child, loc, bufsize - (loc  - buf) - 1, NULL);
-      }
-    break;
-    }
-  result = loc - buf;
-  return result;
+  if (at + sizeof(val) <= w->cap)
+    memcpy(w->buf + at, &val, sizeof(val));
 }
 
-/* allocate and copy the null-terminated name into \a name_out. */
-char* bson_parse_name(const char* bson, size_t* len)
+/* Lengths of a node's strings, NULs and all (see cJSON_ValueHasLength). */
+static size_t bson_value_length(cJSON* item)
 {
-  return cJSON_strdup(bson, len, 1);
+  return cJSON_GetValueLength(item);
 }
 
-void bson_prepare_uuid(cJSON* node, const char* loc)
+static size_t bson_key_length(cJSON* item)
 {
-  node->type = cJSON_UUID;
-  node->valuestring = cJSON_malloc(16);
-  memcpy(node->valuestring, loc, 16);
+  return cJSON_GetKeyLength(item);
 }
 
-void bson_encode_uuid(cJSON* node, const char* loc)
+/* Write the type byte and null-terminated key of an element.
+ * Array elements are keyed by their position, everything
+ * else by item->string.
+ */
+static void bson_put_key(bson_writer* w, int tag, cJSON* item, size_t* index)
 {
-  node->type = cJSON_String;
-  node->valuestring = cJSON_malloc(37);
-  encode_hex_string((const uint8_t*)loc     , 4, node->valuestring +  0);
-  encode_hex_string((const uint8_t*)loc +  4, 2, node->valuestring +  9);
-  encode_hex_string((const uint8_t*)loc +  6, 2, node->valuestring + 14);
-  encode_hex_string((const uint8_t*)loc +  8, 2, node->valuestring + 19);
-  encode_hex_string((const uint8_t*)loc + 10, 6, node->valuestring + 24);
-  node->valuestring[ 8] = '-';
-  node->valuestring[13] = '-';
-  node->valuestring[18] = '-';
-  node->valuestring[23] = '-';
-  node->valuestring[36] = '\0';
+  bson_put_byte(w, (char)tag);
+  if (index)
+    {
+    char digits[24];
+    size_t pos = sizeof(digits);
+    size_t val = (*index)++;
+    do
+      {
+      digits[--pos] = (char)('0' + val % 10);
+      val /= 10;
+      } while (val);
+    bson_put(w, digits + pos, sizeof(digits) - pos);
+    }
+  else if (item->string)
+    { /* BSON keys are C strings, so a key ends at any embedded NULL */
+    size_t len = bson_key_length(item);
+    const char* nul = (const char*)memchr(item->string, 0, len);
+    bson_put(w, item->string, nul ? (size_t)(nul - item->string) : len);
+    }
+  bson_put_byte(w, 0x00);
 }
 
-void bson_prepare_binary(cJSON* node, const char* loc, size_t bloblen, uint8_t subtype)
+/* Extended JSON input.
+ *
+ * With shouldReadExtendedJSON, an object that is an Extended JSON
+ * wrapper is encoded as the value it wraps. Recognizing one reads
+ * its text (hex, base64, digits or a date), so every walk over the
+ * tree reads it again; only the encoded value is ever stored.
+ */
+typedef struct bson_wrapped
 {
-  node->type = cJSON_Binary;
-  node->valueint = subtype;
-  node->valuestring = cJSON_malloc(bloblen);
-  memcpy(node->valuestring, loc, bloblen);
-}
+  char bytes[16];   /* the value, for those of a fixed size */
+  size_t size;
+  cJSON* text;      /* base64 data, code, a symbol or a regex pattern */
+  cJSON* options;   /* regex options */
+  int subtype;      /* of binary data */
+} bson_wrapped;
 
-void bson_encode_binary(cJSON* node, const char* loc, size_t bloblen, uint8_t subtype)
+/* The member of \a object named \a key, if its type is \a type. */
+static cJSON* bson_wrapped_member(cJSON* object, const char* key, int type)
 {
-  node->type = cJSON_String;
-  node->valuestring = cJSON_malloc(2 * bloblen + 1);
-  node->valueint = subtype;
-  encode_hex_string((const uint8_t*)loc, bloblen, node->valuestring);
-  node->valuestring[2 * bloblen] = '\0';
+  cJSON* child;
+  for (child = object->child; child; child = child->next)
+    if (child->string && !strcmp(child->string, key))
+      return ((child->type)&0xff) == type ? child : NULL;
+  return NULL;
 }
 
-size_t bson_parse_float(const char* bson, size_t remaining, cJSON*** prev)
+/* Whether \a object has exactly \a count members. */
+static int bson_wrapped_count(cJSON* object, int count)
 {
-  (void) remaining;
-  size_t len;
-  char* key = bson_parse_name(bson, &len);
-  const char* loc = bson + len;
-  cJSON* node = cJSON_CreateNumber(*(double*)loc);
-  node->string = key;
-  node->valueint = (int)node->valuedouble;
-  cBSON_LinkSibling(prev, node);
-  return sizeof(double) + loc - bson;
+  cJSON* child;
+  for (child = object->child; child && count > 0; child = child->next)
+    --count;
+  return !child && !count;
 }
 
-size_t bson_parse_string(const char* bson, size_t remaining, cJSON*** prev)
+static int bson_base64_value(int c)
 {
-  (void) remaining;
-  size_t len;
-  char* key = bson_parse_name(bson, &len);
-  const char* loc = bson + len;
-  int32_t slen = *(const int32_t*)loc;
-  loc += 4;
-  /* note that we only handle ASCII, not full UTF-8 strings,
-   * while loc may contain embedded NULLs that are not meant
-   * to be terminators.
-   */
-  cJSON* node = cJSON_CreateString(loc);
-  node->string = key;
-  cBSON_LinkSibling(prev, node);
-  return slen + loc - bson;
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
 }
 
+/* Return the number of bytes the padded base64 \a text of \a len
+ * characters decodes to, or -1 if it is not base64.
+ */
+static ptrdiff_t bson_base64_size(const char* text, size_t len)
+{
+  size_t i, pad = 0;
+  if (len % 4)
+    return -1;
+  if (len && text[len - 1] == '=')
+    pad = text[len - 2] == '=' ? 2 : 1;
+  for (i = 0; i < len - pad; ++i)
+    if (bson_base64_value((unsigned char)text[i]) < 0)
+      return -1;
+  return (ptrdiff_t)(len / 4 * 3 - pad);
+}
 
-size_t bson_parse_document(const char* bson, size_t remaining, cJSON*** prev, int tag)
+/* Write the bytes base64 \a text checked by bson_base64_size decodes to. */
+static void bson_put_base64_decoded(bson_writer* w, const char* text, size_t len, size_t n)
 {
-  (void) remaining;
-  size_t len;
-  char* key = bson_parse_name(bson, &len);
-  const char* loc = bson + len;
-  // peek at the size:
-  int32_t dlen = *(const int32_t*)loc;
-  cJSON* node = bson_parse_doc(
-    loc, (size_t)dlen, tag == cBSON_Array ? cJSON_Array : cJSON_Object);
-  if (node)
+  char* out;
+  size_t i;
+  if (w->len - w->skipped + n > w->cap)
+    { /* measuring */
+    w->len += n;
+    return;
+    }
+  out = w->buf + w->len - w->skipped;
+  w->len += n;
+  for (i = 0; i + 4 <= len; i += 4)
     {
-    node->string = key;
-    cBSON_LinkSibling(prev, node);
+    uint32_t v = (uint32_t)bson_base64_value((unsigned char)text[i]) << 18 |
+      (uint32_t)bson_base64_value((unsigned char)text[i + 1]) << 12;
+    *(out++) = (char)(v >> 16);
+    if (text[i + 2] == '=')
+      break;
+    v |= (uint32_t)bson_base64_value((unsigned char)text[i + 2]) << 6;
+    *(out++) = (char)(v >> 8);
+    if (text[i + 3] == '=')
+      break;
+    v |= (uint32_t)bson_base64_value((unsigned char)text[i + 3]);
+    *(out++) = (char)v;
     }
-  return dlen + (loc - bson); /* skip proper length even if we couldn't read it. */
 }
 
-size_t bson_parse_blob(const char* bson, size_t remaining, cJSON*** prev)
+/* Read a signed decimal integer making up all of \a text. */
+static int bson_wrapped_integer(const char* text, int64_t lo, int64_t hi, int64_t* val)
 {
-  (void) remaining;
-  size_t len;
-  char* key = bson_parse_name(bson, &len);
-
-  /* we will change the node type and contents manually: */
-  cJSON* node = cJSON_CreateNull();
-  node->string = key;
-  cBSON_LinkSibling(prev, node);
+  char* end;
+  long long v;
+  if (!text || !*text || isspace((unsigned char)*text))
+    return 0;
+  errno = 0;
+  v = strtoll(text, &end, 10);
+  if (*end || errno || v < lo || v > hi)
+    return 0;
+  *val = v;
+  return 1;
+}
 
-  const char* loc = bson + len;
-  int32_t bloblen = *(const int32_t*)loc;
-  loc += 4;
-  int subtype = (*(loc++)) & 0xff;
-  switch (subtype)
+/* Read \a count digits at \a *text, moving past them. */
+static int bson_wrapped_digits(const char** text, int count, int* val)
+{
+  *val = 0;
+  for (; count > 0; --count, ++*text)
     {
-  case cBSON_UUID: // yay
-    if (shouldUseExtendedTypes)
-      bson_prepare_uuid(node, loc);
-    else
-      bson_encode_uuid(node, loc);
-    break;
-  case cBSON_Generic:
-  case cBSON_Function:
-  case cBSON_Old:
-  case cBSON_OldUUID:
-  case cBSON_MD5:
-  case cBSON_User:
-  default:
-    if (shouldUseExtendedTypes)
-      bson_prepare_binary(node, loc, bloblen, subtype);
-    else
-      bson_encode_binary(node, loc, bloblen, subtype);
-    break;
+    if (!isdigit((unsigned char)**text))
+      return 0;
+    *val = *val * 10 + (**text - '0');
     }
-
-  return bloblen + loc - bson;
+  return 1;
 }
 
-size_t bson_parse_object_id(const char* bson, size_t remaining, cJSON*** prev)
+/* Read an ISO-8601 date and time, "YYYY-MM-DDTHH:MM:SS[.sss](Z|+HH:MM|+HHMM)",
+ * as milliseconds since the epoch.
+ */
+static int bson_wrapped_iso_date(const char* text, int64_t* ms)
 {
-  (void) bson;
-  (void) remaining;
-  (void) prev;
-  return 0;
+  static const int monthDays[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  int year, month, day, hour, minute, second, millis = 0, scale = 100, offset = 0;
+  int64_t y, era, yoe, doy, doe, days;
+  if (!bson_wrapped_digits(&text, 4, &year) || *(text++) != '-' ||
+    !bson_wrapped_digits(&text, 2, &month) || *(text++) != '-' ||
+    !bson_wrapped_digits(&text, 2, &day) || *(text++) != 'T' ||
+    !bson_wrapped_digits(&text, 2, &hour) || *(text++) != ':' ||
+    !bson_wrapped_digits(&text, 2, &minute) || *(text++) != ':' ||
+    !bson_wrapped_digits(&text, 2, &second))
+    return 0;
+  if (*text == '.')
+    for (++text; isdigit((unsigned char)*text); ++text, scale /= 10)
+      millis += (*text - '0') * scale;
+  if (*text == '+' || *text == '-')
+    {
+    int sign = *(text++) == '-' ? -1 : 1, oh, om;
+    if (!bson_wrapped_digits(&text, 2, &oh))
+      return 0;
+    if (*text == ':')
+      ++text;
+    if (!bson_wrapped_digits(&text, 2, &om) || oh > 23 || om > 59)
+      return 0;
+    offset = sign * (oh * 60 + om);
+    }
+  else if (*(text++) != 'Z')
+    return 0;
+  if (*text || month < 1 || month > 12 || day < 1 || day > monthDays[month - 1] ||
+    (month == 2 && day == 29 && (year % 4 || (year % 100 == 0 && year % 400))) ||
+    hour > 23 || minute > 59 || second > 60)
+    return 0;
+  /* a civil date to days since the epoch (Howard Hinnant's algorithm) */
+  y = year - (month <= 2);
+  era = y / 400;
+  yoe = y - era * 400;
+  doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  days = era * 146097 + doe - 719468;
+  *ms = ((days * 24 + hour) * 60 + minute - offset) * 60000 + second * 1000 + millis;
+  return 1;
 }
 
-size_t bson_parse_bool(const char* bson, size_t remaining, cJSON*** prev)
+/* Whether \a text is \a word, ignoring case. */
+static int bson_wrapped_word(const char* text, const char* word)
 {
-  (void) remaining;
-  size_t len;
-  char* key = bson_parse_name(bson, &len);
-  const char* loc = bson + len;
-  cJSON* node = (*(loc++) ? cJSON_CreateTrue() : cJSON_CreateFalse());
-  node->string = key;
-  cBSON_LinkSibling(prev, node);
-  return loc - bson;
+  for (; *text && tolower((unsigned char)*text) == *word; ++text, ++word)
+    ;
+  return !*text && !*word;
 }
 
-size_t bson_parse_int(const char* bson, size_t remaining, cJSON*** prev)
+/* Read the text of a Decimal128 into its 16 bytes, or return 0 if it
+ * is not one or could only be stored rounded.
+ */
+static int bson_wrapped_decimal128(const char* text, char* bytes)
 {
-  (void) remaining;
-  size_t len;
-  char* key = bson_parse_name(bson, &len);
-  const char* loc = bson + len;
-  int64_t val = *(int64_t*)loc;
-  cJSON* node = cJSON_CreateNumber((double)val);
-  node->string = key;
-  node->valueint = (int)val; /* overwrite cJSON-double-cast with exact value */
-  cBSON_LinkSibling(prev, node);
-  return sizeof(int64_t) + loc - bson;
+  uint64_t hi = 0, lo = 0;
+  char digits[34];
+  int ndigits = 0, exponent = 0, sawDigit = 0, sawPoint = 0, dropped = 0, i;
+  const char* p = text;
+  if (*p == '-' || *p == '+')
+    ++p;
+  if (bson_wrapped_word(p, "nan") || bson_wrapped_word(p, "infinity") || bson_wrapped_word(p, "inf"))
+    {
+    hi = (uint64_t)((*p == 'n' || *p == 'N') ? 0x1f : 0x1e) << 58;
+    if (*text == '-' && (*p == 'i' || *p == 'I'))
+      hi |= UINT64_C(1) << 63;
+    memcpy(bytes, &lo, 8);
+    memcpy(bytes + 8, &hi, 8);
+    return 1;
+    }
+  for (; isdigit((unsigned char)*p) || (*p == '.' && !sawPoint); ++p)
+    {
+    if (*p == '.')
+      {
+      sawPoint = 1;
+      continue;
+      }
+    sawDigit = 1;
+    if (sawPoint)
+      --exponent;
+    if (!ndigits && *p == '0')
+      continue; /* leading zeros */
+    if (ndigits < 34)
+      digits[ndigits++] = *p;
+    else if (*p == '0')
+      ++dropped; /* trailing zeros past the precision, dropped if the exponent allows */
+    else
+      return 0;
+    }
+  exponent += dropped;
+  if (!sawDigit)
+    return 0;
+  if (*p == 'e' || *p == 'E')
+    {
+    int64_t e;
+    char* end;
+    errno = 0;
+    e = strtol(p + 1, &end, 10);
+    if (end == p + 1 || *end || errno || e < -100000 || e > 100000)
+      return 0;
+    exponent += (int)e;
+    }
+  else if (*p)
+    return 0;
+  /* clamp: drop trailing zeros while the exponent is too small, pad while it is too large */
+  while (exponent < -6176 && ndigits && digits[ndigits - 1] == '0')
+    --ndigits, ++exponent;
+  if (!ndigits)
+    exponent = exponent < -6176 ? -6176 : exponent > 6111 ? 6111 : exponent;
+  while (exponent > 6111 && ndigits < 34)
+    digits[ndigits++] = '0', --exponent;
+  if (exponent < -6176 || exponent > 6111)
+    return 0;
+  for (i = 0; i < ndigits; ++i)
+    { /* (hi, lo) = (hi, lo) * 10 + digit */
+    uint64_t loLo = (lo & 0xffffffff) * 10 + (uint64_t)(digits[i] - '0');
+    uint64_t loHi = (lo >> 32) * 10 + (loLo >> 32);
+    lo = (loHi << 32) | (loLo & 0xffffffff);
+    hi = hi * 10 + (loHi >> 32);
+    }
+  hi |= (uint64_t)(exponent + 6176) << 49;
+  if (*text == '-')
+    hi |= UINT64_C(1) << 63;
+  memcpy(bytes, &lo, 8);
+  memcpy(bytes + 8, &hi, 8);
+  return 1;
+}
+
+/* Return the BSON tag the Extended JSON wrapper \a item stands for,
+ * filling in \a v, or 0 if it is not one.
+ */
+static int bson_wrapped_read(cJSON* item, bson_wrapped* v)
+{
+  cJSON* member = item->child;
+  const char* key;
+  int64_t val;
+  if (!member || member->next || !member->string || member->string[0] != '$')
+    return 0;
+  key = member->string + 1;
+  switch ((member->type)&0xff)
+    {
+  case cJSON_String:
+    if (!strcmp(key, "oid"))
+      {
+      size_t i;
+      if (bson_value_length(member) != 24)
+        return 0;
+      for (i = 0; i < 24; ++i)
+        if (!isxdigit((unsigned char)member->valuestring[i]))
+          return 0;
+      decode_hex_string(member->valuestring, 24, (uint8_t*)v->bytes);
+      v->size = 12;
+      return cBSON_ObjectId;
+      }
+    if (!strcmp(key, "numberLong") || !strcmp(key, "numberInt"))
+      {
+      int wide = key[6] == 'L';
+      int32_t narrow;
+      if (!bson_wrapped_integer(member->valuestring, wide ? INT64_MIN : INT32_MIN, wide ? INT64_MAX : INT32_MAX, &val))
+        return 0;
+      narrow = (int32_t)val;
+      v->size = wide ? 8 : 4;
+      memcpy(v->bytes, wide ? (void*)&val : (void*)&narrow, v->size);
+      return wide ? cBSON_Int : cBSON_Int32;
+      }
+    if (!strcmp(key, "numberDouble"))
+      {
+      double d;
+      char* end;
+      const char* text = member->valuestring;
+      if (!strcmp(text, "Infinity") || !strcmp(text, "-Infinity"))
+        d = text[0] == '-' ? -HUGE_VAL : HUGE_VAL;
+      else if (!strcmp(text, "NaN"))
+        d = NAN;
+      else if (!*text || text[strspn(text, "0123456789+-.eE")] || (d = strtod(text, &end), *end))
+        return 0; /* only decimal numbers are spelled out */
+      memcpy(v->bytes, &d, 8);
+      v->size = 8;
+      return cBSON_Float;
+      }
+    if (!strcmp(key, "numberDecimal"))
+      {
+      if (!bson_wrapped_decimal128(member->valuestring, v->bytes))
+        return 0;
+      v->size = 16;
+      return cBSON_Decimal128;
+      }
+    if (!strcmp(key, "date"))
+      {
+      if (!bson_wrapped_iso_date(member->valuestring, &val))
+        return 0;
+      memcpy(v->bytes, &val, 8);
+      v->size = 8;
+      return cBSON_UTC_Time;
+      }
+    if (!strcmp(key, "code") || !strcmp(key, "symbol"))
+      {
+      v->text = member;
+      return key[0] == 'c' ? cBSON_JS_Code : cBSON_Deprecated;
+      }
+    return 0;
+  case cJSON_Object:
+    if (!strcmp(key, "date"))
+      { /* {"$date": {"$numberLong": "..."}} */
+      bson_wrapped inner;
+      if (bson_wrapped_read(member, &inner) != cBSON_Int)
+        return 0;
+      memcpy(v->bytes, inner.bytes, 8);
+      v->size = 8;
+      return cBSON_UTC_Time;
+      }
+    if (!strcmp(key, "binary"))
+      {
+      cJSON* type = bson_wrapped_member(member, "subType", cJSON_String);
+      char* end;
+      long subtype;
+      if (!bson_wrapped_count(member, 2) || !type ||
+        !(v->text = bson_wrapped_member(member, "base64", cJSON_String)) ||
+        bson_base64_size(v->text->valuestring, bson_value_length(v->text)) < 0 ||
+        !isxdigit((unsigned char)type->valuestring[0]) || bson_value_length(type) > 2 ||
+        (subtype = strtol(type->valuestring, &end, 16), *end))
+        return 0;
+      v->subtype = (int)subtype;
+      return cBSON_Binary;
+      }
+    if (!strcmp(key, "timestamp"))
+      {
+      cJSON* t = bson_wrapped_member(member, "t", cJSON_Number);
+      cJSON* i = bson_wrapped_member(member, "i", cJSON_Number);
+      uint32_t words[2];
+      if (!bson_wrapped_count(member, 2) || !t || !i ||
+        t->valuedouble < 0 || t->valuedouble > 4294967295.0 || fmod(t->valuedouble, 1.0) != 0 ||
+        i->valuedouble < 0 || i->valuedouble > 4294967295.0 || fmod(i->valuedouble, 1.0) != 0)
+        return 0;
+      words[0] = (uint32_t)i->valuedouble; /* the increment comes first */
+      words[1] = (uint32_t)t->valuedouble;
+      memcpy(v->bytes, words, 8);
+      v->size = 8;
+      return cBSON_Timestamp;
+      }
+    if (!strcmp(key, "regularExpression"))
+      {
+      if (!bson_wrapped_count(member, 2) ||
+        !(v->text = bson_wrapped_member(member, "pattern", cJSON_String)) ||
+        !(v->options = bson_wrapped_member(member, "options", cJSON_String)) ||
+        strlen(v->text->valuestring) != bson_value_length(v->text) ||
+        strlen(v->options->valuestring) != bson_value_length(v->options))
+        return 0; /* stored as C strings */
+      return cBSON_Regex;
+      }
+    return 0;
+  case cJSON_Number:
+    if (!strcmp(key, "date") && fmod(member->valuedouble, 1.0) == 0 &&
+      member->valuedouble >= -9.2e18 && member->valuedouble <= 9.2e18)
+      { /* the legacy relaxed form */
+      val = (int64_t)member->valuedouble;
+      memcpy(v->bytes, &val, 8);
+      v->size = 8;
+      return cBSON_UTC_Time;
+      }
+    v->size = 0;
+    return member->valuedouble == 1 && !strcmp(key, "minKey") ? cBSON_Min_Key :
+      member->valuedouble == 1 && !strcmp(key, "maxKey") ? cBSON_Max_Key : 0;
+  case cJSON_True:
+    v->size = 0;
+    return !strcmp(key, "undefined") ? cBSON_Undefined : 0;
+    }
+  return 0;
+}
+
+/* Write the value of an Extended JSON wrapper. */
+static void bson_put_wrapped(bson_writer* w, cJSON* item)
+{
+  bson_wrapped v;
+  size_t len;
+  switch (bson_wrapped_read(item, &v))
+    {
+  case cBSON_Binary:
+    len = bson_value_length(v.text);
+    bson_put_int32(w, (int32_t)bson_base64_size(v.text->valuestring, len));
+    bson_put_byte(w, (char)v.subtype);
+    bson_put_base64_decoded(w, v.text->valuestring, len, (size_t)bson_base64_size(v.text->valuestring, len));
+    break;
+  case cBSON_JS_Code:
+  case cBSON_Deprecated:
+    len = bson_value_length(v.text);
+    bson_put_int32(w, (int32_t)(len + 1));
+    bson_put_payload(w, v.text->valuestring, len);
+    bson_put_byte(w, 0x00);
+    break;
+  case cBSON_Regex:
+    bson_put(w, v.text->valuestring, bson_value_length(v.text));
+    bson_put_byte(w, 0x00);
+    bson_put(w, v.options->valuestring, bson_value_length(v.options));
+    bson_put_byte(w, 0x00);
+    break;
+  default:
+    bson_put(w, v.bytes, v.size);
+    break;
+    }
+}
+
+/* Return the BSON tag \a item is encoded with, or 0 if it is not encoded. */
+static int bson_item_tag(cJSON* item)
+{
+  bson_wrapped v;
+  int tag;
+  switch ((item->type)&0xff)
+    {
+  case cJSON_NULL:   return cBSON_NULL;
+  case cJSON_False:
+  case cJSON_True:   return cBSON_Bool;
+  case cJSON_Number:
+    /* integral values an int64 can hold are integers, except -0, whose sign only a double keeps */
+    if (fmod(item->valuedouble, 1.0) != 0 || item->valuedouble < -9223372036854775808.0 ||
+      item->valuedouble >= 9223372036854775808.0 || (item->valuedouble == 0 && signbit(item->valuedouble)))
+      return cBSON_Float;
+    return shouldCompactIntegers && item->valuedouble >= INT32_MIN && item->valuedouble <= INT32_MAX ?
+      cBSON_Int32 : cBSON_Int;
+  case cJSON_String:
+    return shouldDetectUUIDsInStrings && bson_value_length(item) == 36 &&
+      bson_is_string_uuid(item->valuestring) ? cBSON_Binary : cBSON_String;
+  case cJSON_Array:  return cBSON_Array;
+  case cJSON_Object:
+    return shouldReadExtendedJSON && (tag = bson_wrapped_read(item, &v)) ? tag : cBSON_Document;
+  case cJSON_Int32:  return cBSON_Int32;
+  case cJSON_Binary: return cBSON_Binary;
+  /* extended types holding their bytes, when there are the right number */
+  case cJSON_UUID:       return bson_value_length(item) == 16 ? cBSON_Binary : 0;
+  case cJSON_ObjectId:   return bson_value_length(item) == 12 ? cBSON_ObjectId : 0;
+  case cJSON_UTCTime:    return bson_value_length(item) == 8 ? cBSON_UTC_Time : 0;
+  case cJSON_Timestamp:  return bson_value_length(item) == 8 ? cBSON_Timestamp : 0;
+  case cJSON_Decimal128: return bson_value_length(item) == 16 ? cBSON_Decimal128 : 0;
+    }
+  /* TODO: Generate error of some sort. */
+  return 0;
+}
+
+/* Write the value (not the type byte or name) of an item
+ * that is neither an array nor an object.
+ */
+static void bson_put_scalar(bson_writer* w, cJSON* item, int tag)
+{
+  if (((item->type)&0xff) == cJSON_Object)
+    {
+    bson_put_wrapped(w, item);
+    return;
+    }
+  switch (tag)
+    {
+  case cBSON_NULL:
+    break;
+  case cBSON_Bool:
+    bson_put_byte(w, ((item->type)&0xff) == cJSON_True ? 0x01 : 0x00);
+    break;
+  case cBSON_Int:
+      { /* item->valueint may only be a 32-bit integer (clipped or worse), so use the double */
+      int64_t tmpVal = (int64_t)item->valuedouble;
+      bson_put(w, &tmpVal, sizeof(tmpVal));
+      }
+    break;
+  case cBSON_Float:
+    bson_put(w, &item->valuedouble, sizeof(double));
+    break;
+  case cBSON_Int32:
+      { /* a cJSON_Int32, or a small cJSON_Number */
+      int32_t tmpVal = ((item->type)&0xff) == cJSON_Number ? (int32_t)item->valuedouble : item->valueint;
+      bson_put(w, &tmpVal, sizeof(tmpVal));
+      }
+    break;
+  case cBSON_ObjectId:
+  case cBSON_UTC_Time:
+  case cBSON_Timestamp:
+  case cBSON_Decimal128: /* stored as they are encoded */
+    bson_put(w, item->valuestring, bson_value_length(item));
+    break;
+  case cBSON_Binary:
+    if (((item->type)&0xff) == cJSON_String)
+      { /* a UUID in its text form */
+      char uuid[21];
+      bson_uuid_value_from_string(uuid, item->valuestring);
+      bson_put(w, uuid, sizeof(uuid));
+      }
+    else
+      { /* cJSON_Binary or cJSON_UUID, holding the data itself */
+      size_t len = bson_value_length(item);
+      bson_put_int32(w, (int32_t)len);
+      bson_put_byte(w, (char)(((item->type)&0xff) == cJSON_UUID ? cBSON_UUID : item->valueint));
+      bson_put_payload(w, item->valuestring, len);
+      }
+    break;
+  case cBSON_String:
+      { /* the length includes the null terminator */
+      size_t len = bson_value_length(item);
+      bson_put_int32(w, (int32_t)(len + 1));
+      bson_put_payload(w, item->valuestring, len);
+      bson_put_byte(w, 0x00);
+      }
+    break;
+    }
+}
+
+/* An encode cache keeps the encodings of arrays and objects, looked
+ * up by the frozen item each one shares (see cJSON_Snapshot): what
+ * a frozen item holds never changes, so neither does its encoding,
+ * and an array or object still sharing one is known to be unchanged
+ * without looking inside it. cJSON_PrintBSONCached snapshots the tree
+ * before encoding it, so the arrays and objects that were thawed to be
+ * changed are the only ones not found. An entry holds a copy of its
+ * item, so the item can't be freed and its address reused while the
+ * entry is kept; entries nothing else holds on to any more are swept
+ * out once the entries or their bytes have doubled.
+ */
+typedef struct bson_cache_entry
+{
+  const cJSON* key;  /* the frozen array or object */
+  cJSON* hold;       /* a copy of it, keeping it alive */
+  char* bytes;
+  size_t size;
+} bson_cache_entry;
+
+struct cBSON_EncodeCache
+{
+  bson_cache_entry* slots;
+  size_t mask;
+  size_t count;
+  size_t bytes;      /* held by the entries */
+  size_t swept;      /* entries left by the last sweep */
+  size_t sweptBytes; /* and their bytes */
+  int detectUUIDs;   /* the settings the entries were encoded with */
+  int readExtendedJSON;
+  int compactIntegers;
+};
+
+/* Smaller values are encoded again rather than kept. */
+#define bson_cache_min 64
+
+static size_t bson_cache_hash(const cJSON* key)
+{
+  uint64_t h = (uint64_t)(uintptr_t)key * 0x9e3779b97f4a7c15ULL;
+  return (size_t)(h ^ (h >> 32));
+}
+
+static bson_cache_entry* bson_cache_find(cBSON_EncodeCache* cache, const cJSON* key)
+{
+  size_t i;
+  for (i = bson_cache_hash(key) & cache->mask; cache->slots[i].key; i = (i + 1) & cache->mask)
+    if (cache->slots[i].key == key)
+      return cache->slots + i;
+  return NULL;
+}
+
+/* The frozen item whose encoding stands for that of \a item, or
+ * NULL if it is not frozen and shares none.
+ */
+static const cJSON* bson_cache_key(const cJSON* item)
+{
+  if (item->shared)
+    return item->shared;
+  return *(const volatile int*)&item->refcount > 0 ? item : NULL;
+}
+
+static void bson_cache_drop(cBSON_EncodeCache* cache, bson_cache_entry* e)
+{
+  cache->bytes -= e->size;
+  cJSON_free(e->bytes);
+  cJSON_Delete(e->hold);
+}
+
+/* Move the entries into a table with \a mask + 1 slots, dropping
+ * those whose item only the entry still holds when \a sweep is
+ * non-zero.
+ */
+static int bson_cache_rebuild(cBSON_EncodeCache* cache, size_t mask, int sweep)
+{
+  bson_cache_entry* slots = (bson_cache_entry*)cJSON_malloc((mask + 1) * sizeof(bson_cache_entry));
+  size_t i, j;
+  if (!slots)
+    return 0;
+  memset(slots, 0, (mask + 1) * sizeof(bson_cache_entry));
+  cache->count = 0;
+  for (i = 0; i <= cache->mask; ++i)
+    {
+    bson_cache_entry* e = cache->slots + i;
+    if (!e->key)
+      continue;
+    if (sweep && *(const volatile int*)&e->key->refcount <= 1)
+      {
+      bson_cache_drop(cache, e);
+      continue;
+      }
+    for (j = bson_cache_hash(e->key) & mask; slots[j].key; j = (j + 1) & mask)
+      ;
+    slots[j] = *e;
+    ++cache->count;
+    }
+  cJSON_free(cache->slots);
+  cache->slots = slots;
+  cache->mask = mask;
+  return 1;
+}
+
+/* Keep the encoding of the frozen \a key, if it is worth it. */
+static void bson_cache_store(cBSON_EncodeCache* cache, const cJSON* key, const char* bytes, size_t size)
+{
+  bson_cache_entry* e;
+  cJSON* hold;
+  char* copy;
+  size_t i;
+  if (size < bson_cache_min || bson_cache_find(cache, key))
+    return;
+  if (2 * (cache->count + 1) > cache->mask && !bson_cache_rebuild(cache, 2 * cache->mask + 1, 0))
+    return;
+  if (!(copy = (char*)cJSON_malloc(size)))
+    return;
+  if (!(hold = cJSON_Share((cJSON*)key)))
+    {
+    cJSON_free(copy);
+    return;
+    }
+  memcpy(copy, bytes, size);
+  for (i = bson_cache_hash(key) & cache->mask; cache->slots[i].key; i = (i + 1) & cache->mask)
+    ;
+  e = cache->slots + i;
+  ++cache->count;
+  e->key = key;
+  e->hold = hold;
+  e->bytes = copy;
+  e->size = size;
+  cache->bytes += size;
+}
+
+typedef struct bson_frame
+{
+  cJSON* next;   /* the next item of this document to encode */
+  size_t start;  /* offset of the document's length */
+  size_t at;     /* where that is in the buffer (see bson_writer) */
+  size_t index;  /* key of the next array element */
+  int isArray;
+  const cJSON* key; /* the frozen item to cache the encoding under */
+} bson_frame;
+
+typedef struct bson_stack
+{
+  bson_frame local[16];
+  bson_frame* frames;
+  int depth;
+  int capacity;
+  cBSON_EncodeCache* cache;
+} bson_stack;
+
+/* Return a stack of frames (which start out in \a local) with
+ * room for one more above \a depth, moving it to a larger heap
+ * block if need be. Returns NULL, leaving the stack as it was,
+ * if that would nest too deeply or memory runs out.
+ */
+static void* bson_stack_grow(void* frames, void* local, int depth, int* capacity, size_t frameSize)
+{
+  void* grown;
+  if (depth >= cJSON_GetNestingLimit())
+    return NULL;
+  if (depth < *capacity)
+    return frames;
+  if (!(grown = cJSON_malloc(2 * (*capacity) * frameSize)))
+    return NULL;
+  memcpy(grown, frames, depth * frameSize);
+  if (frames != local)
+    cJSON_free(frames);
+  *capacity *= 2;
+  return grown;
+}
+
+/* Open a document holding the chain starting at \a first.
+ * Returns 0 if that would nest too deeply (or memory runs out).
+ */
+static int bson_open_doc(bson_stack* stack, bson_writer* w, cJSON* first, int isArray)
+{
+  bson_frame* frame;
+  bson_frame* frames = (bson_frame*)bson_stack_grow(
+    stack->frames, stack->local, stack->depth, &stack->capacity, sizeof(bson_frame));
+  if (!frames)
+    return 0;
+  stack->frames = frames;
+  frame = stack->frames + stack->depth++;
+  frame->next = first;
+  frame->start = w->len;
+  frame->at = w->len - w->skipped;
+  frame->index = 0;
+  frame->isArray = isArray;
+  frame->key = NULL;
+  bson_put_int32(w, 0); /* set aside space for the byte count */
+  return 1;
+}
+
+/* Encode the chain of items starting at \a first as a BSON
+ * document, keyed by position when \a isArray is non-zero.
+ * With a \a cache, arrays and objects that share a frozen item
+ * with an entry are copied from it, and the rest are added once
+ * written. Returns 0 when the items nest more deeply than allowed.
+ */
+static int bson_write_cached(cJSON* first, int isArray, bson_writer* w, cBSON_EncodeCache* cache)
+{
+  bson_stack stack;
+  bson_cache_entry* hit;
+  const cJSON* key;
+  int ok = 1;
+  stack.frames = stack.local;
+  stack.depth = 0;
+  stack.capacity = sizeof(stack.local) / sizeof(stack.local[0]);
+  stack.cache = cache;
+  bson_open_doc(&stack, w, first, isArray);
+  while (ok && stack.depth > 0)
+    {
+    bson_frame* frame = stack.frames + stack.depth - 1;
+    cJSON* item = frame->next;
+    int tag;
+    if (!item)
+      { /* add null terminator and go back to record the total size */
+      bson_put_byte(w, 0x00);
+      bson_patch_int32(w, frame->at, (int32_t)(w->len - frame->start));
+      if (--stack.depth > 0 && frame->key && w->buf && w->len <= w->cap)
+        bson_cache_store(cache, frame->key, w->buf + frame->at, w->len - frame->start);
+      continue;
+      }
+    frame->next = item->next;
+    if (!(tag = bson_item_tag(item)))
+      continue;
+    bson_put_key(w, tag, item, frame->isArray ? &frame->index : NULL);
+    if (tag != cBSON_Array && tag != cBSON_Document)
+      bson_put_scalar(w, item, tag);
+    else if (!cache || !(key = bson_cache_key(item)))
+      ok = bson_open_doc(&stack, w, item->child, tag == cBSON_Array);
+    else if ((hit = bson_cache_find(cache, key)))
+      bson_put(w, hit->bytes, hit->size);
+    else if ((ok = bson_open_doc(&stack, w, item->child, tag == cBSON_Array)))
+      stack.frames[stack.depth - 1].key = key;
+    }
+  if (stack.frames != stack.local)
+    cJSON_free(stack.frames);
+  return ok;
+}
+
+static int bson_write_doc(cJSON* first, int isArray, bson_writer* w)
+{
+  return bson_write_cached(first, isArray, w, NULL);
+}
+
+/* Write the value (not the type byte or name) of any item. */
+static int bson_write_value(cJSON* item, int tag, bson_writer* w)
+{
+  if (tag == cBSON_Array || tag == cBSON_Document)
+    return bson_write_doc(item->child, tag == cBSON_Array, w);
+  bson_put_scalar(w, item, tag);
+  return 1;
+}
+
+/* Return the size of the item treating it as the top-level
+ * entry in a BSON document.
+ */
+size_t bson_get_doc_size(cJSON* item)
+{
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  return bson_write_doc(item->child, 0, &w) ? w.len : 0;
+}
+
+/* Return the size of an item's contents (not including
+ * its type byte or name.
+ */
+size_t bson_get_array_item_size(cJSON* item)
+{
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  int tag;
+  if (!item || !(tag = bson_item_tag(item)))
+    return 0;
+  return bson_write_value(item, tag, &w) ? w.len : 0;
+}
+
+/* Return the size of the array document holding the chain
+ * of items starting at \a item.
+ */
+size_t bson_get_array_size(cJSON* item)
+{
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  return bson_write_doc(item, 1, &w) ? w.len : 0;
+}
+
+/* Return the size of the document holding the chain
+ * of items starting at \a item.
+ */
+size_t bson_get_object_size(cJSON* item)
+{
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  return bson_write_doc(item, 0, &w) ? w.len : 0;
+}
+
+/* Return the size of an item, including its type byte
+ * and "C"-string name.
+ */
+size_t bson_get_size(cJSON* item)
+{
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  int tag;
+  if (!item || !(tag = bson_item_tag(item)))
+    return 0;
+  bson_put_key(&w, tag, item, NULL);
+  return bson_write_value(item, tag, &w) ? w.len : 0;
+}
+
+/* Encode the JSON \a item (and its siblings) in \a buf as a
+ * BSON document, keyed by position if \a idxName is non-NULL.
+ * Returns the end pointer, or NULL if \a buf is too small.
+ */
+char* bson_doc_value(cJSON* item, char* buf, size_t bufsize, ptrdiff_t* idxName)
+{
+  bson_writer w = { buf, bufsize, 0, 0, NULL };
+  if (bufsize < 5 || !bson_write_doc(item, idxName != NULL, &w) || w.len > bufsize)
+    return NULL;
+  return buf + w.len;
+}
+
+/* Print the item's name into the buffer at \a buf
+ * and return the number of characters used (including
+ * the null terminator.
+ * If \a idxName is non-NULL, then it is used to generate
+ * the name. Otherwise, the item's name is used.
+ * A return value of 1 indicates that the item had no name.
+ */
+size_t bson_item_name(cJSON* item, char* buf, size_t bufsize, ptrdiff_t* idxName)
+{
+  size_t result = 0;
+  if (idxName)
+    {
+    result = snprintf(buf, bufsize, "%" PRIuPTR, *idxName);
+    if (result > bufsize)
+      result = bufsize - 1; /* Prevent overruns */
+    (*idxName) ++; /* increment the index for the next item. */
+    }
+  if (item->string)
+    {
+    result = snprintf(buf, bufsize, "%s", item->string);
+    if (result > bufsize)
+      result = bufsize - 1; /* Prevent overruns */
+    }
+  /* always null terminate */
+  buf[result++] = 0x00;
+  return result;
+}
+
+int countkids(cJSON* item)
+{
+  int c;
+  for (c = 0; item; item = item->next)
+    ++c;
+  return c;
+}
+
+/* Encode the JSON \a item in \a buf as a BSON subitem.
+ * This returns the number of bytes used from the start of
+ * \a buf to encode the item, or 0 if it did not fit.
+ */
+size_t bson_item_value(cJSON* item, char* buf, size_t bufsize, ptrdiff_t* idxName)
+{
+  bson_writer w = { buf, bufsize, 0, 0, NULL };
+  size_t index;
+  int tag;
+  if (!item || bufsize < 2 || !(tag = bson_item_tag(item)))
+    return 0;
+  if (idxName)
+    {
+    index = (size_t)(*idxName)++;
+    bson_put_key(&w, tag, item, item->string ? NULL : &index);
+    }
+  else
+    bson_put_key(&w, tag, item, NULL);
+  if (!bson_write_value(item, tag, &w) || w.len > bufsize)
+    return 0;
+  return w.len;
+}
+
+/**\brief Encode \a item as a single element of an enclosing document.
+  *
+  * The element is the type byte, the key (item->string, or \a index
+  * in decimal when the item has no name, as for array elements) and
+  * the value. Writing elements one after another between a length
+  * and a null terminator builds a document without holding it all
+  * in memory. Free the result with cJSON_DeleteBSON.
+  * Returns NULL, with *bufSizeOut set to 0, if the item cannot be
+  * encoded.
+  */
+char* cJSON_PrintBSONElement(cJSON* item, size_t index, size_t* bufSizeOut)
+{
+  char small[256];
+  char* bsonVal;
+  size_t bsonSize;
+  size_t written = cJSON_PrintBSONElementInto(item, index, small, sizeof(small), &bsonSize);
+  *bufSizeOut = 0;
+  if (!bsonSize || !(bsonVal = (char*) cJSON_malloc(bsonSize)))
+    return NULL; /* nested too deeply, or out of memory */
+  if (written)
+    memcpy(bsonVal, small, bsonSize);
+  else
+    cJSON_PrintBSONElementInto(item, index, bsonVal, bsonSize, &bsonSize);
+  *bufSizeOut = bsonSize;
+  return bsonVal;
+}
+
+/**\brief Encode \a item as cJSON_PrintBSONElement does, into the \a cap bytes at \a buf.
+  *
+  * Returns and reports sizes as cJSON_PrintBSONInto does.
+  */
+size_t cJSON_PrintBSONElementInto(cJSON* item, size_t index, char* buf, size_t cap, size_t* needed)
+{
+  bson_writer w = { buf, buf ? cap : 0, 0, 0, NULL };
+  int tag;
+  *needed = 0;
+  if (!item || !(tag = bson_item_tag(item)))
+    return 0;
+  bson_put_key(&w, tag, item, item->string ? NULL : &index);
+  if (!bson_write_value(item, tag, &w))
+    return 0; /* nested too deeply (or out of memory) */
+  *needed = w.len;
+  return w.len <= w.cap ? w.len : 0;
+}
+
+/**\brief Encode \a item into the \a cap bytes at \a buf, allocating nothing.
+  *
+  * This is cJSON_PrintBSON for memory the caller already has, such
+  * as an array on the stack or a slot in a ring buffer. The whole
+  * encoding takes a single walk over \a item. Returns its size, or 0
+  * if it did not fit (leaving \a buf holding a partial encoding) or
+  * \a item cannot be encoded. Either way the size needed is put in
+  * \a needed, which is 0 only if \a item cannot be encoded.
+  */
+size_t cJSON_PrintBSONInto(cJSON* item, char* buf, size_t cap, size_t* needed)
+{
+  bson_writer w = { buf, buf ? cap : 0, 0, 0, NULL };
+  *needed = 0;
+  if (!item || !bson_write_doc(item->child, ((item->type)&0xff) == cJSON_Array, &w))
+    return 0; /* nested too deeply (or out of memory) */
+  *needed = w.len;
+  return w.len <= w.cap ? w.len : 0;
+}
+
+/* A buffer kept from one encoding to the next. */
+struct cBSON_Encoder
+{
+  char* buf;
+  size_t cap;
+};
+
+/**\brief Create an encoder for cJSON_PrintBSONWith.
+  */
+cBSON_Encoder* cBSON_CreateEncoder(void)
+{
+  cBSON_Encoder* enc = (cBSON_Encoder*)cJSON_malloc(sizeof(cBSON_Encoder));
+  if (!enc)
+    return NULL;
+  enc->buf = NULL;
+  enc->cap = 0;
+  return enc;
+}
+
+/**\brief Deallocate an encoder and its buffer.
+  */
+void cBSON_DeleteEncoder(cBSON_Encoder* enc)
+{
+  if (!enc)
+    return;
+  cJSON_free(enc->buf);
+  cJSON_free(enc);
+}
+
+/**\brief Encode \a item as cJSON_PrintBSON does, into a buffer \a enc keeps.
+  *
+  * The buffer only grows (to twice its size, or to fit if more), so
+  * once it has room for the documents being encoded, each call is a
+  * single walk over \a item and allocates nothing. The result belongs
+  * to \a enc and stays valid until its next use; do not free it.
+  * Returns NULL if \a item is nested too deeply or memory runs out.
+  */
+const char* cJSON_PrintBSONWith(cBSON_Encoder* enc, cJSON* item, size_t* bufSizeOut)
+{
+  size_t needed;
+  *bufSizeOut = 0;
+  if (!enc)
+    return NULL;
+  if (!cJSON_PrintBSONInto(item, enc->buf, enc->cap, &needed))
+    {
+    char* grown;
+    size_t cap = needed > 2 * enc->cap ? needed : 2 * enc->cap;
+    if (!needed || !(grown = (char*)cJSON_malloc(cap)))
+      return NULL;
+    cJSON_free(enc->buf);
+    enc->buf = grown;
+    enc->cap = cap;
+    cJSON_PrintBSONInto(item, enc->buf, enc->cap, &needed);
+    }
+  *bufSizeOut = needed;
+  return enc->buf;
+}
+
+/**\brief Create a cache for cJSON_PrintBSONCached.
+  */
+cBSON_EncodeCache* cBSON_CreateEncodeCache(void)
+{
+  cBSON_EncodeCache* cache = (cBSON_EncodeCache*)cJSON_malloc(sizeof(cBSON_EncodeCache));
+  if (!cache)
+    return NULL;
+  cache->mask = 63;
+  cache->count = 0;
+  cache->bytes = 0;
+  cache->swept = 0;
+  cache->sweptBytes = 0;
+  cache->detectUUIDs = shouldDetectUUIDsInStrings;
+  cache->readExtendedJSON = shouldReadExtendedJSON;
+  cache->compactIntegers = shouldCompactIntegers;
+  if (!(cache->slots = (bson_cache_entry*)cJSON_malloc((cache->mask + 1) * sizeof(bson_cache_entry))))
+    {
+    cJSON_free(cache);
+    return NULL;
+    }
+  memset(cache->slots, 0, (cache->mask + 1) * sizeof(bson_cache_entry));
+  return cache;
+}
+
+/* Drop every entry. */
+static void bson_cache_clear(cBSON_EncodeCache* cache)
+{
+  size_t i;
+  for (i = 0; i <= cache->mask; ++i)
+    if (cache->slots[i].key)
+      bson_cache_drop(cache, cache->slots + i);
+  memset(cache->slots, 0, (cache->mask + 1) * sizeof(bson_cache_entry));
+  cache->count = 0;
+  cache->swept = 0;
+  cache->sweptBytes = 0;
+}
+
+/**\brief Deallocate a cache made by cBSON_CreateEncodeCache.
+  *
+  * Trees encoded with it are not affected.
+  */
+void cBSON_DeleteEncodeCache(cBSON_EncodeCache* cache)
+{
+  if (!cache)
+    return;
+  bson_cache_clear(cache);
+  cJSON_free(cache->slots);
+  cJSON_free(cache);
+}
+
+/**\brief Encode \a item as cJSON_PrintBSON does, reusing earlier work.
+  *
+  * \a cache keeps the encodings of the arrays and objects in the tree.
+  * Each call first takes a snapshot of \a item (see cJSON_Snapshot),
+  * which freezes its contents and leaves \a item a copy, so change it
+  * afterwards the way copies are changed: thaw each array or object on
+  * the way down to what changes (cJSON_Thaw, cJSONUtils_ThawPointer,
+  * and cJSONUtils_ApplyPatches do). That marks the path to the change:
+  * the functions that change items refuse frozen ones, and everything
+  * not thawed still shares what was encoded last time. The next call
+  * then copies the encodings of the shared arrays and objects and
+  * encodes only the thawed ones and their members, so its cost follows
+  * the size of the change rather than of the document.
+  *
+  * Values smaller than 64 bytes are not worth keeping and are encoded
+  * each time. Entries whose arrays and objects are no longer used are
+  * dropped as the cache grows, or all together by cBSON_DeleteEncodeCache.
+  * Free the result with cJSON_DeleteBSON. Returns NULL if \a item is
+  * nested too deeply or memory runs out.
+  */
+char* cJSON_PrintBSONCached(cBSON_EncodeCache* cache, cJSON* item, size_t* bufSizeOut)
+{
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  int isArray;
+  *bufSizeOut = 0;
+  if (!cache || !item)
+    return NULL;
+  if (cache->detectUUIDs != shouldDetectUUIDsInStrings || cache->readExtendedJSON != shouldReadExtendedJSON ||
+    cache->compactIntegers != shouldCompactIntegers)
+    { /* strings, objects and numbers may encode differently now */
+    bson_cache_clear(cache);
+    cache->detectUUIDs = shouldDetectUUIDsInStrings;
+    cache->readExtendedJSON = shouldReadExtendedJSON;
+    cache->compactIntegers = shouldCompactIntegers;
+    }
+  /* a frozen tree needs no snapshot, and what a failed one leaves
+     unshared is simply encoded without the cache */
+  cJSON_Snapshot(item);
+  /* the document itself is not kept: it is the result */
+  isArray = ((item->type)&0xff) == cJSON_Array;
+  if (!bson_write_cached(item->child, isArray, &w, cache) || !(w.buf = (char*)cJSON_malloc(w.len)))
+    return NULL; /* nested too deeply, or out of memory */
+  w.cap = w.len;
+  w.len = 0;
+  bson_write_cached(item->child, isArray, &w, cache);
+  if (cache->count > 2 * cache->swept + 64 || cache->bytes > 2 * cache->sweptBytes + 65536)
+    {
+    bson_cache_rebuild(cache, cache->mask, 1);
+    cache->swept = cache->count;
+    cache->sweptBytes = cache->bytes;
+    }
+  *bufSizeOut = w.len;
+  return w.buf;
+}
+
+/* The documents of a batch one thread sizes or writes. */
+typedef struct bson_batch_part
+{
+  cJSON** items;
+  size_t* offsets;
+  char* buf;
+  size_t begin;
+  size_t end;
+  int ok;
+} bson_batch_part;
+
+/* Put the size of each document in the part where its offset goes. */
+static void* bson_batch_size(void* arg)
+{
+  bson_batch_part* part = (bson_batch_part*)arg;
+  size_t i;
+  for (i = part->begin; i < part->end && part->ok; ++i)
+    {
+    bson_writer w = { NULL, 0, 0, 0, NULL };
+    cJSON* item = part->items[i];
+    part->ok = item && bson_write_doc(item->child, ((item->type)&0xff) == cJSON_Array, &w);
+    part->offsets[i] = w.len;
+    }
+  return NULL;
+}
+
+/* Write each document of the part at its offset. */
+static void* bson_batch_write(void* arg)
+{
+  bson_batch_part* part = (bson_batch_part*)arg;
+  size_t i;
+  for (i = part->begin; i < part->end; ++i)
+    {
+    bson_writer w = { part->buf + part->offsets[i], part->offsets[i + 1] - part->offsets[i], 0, 0, NULL };
+    cJSON* item = part->items[i];
+    bson_write_doc(item->child, ((item->type)&0xff) == cJSON_Array, &w);
+    }
+  return NULL;
+}
+
+/* Run \a work on every part, on threads of their own where possible. */
+static void bson_batch_run(void* (*work)(void*), bson_batch_part* parts, int count)
+{
+#ifndef _WIN32
+  pthread_t threads[cBSON_BatchMaxThreads];
+  int started[cBSON_BatchMaxThreads];
+  int i;
+  for (i = 1; i < count; ++i)
+    started[i] = pthread_create(threads + i, NULL, work, parts + i) == 0;
+  work(parts);
+  for (i = 1; i < count; ++i)
+    {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      work(parts + i);
+    }
+#else
+  int i;
+  for (i = 0; i < count; ++i)
+    work(parts + i);
+#endif
+}
+
+/**\brief Encode many items into one buffer, each as cJSON_PrintBSON would.
+  *
+  * Every document is sized first, then a single buffer is allocated
+  * and the documents are written into it back to back. \a offsets must
+  * have room for \a count + 1 entries: where each document starts,
+  * followed by the total size (which is also put in \a bufSizeOut).
+  *
+  * With \a threads above 1 (and at most cBSON_BatchMaxThreads), the
+  * items are split between that many threads, each sizing and then
+  * writing its own share; documents already know where they go, so
+  * no thread waits on another. The items must not change meanwhile.
+  * Threads are not used on Windows.
+  *
+  * Free the result with cJSON_DeleteBSON. Returns NULL if \a count is
+  * zero, an item is NULL or nested too deeply, or memory runs out.
+  */
+char* cJSON_PrintBSONBatch(cJSON** items, size_t count, size_t* offsets, int threads, size_t* bufSizeOut)
+{
+  bson_batch_part parts[cBSON_BatchMaxThreads];
+  size_t i;
+  size_t total = 0;
+  int p;
+  *bufSizeOut = 0;
+  if (!items || !count || !offsets)
+    return NULL;
+  if (threads > cBSON_BatchMaxThreads)
+    threads = cBSON_BatchMaxThreads;
+  if (threads < 1 || (size_t)threads > count)
+    threads = threads < 1 ? 1 : (int)count;
+  for (p = 0; p < threads; ++p)
+    {
+    parts[p].items = items;
+    parts[p].offsets = offsets;
+    parts[p].begin = count * p / threads;
+    parts[p].end = count * (p + 1) / threads;
+    parts[p].ok = 1;
+    }
+  bson_batch_run(bson_batch_size, parts, threads);
+  for (p = 0; p < threads; ++p)
+    if (!parts[p].ok)
+      return NULL; /* a NULL item, or one nested too deeply */
+  for (i = 0; i < count; ++i)
+    {
+    size_t size = offsets[i];
+    offsets[i] = total;
+    total += size;
+    }
+  offsets[count] = total;
+  if (!(parts[0].buf = (char*)cJSON_malloc(total)))
+    return NULL;
+  /* split the writing by bytes rather than by documents */
+  for (p = 0, i = 0; p < threads; ++p)
+    {
+    parts[p].buf = parts[0].buf;
+    parts[p].begin = i;
+    while (i < count && (p == threads - 1 || offsets[i] < total / threads * (p + 1)))
+      ++i;
+    parts[p].end = i;
+    }
+  bson_batch_run(bson_batch_write, parts, threads);
+  *bufSizeOut = total;
+  return parts[0].buf;
+}
+
+/**\brief Encode \a item as cJSON_PrintBSON does, as pieces for writev.
+  *
+  * Strings and binary data of \a min_ref bytes or more are not copied:
+  * their pieces point at item->valuestring itself, so the tree must
+  * outlive the result and not change meanwhile. Everything else
+  * (lengths, keys, numbers and smaller values) is packed into one
+  * buffer that the other pieces point into. The number of pieces is
+  * put in \a countOut and the size of the whole document in
+  * \a bufSizeOut.
+  *
+  * Free the result with cJSON_DeleteBSONVec. Returns NULL if \a item
+  * is nested too deeply or memory runs out.
+  */
+cBSON_IOVec* cJSON_PrintBSONVec(cJSON* item, size_t min_ref, size_t* countOut, size_t* bufSizeOut)
+{
+  bson_gather g = { NULL, 0, 0, 0 };
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  int isArray;
+  *countOut = 0;
+  *bufSizeOut = 0;
+  if (!item)
+    return NULL;
+  g.minRef = min_ref ? min_ref : 1;
+  w.gather = &g;
+  isArray = ((item->type)&0xff) == cJSON_Array;
+  if (!bson_write_doc(item->child, isArray, &w))
+    return NULL; /* nested too deeply */
+  bson_gather_flush(&w);
+  /* the pieces, then the buffer they share */
+  if (!(g.vec = (cBSON_IOVec*)cJSON_malloc(g.count * sizeof(cBSON_IOVec) + w.len - w.skipped)))
+    return NULL;
+  w.buf = (char*)(g.vec + g.count);
+  w.cap = w.len - w.skipped;
+  w.len = w.skipped = 0;
+  g.count = g.flushed = 0;
+  bson_write_doc(item->child, isArray, &w);
+  bson_gather_flush(&w);
+  *countOut = g.count;
+  *bufSizeOut = w.len;
+  return g.vec;
+}
+
+/**\brief Deallocate pieces made by cJSON_PrintBSONVec.
+  */
+void cJSON_DeleteBSONVec(cBSON_IOVec* vec)
+{
+  cJSON_free(vec);
+}
+
+/* allocate and copy the null-terminated name into \a name_out. */
+char* bson_parse_name(const char* bson, size_t* len)
+{
+  return cJSON_strdup(bson, len, 1);
+}
+
+/* Attach a name from bson_parse_name (\a len includes its terminator). */
+static void bson_set_name(cJSON* node, char* key, size_t len)
+{
+  node->string = key; /* BSON names have no NULs */
+  (void)len;
+}
+
+void bson_prepare_uuid(cJSON* node, const char* loc)
+{
+  node->type = cJSON_UUID;
+  cJSON_SetValuestringWithLength(node, loc, 16);
+}
+
+void bson_encode_uuid(cJSON* node, const char* loc)
+{
+  node->type = cJSON_String;
+  node->valuestring = cJSON_malloc(37);
+  encode_hex_string((const uint8_t*)loc     , 4, node->valuestring +  0);
+  encode_hex_string((const uint8_t*)loc +  4, 2, node->valuestring +  9);
+  encode_hex_string((const uint8_t*)loc +  6, 2, node->valuestring + 14);
+  encode_hex_string((const uint8_t*)loc +  8, 2, node->valuestring + 19);
+  encode_hex_string((const uint8_t*)loc + 10, 6, node->valuestring + 24);
+  node->valuestring[ 8] = '-';
+  node->valuestring[13] = '-';
+  node->valuestring[18] = '-';
+  node->valuestring[23] = '-';
+  node->valuestring[36] = '\0';
+}
+
+void bson_prepare_binary(cJSON* node, const char* loc, size_t bloblen, uint8_t subtype)
+{
+  node->type = cJSON_Binary;
+  node->valueint = subtype;
+  cJSON_SetValuestringWithLength(node, loc, bloblen);
+}
+
+void bson_encode_binary(cJSON* node, const char* loc, size_t bloblen, uint8_t subtype)
+{
+  node->type = cJSON_String;
+  node->valuestring = cJSON_malloc(2 * bloblen + 1);
+  node->valueint = subtype;
+  encode_hex_string((const uint8_t*)loc, bloblen, node->valuestring);
+  node->valuestring[2 * bloblen] = '\0';
+}
+
+/* Give \a node an extended \a type holding \a size bytes as they are encoded. */
+static void bson_prepare_bytes(cJSON* node, int type, const char* loc, size_t size)
+{
+  node->type = type;
+  cJSON_SetValuestringWithLength(node, loc, size);
+}
+
+/* An ObjectId is an extended type, or 24 hexadecimal digits. */
+static cJSON* bson_object_id_node(const char* loc)
+{
+  cJSON* node = cJSON_CreateNull();
+  if (shouldUseExtendedTypes)
+    bson_prepare_bytes(node, cJSON_ObjectId, loc, 12);
+  else
+    bson_encode_binary(node, loc, 12, 0);
+  return node;
+}
+
+/* The nearest double to a Decimal128 (IEEE 754-2008, with a binary
+ * integer significand).
+ */
+static double bson_decimal128_value(const char* loc)
+{
+  uint64_t lo, hi;
+  int exponent;
+  double val;
+  memcpy(&lo, loc, 8);
+  memcpy(&hi, loc + 8, 8);
+  if (((hi >> 58) & 0x1f) == 0x1f)
+    return NAN;
+  if (((hi >> 58) & 0x1f) == 0x1e)
+    val = HUGE_VAL;
+  else if (((hi >> 61) & 0x3) == 0x3)
+    val = 0; /* a significand too large to be canonical */
+  else
+    {
+    exponent = (int)((hi >> 49) & 0x3fff) - 6176;
+    val = (double)(hi & 0x1ffffffffffffULL) * 18446744073709551616.0 + (double)lo;
+    if (val != 0)
+      val = exponent < 0 ? val / pow(10, -exponent) : val * pow(10, exponent);
+    }
+  return hi >> 63 ? -val : val;
+}
+
+size_t bson_parse_float(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  cJSON* node = cJSON_CreateNumber(*(double*)loc);
+  bson_set_name(node, key, len);
+  node->valueint = (int)node->valuedouble;
+  cBSON_LinkSibling(prev, node);
+  return sizeof(double) + loc - bson;
+}
+
+size_t bson_parse_string(const char* bson, size_t remaining, cJSON*** prev)
+{
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  int32_t slen = *(const int32_t*)loc;
+  /* bytes left after the type byte, name, and length: */
+  size_t avail = remaining > len + 5 ? remaining - len - 5 : 0;
+  size_t vlen = slen > 0 ? (size_t)slen - 1 : 0;
+  loc += 4;
+  /* the length includes the terminator; loc may contain
+   * embedded NULLs that are not meant to be terminators.
+   */
+  cJSON* node = cJSON_CreateStringWithLength(loc, vlen < avail ? vlen : avail);
+  bson_set_name(node, key, len);
+  cBSON_LinkSibling(prev, node);
+  return slen + loc - bson;
+}
+
+
+size_t bson_parse_document(const char* bson, size_t remaining, cJSON*** prev, int tag)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  // peek at the size:
+  int32_t dlen = *(const int32_t*)loc;
+  cJSON* node = bson_parse_doc(
+    loc, (size_t)dlen, tag == cBSON_Array ? cJSON_Array : cJSON_Object);
+  if (node)
+    {
+    bson_set_name(node, key, len);
+    cBSON_LinkSibling(prev, node);
+    }
+  return dlen + (loc - bson); /* skip proper length even if we couldn't read it. */
+}
+
+size_t bson_parse_blob(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+
+  /* we will change the node type and contents manually: */
+  cJSON* node = cJSON_CreateNull();
+  bson_set_name(node, key, len);
+  cBSON_LinkSibling(prev, node);
+
+  const char* loc = bson + len;
+  int32_t bloblen = *(const int32_t*)loc;
+  loc += 4;
+  int subtype = (*(loc++)) & 0xff;
+  if (subtype == cBSON_UUID && bloblen == 16)
+    { /* yay */
+    if (shouldUseExtendedTypes)
+      bson_prepare_uuid(node, loc);
+    else
+      bson_encode_uuid(node, loc);
+    }
+  else if (shouldUseExtendedTypes)
+    bson_prepare_binary(node, loc, bloblen, subtype);
+  else
+    bson_encode_binary(node, loc, bloblen, subtype);
+
+  return bloblen + loc - bson;
+}
+
+size_t bson_parse_object_id(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  cJSON* node = bson_object_id_node(loc);
+  bson_set_name(node, key, len);
+  cBSON_LinkSibling(prev, node);
+  return 12 + loc - bson;
+}
+
+size_t bson_parse_bool(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  cJSON* node = (*(loc++) ? cJSON_CreateTrue() : cJSON_CreateFalse());
+  bson_set_name(node, key, len);
+  cBSON_LinkSibling(prev, node);
+  return loc - bson;
+}
+
+size_t bson_parse_int(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  int64_t val = *(int64_t*)loc;
+  cJSON* node = cJSON_CreateNumber((double)val);
+  bson_set_name(node, key, len);
+  node->valueint = (int)val; /* overwrite cJSON-double-cast with exact value */
+  cBSON_LinkSibling(prev, node);
+  return sizeof(int64_t) + loc - bson;
+}
+
+size_t bson_parse_int32(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  int32_t val = *(int32_t*)loc;
+  cJSON* node = cJSON_CreateNumber((double)val);
+  bson_set_name(node, key, len);
+  node->valueint = (int)val; /* overwrite cJSON-double-cast with exact value */
+  if (shouldUseExtendedTypes)
+    node->type = cJSON_Int32;
+  cBSON_LinkSibling(prev, node);
+  return sizeof(int32_t) + loc - bson;
+}
+
+/* UTC times and timestamps are int64 numbers unless extended types are on. */
+size_t bson_parse_time(const char* bson, size_t remaining, cJSON*** prev, int tag)
+{
+  size_t len;
+  char* key;
+  const char* loc;
+  int64_t val;
+  cJSON* node;
+  if (!shouldUseExtendedTypes)
+    return bson_parse_int(bson, remaining, prev);
+  key = bson_parse_name(bson, &len);
+  loc = bson + len;
+  memcpy(&val, loc, sizeof(val));
+  node = cJSON_CreateNumber(tag == cBSON_Timestamp ? (double)(uint64_t)val : (double)val);
+  bson_set_name(node, key, len);
+  bson_prepare_bytes(node, tag == cBSON_Timestamp ? cJSON_Timestamp : cJSON_UTCTime, loc, sizeof(val));
+  cBSON_LinkSibling(prev, node);
+  return sizeof(int64_t) + loc - bson;
+}
+
+size_t bson_parse_decimal128(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  cJSON* node = cJSON_CreateNumber(bson_decimal128_value(loc));
+  bson_set_name(node, key, len);
+  if (shouldUseExtendedTypes)
+    bson_prepare_bytes(node, cJSON_Decimal128, loc, 16);
+  cBSON_LinkSibling(prev, node);
+  return 16 + loc - bson;
+}
+
+size_t bson_parse_null(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  cJSON* node = cJSON_CreateNull();
+  bson_set_name(node, key, len);
+  cBSON_LinkSibling(prev, node);
+  return len;
+}
+
+size_t bson_parse_regex(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  /* the pattern and its options follow the name */
+  const char* regex = bson + len;
+  const char* opts = regex + strlen(regex) + 1;
+  cJSON* node = cJSON_CreateArray();
+
+  cJSON_AddItemToArray(node, cJSON_CreateString(regex));
+  cJSON_AddItemToArray(node, cJSON_CreateString(opts));
+  bson_set_name(node, key, len);
+  cBSON_LinkSibling(prev, node);
+  return opts + strlen(opts) + 1 - bson;
+}
+
+/* A DB pointer becomes {"$ref": collection, "$id": ObjectId}. */
+size_t bson_parse_db_pointer(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  int32_t slen = *(const int32_t*)loc;
+  cJSON* node = cJSON_CreateObject();
+  cJSON_AddItemToObject(node, "$ref", cJSON_CreateStringWithLength(loc + 4, slen > 0 ? (size_t)slen - 1 : 0));
+  loc += 4 + slen;
+  cJSON_AddItemToObject(node, "$id", bson_object_id_node(loc));
+  bson_set_name(node, key, len);
+  cBSON_LinkSibling(prev, node);
+  return 12 + loc - bson;
+}
+
+/* Code with scope becomes {"$code": code, "$scope": document}. */
+size_t bson_parse_code_ws(const char* bson, size_t remaining, cJSON*** prev)
+{
+  (void) remaining;
+  size_t len;
+  char* key = bson_parse_name(bson, &len);
+  const char* loc = bson + len;
+  int32_t total = *(const int32_t*)loc;
+  int32_t slen = *(const int32_t*)(loc + 4);
+  cJSON* node = cJSON_CreateObject();
+  cJSON* scope;
+  cJSON_AddItemToObject(node, "$code", cJSON_CreateStringWithLength(loc + 8, slen > 0 ? (size_t)slen - 1 : 0));
+  if ((scope = bson_parse_doc(loc + 8 + slen, (size_t)(total - 8 - slen), cJSON_Object)))
+    cJSON_AddItemToObject(node, "$scope", scope);
+  bson_set_name(node, key, len);
+  cBSON_LinkSibling(prev, node);
+  return total + (loc - bson);
+}
+
+/* Parse the element of type \a itype whose name starts at \a loc
+ * and link it in after \a prev. Returns the number of bytes used,
+ * or 0 if the type is not one we can read.
+ */
+static size_t bson_parse_element(int itype, const char* loc, size_t remaining, cJSON*** prev)
+{
+  switch (itype)
+    {
+  case cBSON_Float:
+    return bson_parse_float(loc, remaining, prev);
+  case cBSON_String:
+  case cBSON_JS_Code:
+  case cBSON_Deprecated:
+    return bson_parse_string(loc, remaining, prev);
+  case cBSON_Document:
+  case cBSON_Array:
+    return bson_parse_document(loc, remaining, prev, itype);
+  case cBSON_Binary:
+    return bson_parse_blob(loc, remaining, prev);
+  case cBSON_ObjectId:
+    return bson_parse_object_id(loc, remaining, prev);
+  case cBSON_Bool:
+    return bson_parse_bool(loc, remaining, prev);
+  case cBSON_UTC_Time:
+  case cBSON_Timestamp:
+    return bson_parse_time(loc, remaining, prev, itype);
+  case cBSON_Int:
+    return bson_parse_int(loc, remaining, prev);
+  case cBSON_Int32:
+    return bson_parse_int32(loc, remaining, prev);
+  case cBSON_Decimal128:
+    return bson_parse_decimal128(loc, remaining, prev);
+  case cBSON_Undefined:
+  case cBSON_NULL:
+  case cBSON_Min_Key:
+  case cBSON_Max_Key:
+    return bson_parse_null(loc, remaining, prev);
+  case cBSON_Regex:
+    return bson_parse_regex(loc, remaining, prev);
+  case cBSON_DBPointer:
+    return bson_parse_db_pointer(loc, remaining, prev);
+  case cBSON_JS_Code_WS:
+    return bson_parse_code_ws(loc, remaining, prev);
+    }
+  return 0;
+}
+
+cJSON* bson_parse_doc(const char* bson, size_t bson_size, int doc_type)
+{
+  cJSON* result =
+    (doc_type != cJSON_Array ?
+     cJSON_CreateObject() :
+     cJSON_CreateArray());
+  cJSON** next_child = &result->child;
+  cJSON* prev = NULL;
+  const char* loc = bson;
+  /* read size for comparison */
+  int32_t actual_size = *(uint32_t*)loc;
+  loc += 4;
+  int itype;
+  size_t used;
+  int allIndicesAreInts = 1;
+  long lastKey = -1;
+  size_t remaining = bson_size - (loc - bson);
+  assert(bson_size == (size_t)actual_size && "BSON size mismatch");
+  while (remaining > 0)
+    {
+    itype = (*(loc++) & 0xff);
+    if (!itype)
+      { /* null terminator marking end of document */
+      if (doc_type < cJSON_Array && allIndicesAreInts)
+        result->type = cJSON_Array;
+      return result;
+      }
+    if (!(used = bson_parse_element(itype, loc, remaining, &next_child)))
+      {
+      cJSON_Delete(result);
+      return NULL;
+      }
+    loc += used;
+    remaining = bson_size - (loc - bson);
+    /* If the document type is unspecified (doc_type == cJSON_NULL),
+     * then we should be checking to see whether it can be an array
+     * or (because the keys are not increasing integers) must be
+     * an object.
+     */
+    if (doc_type < cJSON_Array && allIndicesAreInts)
+      {
+      if (!prev)
+        prev = result->child;
+      else
+        prev = prev->next;
+      if (prev && prev->string)
+        {
+        char* dummy;
+        long idx = strtol(prev->string, &dummy, 10);
+        if (!dummy || *dummy || idx <= lastKey)
+          allIndicesAreInts = 0;
+        else
+          lastKey = idx;
+        }
+      else
+        {
+        allIndicesAreInts = 0;
+        }
+      }
+    }
+  /* If we were not told the document type, set it: */
+  if (doc_type < cJSON_Array && allIndicesAreInts)
+    result->type = cJSON_Array;
+  return result;
+}
+
+/**\brief Parse a BSON buffer into a tree of cJSON records.
+  *
+  * The first two arguments are the buffer and size.
+  * The third argument allows you to specify a preference
+  * for the top-level object type.
+  * The following values are accepted:
+  *
+  * + cJSON_Array, indicating that an array should contain
+  *   all the top-level entries (even if their key values
+  *   are not all integers);
+  * + cJSON_Object, indicating that a dictionary should
+  *   contain all the top-level entries (even if their
+  *   key values are all integers); or
+  * + cJSON_NULL, indicating that you have no preference
+  *   and the key values should be used to decide whether
+  *   to create a cJSON_Array or cJSON_Object.
+  */
+cJSON* cJSON_ParseBSON(const char* bson, size_t bson_size, int doc_type)
+{
+  return bson_parse_doc(bson, bson_size, doc_type);
+}
+
+/**\brief Parse a BSON buffer as cJSON_ParseBSON does, interning the tree.
+  *
+  * Strings and subdocuments seen before (in this document or any other
+  * parsed with \a pool) are shared with their earlier copies rather
+  * than kept again; see cJSON_Intern. Returns NULL on failure.
+  */
+cJSON* cJSON_ParseBSONInterned(const char* bson, size_t bson_size, int doc_type, cJSON_InternPool* pool)
+{
+  cJSON* result;
+  if (!pool || !(result = bson_parse_doc(bson, bson_size, doc_type)))
+    return NULL;
+  if (!cJSON_Intern(pool, result))
+    {
+    cJSON_Delete(result);
+    return NULL;
+    }
+  return result;
+}
+
+/* Return the size of the value (not the type byte or name) of
+ * a \a itype element starting at \a loc, or -1 if it is malformed
+ * or would run past the \a avail bytes that remain.
+ */
+static ptrdiff_t bson_value_size(int itype, const char* loc, size_t avail)
+{
+  int32_t len;
+  const char* nul;
+  switch (itype)
+    {
+  case cBSON_Undefined:
+  case cBSON_NULL:
+  case cBSON_Min_Key:
+  case cBSON_Max_Key:
+    return 0;
+  case cBSON_Bool:
+    return avail >= 1 ? 1 : -1;
+  case cBSON_Int32:
+    return avail >= 4 ? 4 : -1;
+  case cBSON_Float:
+  case cBSON_UTC_Time:
+  case cBSON_Timestamp:
+  case cBSON_Int:
+    return avail >= 8 ? 8 : -1;
+  case cBSON_ObjectId:
+    return avail >= 12 ? 12 : -1;
+  case cBSON_Decimal128:
+    return avail >= 16 ? 16 : -1;
+  case cBSON_String:
+  case cBSON_JS_Code:
+  case cBSON_Deprecated:
+  case cBSON_DBPointer:
+    /* int32 length, then the string and its terminator (plus a 12-byte id for pointers) */
+    if (avail < 4)
+      return -1;
+    memcpy(&len, loc, 4);
+    if (len < 1 || (size_t)len > avail - 4 || loc[4 + len - 1] != 0)
+      return -1;
+    len += 4;
+    if (itype == cBSON_DBPointer)
+      return (size_t)len + 12 <= avail ? len + 12 : -1;
+    return len;
+  case cBSON_Document:
+  case cBSON_Array:
+    /* the int32 length covers itself */
+    if (avail < 5)
+      return -1;
+    memcpy(&len, loc, 4);
+    return len >= 5 && (size_t)len <= avail ? len : -1;
+  case cBSON_JS_Code_WS:
+      { /* an int32 length covering itself, a string, and exactly a document */
+      ptrdiff_t code;
+      if (avail < 4)
+        return -1;
+      memcpy(&len, loc, 4);
+      if (len < 14 || (size_t)len > avail || (code = bson_value_size(cBSON_String, loc + 4, len - 4)) < 0 ||
+        bson_value_size(cBSON_Document, loc + 4 + code, len - 4 - code) != len - 4 - code)
+        return -1;
+      return len;
+      }
+  case cBSON_Binary:
+    /* int32 length, a subtype byte, then the data */
+    if (avail < 5)
+      return -1;
+    memcpy(&len, loc, 4);
+    return len >= 0 && (size_t)len <= avail - 5 ? len + 5 : -1;
+  case cBSON_Regex:
+    /* two C strings: the pattern and its options */
+    if (!(nul = (const char*)memchr(loc, 0, avail)) ||
+      !(nul = (const char*)memchr(nul + 1, 0, avail - (nul + 1 - loc))))
+      return -1;
+    return nul + 1 - loc;
+    }
+  return -1;
+}
+
+/* Mirror bson_parse_doc's choice of an array for top-level
+ * documents whose keys are increasing integers.
+ */
+static int bson_keys_are_indices(const char* bson, size_t bson_size)
+{
+  const char* loc = bson + 4;
+  const char* end = bson + bson_size - 1;
+  long lastKey = -1;
+  while (loc < end)
+    {
+    int itype = *(loc++) & 0xff;
+    const char* nul = (const char*)memchr(loc, 0, end - loc);
+    char* dummy;
+    long idx;
+    ptrdiff_t size;
+    if (!itype || !nul || nul == loc)
+      return 0;
+    idx = strtol(loc, &dummy, 10);
+    if (*dummy || idx <= lastKey)
+      return 0;
+    lastKey = idx;
+    if ((size = bson_value_size(itype, nul + 1, end - nul - 1)) < 0)
+      return 0;
+    loc = nul + 1 + size;
+    }
+  return 1;
+}
+
+/* Append binary data to a tape the way cJSON_ParseBSON presents it
+ * without extended types: UUIDs in their usual text form and
+ * anything else as hexadecimal.
+ */
+static size_t bson_tape_binary(cJSON_Tape* tape, const char* loc, size_t bloblen, int subtype)
+{
+  size_t result;
+  char* hex;
+  if (subtype == cBSON_UUID && bloblen == 16)
+    {
+    char uuid[36];
+    encode_hex_string((const uint8_t*)loc     , 4, uuid +  0);
+    encode_hex_string((const uint8_t*)loc +  4, 2, uuid +  9);
+    encode_hex_string((const uint8_t*)loc +  6, 2, uuid + 14);
+    encode_hex_string((const uint8_t*)loc +  8, 2, uuid + 19);
+    encode_hex_string((const uint8_t*)loc + 10, 6, uuid + 24);
+    uuid[8] = uuid[13] = uuid[18] = uuid[23] = '-';
+    return cJSON_TapeAppendString(tape, cJSON_TapeString, uuid, sizeof(uuid));
+    }
+  if (!(hex = (char*)cJSON_malloc(2 * bloblen + 1)))
+    return 0;
+  encode_hex_string((const uint8_t*)loc, bloblen, hex);
+  result = cJSON_TapeAppendString(tape, cJSON_TapeString, hex, 2 * bloblen);
+  cJSON_free(hex);
+  return result;
+}
+
+typedef struct bson_tape_frame
+{
+  const char* end; /* one past the document's terminator */
+  size_t open;     /* the tape word that opened the document */
+  int isArray;
+  int wrapped;     /* code with scope, which ends with its scope */
+} bson_tape_frame;
+
+/* Append the value of an ObjectId the way cJSON_ParseBSON presents it
+ * without extended types.
+ */
+static size_t bson_tape_object_id(cJSON_Tape* tape, const char* loc)
+{
+  char hex[24];
+  encode_hex_string((const uint8_t*)loc, 12, hex);
+  return cJSON_TapeAppendString(tape, cJSON_TapeString, hex, sizeof(hex));
+}
+
+/**\brief Flatten a BSON buffer into a cJSON_Tape.
+  *
+  * This is the read-only counterpart of cJSON_ParseBSON and
+  * takes the same arguments. Every value appears just as
+  * cJSON_ParseBSON presents it when extended types are off:
+  * binary data and ObjectIds as strings, DB pointers and code
+  * with scope as objects, and Decimal128 as a double. Unlike the
+  * tree parser, every length is checked against \a bson_size:
+  * malformed input returns NULL. Call cJSON_DeleteTape when done.
+  */
+cJSON_Tape* cJSON_ParseBSONTape(const char* bson, size_t bson_size, int doc_type)
+{
+  bson_tape_frame local[16];
+  bson_tape_frame* frames = local;
+  bson_tape_frame* frame;
+  int depth = 0;
+  int capacity = sizeof(local) / sizeof(local[0]);
+  int ok = 0;
+  int32_t len;
+  const char* loc;
+  cJSON_Tape* tape = cJSON_CreateTape();
+
+  if (!tape || !bson || bson_size < 5)
+    goto done;
+  memcpy(&len, bson, 4);
+  if ((size_t)len != bson_size || bson[bson_size - 1] != 0)
+    goto done;
+  frame = frames + depth++;
+  frame->end = bson + bson_size;
+  frame->wrapped = 0;
+  frame->isArray = doc_type == cJSON_Array ||
+    (doc_type < cJSON_Array && bson_keys_are_indices(bson, bson_size));
+  if (!(frame->open = cJSON_TapeAppend(tape, frame->isArray ? cJSON_TapeArray : cJSON_TapeObject, 0)))
+    goto done;
+  loc = bson + 4;
+
+  while (depth > 0)
+    {
+    const char* key;
+    size_t keylen;
+    int appended;
+    ptrdiff_t size;
+    int itype;
+    frame = frames + depth - 1;
+    if (frame->wrapped)
+      { /* its scope has just ended */
+      if (!cJSON_TapeAppendEnd(tape, frame->open))
+        goto done;
+      --depth;
+      continue;
+      }
+    if (loc >= frame->end)
+      goto done;
+    itype = *(loc++) & 0xff;
+    if (!itype)
+      { /* the terminator must be the document's last byte */
+      if (loc != frame->end || !cJSON_TapeAppendEnd(tape, frame->open))
+        goto done;
+      --depth;
+      continue;
+      }
+    key = loc;
+    if (!(loc = (const char*)memchr(loc, 0, frame->end - loc)))
+      goto done;
+    keylen = loc++ - key;
+    if ((size = bson_value_size(itype, loc, frame->end - loc)) < 0)
+      goto done;
+    if (!frame->isArray && !cJSON_TapeAppendString(tape, cJSON_TapeKey, key, keylen))
+      goto done;
+    switch (itype)
+      {
+    case cBSON_JS_Code_WS:
+        { /* {"$code": code, "$scope": document}, the object ending with the document */
+        bson_tape_frame* grown = (bson_tape_frame*)bson_stack_grow(
+          frames, local, depth, &capacity, sizeof(bson_tape_frame));
+        memcpy(&len, loc + 4, 4);
+        if (!grown)
+          goto done;
+        frames = grown;
+        frame = frames + depth++;
+        frame->end = loc + size;
+        frame->isArray = 0;
+        frame->wrapped = 1;
+        if (!(frame->open = cJSON_TapeAppend(tape, cJSON_TapeObject, 0)) ||
+          !cJSON_TapeAppendString(tape, cJSON_TapeKey, "$code", 5) ||
+          !cJSON_TapeAppendString(tape, cJSON_TapeString, loc + 8, len - 1) ||
+          !cJSON_TapeAppendString(tape, cJSON_TapeKey, "$scope", 6))
+          goto done;
+        loc += 8 + len;
+        size = frame->end - loc;
+        itype = cBSON_Document;
+        }
+      /* fall through - the scope opens like any document */
+    case cBSON_Document:
+    case cBSON_Array:
+        {
+        bson_tape_frame* grown = (bson_tape_frame*)bson_stack_grow(
+          frames, local, depth, &capacity, sizeof(bson_tape_frame));
+        if (!grown)
+          goto done;
+        frames = grown;
+        frame = frames + depth++;
+        frame->end = loc + size;
+        frame->isArray = itype == cBSON_Array;
+        frame->wrapped = 0;
+        if (!(frame->open = cJSON_TapeAppend(tape, frame->isArray ? cJSON_TapeArray : cJSON_TapeObject, 0)))
+          goto done;
+        loc += 4;
+        }
+      continue;
+    case cBSON_ObjectId:
+      appended = bson_tape_object_id(tape, loc) != 0;
+      break;
+    case cBSON_DBPointer:
+        { /* {"$ref": collection, "$id": ObjectId} */
+        size_t open = cJSON_TapeAppend(tape, cJSON_TapeObject, 0);
+        appended = open &&
+          cJSON_TapeAppendString(tape, cJSON_TapeKey, "$ref", 4) &&
+          cJSON_TapeAppendString(tape, cJSON_TapeString, loc + 4, size - 17) &&
+          cJSON_TapeAppendString(tape, cJSON_TapeKey, "$id", 3) &&
+          bson_tape_object_id(tape, loc + size - 12) &&
+          cJSON_TapeAppendEnd(tape, open);
+        }
+      break;
+    case cBSON_Decimal128:
+      appended = cJSON_TapeAppendDouble(tape, bson_decimal128_value(loc)) != 0;
+      break;
+    case cBSON_Float:
+        {
+        double val;
+        memcpy(&val, loc, sizeof(val));
+        appended = cJSON_TapeAppendDouble(tape, val) != 0;
+        }
+      break;
+    case cBSON_UTC_Time:
+    case cBSON_Timestamp:
+    case cBSON_Int:
+        {
+        int64_t val;
+        memcpy(&val, loc, sizeof(val));
+        appended = cJSON_TapeAppendInt64(tape, val) != 0;
+        }
+      break;
+    case cBSON_Int32:
+        {
+        int32_t val;
+        memcpy(&val, loc, sizeof(val));
+        appended = cJSON_TapeAppendInt64(tape, val) != 0;
+        }
+      break;
+    case cBSON_Bool:
+      appended = cJSON_TapeAppend(tape, *loc ? cJSON_TapeTrue : cJSON_TapeFalse, 0) != 0;
+      break;
+    case cBSON_String:
+    case cBSON_JS_Code:
+    case cBSON_Deprecated:
+      appended = cJSON_TapeAppendString(tape, cJSON_TapeString, loc + 4, size - 5) != 0;
+      break;
+    case cBSON_Binary:
+      appended = bson_tape_binary(tape, loc + 5, size - 5, loc[4] & 0xff) != 0;
+      break;
+    case cBSON_Regex:
+        { /* an array of the pattern and its options, as cJSON_ParseBSON makes */
+        size_t open = cJSON_TapeAppend(tape, cJSON_TapeArray, 0);
+        size_t plen = strlen(loc);
+        appended = open &&
+          cJSON_TapeAppendString(tape, cJSON_TapeString, loc, plen) &&
+          cJSON_TapeAppendString(tape, cJSON_TapeString, loc + plen + 1, size - plen - 2) &&
+          cJSON_TapeAppendEnd(tape, open);
+        }
+      break;
+    default: /* cBSON_Undefined, cBSON_NULL, cBSON_Min_Key, cBSON_Max_Key */
+      appended = cJSON_TapeAppend(tape, cJSON_TapeNull, 0) != 0;
+      break;
+      }
+    if (!appended)
+      goto done;
+    loc += size;
+    }
+  ok = 1;
+
+done:
+  if (frames != local)
+    cJSON_free(frames);
+  if (!ok)
+    {
+    cJSON_DeleteTape(tape);
+    return NULL;
+    }
+  return tape;
+}
+
+/* Incremental decoding.
+ *
+ * A cBSON_Stream is fed one or more BSON documents in pieces of any
+ * size. The input is taken in units: a document's length, one
+ * element (its type byte, name and value; for an embedded document
+ * just the name and length), or a document's terminator. A unit
+ * lying wholly within the piece being fed is decoded in place, and
+ * only one that straddles two pieces is gathered into a buffer
+ * first. Embedded documents are never gathered whole: there is a
+ * frame for each open document, counting the bytes it has left.
+ */
+typedef struct bson_stream_frame
+{
+  cJSON* node;      /* the document being filled in, if there is one */
+  cJSON** next;     /* where its next element is linked */
+  size_t remaining; /* bytes of the document still to come, terminator included */
+} bson_stream_frame;
+
+struct cBSON_Stream
+{
+  cJSON_StreamHandler handler;
+  void* ctx;
+  int docType;
+  int split;
+  int failed;
+  bson_stream_frame local[16];
+  bson_stream_frame* frames;
+  int depth;
+  int capacity;
+  int allIndicesAreInts; /* whether the top-level keys so far count up */
+  long lastKey;
+  cJSON container;       /* passed with cJSON_StreamOpen and cJSON_StreamClose */
+  char* pending;         /* a unit begun in an earlier piece */
+  size_t pendingPos;
+  size_t pendingLen;
+  size_t pendingCap;
+};
+
+/**\brief Create a decoder for a sequence of BSON documents.
+  *
+  * \a doc_type is as for cJSON_ParseBSON. Each document is handed to
+  * \a handler as a cJSON_StreamValue once its last byte arrives. If
+  * \a split is non-zero, top-level documents are not built: \a handler
+  * sees cJSON_StreamOpen, each top-level element as a cJSON_StreamItem
+  * (named by item->string), then cJSON_StreamClose. Only at Close is
+  * the container's type settled when \a doc_type leaves it open.
+  */
+cBSON_Stream* cJSON_CreateBSONStream(int doc_type, int split, cJSON_StreamHandler handler, void* ctx)
+{
+  cBSON_Stream* s;
+  if (!handler || !(s = (cBSON_Stream*)cJSON_malloc(sizeof(cBSON_Stream))))
+    return NULL;
+  memset(s, 0, sizeof(cBSON_Stream));
+  s->handler = handler;
+  s->ctx = ctx;
+  s->docType = doc_type;
+  s->split = split;
+  s->frames = s->local;
+  s->capacity = sizeof(s->local) / sizeof(s->local[0]);
+  return s;
+}
+
+/* Free whatever documents are partly built. */
+static void bson_stream_discard(cBSON_Stream* s)
+{
+  if (s->depth > 0 && !s->split)
+    cJSON_Delete(s->frames[0].node);
+  else if (s->depth > 1)
+    cJSON_Delete(s->frames[1].node);
+  s->depth = 0;
+}
+
+void cJSON_DeleteBSONStream(cBSON_Stream* s)
+{
+  if (!s)
+    return;
+  bson_stream_discard(s);
+  if (s->frames != s->local)
+    cJSON_free(s->frames);
+  if (s->pending)
+    cJSON_free(s->pending);
+  cJSON_free(s);
+}
+
+/* Return the size of the unit starting at \a buf, of which \a have
+ * bytes are here: 0 if that cannot be told yet, or -1 if the input
+ * is malformed.
+ */
+static ptrdiff_t bson_stream_unit(cBSON_Stream* s, const char* buf, size_t have)
+{
+  bson_stream_frame* frame;
+  const char* nul;
+  size_t avail;
+  size_t head;
+  ptrdiff_t size;
+  int itype;
+  if (!s->depth)
+    return 4; /* a document's length */
+  if (!have)
+    return 0;
+  frame = s->frames + s->depth - 1;
+  if (!(itype = buf[0] & 0xff))
+    return 1;
+  /* an element has to end before its document's terminator */
+  if (frame->remaining < 3)
+    return -1;
+  avail = frame->remaining - 1;
+  if (!(nul = (const char*)memchr(buf + 1, 0, (have < avail ? have : avail) - 1)))
+    return have < avail ? 0 : -1;
+  head = nul + 1 - buf;
+  if (itype == cBSON_Document || itype == cBSON_Array)
+    return avail - head >= 5 ? (ptrdiff_t)(head + 4) : -1;
+  if ((size = bson_value_size(itype, nul + 1, (have < avail ? have : avail) - head)) >= 0)
+    return head + size;
+  return have < avail ? 0 : -1;
+}
+
+/* Open a document of \a remaining more bytes, filled into \a node. */
+static int bson_stream_push(cBSON_Stream* s, cJSON* node, size_t remaining)
+{
+  bson_stream_frame* frame;
+  bson_stream_frame* frames = (bson_stream_frame*)bson_stack_grow(
+    s->frames, s->local, s->depth, &s->capacity, sizeof(bson_stream_frame));
+  if (!frames)
+    return 0;
+  s->frames = frames;
+  frame = s->frames + s->depth++;
+  frame->node = node;
+  frame->next = node ? &node->child : NULL;
+  frame->remaining = remaining;
+  return 1;
+}
+
+/* Finish the innermost document and pass on anything now complete. */
+static int bson_stream_close(cBSON_Stream* s)
+{
+  bson_stream_frame* frame = s->frames + s->depth - 1;
+  int type;
+  if (frame->remaining != 1)
+    return 0; /* the terminator came early */
+  --s->depth;
+  if (s->depth > 0)
+    return !s->split || s->depth > 1 || s->handler(s->ctx, cJSON_StreamItem, frame->node);
+  type = s->docType == cJSON_Array || (s->docType < cJSON_Array && s->allIndicesAreInts) ?
+    cJSON_Array : cJSON_Object;
+  if (s->split)
+    {
+    s->container.type = type;
+    return s->handler(s->ctx, cJSON_StreamClose, &s->container);
+    }
+  frame->node->type = type;
+  return s->handler(s->ctx, cJSON_StreamValue, frame->node);
+}
+
+/* Decode the complete unit of \a size bytes at \a buf. */
+static int bson_stream_take(cBSON_Stream* s, const char* buf, size_t size)
+{
+  bson_stream_frame* frame;
+  cJSON* node = NULL;
+  int32_t len;
+  int itype;
+  if (!s->depth)
+    { /* the start of a document */
+    memcpy(&len, buf, 4);
+    if (len < 5)
+      return 0;
+    s->allIndicesAreInts = 1;
+    s->lastKey = -1;
+    if (s->split)
+      {
+      s->container.type = s->docType == cJSON_Array ? cJSON_Array : cJSON_Object;
+      return bson_stream_push(s, NULL, (size_t)len - 4) &&
+        s->handler(s->ctx, cJSON_StreamOpen, &s->container);
+      }
+    if (!(node = s->docType == cJSON_Array ? cJSON_CreateArray() : cJSON_CreateObject()))
+      return 0;
+    if (bson_stream_push(s, node, (size_t)len - 4))
+      return 1;
+    cJSON_Delete(node);
+    return 0;
+    }
+
+  frame = s->frames + s->depth - 1;
+  if (!(itype = buf[0] & 0xff))
+    return bson_stream_close(s);
+  frame->remaining -= size;
+  if (s->depth == 1 && s->allIndicesAreInts)
+    { /* the same test bson_parse_doc applies */
+    char* dummy;
+    long idx = strtol(buf + 1, &dummy, 10);
+    if (!buf[1] || *dummy || idx <= s->lastKey)
+      s->allIndicesAreInts = 0;
+    else
+      s->lastKey = idx;
+    }
+
+  if (itype == cBSON_Document || itype == cBSON_Array)
+    {
+    cJSON*** prev;
+    char* key;
+    size_t keylen;
+    memcpy(&len, buf + size - 4, 4);
+    if (len < 5 || (size_t)len - 4 >= frame->remaining)
+      return 0;
+    frame->remaining -= (size_t)len - 4;
+    if (!(node = itype == cBSON_Array ? cJSON_CreateArray() : cJSON_CreateObject()))
+      return 0;
+    key = bson_parse_name(buf + 1, &keylen);
+    bson_set_name(node, key, keylen);
+    if (!frame->next)
+      { /* the root of a top-level element, linked nowhere until it is handed over */
+      if (bson_stream_push(s, node, (size_t)len - 4))
+        return 1;
+      cJSON_Delete(node);
+      return 0;
+      }
+    prev = &frame->next;
+    cBSON_LinkSibling(prev, node);
+    return bson_stream_push(s, node, (size_t)len - 4);
+    }
+  if (frame->next)
+    return bson_parse_element(itype, buf + 1, size - 1, &frame->next) != 0;
+  else
+    { /* a top-level element of a document being split */
+    cJSON** link = &node;
+    return bson_parse_element(itype, buf + 1, size - 1, &link) &&
+      s->handler(s->ctx, cJSON_StreamItem, node);
+    }
+}
+
+/* Move up to \a want bytes from the piece at \a *data to the end of
+ * the pending unit.
+ */
+static int bson_stream_gather(cBSON_Stream* s, const char** data, const char* end, size_t want)
+{
+  size_t have = s->pendingLen - s->pendingPos;
+  size_t n = (size_t)(end - *data) < want ? (size_t)(end - *data) : want;
+  if (s->pendingPos)
+    {
+    memmove(s->pending, s->pending + s->pendingPos, have);
+    s->pendingPos = 0;
+    s->pendingLen = have;
+    }
+  if (have + n > s->pendingCap)
+    {
+    size_t cap = s->pendingCap ? s->pendingCap : 64;
+    char* grown;
+    while (cap < have + n)
+      cap *= 2;
+    if (!(grown = (char*)cJSON_malloc(cap)))
+      return 0;
+    if (s->pending)
+      {
+      memcpy(grown, s->pending, have);
+      cJSON_free(s->pending);
+      }
+    s->pending = grown;
+    s->pendingCap = cap;
+    }
+  memcpy(s->pending + have, *data, n);
+  s->pendingLen += n;
+  *data += n;
+  return 1;
+}
+
+/**\brief Decode the next \a len bytes of the stream.
+  *
+  * Returns 0 once the input is malformed or the handler has
+  * stopped the stream; every later call then fails too.
+  */
+int cJSON_BSONStreamFeed(cBSON_Stream* s, const char* data, size_t len)
+{
+  const char* end = data + len;
+  ptrdiff_t size;
+  if (s->failed)
+    return 0;
+  for (;;)
+    {
+    size_t have = s->pendingLen - s->pendingPos;
+    if (have)
+      { /* carry on with the unit begun in an earlier piece */
+      const char* buf = s->pending + s->pendingPos;
+      if ((size = bson_stream_unit(s, buf, have)) < 0)
+        break;
+      if (size && (size_t)size <= have)
+        {
+        s->pendingPos += size;
+        if (!bson_stream_take(s, buf, size))
+          break;
+        continue;
+        }
+      if (data == end)
+        return 1;
+      /* while the size is unknown, take more a little at a time */
+      if (!bson_stream_gather(s, &data, end, size ? size - have : (have < 64 ? 64 : have)))
+        break;
+      continue;
+      }
+    if (data == end)
+      return 1;
+    if ((size = bson_stream_unit(s, data, end - data)) < 0)
+      break;
+    if (size && (size_t)size <= (size_t)(end - data))
+      {
+      if (!bson_stream_take(s, data, size))
+        break;
+      data += size;
+      continue;
+      }
+    if (!bson_stream_gather(s, &data, end, end - data))
+      break;
+    }
+  bson_stream_discard(s);
+  s->failed = 1;
+  return 0;
+}
+
+/**\brief Call at the end of the input.
+  *
+  * Returns 0 if it stopped in the middle of a document.
+  */
+int cJSON_BSONStreamFinish(cBSON_Stream* s)
+{
+  return !s->failed && !s->depth && s->pendingPos == s->pendingLen;
+}
+
+/* Diffing works on the raw bytes: elements whose type and value bytes
+ * are identical (whole subdocuments included) are skipped with one
+ * memcmp, and only values that differ are decoded into cJSON. A
+ * document's elements are listed (type, name and value location)
+ * but not decoded, so the work follows the changed documents.
+ */
+typedef struct bson_diff_elem
+{
+  int type;
+  const char* name;  /* NUL-terminated, followed by the value */
+  const char* value;
+  size_t size;       /* of the value */
+  size_t avail;      /* bytes from name to the end of its document */
+} bson_diff_elem;
+
+typedef struct bson_differ
+{
+  cJSON* patches;
+  cJSON* last;
+  char* path;        /* JSON Pointer to the value being compared */
+  size_t len;
+  size_t cap;
+  int depth;
+  int failed;
+} bson_differ;
+
+/* List the elements of the document \a doc (\a size bytes, already
+ * bounds-checked by the caller). Returns 0 if it is malformed or
+ * memory runs out.
+ */
+static int bson_diff_scan(const char* doc, size_t size, bson_diff_elem** elems, size_t* count)
+{
+  const char* loc = doc + 4;
+  const char* end = doc + size - 1;
+  size_t cap = 0;
+  bson_diff_elem* grown;
+  const char* nul;
+  ptrdiff_t vsize;
+  *elems = NULL;
+  *count = 0;
+  if (*end)
+    return 0;
+  while (loc < end)
+    {
+    int itype = *(loc++) & 0xff;
+    if (!(nul = (const char*)memchr(loc, 0, end - loc)) ||
+      (vsize = bson_value_size(itype, nul + 1, end - nul - 1)) < 0)
+      return 0;
+    if (*count == cap)
+      {
+      cap = cap ? 2 * cap : 16;
+      if (!(grown = (bson_diff_elem*)cJSON_malloc(cap * sizeof(bson_diff_elem))))
+        return 0;
+      if (*elems)
+        {
+        memcpy(grown, *elems, *count * sizeof(bson_diff_elem));
+        cJSON_free(*elems);
+        }
+      *elems = grown;
+      }
+    (*elems)[*count].type = itype;
+    (*elems)[*count].name = loc;
+    (*elems)[*count].value = nul + 1;
+    (*elems)[*count].size = (size_t)vsize;
+    (*elems)[*count].avail = doc + size - loc;
+    ++*count;
+    loc = nul + 1 + vsize;
+    }
+  return 1;
+}
+
+/* Object members match the way cJSONUtils_GeneratePatches matches
+ * them (see cJSONUtils_KeyCompare), with the first of duplicate names
+ * winning. Wide documents get a hash table of element indices (-1 is
+ * empty).
+ */
+static long* bson_diff_index(const bson_diff_elem* elems, size_t count, size_t* mask)
+{
+  size_t size = 16, i, j;
+  long* slots;
+  if (count <= 8)
+    return NULL;
+  while (size < 2 * count)
+    size *= 2;
+  if (!(slots = (long*)cJSON_malloc(size * sizeof(long))))
+    return NULL; /* just scan */
+  memset(slots, 0xff, size * sizeof(long));
+  *mask = size - 1;
+  for (j = 0; j < count; ++j)
+    {
+    for (i = cJSONUtils_KeyHash(elems[j].name) & *mask; slots[i] >= 0; i = (i + 1) & *mask)
+      if (!cJSONUtils_KeyCompare(elems[slots[i]].name, elems[j].name))
+        break;
+    if (slots[i] < 0)
+      slots[i] = (long)j;
+    }
+  return slots;
+}
+
+static const bson_diff_elem* bson_diff_find(
+  const bson_diff_elem* elems, size_t count, const long* slots, size_t mask, const char* key)
+{
+  size_t i;
+  if (!slots)
+    {
+    for (i = 0; i < count; ++i)
+      if (!cJSONUtils_KeyCompare(elems[i].name, key))
+        return elems + i;
+    return NULL;
+    }
+  for (i = cJSONUtils_KeyHash(key) & mask; slots[i] >= 0; i = (i + 1) & mask)
+    if (!cJSONUtils_KeyCompare(elems[slots[i]].name, key))
+      return elems + slots[i];
+  return NULL;
+}
+
+/* Append "/key" (pointer-encoded) or "/index" to the path. */
+static int bson_diff_push(bson_differ* d, const char* key, size_t index)
+{
+  size_t need = key ? 2 * strlen(key) + 2 : 24;
+  char* grown;
+  if (d->len + need > d->cap)
+    {
+    size_t cap = d->cap ? d->cap : 64;
+    while (cap < d->len + need)
+      cap *= 2;
+    if (!(grown = (char*)cJSON_malloc(cap)))
+      {
+      d->failed = 1;
+      return 0;
+      }
+    memcpy(grown, d->path, d->len + 1);
+    cJSON_free(d->path);
+    d->path = grown;
+    d->cap = cap;
+    }
+  if (!key)
+    {
+    d->len += sprintf(d->path + d->len, "/%lu", (unsigned long)index);
+    return 1;
+    }
+  d->path[d->len++] = '/';
+  for (; *key; ++key)
+    {
+    if (*key == '~' || *key == '/')
+      {
+      d->path[d->len++] = '~';
+      d->path[d->len++] = *key == '~' ? '0' : '1';
+      }
+    else
+      d->path[d->len++] = *key;
+    }
+  d->path[d->len] = '\0';
+  return 1;
+}
+
+static void bson_diff_pop(bson_differ* d, size_t len)
+{
+  d->len = len;
+  d->path[len] = '\0';
+}
+
+/* Append {op, path, value} to the patches; \a value is consumed. */
+static void bson_diff_emit(bson_differ* d, const char* op, cJSON* value)
+{
+  cJSON* patch = cJSON_CreateObject();
+  if (!patch)
+    {
+    cJSON_Delete(value);
+    d->failed = 1;
+    return;
+    }
+  cJSON_AddItemToObject(patch, "op", cJSON_CreateString(op));
+  cJSON_AddItemToObject(patch, "path", cJSON_CreateStringWithLength(d->path, d->len));
+  if (value)
+    cJSON_AddItemToObject(patch, "value", value);
+  if (d->last)
+    {
+    d->last->next = patch;
+    patch->prev = d->last;
+    }
+  else
+    d->patches->child = patch;
+  d->last = patch;
+}
+
+/* Decode one element's value as cJSON_ParseBSON would. */
+static cJSON* bson_diff_decode(bson_differ* d, const bson_diff_elem* e)
+{
+  cJSON* node = NULL;
+  cJSON** slot = &node;
+  cJSON*** prev = &slot;
+  if (!bson_parse_element(e->type, e->name, e->avail, prev) || !node)
+    d->failed = 1; /* not a type we can read */
+  return node;
+}
+
+/* Whether two decoded values (neither an object) are equal the way
+ * cJSONUtils_GeneratePatches compares them.
+ */
+static int bson_diff_same(cJSON* a, cJSON* b)
+{
+  if ((a->type & 0xff) != (b->type & 0xff))
+    return 0;
+  switch ((a->type)&0xff)
+    {
+  case cJSON_Number:
+  case cJSON_Int32:
+    return a->valueint == b->valueint && a->valuedouble == b->valuedouble;
+  case cJSON_String:
+  case cJSON_Binary:
+  case cJSON_UUID:
+  case cJSON_ObjectId:
+  case cJSON_UTCTime:
+  case cJSON_Timestamp:
+  case cJSON_Decimal128:
+    return a->valueint == b->valueint && bson_value_length(a) == bson_value_length(b) &&
+      !memcmp(a->valuestring, b->valuestring, bson_value_length(a));
+  case cJSON_Array: /* a regular expression */
+    for (a = a->child, b = b->child; a && b; a = a->next, b = b->next)
+      if (!bson_diff_same(a, b))
+        return 0;
+    return !a && !b;
+  case cJSON_Object: /* a DB pointer or code with scope, whose bytes differ */
+    return 0;
+    }
+  return 1;
+}
+
+static void bson_diff_doc(bson_differ* d, const char* a, size_t alen, const char* b, size_t blen, int isArray);
+
+static void bson_diff_value(bson_differ* d, const bson_diff_elem* ea, const bson_diff_elem* eb)
+{
+  int docA = ea->type == cBSON_Document || ea->type == cBSON_Array;
+  int docB = eb->type == cBSON_Document || eb->type == cBSON_Array;
+  cJSON* va;
+  cJSON* vb;
+  if (ea->type == eb->type && ea->size == eb->size && !memcmp(ea->value, eb->value, ea->size))
+    return; /* identical bytes, however deep */
+  if (docA && ea->type == eb->type)
+    {
+    bson_diff_doc(d, ea->value, ea->size, eb->value, eb->size, ea->type == cBSON_Array);
+    return;
+    }
+  if (!(vb = bson_diff_decode(d, eb)))
+    return;
+  if (docA || docB)
+    {
+    bson_diff_emit(d, "replace", vb);
+    return;
+    }
+  if (!(va = bson_diff_decode(d, ea)))
+    {
+    cJSON_Delete(vb);
+    return;
+    }
+  if (bson_diff_same(va, vb))
+    cJSON_Delete(vb);
+  else
+    bson_diff_emit(d, "replace", vb);
+  cJSON_Delete(va);
+}
+
+static void bson_diff_doc(bson_differ* d, const char* a, size_t alen, const char* b, size_t blen, int isArray)
+{
+  bson_diff_elem* ea = NULL;
+  bson_diff_elem* eb = NULL;
+  size_t na, nb, i, len = d->len, amask = 0, bmask = 0;
+  long* aslots = NULL;
+  long* bslots = NULL;
+  const bson_diff_elem* other;
+  if (d->depth >= cJSON_GetNestingLimit() || !bson_diff_scan(a, alen, &ea, &na) || !bson_diff_scan(b, blen, &eb, &nb))
+    {
+    d->failed = 1;
+    goto done;
+    }
+  ++d->depth;
+  if (isArray)
+    {
+    for (i = 0; i < na && i < nb && !d->failed; ++i)
+      {
+      if (!bson_diff_push(d, NULL, i))
+        break;
+      bson_diff_value(d, ea + i, eb + i);
+      bson_diff_pop(d, len);
+      }
+    /* surplus items go from the end, so each index stays valid */
+    for (i = na; i > nb && !d->failed && bson_diff_push(d, NULL, i - 1); --i)
+      {
+      bson_diff_emit(d, "remove", NULL);
+      bson_diff_pop(d, len);
+      }
+    for (i = na; i < nb && !d->failed && bson_diff_push(d, "-", 0); ++i)
+      {
+      bson_diff_emit(d, "add", bson_diff_decode(d, eb + i));
+      bson_diff_pop(d, len);
+      }
+    }
+  else
+    {
+    /* documents usually keep their keys in order; match by position if so */
+    for (i = 0; i < na && i < nb && !strcmp(ea[i].name, eb[i].name); ++i)
+      ;
+    if (na == nb && i == na)
+      {
+      for (i = 0; i < na && !d->failed && bson_diff_push(d, ea[i].name, 0); ++i)
+        {
+        bson_diff_value(d, ea + i, eb + i);
+        bson_diff_pop(d, len);
+        }
+      }
+    else
+      {
+      aslots = bson_diff_index(ea, na, &amask);
+      bslots = bson_diff_index(eb, nb, &bmask);
+      for (i = 0; i < na && !d->failed; ++i)
+        if (!bson_diff_find(eb, nb, bslots, bmask, ea[i].name) && bson_diff_push(d, ea[i].name, 0))
+          {
+          bson_diff_emit(d, "remove", NULL);
+          bson_diff_pop(d, len);
+          }
+      for (i = 0; i < nb && !d->failed && bson_diff_push(d, eb[i].name, 0); ++i)
+        {
+        if ((other = bson_diff_find(ea, na, aslots, amask, eb[i].name)))
+          bson_diff_value(d, other, eb + i);
+        else
+          bson_diff_emit(d, "add", bson_diff_decode(d, eb + i));
+        bson_diff_pop(d, len);
+        }
+      }
+    }
+  --d->depth;
+done:
+  cJSON_free(ea);
+  cJSON_free(eb);
+  cJSON_free(aslots);
+  cJSON_free(bslots);
+}
+
+/**\brief Diff two BSON documents into a JSON Patch (RFC 6902).
+  *
+  * The result is the array of patches that turns \a a into \a b,
+  * as cJSONUtils_GeneratePatches would produce from the documents
+  * decoded with cJSON_ParseBSON(..., cJSON_Object), except that
+  * differing values other than documents and arrays are replaced
+  * whole. Encode it with cJSON_PrintBSON to get the patch as BSON.
+  *
+  * Both buffers are walked together; byte-identical elements and
+  * subdocuments are skipped without being decoded, so the cost
+  * grows with the amount of change rather than with the documents.
+  * Returns NULL if either document is malformed, nests too deeply,
+  * or has a changed value of a type cJSON_ParseBSON cannot read.
+  */
+cJSON* cBSON_Diff(const char* a, size_t alen, const char* b, size_t blen)
+{
+  bson_differ d;
+  int32_t len;
+  memset(&d, 0, sizeof(d));
+  if (!a || !b || alen < 5 || blen < 5)
+    return NULL;
+  memcpy(&len, a, 4);
+  if ((size_t)len != alen)
+    return NULL;
+  memcpy(&len, b, 4);
+  if ((size_t)len != blen ||
+    !(d.path = (char*)cJSON_malloc(d.cap = 64)) ||
+    !(d.patches = cJSON_CreateArray()))
+    {
+    cJSON_free(d.path);
+    return NULL;
+    }
+  d.path[0] = '\0';
+  if (alen != blen || memcmp(a, b, alen))
+    bson_diff_doc(&d, a, alen, b, blen, 0);
+  cJSON_free(d.path);
+  if (d.failed)
+    {
+    cJSON_Delete(d.patches);
+    return NULL;
+    }
+  return d.patches;
+}
+
+/* Patches are applied to a copy of the document one at a time. Each
+ * one finds its target by walking the element headers along its path,
+ * then splices: the bytes around the change are moved as they are, the
+ * new value is encoded straight into the gap, and the lengths of the
+ * enclosing documents are adjusted. A value that keeps its size is
+ * overwritten in place and nothing moves.
+ */
+typedef struct bson_patcher
+{
+  char* buf;
+  size_t len;
+  size_t cap;
+  size_t local[16];
+  size_t* docs;     /* offsets of the documents around the target, outermost first */
+  int depth;
+  int capacity;
+} bson_patcher;
+
+typedef struct bson_patch_target
+{
+  size_t doc;       /* offset of the parent document */
+  int isArray;
+  size_t at;        /* offset of the target element, or where a new one goes */
+  size_t size;      /* of the target element, or 0 if there is none */
+  size_t index;     /* position of \a at among the parent's elements */
+  char* key;        /* the last reference token, decoded */
+} bson_patch_target;
+
+/* A value to write: a cJSON item, or the raw bytes of a BSON value. */
+typedef struct bson_patch_value
+{
+  int type;
+  cJSON* item;
+  const char* bytes;
+  size_t size;
+} bson_patch_value;
+
+/* Size of the element at \a at of the document at \a doc (type byte,
+ * name and value), 0 at the document's terminator, or -1 if malformed.
+ */
+static ptrdiff_t bson_patch_element(const bson_patcher* p, size_t doc, size_t at)
+{
+  int32_t len;
+  const char* end;
+  const char* nul;
+  ptrdiff_t size;
+  memcpy(&len, p->buf + doc, 4);
+  end = p->buf + doc + len - 1;
+  if (p->buf + at >= end)
+    return p->buf + at == end ? 0 : -1;
+  if (!(nul = (const char*)memchr(p->buf + at + 1, 0, end - (p->buf + at + 1))) ||
+    (size = bson_value_size(p->buf[at] & 0xff, nul + 1, end - nul - 1)) < 0)
+    return -1;
+  return nul + 1 + size - (p->buf + at);
+}
+
+/* Resolve the JSON Pointer \a path to its parent document and the
+ * element it names there, matching keys the way cJSONUtils_GetPointer
+ * does. Leaves the enclosing documents in p->docs.
+ */
+static int bson_patch_locate(bson_patcher* p, const char* path, bson_patch_target* t)
+{
+  const char* end;
+  char* key;
+  size_t want = 0, at;
+  ptrdiff_t size;
+  int32_t len;
+  int isArray = 0, itype;
+  memset(t, 0, sizeof(*t));
+  p->depth = 0;
+  if (*path != '/')
+    return 0; /* the whole document can't be replaced in place */
+  for (;;)
+    {
+    size_t* docs = (size_t*)bson_stack_grow(p->docs, p->local, p->depth, &p->capacity, sizeof(size_t));
+    if (!docs)
+      return 0;
+    p->docs = docs;
+    p->docs[p->depth++] = t->doc;
+    ++path;
+    if (!(end = strchr(path, '/')))
+      end = path + strlen(path);
+    cJSON_free(t->key);
+    if (!(t->key = key = (char*)cJSON_malloc(end - path + 1)))
+      return 0;
+    for (; path < end; ++path)
+      *key++ = *path != '~' ? *path : (*++path == '0' ? '~' : '/');
+    *key = '\0';
+    if (isArray)
+      {
+      char* dummy;
+      if (*end || strcmp(t->key, "-"))
+        {
+        want = (size_t)strtoul(t->key, &dummy, 10);
+        if (!*t->key || *dummy)
+          return 0;
+        }
+      else
+        want = (size_t)-1; /* the end */
+      }
+    for (at = t->doc + 4, t->index = 0; (size = bson_patch_element(p, t->doc, at)) > 0; at += size, ++t->index)
+      if (isArray ? t->index == want : !cJSONUtils_KeyCompare(p->buf + at + 1, t->key))
+        break;
+    if (size < 0)
+      return 0;
+    t->at = at;
+    t->size = (size_t)size;
+    t->isArray = isArray;
+    if (!*end)
+      return 1;
+    /* go on down into a subdocument */
+    itype = size ? p->buf[at] & 0xff : 0;
+    if (itype != cBSON_Document && itype != cBSON_Array)
+      return 0;
+    at += strlen(p->buf + at + 1) + 2;
+    memcpy(&len, p->buf + at, 4);
+    if (p->buf[at + len - 1])
+      return 0;
+    t->doc = at;
+    isArray = itype == cBSON_Array;
+    }
+}
+
+/* Replace the \a oldSize bytes at \a at with room for \a newSize,
+ * fixing the lengths of the documents around them.
+ */
+static char* bson_patch_splice(bson_patcher* p, size_t at, size_t oldSize, size_t newSize)
+{
+  size_t len = p->len - oldSize + newSize;
+  char* grown;
+  int32_t dlen;
+  int i;
+  if (len > 0x7fffffff)
+    return NULL;
+  if (len > p->cap)
+    {
+    size_t cap = 2 * p->cap > len ? 2 * p->cap : len;
+    if (!(grown = (char*)cJSON_malloc(cap)))
+      return NULL;
+    memcpy(grown, p->buf, at);
+    memcpy(grown + at + newSize, p->buf + at + oldSize, p->len - at - oldSize);
+    cJSON_free(p->buf);
+    p->buf = grown;
+    p->cap = cap;
+    }
+  else if (oldSize != newSize)
+    memmove(p->buf + at + newSize, p->buf + at + oldSize, p->len - at - oldSize);
+  p->len = len;
+  for (i = 0; oldSize != newSize && i < p->depth; ++i)
+    {
+    memcpy(&dlen, p->buf + p->docs[i], 4);
+    dlen += (int32_t)newSize - (int32_t)oldSize;
+    memcpy(p->buf + p->docs[i], &dlen, 4);
+    }
+  return p->buf + at;
+}
+
+/* Write an element named \a key (or numbered \a index when \a key is
+ * NULL) into the writer; measure it first with a writer of no capacity.
+ */
+static void bson_patch_put(bson_writer* w, const char* key, size_t index, const bson_patch_value* v)
+{
+  if (key)
+    {
+    bson_put_byte(w, (char)v->type);
+    bson_put(w, key, strlen(key) + 1);
+    }
+  else
+    bson_put_key(w, v->type, NULL, &index);
+  if (v->item)
+    bson_write_value(v->item, v->type, w);
+  else
+    bson_put(w, v->bytes, v->size);
+}
+
+/* Put a new element in place of the \a oldSize bytes at \a at. */
+static int bson_patch_write(bson_patcher* p, size_t at, size_t oldSize, const char* key, size_t index, const bson_patch_value* v)
+{
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  bson_patch_put(&w, key, index, v);
+  if (!(w.buf = bson_patch_splice(p, at, oldSize, w.len)))
+    return 0;
+  w.cap = w.len;
+  w.len = 0;
+  bson_patch_put(&w, key, index, v);
+  return 1;
+}
+
+/* Renumber the array elements from \a at (position \a index) on,
+ * after one was inserted or removed before them.
+ */
+static int bson_patch_rekey(bson_patcher* p, size_t doc, size_t at, size_t index)
+{
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  size_t from, end = at;
+  ptrdiff_t size;
+  int pass;
+  for (pass = 0; pass < 2; ++pass)
+    {
+    size_t key = index;
+    w.len = 0;
+    for (from = at; (size = bson_patch_element(p, doc, from)) > 0; from += size)
+      {
+      size_t head = strlen(p->buf + from + 1) + 2;
+      bson_put_key(&w, p->buf[from] & 0xff, NULL, &key);
+      bson_put(&w, p->buf + from + head, size - head);
+      }
+    if (size < 0)
+      break;
+    end = from;
+    if (!pass && !(w.buf = (char*)cJSON_malloc(w.cap = w.len ? w.len : 1)))
+      return 0;
+    }
+  if (size < 0 || !bson_patch_splice(p, at, end - at, w.len))
+    {
+    cJSON_free(w.buf);
+    return 0;
+    }
+  memcpy(p->buf + at, w.buf, w.len);
+  cJSON_free(w.buf);
+  return 1;
+}
+
+static int bson_patch_remove(bson_patcher* p, bson_patch_target* t)
+{
+  if (!t->size || !bson_patch_splice(p, t->at, t->size, 0))
+    return 0;
+  return !t->isArray || bson_patch_rekey(p, t->doc, t->at, t->index);
+}
+
+/* "add" and "replace": an existing member keeps its name and place. */
+static int bson_patch_add(bson_patcher* p, bson_patch_target* t, const bson_patch_value* v, int replace)
+{
+  bson_writer w = { NULL, 0, 0, 0, NULL };
+  size_t keylen;
+  if (!t->isArray)
+    {
+    if (t->size)
+      { /* keep the member's own name, which the splice may move */
+      cJSON_free(t->key);
+      if (!(t->key = cJSON_strdup(p->buf + t->at + 1, &keylen, 0)))
+        return 0;
+      }
+    return bson_patch_write(p, t->at, t->size, t->key, 0, v);
+    }
+  if (!t->size || replace)
+    return bson_patch_write(p, t->at, t->size, NULL, t->index, v);
+  /* inserting before an element moves the rest up one */
+  bson_patch_put(&w, NULL, t->index, v);
+  return bson_patch_write(p, t->at, 0, NULL, t->index, v) &&
+    bson_patch_rekey(p, t->doc, t->at + w.len, t->index + 1);
+}
+
+/* Copy the value of the element at the target, for "move" and "copy". */
+static char* bson_patch_take(const bson_patcher* p, const bson_patch_target* t, bson_patch_value* v)
+{
+  size_t head = strlen(p->buf + t->at + 1) + 2;
+  char* bytes;
+  v->type = p->buf[t->at] & 0xff;
+  v->item = NULL;
+  v->size = t->size - head;
+  if (!(bytes = (char*)cJSON_malloc(v->size ? v->size : 1)))
+    return NULL;
+  memcpy(bytes, p->buf + t->at + head, v->size);
+  v->bytes = bytes;
+  return bytes;
+}
+
+/* "test": the target must equal the value as cJSONUtils compares them. */
+static int bson_patch_test(bson_patcher* p, bson_patch_target* t, cJSON* value)
+{
+  cJSON* node = NULL;
+  cJSON** slot = &node;
+  cJSON* diff;
+  int same;
+  if (!t->size || !value ||
+    !bson_parse_element(p->buf[t->at] & 0xff, p->buf + t->at + 1, p->len - t->at - 1, &slot) || !node)
+    {
+    cJSON_Delete(node);
+    return 0;
+    }
+  diff = cJSONUtils_GeneratePatches(node, value);
+  same = diff && !diff->child;
+  cJSON_Delete(diff);
+  cJSON_Delete(node);
+  return same;
+}
+
+static int bson_patch_apply(bson_patcher* p, cJSON* patch)
+{
+  cJSON* op = cJSON_GetObjectItem(patch, "op");
+  cJSON* path = cJSON_GetObjectItem(patch, "path");
+  cJSON* from = cJSON_GetObjectItem(patch, "from");
+  cJSON* value = cJSON_GetObjectItem(patch, "value");
+  bson_patch_target t;
+  bson_patch_value v;
+  char* bytes = NULL;
+  int ok = 0;
+  memset(&t, 0, sizeof(t));
+  if (!op || !path || !op->valuestring || !path->valuestring)
+    return 0;
+  if (!strcmp(op->valuestring, "test"))
+    ok = bson_patch_locate(p, path->valuestring, &t) && bson_patch_test(p, &t, value);
+  else if (!strcmp(op->valuestring, "remove"))
+    ok = bson_patch_locate(p, path->valuestring, &t) && bson_patch_remove(p, &t);
+  else if (!strcmp(op->valuestring, "add") || !strcmp(op->valuestring, "replace"))
+    {
+    v.item = value;
+    v.bytes = NULL;
+    v.size = 0;
+    ok = value && (v.type = bson_item_tag(value)) &&
+      bson_patch_locate(p, path->valuestring, &t) &&
+      bson_patch_add(p, &t, &v, op->valuestring[0] == 'r');
+    }
+  else if (!strcmp(op->valuestring, "move") || !strcmp(op->valuestring, "copy"))
+    {
+    ok = from && from->valuestring &&
+      bson_patch_locate(p, from->valuestring, &t) && t.size &&
+      (bytes = bson_patch_take(p, &t, &v)) &&
+      (op->valuestring[0] == 'c' || bson_patch_remove(p, &t));
+    cJSON_free(t.key);
+    t.key = NULL;
+    ok = ok && bson_patch_locate(p, path->valuestring, &t) &&
+      bson_patch_add(p, &t, &v, 0);
+    cJSON_free(bytes);
+    }
+  cJSON_free(t.key);
+  return ok;
+}
+
+/**\brief Apply a JSON Patch (RFC 6902) array to a BSON document.
+  *
+  * Returns the patched document (free it with cJSON_DeleteBSON) and
+  * its size in \a bson_size_out, leaving \a bson as it was. Untouched
+  * bytes are copied as they are and only the values the patches bring
+  * in are encoded, so the cost is mostly memcpy. Paths resolve as in
+  * cJSONUtils_ApplyPatches, with the top level taken as a document;
+  * members that are added or replaced keep their place if they exist.
+  * Returns NULL if the document is malformed or any patch fails
+  * (including a "test"), or for a patch of the whole document.
+  */
+char* cBSON_ApplyPatches(const char* bson, size_t bson_size, cJSON* patches, size_t* bson_size_out)
+{
+  bson_patcher p;
+  int32_t len;
+  cJSON* patch;
+  *bson_size_out = 0;
+  if (!bson || bson_size < 5 || bson_size > 0x7fffffff || !patches || patches->type != cJSON_Array)
+    return NULL;
+  memcpy(&len, bson, 4);
+  if ((size_t)len != bson_size || bson[bson_size - 1])
+    return NULL;
+  memset(&p, 0, sizeof(p));
+  p.docs = p.local;
+  p.capacity = sizeof(p.local) / sizeof(p.local[0]);
+  p.cap = bson_size + bson_size / 8 + 64;
+  if (!(p.buf = (char*)cJSON_malloc(p.cap)))
+    return NULL;
+  memcpy(p.buf, bson, bson_size);
+  p.len = bson_size;
+  for (patch = patches->child; patch; patch = patch->next)
+    if (!bson_patch_apply(&p, patch))
+      {
+      cJSON_free(p.buf);
+      p.buf = NULL;
+      break;
+      }
+  if (p.docs != p.local)
+    cJSON_free(p.docs);
+  if (p.buf)
+    *bson_size_out = p.len;
+  return p.buf;
+}
+
+/* Fingerprints hash values as cJSON_ParseBSON would present them, so
+ * that a tree and its encoding agree: every number is hashed as a
+ * double, UUIDs as their 16 bytes whether they are stored as binary or
+ * spelled out in a string, and other binary data as the hexadecimal
+ * string the parser makes of it unless extended types are in use.
+ * Values are combined wyhash-style, with 64x64->128 bit multiplies.
+ */
+#define bson_fp_p0 0xa0761d6478bd642fULL
+#define bson_fp_p1 0xe7037ed1a0b428dbULL
+#define bson_fp_p2 0x8ebc6af09c88c6e3ULL
+#define bson_fp_p3 0x589965cc75374cc3ULL
+
+enum
+{
+  bson_fp_is_null = 1,
+  bson_fp_is_false,
+  bson_fp_is_true,
+  bson_fp_is_number,
+  bson_fp_is_string,
+  bson_fp_is_uuid,
+  bson_fp_is_binary,
+  bson_fp_is_array,
+  bson_fp_is_object,
+  bson_fp_is_object_id,
+  bson_fp_is_utc_time,
+  bson_fp_is_timestamp,
+  bson_fp_is_decimal128
+};
+
+typedef struct bson_fp_frame
+{
+  uint64_t h;        /* running hash of the members, in order */
+  uint64_t sum;      /* order-free sum of the members */
+  uint64_t key;      /* hash of this document's own name in its parent */
+  size_t count;
+  int isObject;
+  cJSON* next;       /* tree walk: the next child */
+  const char* at;    /* buffer walk: the next element... */
+  const char* end;   /* ...up to the end of the document */
+} bson_fp_frame;
+
+typedef struct bson_fingerprinter
+{
+  bson_fp_frame local[16];
+  bson_fp_frame* frames;
+  int depth;
+  int capacity;
+  int unordered;
+  uint64_t result;
+} bson_fingerprinter;
+
+static uint64_t bson_fp_mum(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+  uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), lo, hi;
+  uint64_t c = t < rl;
+  lo = t + (rm1 << 32);
+  c += lo < t;
+  hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  return lo ^ hi;
+#endif
+}
+
+static uint64_t bson_fp_mix(uint64_t a, uint64_t b)
+{
+  return bson_fp_mum(a ^ bson_fp_p0, b ^ bson_fp_p1);
+}
+
+static uint64_t bson_fp_read(const char* p, size_t n)
+{
+  uint64_t v = 0;
+  memcpy(&v, p, n);
+  return v;
+}
+
+static uint64_t bson_fp_bytes(int kind, const char* p, size_t n)
+{
+  uint64_t h = bson_fp_mix((uint64_t)kind * bson_fp_p2, (uint64_t)n);
+  uint64_t a = 0, b = 0;
+  for (; n > 16; p += 16, n -= 16)
+    h = bson_fp_mum(bson_fp_read(p, 8) ^ bson_fp_p1, bson_fp_read(p + 8, 8) ^ h);
+  if (n > 8)
+    {
+    a = bson_fp_read(p, 8);
+    b = bson_fp_read(p + n - 8, 8);
+    }
+  else if (n >= 4)
+    {
+    a = bson_fp_read(p, 4);
+    b = bson_fp_read(p + n - 4, 4);
+    }
+  else if (n > 0)
+    a = ((uint64_t)(uint8_t)p[0] << 16) | ((uint64_t)(uint8_t)p[n >> 1] << 8) | (uint8_t)p[n - 1];
+  return bson_fp_mum(bson_fp_p3 ^ n, bson_fp_mum(a ^ bson_fp_p2, b ^ h));
+}
+
+static uint64_t bson_fp_number(double val)
+{
+  uint64_t bits;
+  if (val == 0)
+    val = 0; /* -0 is 0 */
+  else if (val != val)
+    val = NAN;
+  memcpy(&bits, &val, sizeof(bits));
+  return bson_fp_mix(bson_fp_is_number * bson_fp_p2, bits);
+}
+
+/* Strings in the form of a UUID hash as the UUID they encode. */
+static uint64_t bson_fp_string(const char* str, size_t len)
+{
+  if (len == 36 && !str[36] && bson_is_string_uuid(str))
+    {
+    char uuid[21];
+    bson_uuid_value_from_string(uuid, str);
+    return bson_fp_bytes(bson_fp_is_uuid, uuid + 5, 16);
+    }
+  return bson_fp_bytes(bson_fp_is_string, str, len);
+}
+
+static uint64_t bson_fp_binary(const char* data, size_t len, int subtype)
+{
+  char local[128];
+  char* hex = local;
+  uint64_t h;
+  if (subtype == cBSON_UUID && len == 16)
+    return bson_fp_bytes(bson_fp_is_uuid, data, 16);
+  if (shouldUseExtendedTypes)
+    return bson_fp_mix(bson_fp_bytes(bson_fp_is_binary, data, len), (uint64_t)subtype);
+  if (2 * len > sizeof(local) && !(hex = (char*)cJSON_malloc(2 * len)))
+    return 0;
+  encode_hex_string((const uint8_t*)data, len, hex);
+  h = bson_fp_bytes(bson_fp_is_string, hex, 2 * len);
+  if (hex != local)
+    cJSON_free(hex);
+  return h;
+}
+
+/* ObjectIds hash as the hexadecimal strings they are parsed into,
+ * unless extended types are on.
+ */
+static uint64_t bson_fp_object_id(const char* data)
+{
+  char hex[24];
+  if (shouldUseExtendedTypes)
+    return bson_fp_bytes(bson_fp_is_object_id, data, 12);
+  encode_hex_string((const uint8_t*)data, 12, hex);
+  return bson_fp_bytes(bson_fp_is_string, hex, sizeof(hex));
+}
+
+/* An extended type holding its encoded bytes, 0 if it has too few. */
+static uint64_t bson_fp_extended(cJSON* item, int kind, size_t size)
+{
+  return item->valuestring && bson_value_length(item) == size ? bson_fp_bytes(kind, item->valuestring, size) : 0;
+}
+
+/* Fold a member into the document being hashed. Array elements
+ * always count in order; object members only when asked to.
+ */
+static void bson_fp_add(bson_fp_frame* f, int unordered, uint64_t key, uint64_t value)
+{
+  ++f->count;
+  if (!f->isObject)
+    f->h = bson_fp_mix(f->h, value);
+  else if (unordered)
+    f->sum += bson_fp_mix(key, value);
+  else
+    f->h = bson_fp_mix(f->h, bson_fp_mix(key, value));
+}
+
+static uint64_t bson_fp_final(const bson_fp_frame* f)
+{
+  int kind = f->isObject ? bson_fp_is_object : bson_fp_is_array;
+  return bson_fp_mum(f->h ^ f->sum ^ (uint64_t)kind * bson_fp_p3, (uint64_t)f->count ^ bson_fp_p0);
+}
+
+static bson_fp_frame* bson_fp_open(bson_fingerprinter* fp, uint64_t key, int isObject)
+{
+  bson_fp_frame* f;
+  bson_fp_frame* frames = (bson_fp_frame*)bson_stack_grow(
+    fp->frames, fp->local, fp->depth, &fp->capacity, sizeof(bson_fp_frame));
+  if (!frames)
+    return NULL;
+  fp->frames = frames;
+  f = fp->frames + fp->depth++;
+  memset(f, 0, sizeof(*f));
+  f->key = key;
+  f->isObject = isObject;
+  return f;
+}
+
+/* Finish the innermost document and fold it into its parent. */
+static void bson_fp_close(bson_fingerprinter* fp)
+{
+  bson_fp_frame* f = fp->frames + --fp->depth;
+  uint64_t value = bson_fp_final(f);
+  if (fp->depth > 0)
+    bson_fp_add(f - 1, fp->unordered, f->key, value);
+  else
+    fp->result = value;
+}
+
+static void bson_fp_init(bson_fingerprinter* fp, int unordered)
+{
+  fp->frames = fp->local;
+  fp->depth = 0;
+  fp->capacity = sizeof(fp->local) / sizeof(fp->local[0]);
+  fp->unordered = unordered;
+  fp->result = 0;
+}
+
+/* Hash of a tree item that is not an array or object, 0 if it has
+ * no value to hash.
+ */
+static uint64_t bson_fp_item(cJSON* item)
+{
+  switch ((item->type)&0xff)
+    {
+  case cJSON_NULL:   return bson_fp_mix(bson_fp_is_null, 0);
+  case cJSON_False:  return bson_fp_mix(bson_fp_is_false, 0);
+  case cJSON_True:   return bson_fp_mix(bson_fp_is_true, 0);
+  case cJSON_Number: return bson_fp_number(item->valuedouble);
+  case cJSON_String:
+    return item->valuestring ? bson_fp_string(item->valuestring, bson_value_length(item)) : 0;
+  case cJSON_UUID:
+    return item->valuestring ? bson_fp_bytes(bson_fp_is_uuid, item->valuestring, 16) : 0;
+  case cJSON_Binary:
+    return item->valuestring ? bson_fp_binary(item->valuestring, bson_value_length(item), item->valueint) : 0;
+  case cJSON_Int32:      return bson_fp_number((double)item->valueint);
+  case cJSON_ObjectId:   return bson_fp_extended(item, bson_fp_is_object_id, 12);
+  case cJSON_UTCTime:    return bson_fp_extended(item, bson_fp_is_utc_time, 8);
+  case cJSON_Timestamp:  return bson_fp_extended(item, bson_fp_is_timestamp, 8);
+  case cJSON_Decimal128: return bson_fp_extended(item, bson_fp_is_decimal128, 16);
+    }
+  return 0;
+}
+
+/* Keys end at any embedded NULL, as they do once encoded. */
+static uint64_t bson_fp_key(cJSON* item)
+{
+  size_t len = item->string ? bson_key_length(item) : 0;
+  const char* nul = len ? (const char*)memchr(item->string, 0, len) : NULL;
+  return bson_fp_bytes(bson_fp_is_string, item->string, nul ? (size_t)(nul - item->string) : len);
+}
+
+/**\brief Compute a 64-bit fingerprint of the content of \a item.
+  *
+  * The value matches cBSON_Fingerprint of \a item's BSON encoding,
+  * so equal documents can be recognized whichever form they are in.
+  * With \a unordered non-zero, the order of object members does not
+  * change the result (that of array elements always does). The tree
+  * is walked once without encoding it; the result is stored in
+  * \a hash_out. Returns 0 if \a item nests too deeply.
+  */
+int cJSON_Fingerprint(cJSON* item, int unordered, uint64_t* hash_out)
+{
+  bson_fingerprinter fp;
+  bson_fp_frame* f;
+  int ok = 1;
+  *hash_out = 0;
+  if (!item)
+    return 0;
+  bson_fp_init(&fp, unordered);
+  if (((item->type)&0xff) != cJSON_Array && ((item->type)&0xff) != cJSON_Object)
+    {
+    *hash_out = bson_fp_item(item);
+    return 1;
+    }
+  if (!(f = bson_fp_open(&fp, 0, ((item->type)&0xff) == cJSON_Object)))
+    return 0;
+  f->next = item->child;
+  while (fp.depth > 0)
+    {
+    cJSON* child;
+    int type;
+    uint64_t value;
+    f = fp.frames + fp.depth - 1;
+    if (!(child = f->next))
+      {
+      bson_fp_close(&fp);
+      continue;
+      }
+    f->next = child->next;
+    type = (child->type)&0xff;
+    if (type == cJSON_Array || type == cJSON_Object)
+      {
+      uint64_t key = f->isObject ? bson_fp_key(child) : 0;
+      if (!(f = bson_fp_open(&fp, key, type == cJSON_Object)))
+        {
+        ok = 0;
+        break;
+        }
+      f->next = child->child;
+      }
+    else if ((value = bson_fp_item(child)))
+      bson_fp_add(f, unordered, f->isObject ? bson_fp_key(child) : 0, value);
+    }
+  if (fp.frames != fp.local)
+    cJSON_free(fp.frames);
+  if (ok)
+    *hash_out = fp.result;
+  return ok;
+}
+
+/* Hash of a BSON value that is not a document or array, or 0 if
+ * it is of a type cJSON_ParseBSON cannot read.
+ */
+static uint64_t bson_fp_value(int itype, const char* loc, size_t size)
+{
+  int64_t i64;
+  int32_t i32;
+  double d;
+  bson_fp_frame regex;
+  switch (itype)
+    {
+  case cBSON_Undefined:
+  case cBSON_NULL:
+  case cBSON_Min_Key:
+  case cBSON_Max_Key:
+    return bson_fp_mix(bson_fp_is_null, 0);
+  case cBSON_Bool:
+    return bson_fp_mix(*loc ? bson_fp_is_true : bson_fp_is_false, 0);
+  case cBSON_Float:
+    memcpy(&d, loc, sizeof(d));
+    return bson_fp_number(d);
+  case cBSON_UTC_Time:
+  case cBSON_Timestamp:
+    if (shouldUseExtendedTypes)
+      return bson_fp_bytes(itype == cBSON_UTC_Time ? bson_fp_is_utc_time : bson_fp_is_timestamp, loc, 8);
+    /* fall through - they are parsed as int64 numbers */
+  case cBSON_Int:
+    memcpy(&i64, loc, sizeof(i64));
+    return bson_fp_number((double)i64);
+  case cBSON_Decimal128:
+    if (shouldUseExtendedTypes)
+      return bson_fp_bytes(bson_fp_is_decimal128, loc, 16);
+    return bson_fp_number(bson_decimal128_value(loc));
+  case cBSON_ObjectId:
+    return bson_fp_object_id(loc);
+  case cBSON_Int32:
+    memcpy(&i32, loc, sizeof(i32));
+    return bson_fp_number((double)i32);
+  case cBSON_String:
+  case cBSON_JS_Code:
+  case cBSON_Deprecated:
+    return bson_fp_string(loc + 4, size - 5);
+  case cBSON_Binary:
+    return bson_fp_binary(loc + 5, size - 5, loc[4] & 0xff);
+  case cBSON_Regex:
+    /* the parser makes an array of the pattern and its options */
+    memset(&regex, 0, sizeof(regex));
+    bson_fp_add(&regex, 0, 0, bson_fp_string(loc, strlen(loc)));
+    loc += strlen(loc) + 1;
+    bson_fp_add(&regex, 0, 0, bson_fp_string(loc, strlen(loc)));
+    return bson_fp_final(&regex);
+    }
+  return 0;
+}
+
+/**\brief Compute the fingerprint of a BSON document.
+  *
+  * The result, stored in \a hash_out, is what cJSON_Fingerprint gives
+  * for the tree cJSON_ParseBSON(\a bson, \a bson_size, \a doc_type)
+  * would build, but the buffer is hashed where it lies without
+  * decoding anything. Returns 0 if the document is malformed, nests
+  * too deeply, or holds a value cJSON_ParseBSON cannot read.
+  */
+int cBSON_Fingerprint(const char* bson, size_t bson_size, int doc_type, int unordered, uint64_t* hash_out)
+{
+  bson_fingerprinter fp;
+  bson_fp_frame* f;
+  int32_t len;
+  int ok = 1;
+  *hash_out = 0;
+  if (!bson || bson_size < 5)
+    return 0;
+  memcpy(&len, bson, 4);
+  if ((size_t)len != bson_size || bson[bson_size - 1])
+    return 0;
+  bson_fp_init(&fp, unordered);
+  if (!(f = bson_fp_open(&fp, 0, doc_type == cJSON_Object ||
+    (doc_type != cJSON_Array && !bson_keys_are_indices(bson, bson_size)))))
+    return 0;
+  f->at = bson + 4;
+  f->end = bson + bson_size - 1;
+  while (ok && fp.depth > 0)
+    {
+    const char* name;
+    const char* nul;
+    ptrdiff_t size;
+    int itype;
+    uint64_t key, value;
+    f = fp.frames + fp.depth - 1;
+    if (f->at >= f->end)
+      {
+      bson_fp_close(&fp);
+      continue;
+      }
+    itype = *(f->at++) & 0xff;
+    name = f->at;
+    if (!itype || !(nul = (const char*)memchr(name, 0, f->end - name)) ||
+      (size = bson_value_size(itype, nul + 1, f->end - nul - 1)) < 0)
+      {
+      ok = 0;
+      break;
+      }
+    f->at = nul + 1 + size;
+    key = f->isObject ? bson_fp_bytes(bson_fp_is_string, name, nul - name) : 0;
+    if (itype == cBSON_Document || itype == cBSON_Array)
+      {
+      if (nul[size] || !(f = bson_fp_open(&fp, key, itype == cBSON_Document)))
+        {
+        ok = 0;
+        break;
+        }
+      f->at = nul + 1 + 4;
+      f->end = nul + size;
+      }
+    else if (itype == cBSON_DBPointer)
+      { /* parsed as {"$ref": collection, "$id": ObjectId} */
+      bson_fp_frame ptr;
+      memset(&ptr, 0, sizeof(ptr));
+      ptr.isObject = 1;
+      bson_fp_add(&ptr, unordered, bson_fp_bytes(bson_fp_is_string, "$ref", 4), bson_fp_string(nul + 5, size - 17));
+      bson_fp_add(&ptr, unordered, bson_fp_bytes(bson_fp_is_string, "$id", 3), bson_fp_object_id(nul + 1 + size - 12));
+      bson_fp_add(f, unordered, key, bson_fp_final(&ptr));
+      }
+    else if (itype == cBSON_JS_Code_WS)
+      { /* parsed as {"$code": code, "$scope": document}, which ends with the document */
+      const char* code = nul + 1 + 4;
+      memcpy(&len, code, 4);
+      if (!(f = bson_fp_open(&fp, key, 1)))
+        {
+        ok = 0;
+        break;
+        }
+      f->at = f->end = code; /* closes as soon as its scope does */
+      bson_fp_add(f, unordered, bson_fp_bytes(bson_fp_is_string, "$code", 5), bson_fp_string(code + 4, len - 1));
+      if (nul[size] || !(f = bson_fp_open(&fp, bson_fp_bytes(bson_fp_is_string, "$scope", 6), 1)))
+        {
+        ok = 0;
+        break;
+        }
+      f->at = code + 4 + len + 4;
+      f->end = nul + size;
+      }
+    else if ((value = bson_fp_value(itype, nul + 1, (size_t)size)))
+      bson_fp_add(f, unordered, key, value);
+    else
+      ok = 0;
+    }
+  if (fp.frames != fp.local)
+    cJSON_free(fp.frames);
+  if (ok)
+    *hash_out = fp.result;
+  return ok;
 }
 
-size_t bson_parse_int32(const char* bson, size_t remaining, cJSON*** prev)
+/* Extended JSON.
+ *
+ * MongoDB's Extended JSON (v2) spells out the BSON types that plain
+ * JSON has no room for as small wrapper objects: {"$oid": hex},
+ * {"$binary": {"base64": ..., "subType": hex}}, {"$date": ...},
+ * {"$numberLong": text} and so on. It is written straight from the
+ * BSON bytes, without building a tree, through a bson_writer: the
+ * first walk measures the text and the second writes it.
+ */
+typedef struct bson_ejson
 {
-  (void) remaining;
-  size_t len;
-  char* key = bson_parse_name(bson, &len);
-  const char* loc = bson + len;
-  int32_t val = *(int32_t*)loc;
-  cJSON* node = cJSON_CreateNumber((double)val);
-  node->string = key;
-  node->valueint = (int)val; /* overwrite cJSON-double-cast with exact value */
-  cBSON_LinkSibling(prev, node);
-  return sizeof(int32_t) + loc - bson;
+  bson_writer w;
+  int canonical;
+  int fmt;
+  int depth; /* JSON containers open, wrappers included */
+} bson_ejson;
+
+typedef struct bson_ejson_frame
+{
+  const char* end; /* the document's terminator */
+  int isArray;
+  int count;       /* elements written so far */
+  int wrapped;     /* the scope of code with scope, whose wrapper it closes */
+} bson_ejson_frame;
+
+static const char bson_base64_digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define cBSON_Base64SSSE3
+#include <tmmintrin.h>
+
+/* Encode 12 bytes at a time into 16 digits (Muła's method): each
+ * group of 3 bytes is spread over a 32-bit lane, its four 6-bit
+ * fields are moved into bytes of their own with two multiplies, and
+ * a table lookup turns those into digits. Returns the bytes consumed;
+ * as each load reads 16 bytes, the last 4 or more are left over.
+ */
+__attribute__((target("ssse3")))
+static size_t bson_base64_ssse3(const uint8_t* in, size_t len, char* out)
+{
+  const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m128i shifts = _mm_setr_epi8(
+    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+    '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t done = 0;
+  for (; len - done >= 16; done += 12, out += 16)
+    {
+    __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + done)), spread);
+    __m128i hi = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i lo = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    __m128i sixes = _mm_or_si128(hi, lo);
+    /* 0..25 -> 13 ('A'), 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+    __m128i range = _mm_subs_epu8(sixes, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), sixes), _mm_set1_epi8(13)));
+    _mm_storeu_si128((__m128i*)out, _mm_add_epi8(_mm_shuffle_epi8(shifts, range), sixes));
+    }
+  return done;
 }
+#endif
 
-size_t bson_parse_null(const char* bson, size_t remaining, cJSON*** prev)
+/* Write \a n bytes as (padded) base64 digits. */
+static void bson_put_base64(bson_writer* w, const char* src, size_t n)
 {
-  (void) remaining;
-  size_t len;
-  char* key = bson_parse_name(bson, &len);
-  cJSON* node = cJSON_CreateNull();
-  node->string = key;
-  cBSON_LinkSibling(prev, node);
-  return len;
+  const uint8_t* in = (const uint8_t*)src;
+  size_t digits = (n + 2) / 3 * 4;
+  char* out;
+  uint32_t v;
+  if (w->len - w->skipped + digits > w->cap)
+    { /* measuring */
+    w->len += digits;
+    return;
+    }
+  out = w->buf + w->len - w->skipped;
+  w->len += digits;
+#ifdef cBSON_Base64SSSE3
+  if (n >= 16 && __builtin_cpu_supports("ssse3"))
+    {
+    size_t done = bson_base64_ssse3(in, n, out);
+    in += done;
+    n -= done;
+    out += done / 3 * 4;
+    }
+#endif
+  for (; n >= 3; n -= 3, in += 3, out += 4)
+    {
+    v = (uint32_t)in[0] << 16 | (uint32_t)in[1] << 8 | in[2];
+    out[0] = bson_base64_digits[v >> 18];
+    out[1] = bson_base64_digits[(v >> 12) & 63];
+    out[2] = bson_base64_digits[(v >> 6) & 63];
+    out[3] = bson_base64_digits[v & 63];
+    }
+  if (n)
+    {
+    v = (uint32_t)in[0] << 16 | (n > 1 ? (uint32_t)in[1] << 8 : 0);
+    out[0] = bson_base64_digits[v >> 18];
+    out[1] = bson_base64_digits[(v >> 12) & 63];
+    out[2] = n > 1 ? bson_base64_digits[(v >> 6) & 63] : '=';
+    out[3] = '=';
+    }
 }
 
-size_t bson_parse_regex(const char* bson, size_t remaining, cJSON*** prev)
+static void bson_put_text(bson_writer* w, const char* text)
 {
-  (void) remaining;
-  size_t tot;
-  size_t len;
-  char* key = bson_parse_name(bson, &tot);
-  cJSON* node = cJSON_CreateArray();
+  bson_put(w, text, strlen(text));
+}
 
-  char* regex = bson_parse_name(bson, &len);
-  tot += len;
-  char* opts = bson_parse_name(bson, &len);
-  tot += len;
+/* Write \a n bytes as a JSON string, escaped as cJSON_Print does. */
+static void bson_put_json_string(bson_writer* w, const char* s, size_t n)
+{
+  size_t i, run = 0;
+  char esc[8];
+  bson_put_byte(w, '"');
+  for (i = 0; i < n; ++i)
+    {
+    unsigned char c = (unsigned char)s[i];
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    bson_put(w, s + run, i - run);
+    run = i + 1;
+    switch (c)
+      {
+    case '"': bson_put(w, "\\\"", 2); break;
+    case '\\': bson_put(w, "\\\\", 2); break;
+    case '\b': bson_put(w, "\\b", 2); break;
+    case '\f': bson_put(w, "\\f", 2); break;
+    case '\n': bson_put(w, "\\n", 2); break;
+    case '\r': bson_put(w, "\\r", 2); break;
+    case '\t': bson_put(w, "\\t", 2); break;
+    default:
+      sprintf(esc, "\\u%04x", c);
+      bson_put(w, esc, 6);
+      break;
+      }
+    }
+  bson_put(w, s + run, n - run);
+  bson_put_byte(w, '"');
+}
 
-  cJSON_AddItemToArray(node, cJSON_CreateString(regex));
-  cJSON_AddItemToArray(node, cJSON_CreateString(opts));
-  node->string = key;
-  cBSON_LinkSibling(prev, node);
-  return tot;
+static void bson_ejson_indent(bson_ejson* j, int depth)
+{
+  for (; depth > 0; --depth)
+    bson_put_byte(&j->w, '\t');
 }
 
-size_t bson_parse_db_pointer(const char* bson, size_t remaining, cJSON*** prev)
+/* Open an object or array, laid out as cJSON_Print lays them out. */
+static void bson_ejson_open(bson_ejson* j, int isArray)
 {
-  (void) bson;
-  (void) remaining;
-  (void) prev;
-  return 0;
+  bson_put_byte(&j->w, isArray ? '[' : '{');
+  ++j->depth;
 }
 
-size_t bson_parse_code_ws(const char* bson, size_t remaining, cJSON*** prev)
+static void bson_ejson_close(bson_ejson* j, int isArray)
 {
-  (void) bson;
-  (void) remaining;
-  (void) prev;
-  return 0;
+  --j->depth;
+  if (isArray)
+    {
+    bson_put_byte(&j->w, ']');
+    return;
+    }
+  if (j->fmt)
+    {
+    bson_put_byte(&j->w, '\n');
+    bson_ejson_indent(j, j->depth);
+    }
+  bson_put_byte(&j->w, '}');
 }
 
-cJSON* bson_parse_doc(const char* bson, size_t bson_size, int doc_type)
+/* Start the \a count'th member of the innermost container, naming it
+ * \a key (of \a len bytes) unless that is an array.
+ */
+static void bson_ejson_member(bson_ejson* j, int isArray, int count, const char* key, size_t len)
 {
-  cJSON* result =
-    (doc_type != cJSON_Array ?
-     cJSON_CreateObject() :
-     cJSON_CreateArray());
-  cJSON** next_child = &result->child;
-  cJSON* prev = NULL;
-  const char* loc = bson;
-  /* read size for comparison */
-  int32_t actual_size = *(uint32_t*)loc;
-  loc += 4;
-  int itype;
-  int allIndicesAreInts = 1;
-  long lastKey = -1;
-  size_t remaining = bson_size - (loc - bson);
-  assert(bson_size == (size_t)actual_size && "BSON size mismatch");
-  while (remaining > 0)
+  if (isArray)
     {
-    itype = (*(loc++) & 0xff);
-    switch (itype)
+    if (count)
+      bson_put(&j->w, ", ", j->fmt ? 2 : 1);
+    return;
+    }
+  if (count)
+    bson_put_byte(&j->w, ',');
+  if (j->fmt)
+    {
+    bson_put_byte(&j->w, '\n');
+    bson_ejson_indent(j, j->depth);
+    }
+  bson_put_json_string(&j->w, key, len);
+  bson_put(&j->w, ":\t", j->fmt ? 2 : 1);
+}
+
+/* Open {"$wrapper": ... for the value to follow. */
+static void bson_ejson_wrap(bson_ejson* j, const char* wrapper)
+{
+  bson_ejson_open(j, 0);
+  bson_ejson_member(j, 0, 0, wrapper, strlen(wrapper));
+}
+
+/* {"$wrapper": "text"} */
+static void bson_ejson_wrapped_text(bson_ejson* j, const char* wrapper, const char* text, size_t len)
+{
+  bson_ejson_wrap(j, wrapper);
+  bson_put_json_string(&j->w, text, len);
+  bson_ejson_close(j, 0);
+}
+
+static void bson_ejson_object_id(bson_ejson* j, const char* loc)
+{
+  char hex[24];
+  encode_hex_string((const uint8_t*)loc, 12, hex);
+  bson_ejson_wrapped_text(j, "$oid", hex, sizeof(hex));
+}
+
+/* The shortest text that reads back as \a val, which must be finite,
+ * always with a fraction or an exponent ("1.0", "1.0E+300").
+ */
+static size_t bson_ejson_double_text(double val, char* buf)
+{
+  int prec;
+  char* e;
+  char* p;
+  for (prec = 15; prec < 17; ++prec)
+    {
+    sprintf(buf, "%.*g", prec, val);
+    if (strtod(buf, NULL) == val)
+      break;
+    }
+  if (prec == 17)
+    sprintf(buf, "%.17g", val);
+  if (!(e = strchr(buf, 'e')))
+    {
+    if (!strchr(buf, '.'))
+      strcat(buf, ".0");
+    return strlen(buf);
+    }
+  /* 1e+300 -> 1.0E+300, 1.5e-07 -> 1.5E-7 */
+  *e = 'E';
+  if (!memchr(buf, '.', e - buf))
+    {
+    memmove(e + 2, e, strlen(e) + 1);
+    memcpy(e, ".0", 2);
+    e += 2;
+    }
+  for (p = e + 2; *p == '0' && p[1]; ++p)
+    ;
+  memmove(e + 2, p, strlen(p) + 1);
+  return strlen(buf);
+}
+
+static void bson_ejson_double(bson_ejson* j, double val)
+{
+  char buf[40];
+  size_t len;
+  if (val != val)
+    len = strlen(strcpy(buf, "NaN"));
+  else if (val == HUGE_VAL || val == -HUGE_VAL)
+    len = strlen(strcpy(buf, val > 0 ? "Infinity" : "-Infinity"));
+  else
+    len = bson_ejson_double_text(val, buf);
+  /* relaxed output keeps plain numbers where JSON can hold them */
+  if (!j->canonical && val == val && val != HUGE_VAL && val != -HUGE_VAL && (val != 0 || !signbit(val)))
+    bson_put(&j->w, buf, len);
+  else
+    bson_ejson_wrapped_text(j, "$numberDouble", buf, len);
+}
+
+static void bson_ejson_int(bson_ejson* j, int64_t val, const char* wrapper)
+{
+  char buf[24];
+  sprintf(buf, "%" PRId64, val);
+  if (j->canonical)
+    bson_ejson_wrapped_text(j, wrapper, buf, strlen(buf));
+  else
+    bson_put_text(&j->w, buf);
+}
+
+/* Relaxed output shows dates from 1970 to 9999 as ISO-8601 text. */
+static void bson_ejson_date(bson_ejson* j, int64_t ms)
+{
+  char buf[80];
+  int64_t days, z, era, doe, yoe, doy, mp;
+  int year, month, day, msOfDay;
+  bson_ejson_wrap(j, "$date");
+  if (j->canonical || ms < 0 || ms > INT64_C(253402300799999))
+    {
+    sprintf(buf, "%" PRId64, ms);
+    bson_ejson_wrapped_text(j, "$numberLong", buf, strlen(buf));
+    bson_ejson_close(j, 0);
+    return;
+    }
+  /* days since the epoch to a civil date (Howard Hinnant's algorithm) */
+  days = ms / 86400000;
+  msOfDay = (int)(ms % 86400000);
+  z = days + 719468;
+  era = z / 146097;
+  doe = z - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  day = (int)(doy - (153 * mp + 2) / 5 + 1);
+  month = (int)(mp < 10 ? mp + 3 : mp - 9);
+  year = (int)(yoe + era * 400) + (month <= 2);
+  sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02d", year, month, day,
+    msOfDay / 3600000, msOfDay / 60000 % 60, msOfDay / 1000 % 60);
+  if (msOfDay % 1000)
+    sprintf(buf + strlen(buf), ".%03d", msOfDay % 1000);
+  strcat(buf, "Z");
+  bson_put_json_string(&j->w, buf, strlen(buf));
+  bson_ejson_close(j, 0);
+}
+
+/* The text of a Decimal128 as its specification has it: the
+ * coefficient's digits with a point placed by the exponent, or in
+ * scientific notation when that would need many zeros.
+ */
+static size_t bson_ejson_decimal128_text(const char* loc, char* buf)
+{
+  uint64_t lo, hi;
+  uint32_t limbs[4];
+  char digits[48];
+  char* out = buf;
+  int ndigits = 0, exponent, adjusted, i;
+  memcpy(&lo, loc, 8);
+  memcpy(&hi, loc + 8, 8);
+  if (hi >> 63)
+    *(out++) = '-';
+  if (((hi >> 58) & 0x1f) == 0x1f)
+    return strlen(strcpy(buf, "NaN"));
+  if (((hi >> 58) & 0x1f) == 0x1e)
+    return strlen(strcpy(out, "Infinity")) + (out - buf);
+  if (((hi >> 61) & 3) == 3)
+    { /* the coefficient would exceed 10^34 - 1, which reads as 0 */
+    exponent = (int)((hi >> 47) & 0x3fff) - 6176;
+    hi = lo = 0;
+    }
+  else
+    {
+    exponent = (int)((hi >> 49) & 0x3fff) - 6176;
+    hi &= UINT64_C(0x1ffffffffffff);
+    }
+  limbs[0] = (uint32_t)(hi >> 32);
+  limbs[1] = (uint32_t)hi;
+  limbs[2] = (uint32_t)(lo >> 32);
+  limbs[3] = (uint32_t)lo;
+  /* nine digits at a time, from the right */
+  while (limbs[0] | limbs[1] | limbs[2] | limbs[3])
+    {
+    uint64_t rem = 0;
+    uint32_t chunk;
+    for (i = 0; i < 4; ++i)
       {
-    case 0: /* null terminator marking end of document */
-                           if (doc_type < cJSON_Array && allIndicesAreInts)
-                             result->type = cJSON_Array;
-                           return result;
-    case cBSON_Float:
-                           loc += bson_parse_float(loc, remaining, &next_child); break;
-    case cBSON_String:
-    case cBSON_JS_Code:
-    case cBSON_Deprecated:
-                           loc += bson_parse_string(loc, remaining, &next_child); break;
-    case cBSON_Document:
-    case cBSON_Array:
-                           loc += bson_parse_document(loc, remaining, &next_child, itype); break;
-    case cBSON_Binary:
-                           loc += bson_parse_blob(loc, remaining, &next_child); break;
-    case cBSON_ObjectId:
-                           loc += bson_parse_object_id(loc, remaining, &next_child); break;
-    case cBSON_Bool:
-                           loc += bson_parse_bool(loc, remaining, &next_child); break;
-    case cBSON_UTC_Time:
-    case cBSON_Timestamp:
-    case cBSON_Int:
-                           loc += bson_parse_int(loc, remaining, &next_child); break;
-    case cBSON_Int32:
-                           loc += bson_parse_int32(loc, remaining, &next_child); break;
-    case cBSON_Undefined:
-    case cBSON_NULL:
-    case cBSON_Min_Key:
-    case cBSON_Max_Key:
-                           loc += bson_parse_null(loc, remaining, &next_child); break;
-    case cBSON_Regex:
-                           loc += bson_parse_regex(loc, remaining, &next_child); break;
-    case cBSON_DBPointer:
-                           loc += bson_parse_db_pointer(loc, remaining, &next_child); break;
-    case cBSON_JS_Code_WS:
-                           loc += bson_parse_code_ws(loc, remaining, &next_child); break;
-    default:
-                           cJSON_Delete(result);
-                           return NULL;
+      uint64_t cur = rem << 32 | limbs[i];
+      limbs[i] = (uint32_t)(cur / 1000000000);
+      rem = cur % 1000000000;
       }
-    remaining = bson_size - (loc - bson);
-    /* If the document type is unspecified (doc_type == cJSON_NULL),
-     * then we should be checking to see whether it can be an array
-     * or (because the keys are not increasing integers) must be
-     * an object.
-     */
-    if (doc_type < cJSON_Array && allIndicesAreInts)
+    chunk = (uint32_t)rem;
+    for (i = 0; i < 9; ++i, chunk /= 10)
+      digits[ndigits++] = (char)('0' + chunk % 10);
+    }
+  while (ndigits > 1 && digits[ndigits - 1] == '0')
+    --ndigits;
+  if (!ndigits || ndigits > 34)
+    {
+    digits[0] = '0';
+    ndigits = 1;
+    }
+  adjusted = exponent + ndigits - 1;
+  if (exponent <= 0 && adjusted >= -6)
+    {
+    int point = ndigits + exponent; /* digits before the point */
+    if (point <= 0)
       {
-      if (!prev)
-        prev = result->child;
-      else
-        prev = prev->next;
-      if (prev && prev->string)
-        {
-        char* dummy;
-        long idx = strtol(prev->string, &dummy, 10);
-        if (!dummy || *dummy || idx <= lastKey)
-          allIndicesAreInts = 0;
-        else
-          lastKey = idx;
-        }
-      else
-        {
-        allIndicesAreInts = 0;
+      *(out++) = '0';
+      if (exponent)
+        *(out++) = '.';
+      for (; point < 0; ++point)
+        *(out++) = '0';
+      point = 0;
+      }
+    for (i = ndigits - 1; i >= 0; --i)
+      {
+      if (ndigits - 1 - i == point && point > 0 && exponent)
+        *(out++) = '.';
+      *(out++) = digits[i];
+      }
+    }
+  else
+    {
+    *(out++) = digits[ndigits - 1];
+    if (ndigits > 1)
+      *(out++) = '.';
+    for (i = ndigits - 2; i >= 0; --i)
+      *(out++) = digits[i];
+    out += sprintf(out, "E%c%d", adjusted < 0 ? '-' : '+', adjusted < 0 ? -adjusted : adjusted);
+    }
+  *out = 0;
+  return out - buf;
+}
+
+/* Write the value of a \a itype element of \a size bytes at \a loc,
+ * other than a document, an array or code with scope.
+ */
+static void bson_ejson_value(bson_ejson* j, int itype, const char* loc, size_t size)
+{
+  char buf[64];
+  int32_t i32;
+  int64_t i64;
+  double val;
+  switch (itype)
+    {
+  case cBSON_Float:
+    memcpy(&val, loc, 8);
+    bson_ejson_double(j, val);
+    break;
+  case cBSON_String:
+    bson_put_json_string(&j->w, loc + 4, size - 5);
+    break;
+  case cBSON_Binary:
+    bson_ejson_wrap(j, "$binary");
+    bson_ejson_open(j, 0);
+    bson_ejson_member(j, 0, 0, "base64", 6);
+    bson_put_byte(&j->w, '"');
+    bson_put_base64(&j->w, loc + 5, size - 5);
+    bson_put_byte(&j->w, '"');
+    bson_ejson_member(j, 0, 1, "subType", 7);
+    sprintf(buf, "%02x", loc[4] & 0xff);
+    bson_put_json_string(&j->w, buf, 2);
+    bson_ejson_close(j, 0);
+    bson_ejson_close(j, 0);
+    break;
+  case cBSON_Undefined:
+    bson_ejson_wrap(j, "$undefined");
+    bson_put_text(&j->w, "true");
+    bson_ejson_close(j, 0);
+    break;
+  case cBSON_ObjectId:
+    bson_ejson_object_id(j, loc);
+    break;
+  case cBSON_Bool:
+    bson_put_text(&j->w, *loc ? "true" : "false");
+    break;
+  case cBSON_UTC_Time:
+    memcpy(&i64, loc, 8);
+    bson_ejson_date(j, i64);
+    break;
+  case cBSON_NULL:
+    bson_put_text(&j->w, "null");
+    break;
+  case cBSON_Regex:
+      {
+      size_t plen = strlen(loc);
+      bson_ejson_wrap(j, "$regularExpression");
+      bson_ejson_open(j, 0);
+      bson_ejson_member(j, 0, 0, "pattern", 7);
+      bson_put_json_string(&j->w, loc, plen);
+      bson_ejson_member(j, 0, 1, "options", 7);
+      bson_put_json_string(&j->w, loc + plen + 1, size - plen - 2);
+      bson_ejson_close(j, 0);
+      bson_ejson_close(j, 0);
+      }
+    break;
+  case cBSON_DBPointer:
+    bson_ejson_wrap(j, "$dbPointer");
+    bson_ejson_open(j, 0);
+    bson_ejson_member(j, 0, 0, "$ref", 4);
+    bson_put_json_string(&j->w, loc + 4, size - 17);
+    bson_ejson_member(j, 0, 1, "$id", 3);
+    bson_ejson_object_id(j, loc + size - 12);
+    bson_ejson_close(j, 0);
+    bson_ejson_close(j, 0);
+    break;
+  case cBSON_JS_Code:
+    bson_ejson_wrapped_text(j, "$code", loc + 4, size - 5);
+    break;
+  case cBSON_Deprecated:
+    bson_ejson_wrapped_text(j, "$symbol", loc + 4, size - 5);
+    break;
+  case cBSON_Int32:
+    memcpy(&i32, loc, 4);
+    bson_ejson_int(j, i32, "$numberInt");
+    break;
+  case cBSON_Timestamp:
+      {
+      uint32_t inc, secs;
+      memcpy(&inc, loc, 4);
+      memcpy(&secs, loc + 4, 4);
+      bson_ejson_wrap(j, "$timestamp");
+      bson_ejson_open(j, 0);
+      bson_ejson_member(j, 0, 0, "t", 1);
+      sprintf(buf, "%" PRIu32, secs);
+      bson_put_text(&j->w, buf);
+      bson_ejson_member(j, 0, 1, "i", 1);
+      sprintf(buf, "%" PRIu32, inc);
+      bson_put_text(&j->w, buf);
+      bson_ejson_close(j, 0);
+      bson_ejson_close(j, 0);
+      }
+    break;
+  case cBSON_Int:
+    memcpy(&i64, loc, 8);
+    bson_ejson_int(j, i64, "$numberLong");
+    break;
+  case cBSON_Decimal128:
+    bson_ejson_wrapped_text(j, "$numberDecimal", buf, bson_ejson_decimal128_text(loc, buf));
+    break;
+  case cBSON_Min_Key:
+  case cBSON_Max_Key:
+    bson_ejson_wrap(j, itype == cBSON_Min_Key ? "$minKey" : "$maxKey");
+    bson_put_byte(&j->w, '1');
+    bson_ejson_close(j, 0);
+    break;
+    }
+}
+
+/* Walk a whole, checked \a bson buffer once, writing its Extended JSON. */
+static int bson_ejson_write(bson_ejson* j, const char* bson, size_t bson_size, int isArray)
+{
+  bson_ejson_frame local[16];
+  bson_ejson_frame* frames = local;
+  bson_ejson_frame* frame;
+  int depth = 0;
+  int capacity = sizeof(local) / sizeof(local[0]);
+  int ok = 0;
+  const char* loc = bson + 4;
+
+  frame = frames + depth++;
+  frame->end = bson + bson_size - 1;
+  frame->isArray = isArray;
+  frame->count = 0;
+  frame->wrapped = 0;
+  bson_ejson_open(j, isArray);
+  while (depth > 0)
+    {
+    const char* key;
+    ptrdiff_t size;
+    int itype;
+    frame = frames + depth - 1;
+    if (loc == frame->end)
+      { /* its terminator */
+      bson_ejson_close(j, frame->isArray);
+      if (frame->wrapped)
+        bson_ejson_close(j, 0);
+      ++loc;
+      --depth;
+      continue;
+      }
+    itype = *(loc++) & 0xff;
+    key = loc;
+    if (!itype || !(loc = (const char*)memchr(loc, 0, frame->end - loc)) ||
+      (size = bson_value_size(itype, loc + 1, frame->end - loc - 1)) < 0)
+      goto done;
+    bson_ejson_member(j, frame->isArray, frame->count++, key, loc++ - key);
+    if (itype == cBSON_Document || itype == cBSON_Array || itype == cBSON_JS_Code_WS)
+      {
+      bson_ejson_frame* grown = (bson_ejson_frame*)bson_stack_grow(
+        frames, local, depth, &capacity, sizeof(bson_ejson_frame));
+      int wrapped = itype == cBSON_JS_Code_WS;
+      if (!grown)
+        goto done;
+      frames = grown;
+      if (wrapped)
+        { /* {"$code": code, "$scope": document}, the wrapper ending with the document */
+        int32_t len;
+        memcpy(&len, loc + 4, 4);
+        bson_ejson_wrap(j, "$code");
+        bson_put_json_string(&j->w, loc + 8, len - 1);
+        bson_ejson_member(j, 0, 1, "$scope", 6);
+        size -= 8 + len;
+        loc += 8 + len;
         }
+      if (loc[size - 1])
+        goto done;
+      frame = frames + depth++;
+      frame->end = loc + size - 1;
+      frame->isArray = itype == cBSON_Array;
+      frame->count = 0;
+      frame->wrapped = wrapped;
+      bson_ejson_open(j, frame->isArray);
+      loc += 4;
+      continue;
       }
+    bson_ejson_value(j, itype, loc, (size_t)size);
+    loc += size;
     }
-  /* If we were not told the document type, set it: */
-  if (doc_type < cJSON_Array && allIndicesAreInts)
-    result->type = cJSON_Array;
-  return result;
+  ok = 1;
+
+done:
+  if (frames != local)
+    cJSON_free(frames);
+  return ok;
 }
 
-/**\brief Parse a BSON buffer into a tree of cJSON records.
+/**\brief Print a BSON document as MongoDB Extended JSON (v2).
   *
-  * The first two arguments are the buffer and size.
-  * The third argument allows you to specify a preference
-  * for the top-level object type.
-  * The following values are accepted:
+  * Where cJSON_ParseBSON turns binary data and ObjectIds into hex
+  * strings and every integer into a number, this keeps each type
+  * distinguishable: binary data becomes {"$binary": {"base64": ...,
+  * "subType": ...}}, ObjectIds {"$oid": ...}, times {"$date": ...}
+  * and so on. In cBSON_ExtJSONCanonical mode every number is wrapped
+  * with its type ({"$numberLong": "7"}) and dates are milliseconds;
+  * cBSON_ExtJSONRelaxed mode prints numbers plainly and dates from
+  * 1970 to 9999 as ISO-8601 text. \a doc_type and \a fmt are as for
+  * cJSON_ParseBSON and cJSON_Print. The BSON is checked as it is
+  * walked; malformed input returns NULL.
   *
-  * + cJSON_Array, indicating that an array should contain
-  *   all the top-level entries (even if their key values
-  *   are not all integers);
-  * + cJSON_Object, indicating that a dictionary should
-  *   contain all the top-level entries (even if their
-  *   key values are all integers); or
-  * + cJSON_NULL, indicating that you have no preference
-  *   and the key values should be used to decide whether
-  *   to create a cJSON_Array or cJSON_Object.
+  * You are responsible for calling cJSON_DeleteBSON() on the result,
+  * whose length (not counting its terminator) is put in \a len_out.
   */
-cJSON* cJSON_ParseBSON(const char* bson, size_t bson_size, int doc_type)
+char* cBSON_PrintExtendedJSON(const char* bson, size_t bson_size, int doc_type, int mode, int fmt, size_t* len_out)
 {
-  return bson_parse_doc(bson, bson_size, doc_type);
+  bson_ejson j = { { NULL, 0, 0, 0, NULL }, mode == cBSON_ExtJSONCanonical, fmt, 0 };
+  int32_t len;
+  int isArray;
+  *len_out = 0;
+  if (!bson || bson_size < 5)
+    return NULL;
+  memcpy(&len, bson, 4);
+  if ((size_t)len != bson_size || bson[bson_size - 1])
+    return NULL;
+  isArray = doc_type == cJSON_Array ||
+    (doc_type < cJSON_Array && bson_keys_are_indices(bson, bson_size));
+  if (!bson_ejson_write(&j, bson, bson_size, isArray))
+    return NULL;
+  j.w.cap = j.w.len;
+  if (!(j.w.buf = (char*)cJSON_malloc(j.w.cap + 1)))
+    return NULL;
+  j.w.len = 0;
+  j.depth = 0;
+  bson_ejson_write(&j, bson, bson_size, isArray);
+  j.w.buf[j.w.len] = 0;
+  *len_out = j.w.len;
+  return j.w.buf;
 }
@@ -4,6 +4,9 @@
 #include "cJSON.h"
 #include <stddef.h>
 #include <stdint.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 
 /* Extra cJSON tags for extended BSON types.
  *
@@ -15,12 +18,24 @@
  * You can have cJSON_BSON_Parse() produce
  * these or not by calling the
  * cJSON_BSON_SetUseExtendedTypes() function.
+ * cJSON_PrintBSON writes them back out as
+ * they were read, copying their bytes.
+ * cJSON_Print prints those holding a number
+ * as that number, and the others as strings
+ * of hex digits.
  *
  * Note that these enums start with "cJSON_"
  * while those below start with "cBSON_"!
  */
-#define cJSON_Binary 16 /* subtype is specified in item->valueint, data in item->valuestring */
-#define cJSON_UUID   17 /* subtype is implicit, data stored in item->valuestring */
+#define cJSON_Binary     16 /* subtype is specified in item->valueint, data in item->valuestring */
+#define cJSON_UUID       17 /* subtype is implicit, data stored in item->valuestring */
+#define cJSON_ObjectId   18 /* the 12 bytes are in item->valuestring */
+#define cJSON_UTCTime    19 /* the 8 bytes of an int64 (milliseconds since the epoch) are in item->valuestring,
+                               and its value in item->valuedouble */
+#define cJSON_Int32      20 /* value in item->valueint (and item->valuedouble) */
+#define cJSON_Timestamp  21 /* the 8 bytes (increment, then seconds) are in item->valuestring,
+                               and their value as a uint64 in item->valuedouble */
+#define cJSON_Decimal128 22 /* the 16 bytes are in item->valuestring, and the nearest double in item->valuedouble */
 
 /* BSON tags we support */
 #define cBSON_Float      0x01
@@ -28,21 +43,22 @@
 #define cBSON_Document   0x03
 #define cBSON_Array      0x04
 #define cBSON_Binary     0x05
+#define cBSON_ObjectId   0x07
 #define cBSON_Bool       0x08
+#define cBSON_UTC_Time   0x09
 #define cBSON_NULL       0x0a
+#define cBSON_Int32      0x10
+#define cBSON_Timestamp  0x11
 #define cBSON_Int        0x12
+#define cBSON_Decimal128 0x13
 
-/* BSON tags we don't support */
+/* BSON tags we don't support (they are read, but written differently) */
 #define cBSON_Undefined  0x06 /* deprecated */
-#define cBSON_ObjectId   0x07
-#define cBSON_UTC_Time   0x09
 #define cBSON_Regex      0x0b
 #define cBSON_DBPointer  0x0c /* deprecated */
 #define cBSON_JS_Code    0x0d
 #define cBSON_Deprecated 0x0e /* deprecated? */
 #define cBSON_JS_Code_WS 0x0f /* Javascript code with scope */
-#define cBSON_Int32      0x10
-#define cBSON_Timestamp  0x11
 #define cBSON_Min_Key    0xff
 #define cBSON_Max_Key    0x7f
 
@@ -62,8 +78,63 @@ extern "C" {
 #endif
 
 char* cJSON_PrintBSON(cJSON *item, size_t* bson_size_out);
+char* cJSON_PrintBSONElement(cJSON *item, size_t index, size_t* bson_size_out);
 void cJSON_DeleteBSON(char* bson);
+
+/* Encode into the caller's memory, or into a buffer an encoder keeps from one call to the next. */
+size_t cJSON_PrintBSONInto(cJSON* item, char* buf, size_t cap, size_t* needed);
+size_t cJSON_PrintBSONElementInto(cJSON* item, size_t index, char* buf, size_t cap, size_t* needed);
+typedef struct cBSON_Encoder cBSON_Encoder;
+cBSON_Encoder* cBSON_CreateEncoder(void);
+void cBSON_DeleteEncoder(cBSON_Encoder* enc);
+const char* cJSON_PrintBSONWith(cBSON_Encoder* enc, cJSON* item, size_t* bson_size_out);
+
+/* Encode many documents back to back in one buffer, optionally on several threads. */
+#define cBSON_BatchMaxThreads 64
+char* cJSON_PrintBSONBatch(cJSON** items, size_t count, size_t* offsets, int threads, size_t* bson_size_out);
+
+/* Encode as a list of pieces for writev, pointing at large strings and blobs rather than copying them. */
+#ifndef _WIN32
+typedef struct iovec cBSON_IOVec;
+#else
+typedef struct cBSON_IOVec
+{
+  void* iov_base;
+  size_t iov_len;
+} cBSON_IOVec;
+#endif
+cBSON_IOVec* cJSON_PrintBSONVec(cJSON* item, size_t min_ref, size_t* count_out, size_t* bson_size_out);
+void cJSON_DeleteBSONVec(cBSON_IOVec* vec);
+
+/* Encode again after small changes, copying the encodings of whatever is unchanged. */
+typedef struct cBSON_EncodeCache cBSON_EncodeCache;
+cBSON_EncodeCache* cBSON_CreateEncodeCache(void);
+void cBSON_DeleteEncodeCache(cBSON_EncodeCache* cache);
+char* cJSON_PrintBSONCached(cBSON_EncodeCache* cache, cJSON* item, size_t* bson_size_out);
+
 cJSON* cJSON_ParseBSON(const char* bson, size_t bson_size, int doc_type);
+cJSON* cJSON_ParseBSONInterned(const char* bson, size_t bson_size, int doc_type, cJSON_InternPool* pool);
+cJSON_Tape* cJSON_ParseBSONTape(const char* bson, size_t bson_size, int doc_type);
+
+/* Decode BSON documents incrementally, as their bytes arrive. */
+typedef struct cBSON_Stream cBSON_Stream;
+cBSON_Stream* cJSON_CreateBSONStream(int doc_type, int split, cJSON_StreamHandler handler, void* ctx);
+int cJSON_BSONStreamFeed(cBSON_Stream* stream, const char* data, size_t len);
+int cJSON_BSONStreamFinish(cBSON_Stream* stream);
+void cJSON_DeleteBSONStream(cBSON_Stream* stream);
+
+/* MongoDB Extended JSON (v2), straight from BSON; free the text with cJSON_DeleteBSON. */
+#define cBSON_ExtJSONRelaxed   0
+#define cBSON_ExtJSONCanonical 1
+char* cBSON_PrintExtendedJSON(const char* bson, size_t bson_size, int doc_type, int mode, int fmt, size_t* len_out);
+
+/* JSON Patch (RFC 6902) between two BSON documents, decoding only what differs. */
+cJSON* cBSON_Diff(const char* a, size_t alen, const char* b, size_t blen);
+/* Apply JSON Patch to a BSON document by splicing its bytes rather than decoding it. */
+char* cBSON_ApplyPatches(const char* bson, size_t bson_size, cJSON* patches, size_t* bson_size_out);
+/* Content hashes that agree between a tree and its BSON encoding. */
+int cJSON_Fingerprint(cJSON* item, int unordered, uint64_t* hash_out);
+int cBSON_Fingerprint(const char* bson, size_t bson_size, int doc_type, int unordered, uint64_t* hash_out);
 
 void cJSON_BSON_SetDetectUUIDs(int yes);
 int cJSON_BSON_WillDetectUUIDs();
@@ -71,6 +142,12 @@ int cJSON_BSON_WillDetectUUIDs();
 void cJSON_BSON_SetUseExtendedTypes(int yes);
 int cJSON_BSON_WillUseExtendedTypes();
 
+void cJSON_BSON_SetReadExtendedJSON(int yes);
+int cJSON_BSON_WillReadExtendedJSON();
+
+void cJSON_BSON_SetCompactIntegers(int yes);
+int cJSON_BSON_WillCompactIntegers();
+
 char* bson_doc_value(cJSON* item, char* buf, size_t bufsize, ptrdiff_t* idxName);
 size_t bson_item_name(cJSON* item, char* buf, size_t bufsize, ptrdiff_t* idxName);
 size_t bson_item_value(cJSON* item, char* buf, size_t bufsize, ptrdiff_t* idxName);
@@ -3,6 +3,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "cJSON_Utils.h"
+#include "cJSON_Utils_private.h"
+
+// An item's type, without the flags that only say how its strings are kept (see cJSON.h).
+#define cJSONUtils_Type(item)	((item)->type&~(cJSON_StringIsConst|cJSON_StringHasLength|cJSON_ValueHasLength))
 
 // JSON Pointer implementation:
 static int cJSONUtils_Pstrcasecmp(const char *a,const char *e)
@@ -33,7 +37,7 @@ char *cJSONUtils_FindPointerFromObjectTo(cJSON *object,cJSON *target)
 {
 	if (object==target) return strdup("");
 
-	int type=object->type,c=0;
+	int type=cJSONUtils_Type(object),c=0;
 	for (cJSON *obj=object->child;obj;obj=obj->next,c++)
 	{
 		char *found=cJSONUtils_FindPointerFromObjectTo(obj,target);
@@ -61,17 +65,19 @@ char *cJSONUtils_FindPointerFromObjectTo(cJSON *object,cJSON *target)
 	return 0;
 }
 
-cJSON *cJSONUtils_GetPointer(cJSON *object,const char *pointer)
+// Follows pointer from object, thawing each array and object on the way when thaw is set.
+static cJSON *cJSONUtils_FollowPointer(cJSON *object,const char *pointer,int thaw)
 {
 	while (*pointer++=='/' && object)
 	{
-		if (object->type==cJSON_Array)
+		if (thaw && !(object=cJSON_Thaw(object))) return 0;
+		if (cJSONUtils_Type(object)==cJSON_Array)
 		{
 			int which=0; while (*pointer>='0' && *pointer<='9') which=(10*which) + *pointer++ - '0';
 			if (*pointer && *pointer!='/') return 0;
 			object=cJSON_GetArrayItem(object,which);
 		}
-		else if (object->type==cJSON_Object)
+		else if (cJSONUtils_Type(object)==cJSON_Object)
 		{
 			object=object->child;	while (object && cJSONUtils_Pstrcasecmp(object->string,pointer)) object=object->next;	// GetObjectItem.
 			while (*pointer && *pointer!='/') pointer++;
@@ -81,53 +87,341 @@ cJSON *cJSONUtils_GetPointer(cJSON *object,const char *pointer)
 	return object;
 }
 
+cJSON *cJSONUtils_GetPointer(cJSON *object,const char *pointer)	{return cJSONUtils_FollowPointer(object,pointer,0);}
+cJSON *cJSONUtils_ThawPointer(cJSON *object,const char *pointer)	{return cJSONUtils_FollowPointer(object,pointer,1);}
+
 // JSON Patch implementation.
-static void cJSONUtils_InplaceDecodePointerString(char *string)
+// Object members are matched by key the way cJSON_GetObjectItem matches them (ignoring case, first duplicate wins),
+// but wide objects are indexed in a hash table first so matching all the members of one stays linear.
+#define cJSONUtils_LinearMembers 8
+
+typedef struct {cJSON *object,**slots;size_t mask;} cJSONUtils_Members;
+
+int cJSONUtils_KeyCompare(const char *a,const char *b)
 {
-	char *s2=string;
-	for (;*string;s2++,string++) *s2=(*string!='~')?(*string):((*(++string)=='0')?'~':'/');
-	*s2=0;
+	if (!a || !b) return (a==b)?0:1;
+	for (;tolower((unsigned char)*a)==tolower((unsigned char)*b);a++,b++) if (!*a) return 0;
+	return 1;
 }
 
-static cJSON *cJSONUtils_PatchDetach(cJSON *object,const char *path)
+size_t cJSONUtils_KeyHash(const char *s)
 {
-	char *parentptr=0,*childptr=0;cJSON *parent=0;
+	size_t h=2166136261u;
+	if (s) for (;*s;s++) h=(h^(size_t)tolower((unsigned char)*s))*16777619u;
+	return h;
+}
+
+static void cJSONUtils_IndexMembers(cJSONUtils_Members *m,cJSON *object)
+{
+	size_t n=0,size=16,i;cJSON *c;
+	m->object=object;m->slots=0;m->mask=0;
+	for (c=object->child;c;c=c->next) n++;
+	if (n<=cJSONUtils_LinearMembers) return;
+	while (size<2*n) size*=2;
+	if (!(m->slots=(cJSON**)calloc(size,sizeof(cJSON*)))) return;	// Out of memory: just scan.
+	m->mask=size-1;
+	for (c=object->child;c;c=c->next)
+	{
+		for (i=cJSONUtils_KeyHash(c->string)&m->mask;m->slots[i];i=(i+1)&m->mask) if (!cJSONUtils_KeyCompare(m->slots[i]->string,c->string)) break;
+		if (!m->slots[i]) m->slots[i]=c;
+	}
+}
 
-	parentptr=strdup(path);	childptr=strrchr(parentptr,'/');	if (childptr) *childptr++=0;
-	parent=cJSONUtils_GetPointer(object,parentptr);
-	cJSONUtils_InplaceDecodePointerString(childptr);
+static cJSON *cJSONUtils_FindMember(cJSONUtils_Members *m,const char *key)
+{
+	size_t i;
+	if (!m->slots) return cJSON_GetObjectItem(m->object,key);
+	for (i=cJSONUtils_KeyHash(key)&m->mask;m->slots[i];i=(i+1)&m->mask) if (!cJSONUtils_KeyCompare(m->slots[i]->string,key)) return m->slots[i];
+	return 0;
+}
 
-	cJSON *ret=0;
-	if (!parent) ret=0;	// Couldn't find object to remove child from.
-	else if (parent->type==cJSON_Array)		ret=cJSON_DetachItemFromArray(parent,atoi(childptr));
-	else if (parent->type==cJSON_Object)	ret=cJSON_DetachItemFromObject(parent,childptr);
-	free(parentptr);
-	return ret;
+// Strings are compared NULs and all. The BSON types past cJSON_Object (see cJSON_BSON.h) hold bytes, a number or both,
+// and are equal when all of them are.
+static int cJSONUtils_SameString(cJSON *a,cJSON *b)
+{
+	size_t len=cJSON_GetValueLength(a);
+	return len==cJSON_GetValueLength(b) && !memcmp(a->valuestring,b->valuestring,len);
+}
+static int cJSONUtils_SameExtended(cJSON *a,cJSON *b)
+{
+	if (a->valueint!=b->valueint || memcmp(&a->valuedouble,&b->valuedouble,sizeof(double)) || !a->valuestring!=!b->valuestring) return 0;
+	return !a->valuestring || cJSONUtils_SameString(a,b);
 }
 
 static int cJSONUtils_Compare(cJSON *a,cJSON *b)
 {
-	if (a->type!=b->type)	return -1;	// mismatched type.
-	switch (a->type)
+	if (!a || !b)			return (a==b)?0:-7;	// missing value.
+	if (cJSONUtils_Type(a)!=cJSONUtils_Type(b))	return -1;	// mismatched type.
+	switch (cJSONUtils_Type(a))
 	{
 	case cJSON_Number:	return (a->valueint!=b->valueint || a->valuedouble!=b->valuedouble)?-2:0;	// numeric mismatch.
-	case cJSON_String:	return (strcmp(a->valuestring,b->valuestring)!=0)?-3:0;						// string mismatch.
+	case cJSON_String:	return cJSONUtils_SameString(a,b)?0:-3;													// string mismatch.
 	case cJSON_Array:	for (a=a->child,b=b->child;a && b;a=a->next,b=b->next)	{int err=cJSONUtils_Compare(a,b);if (err) return err;}
 						return (a || b)?-4:0;	// array size mismatch.
 	case cJSON_Object:
+	{
+						int err=0;cJSONUtils_Members members;
 						if (cJSON_GetArraySize(a)!=cJSON_GetArraySize(b))	return -5;	// object length mismatch.
-						for (a=a->child;a;a=a->next)
+						cJSONUtils_IndexMembers(&members,b);
+						for (a=a->child;a && !err;a=a->next)
 						{
-							int err=0;cJSON *s=cJSON_GetObjectItem(b,a->string); if (!s) return -6;	// missing object member.
-							err=cJSONUtils_Compare(a,s);if (err) return err;
+							cJSON *s=cJSONUtils_FindMember(&members,a->string);
+							err=s?cJSONUtils_Compare(a,s):-6;	// missing object member.
 						}
-						return 0;
-	default:			break;
+						free(members.slots);
+						return err;
+	}
+	default:			if (cJSONUtils_Type(a)>cJSON_Object && !cJSONUtils_SameExtended(a,b)) return -2;	// value mismatch.
+						break;
 	}
 	return 0;
 }
 
-static int cJSONUtils_ApplyPatch(cJSON *object,cJSON *patch)
+// Applying patches. The arrays and objects patches reach are indexed once per cJSONUtils_ApplyPatches: an object's
+// members by key, an array's elements by position, and the last child of either, so a run of patches against one wide
+// object or long array costs about as much per patch as against a small one. Only containers this tree owns outright
+// are indexed, since thawing a shared one (see cJSON_Thaw) replaces its children; the indices follow every child the
+// patches add or remove, and go with the subtrees the patches delete, before their addresses can be reused.
+typedef struct {
+	cJSON *container,*last;
+	void **members;size_t mask,count;int dups;	// objects: the first member with each key, and whether any key repeats.
+	cJSON **items;size_t size,cap;				// arrays: the elements in order.
+} cJSONUtils_Parent;
+
+typedef struct {void **parents;size_t mask,count;char *key;size_t cap;} cJSONUtils_Patching;
+
+static size_t cJSONUtils_AddressHash(const void *p)		{size_t h=(size_t)p;return (h^(h>>4)^(h>>16))*2654435761u;}
+static size_t cJSONUtils_ParentHash(const void *e)		{return cJSONUtils_AddressHash(((const cJSONUtils_Parent*)e)->container);}
+static size_t cJSONUtils_MemberHash(const void *item)	{return cJSONUtils_KeyHash(((const cJSON*)item)->string);}
+
+// Put entry into a linear-probing table, first doubling it as need be to keep it at most half full. 0 if memory runs out.
+static int cJSONUtils_SlotInsert(void ***slots,size_t *mask,size_t count,void *entry,size_t (*hash)(const void*))
+{
+	size_t i,j,size=*slots?*mask+1:16;void **grown;
+	while (size<2*(count+1)) size*=2;
+	if (!*slots || size>*mask+1)
+	{
+		if (!(grown=(void**)calloc(size,sizeof(void*)))) return 0;
+		if (*slots) for (j=0;j<=*mask;j++) if ((*slots)[j]) {for (i=hash((*slots)[j])&(size-1);grown[i];i=(i+1)&(size-1));grown[i]=(*slots)[j];}
+		free(*slots);*slots=grown;*mask=size-1;
+	}
+	for (i=hash(entry)&*mask;(*slots)[i];i=(i+1)&*mask);
+	(*slots)[i]=entry;
+	return 1;
+}
+
+// Empty slot i, moving later entries of its run back so that every one stays reachable from where it hashes.
+static void cJSONUtils_SlotRemove(void **slots,size_t mask,size_t i,size_t (*hash)(const void*))
+{
+	size_t j=i,home;
+	for (;;)
+	{
+		slots[i]=0;
+		do
+		{
+			j=(j+1)&mask;
+			if (!slots[j]) return;
+			home=hash(slots[j])&mask;
+		} while (i<=j ? (home>i && home<=j) : (home>i || home<=j));
+		slots[i]=slots[j];i=j;
+	}
+}
+
+static void cJSONUtils_FreeParent(cJSONUtils_Parent *e)	{free(e->members);free(e->items);free(e);}
+
+static cJSON *cJSONUtils_FindIndexedMember(cJSONUtils_Parent *e,const char *key)
+{
+	size_t i;
+	if (e->members) for (i=cJSONUtils_KeyHash(key)&e->mask;e->members[i];i=(i+1)&e->mask) if (!cJSONUtils_KeyCompare(((cJSON*)e->members[i])->string,key)) return (cJSON*)e->members[i];
+	return 0;
+}
+
+// The child a decoded pointer segment names, matched as cJSONUtils_GetPointer matches it.
+static cJSON *cJSONUtils_IndexedChild(cJSONUtils_Parent *e,const char *key)
+{
+	size_t which=0;
+	if (cJSONUtils_Type(e->container)==cJSON_Object) return cJSONUtils_FindIndexedMember(e,key);
+	while (*key>='0' && *key<='9') which=(10*which) + *key++ - '0';
+	return (!*key && which<e->size)?e->items[which]:0;
+}
+
+// Index c as the new last child of e; it is linked in afterwards, so on running out of memory (0) nothing has changed.
+static int cJSONUtils_Track(cJSONUtils_Parent *e,cJSON *c)
+{
+	cJSON **grown;size_t cap=e->cap?2*e->cap:16;
+	if (cJSONUtils_Type(e->container)==cJSON_Object)
+	{
+		if (cJSONUtils_FindIndexedMember(e,c->string))	{e->dups=1;return 1;}
+		if (!cJSONUtils_SlotInsert(&e->members,&e->mask,e->count,c,cJSONUtils_MemberHash)) return 0;
+		e->count++;
+		return 1;
+	}
+	if (e->size==e->cap)
+	{
+		if (!(grown=(cJSON**)realloc(e->items,cap*sizeof(cJSON*)))) return 0;
+		e->items=grown;e->cap=cap;
+	}
+	e->items[e->size++]=c;
+	return 1;
+}
+
+// Take c, the element at index which of an array or any member of an object, out of e and of its chain.
+static void cJSONUtils_Unlink(cJSONUtils_Parent *e,cJSON *c,size_t which)
+{
+	size_t i;cJSON *next;
+	if (cJSONUtils_Type(e->container)!=cJSON_Object)	memmove(e->items+which,e->items+which+1,(--e->size-which)*sizeof(cJSON*));
+	else
+	{
+		for (i=cJSONUtils_MemberHash(c)&e->mask;e->members[i] && e->members[i]!=c;i=(i+1)&e->mask);
+		if (e->members[i])	// c was the first with its key, so the next with it (if any) takes its place.
+		{
+			cJSONUtils_SlotRemove(e->members,e->mask,i,cJSONUtils_MemberHash);e->count--;
+			if (e->dups) for (next=c->next;next;next=next->next) if (!cJSONUtils_KeyCompare(next->string,c->string)) {cJSONUtils_SlotInsert(&e->members,&e->mask,e->count++,next,cJSONUtils_MemberHash);break;}
+		}
+	}
+	if (c==e->last) e->last=c->prev;
+	if (c->prev) c->prev->next=c->next;
+	if (c->next) c->next->prev=c->prev;
+	if (c==e->container->child) e->container->child=c->next;
+	c->prev=c->next=0;
+}
+
+static int cJSONUtils_Append(cJSONUtils_Parent *e,cJSON *c)
+{
+	if (!cJSONUtils_Track(e,c)) return 0;
+	if (e->last)	{e->last->next=c;c->prev=e->last;}
+	else			e->container->child=c;
+	e->last=c;
+	return 1;
+}
+
+// Put c before the element at index which of an array.
+static int cJSONUtils_Insert(cJSONUtils_Parent *e,cJSON *c,size_t which)
+{
+	cJSON *next=e->items[which];
+	if (!cJSONUtils_Track(e,c)) return 0;
+	memmove(e->items+which+1,e->items+which,(e->size-1-which)*sizeof(cJSON*));e->items[which]=c;
+	c->next=next;c->prev=next->prev;next->prev=c;
+	if (next==e->container->child) e->container->child=c; else c->prev->next=c;
+	return 1;
+}
+
+// The index of an array or object this tree owns, made on first use; 0 if memory runs out.
+static cJSONUtils_Parent *cJSONUtils_IndexParent(cJSONUtils_Patching *p,cJSON *container)
+{
+	size_t i;cJSONUtils_Parent *e;cJSON *c;
+	if (p->parents) for (i=cJSONUtils_AddressHash(container)&p->mask;p->parents[i];i=(i+1)&p->mask) if (((cJSONUtils_Parent*)p->parents[i])->container==container) return (cJSONUtils_Parent*)p->parents[i];
+	if (!(e=(cJSONUtils_Parent*)calloc(1,sizeof(cJSONUtils_Parent)))) return 0;
+	e->container=container;
+	for (c=container->child;c;c=c->next)
+	{
+		if (!cJSONUtils_Track(e,c)) {cJSONUtils_FreeParent(e);return 0;}
+		e->last=c;
+	}
+	if (!cJSONUtils_SlotInsert(&p->parents,&p->mask,p->count,e,cJSONUtils_ParentHash)) {cJSONUtils_FreeParent(e);return 0;}
+	p->count++;
+	return e;
+}
+
+// Drop the indices of an item's subtree, which is about to be deleted.
+static void cJSONUtils_Forget(cJSONUtils_Patching *p,cJSON *item)
+{
+	size_t i;cJSON *c;
+	if (!p->count || item->shared || item->refcount || (cJSONUtils_Type(item)!=cJSON_Array && cJSONUtils_Type(item)!=cJSON_Object)) return;
+	for (c=item->child;c;c=c->next) cJSONUtils_Forget(p,c);
+	for (i=cJSONUtils_AddressHash(item)&p->mask;p->parents[i];i=(i+1)&p->mask) if (((cJSONUtils_Parent*)p->parents[i])->container==item)
+	{
+		cJSONUtils_FreeParent((cJSONUtils_Parent*)p->parents[i]);
+		cJSONUtils_SlotRemove(p->parents,p->mask,i,cJSONUtils_ParentHash);p->count--;
+		return;
+	}
+}
+
+static void cJSONUtils_Discard(cJSONUtils_Patching *p,cJSON *item)	{cJSONUtils_Forget(p,item);cJSON_Delete(item);}
+
+// Decode the pointer segment from s to end into p->key. 0 if memory runs out.
+static int cJSONUtils_DecodeSegment(cJSONUtils_Patching *p,const char *s,const char *end)
+{
+	char *d;size_t cap=p->cap?p->cap:64;
+	if ((size_t)(end-s)>=p->cap)
+	{
+		while (cap<=(size_t)(end-s)) cap*=2;
+		if (!(d=(char*)malloc(cap))) return 0;
+		free(p->key);p->key=d;p->cap=cap;
+	}
+	for (d=p->key;s<end;s++,d++) *d=(*s!='~')?(*s):((*(++s)=='0')?'~':'/');
+	*d=0;
+	return 1;
+}
+
+// The item a pointer names, found as cJSONUtils_GetPointer finds it, but through the indices wherever this tree owns the way.
+static cJSON *cJSONUtils_Lookup(cJSONUtils_Patching *p,cJSON *object,const char *pointer)
+{
+	const char *end;cJSONUtils_Parent *e;
+	while (object && *pointer=='/')
+	{
+		for (end=pointer+1;*end && *end!='/';end++);
+		if (object->shared || object->refcount || (cJSONUtils_Type(object)!=cJSON_Array && cJSONUtils_Type(object)!=cJSON_Object)
+			|| !(e=cJSONUtils_IndexParent(p,object)) || !cJSONUtils_DecodeSegment(p,pointer+1,end)) return cJSONUtils_GetPointer(object,pointer);
+		object=cJSONUtils_IndexedChild(e,p->key);pointer=end;
+	}
+	return object;
+}
+
+// The parent of the item a pointer names, thawed on the way down and indexed, with the last segment decoded into p->key.
+// 0 if there is no such array or object, or it is frozen, or memory runs out.
+static cJSONUtils_Parent *cJSONUtils_FindParent(cJSONUtils_Patching *p,cJSON *object,const char *pointer)
+{
+	const char *last=strrchr(pointer,'/'),*end;cJSONUtils_Parent *e;
+	if (*pointer!='/') return 0;
+	for (;;)
+	{
+		if (!(object=cJSON_Thaw(object)) || (cJSONUtils_Type(object)!=cJSON_Array && cJSONUtils_Type(object)!=cJSON_Object) || !(e=cJSONUtils_IndexParent(p,object))) return 0;
+		for (end=pointer+1;*end && *end!='/';end++);
+		if (!cJSONUtils_DecodeSegment(p,pointer+1,end))	return 0;
+		if (pointer==last)								return e;
+		if (!(object=cJSONUtils_IndexedChild(e,p->key)))	return 0;
+		pointer=end;
+	}
+}
+
+// An array element is named by its index (as atoi reads it, so anything else is the first).
+static size_t cJSONUtils_ElementIndex(const char *key)	{int which=atoi(key);return which>0?(size_t)which:0;}
+
+static cJSON *cJSONUtils_PatchDetach(cJSONUtils_Patching *p,cJSON *object,const char *path)
+{
+	cJSONUtils_Parent *e=cJSONUtils_FindParent(p,object,path);cJSON *c;size_t which=0;
+	if (!e) return 0;	// Couldn't find object to remove child from.
+	if (cJSONUtils_Type(e->container)==cJSON_Object)		c=cJSONUtils_FindIndexedMember(e,p->key);
+	else if ((which=cJSONUtils_ElementIndex(p->key))<e->size)	c=e->items[which];
+	else										c=0;
+	if (c) cJSONUtils_Unlink(e,c,which);
+	return c;
+}
+
+// Add value at path: "-" or an index past the end appends to an array, another index inserts before that element,
+// and a key replaces the first member of an object with it, as the new last member.
+static int cJSONUtils_PatchAttach(cJSONUtils_Patching *p,cJSON *object,const char *path,cJSON *value)
+{
+	cJSONUtils_Parent *e=cJSONUtils_FindParent(p,object,path);cJSON holder,*old;size_t which;int added;
+	if (!e) {cJSONUtils_Discard(p,value);return 9;}	// Couldn't find object to add to.
+	// cJSON_AddItemTo... give value its key (and swap a frozen one for a copy) in an empty holder; it is moved from there.
+	memset(&holder,0,sizeof(cJSON));holder.type=cJSON_Object;
+	if (cJSONUtils_Type(e->container)==cJSON_Object)
+	{
+		if ((old=cJSONUtils_FindIndexedMember(e,p->key)))	{cJSONUtils_Unlink(e,old,0);cJSONUtils_Discard(p,old);}
+		added=cJSON_AddItemToObject(&holder,p->key,value);
+	}
+	else added=cJSON_AddItemToArray(&holder,value);
+	if (!added) return 9;
+	value=holder.child;
+	which=(cJSONUtils_Type(e->container)==cJSON_Array && strcmp(p->key,"-"))?cJSONUtils_ElementIndex(p->key):e->size;
+	if (which<e->size?cJSONUtils_Insert(e,value,which):cJSONUtils_Append(e,value)) return 0;
+	cJSONUtils_Discard(p,value);
+	return 8;	// out of memory for the index.
+}
+
+static int cJSONUtils_ApplyPatch(cJSONUtils_Patching *p,cJSON *object,cJSON *patch)
 {
 	cJSON *op=0,*path=0,*value=0;int opcode=0;
 	
@@ -140,12 +434,12 @@ static int cJSONUtils_ApplyPatch(cJSON *object,cJSON *patch)
 	else if (!strcmp(op->valuestring,"replace"))opcode=2;
 	else if (!strcmp(op->valuestring,"move"))	opcode=3;
 	else if (!strcmp(op->valuestring,"copy"))	opcode=4;
-	else if (!strcmp(op->valuestring,"test"))	return cJSONUtils_Compare(cJSONUtils_GetPointer(object,path->valuestring),cJSON_GetObjectItem(patch,"value"));
+	else if (!strcmp(op->valuestring,"test"))	return cJSONUtils_Compare(cJSONUtils_Lookup(p,object,path->valuestring),cJSON_GetObjectItem(patch,"value"));
 	else return 3; // unknown opcode.
 
 	if (opcode==1 || opcode==2)	// Remove/Replace
 	{
-		cJSON_Delete(cJSONUtils_PatchDetach(object,path->valuestring));	// Get rid of old.
+		if ((value=cJSONUtils_PatchDetach(p,object,path->valuestring))) cJSONUtils_Discard(p,value);	// Get rid of old.
 		if (opcode==1) return 0;	// For Remove, this is job done.
 	}
 
@@ -153,8 +447,8 @@ static int cJSONUtils_ApplyPatch(cJSON *object,cJSON *patch)
 	{
 		cJSON *from=cJSON_GetObjectItem(patch,"from");	if (!from) return 4; // missing "from" for copy/move.
 
-		if (opcode==3) value=cJSONUtils_PatchDetach(object,from->valuestring);
-		if (opcode==4) value=cJSONUtils_GetPointer(object,from->valuestring);
+		if (opcode==3) value=cJSONUtils_PatchDetach(p,object,from->valuestring);
+		if (opcode==4) value=cJSONUtils_Lookup(p,object,from->valuestring);
 		if (!value) return 5; // missing "from" for copy/move.
 		if (opcode==4) value=cJSON_Duplicate(value,1);
 		if (!value) return 6; // out of memory for copy/move.
@@ -168,118 +462,154 @@ static int cJSONUtils_ApplyPatch(cJSON *object,cJSON *patch)
 	}
 		
 	// Now, just add "value" to "path".
-	char *parentptr=0,*childptr=0;cJSON *parent=0;
-
-	parentptr=strdup(path->valuestring);	childptr=strrchr(parentptr,'/');	if (childptr) *childptr++=0;
-	parent=cJSONUtils_GetPointer(object,parentptr);
-	cJSONUtils_InplaceDecodePointerString(childptr);
-
-	// add, remove, replace, move, copy, test.
-	if (!parent) {free(parentptr); return 9;}	// Couldn't find object to add to.
-	else if (parent->type==cJSON_Array)
-	{
-		if (!strcmp(childptr,"-"))	cJSON_AddItemToArray(parent,value);
-		else						cJSON_InsertItemInArray(parent,atoi(childptr),value);
-	}
-	else if (parent->type==cJSON_Object)
-	{
-		cJSON_DeleteItemFromObject(parent,childptr);
-		cJSON_AddItemToObject(parent,childptr,value);
-	}
-	free(parentptr);
-	return 0;
+	return cJSONUtils_PatchAttach(p,object,path->valuestring,value);	// 9 if the parent is missing or frozen.
 }
 
 
 int cJSONUtils_ApplyPatches(cJSON *object,cJSON *patches)
 {
-	int err;
-	if (!patches->type==cJSON_Array) return 1;	// malformed patches.
-	if (patches) patches=patches->child;
-	while (patches)
-	{
-		if ((err=cJSONUtils_ApplyPatch(object,patches))) return err;
-		patches=patches->next;
-	}
-	return 0;
+	cJSONUtils_Patching p={0,0,0,0,0};size_t i;int err=0;
+	if (!patches || patches->type!=cJSON_Array) return 1;	// malformed patches.
+	for (patches=patches->child;patches && !err;patches=patches->next) err=cJSONUtils_ApplyPatch(&p,object,patches);
+	if (p.parents) for (i=0;i<=p.mask;i++) if (p.parents[i]) cJSONUtils_FreeParent((cJSONUtils_Parent*)p.parents[i]);
+	free(p.parents);free(p.key);
+	return err;
 }
 
-static void cJSONUtils_GeneratePatch(cJSON *patches,const char *op,const char *path,const char *suffix,cJSON *val)
+static cJSON *cJSONUtils_CreatePatch(const char *op,const char *path,cJSON *val)
 {
 	cJSON *patch=cJSON_CreateObject();
-	cJSON_AddItemToObject(patch,"op",cJSON_CreateString(op));
-	if (suffix)
-	{
-		char *newpath=(char*)malloc(strlen(path)+cJSONUtils_PointerEncodedstrlen(suffix)+2);
-		cJSONUtils_PointerEncodedstrcpy(newpath+sprintf(newpath,"%s/",path),suffix);
-		cJSON_AddItemToObject(patch,"path",cJSON_CreateString(newpath));
-		free(newpath);
-	}
-	else	cJSON_AddItemToObject(patch,"path",cJSON_CreateString(path));
-	if (val) cJSON_AddItemToObject(patch,"value",cJSON_Duplicate(val,1));
-	cJSON_AddItemToArray(patches,patch);
+	if (!patch) return 0;
+	if (!cJSON_AddItemToObject(patch,"op",cJSON_CreateString(op)) || !cJSON_AddItemToObject(patch,"path",cJSON_CreateString(path))
+		|| (val && !cJSON_AddItemToObject(patch,"value",cJSON_Duplicate(val,1))))	{cJSON_Delete(patch);return 0;}	// out of memory.
+	return patch;
+}
+
+void cJSONUtils_AddPatchToArray(cJSON *array,const char *op,const char *path,cJSON *val)	{cJSON_AddItemToArray(array,cJSONUtils_CreatePatch(op,path,val));}
+
+// Generated patches are appended at a remembered tail rather than by walking the whole array each time.
+typedef struct {cJSON *array,*last;} cJSONUtils_Patches;
+
+static int cJSONUtils_GeneratePatch(cJSONUtils_Patches *patches,const char *op,const char *path,cJSON *val)
+{
+	cJSON *patch=cJSONUtils_CreatePatch(op,path,val);
+	if (!patch) return 0;
+	if (patches->last)	{patches->last->next=patch;patch->prev=patches->last;}
+	else				patches->array->child=patch;
+	patches->last=patch;
+	return 1;
+}
+
+// The pointer to the item being compared is built up in one buffer, a segment per level, and cut back on the way out.
+typedef struct {char *buf;size_t len,cap;} cJSONUtils_Path;
+
+static int cJSONUtils_PathReserve(cJSONUtils_Path *path,size_t extra)
+{
+	char *grown;size_t cap=path->cap?path->cap:64;
+	if (path->len+extra<path->cap) return 1;
+	while (cap<=path->len+extra) cap*=2;
+	if (!(grown=(char*)malloc(cap))) return 0;
+	if (path->buf) {memcpy(grown,path->buf,path->len+1);free(path->buf);} else *grown=0;
+	path->buf=grown;path->cap=cap;
+	return 1;
+}
+
+static int cJSONUtils_PathPushKey(cJSONUtils_Path *path,const char *key)
+{
+	if (!key) key="";
+	if (!cJSONUtils_PathReserve(path,cJSONUtils_PointerEncodedstrlen(key)+1)) return 0;
+	path->buf[path->len]='/';cJSONUtils_PointerEncodedstrcpy(path->buf+path->len+1,key);
+	path->len+=strlen(path->buf+path->len);
+	return 1;
+}
+
+static int cJSONUtils_PathPushIndex(cJSONUtils_Path *path,int index)
+{
+	if (!cJSONUtils_PathReserve(path,23)) return 0;	// Allow space for 64bit int.
+	path->len+=sprintf(path->buf+path->len,"/%d",index);
+	return 1;
 }
 
-void cJSONUtils_AddPatchToArray(cJSON *array,const char *op,const char *path,cJSON *val)	{cJSONUtils_GeneratePatch(array,op,path,0,val);}
+static void cJSONUtils_PathPop(cJSONUtils_Path *path,size_t len)	{path->len=len;path->buf[len]=0;}
 
-static void cJSONUtils_CompareToPatch(cJSON *patches,const char *path,cJSON *from,cJSON *to)
+static int cJSONUtils_GenerateChildPatch(cJSONUtils_Patches *patches,const char *op,cJSONUtils_Path *path,const char *key,cJSON *val)
 {
-	if (from->type!=to->type)	{cJSONUtils_GeneratePatch(patches,"replace",path,0,to);	return;	}
+	size_t len=path->len;
+	if (!cJSONUtils_PathPushKey(path,key) || !cJSONUtils_GeneratePatch(patches,op,path->buf,val)) return 0;
+	cJSONUtils_PathPop(path,len);
+	return 1;
+}
+
+// Returns 0 if memory runs out, leaving the patches so far incomplete.
+static int cJSONUtils_CompareToPatch(cJSONUtils_Patches *patches,cJSONUtils_Path *path,cJSON *from,cJSON *to)
+{
+	size_t len=path->len;
+	if (cJSONUtils_Type(from)!=cJSONUtils_Type(to))	return cJSONUtils_GeneratePatch(patches,"replace",path->buf,to);
 	
-	switch (from->type)
+	switch (cJSONUtils_Type(from))
 	{
 	case cJSON_Number:	
 		if (from->valueint!=to->valueint || from->valuedouble!=to->valuedouble)
-			cJSONUtils_GeneratePatch(patches,"replace",path,0,to);
-		return;
+			return cJSONUtils_GeneratePatch(patches,"replace",path->buf,to);
+		return 1;
 						
 	case cJSON_String:	
-		if (strcmp(from->valuestring,to->valuestring)!=0)
-			cJSONUtils_GeneratePatch(patches,"replace",path,0,to);
-		return;
+		if (!cJSONUtils_SameString(from,to))
+			return cJSONUtils_GeneratePatch(patches,"replace",path->buf,to);
+		return 1;
 
 	case cJSON_Array:
 	{
-		int c;char *newpath=(char*)malloc(strlen(path)+23);	// Allow space for 64bit int.
-		for (c=0,from=from->child,to=to->child;from && to;from=from->next,to=to->next,c++){
-										sprintf(newpath,"%s/%d",path,c);	cJSONUtils_CompareToPatch(patches,newpath,from,to);
+		int c,n;
+		for (c=0,from=from->child,to=to->child;from && to;from=from->next,to=to->next,c++)
+		{
+			if (!cJSONUtils_PathPushIndex(path,c) || !cJSONUtils_CompareToPatch(patches,path,from,to)) return 0;
+			cJSONUtils_PathPop(path,len);
 		}
-		for (;from;from=from->next,c++)	{sprintf(newpath,"%d",c);	cJSONUtils_GeneratePatch(patches,"remove",path,newpath,0);	}
-		for (;to;to=to->next,c++)		cJSONUtils_GeneratePatch(patches,"add",path,"-",to);
-		free(newpath);
-		return;
+		// Remove surplus items from the end, so each index is still valid when its patch is applied.
+		for (n=c;from;from=from->next) n++;
+		while (n-->c)
+		{
+			if (!cJSONUtils_PathPushIndex(path,n) || !cJSONUtils_GeneratePatch(patches,"remove",path->buf,0)) return 0;
+			cJSONUtils_PathPop(path,len);
+		}
+		for (;to;to=to->next)	if (!cJSONUtils_GenerateChildPatch(patches,"add",path,"-",to)) return 0;
+		return 1;
 	}
 
 	case cJSON_Object:
-		for (cJSON *a=from->child;a;a=a->next)
+	{
+		cJSONUtils_Members fromMembers,toMembers;cJSON *a,*other;int ok=1;
+		cJSONUtils_IndexMembers(&fromMembers,from);
+		cJSONUtils_IndexMembers(&toMembers,to);
+		for (a=from->child;a && ok;a=a->next)
 		{
-			if (!cJSON_GetObjectItem(to,a->string))	cJSONUtils_GeneratePatch(patches,"remove",path,a->string,0);
+			if (!cJSONUtils_FindMember(&toMembers,a->string))	ok=cJSONUtils_GenerateChildPatch(patches,"remove",path,a->string,0);
 		}
-		for (cJSON *a=to->child;a;a=a->next)
+		for (a=to->child;a && ok;a=a->next)
 		{
-			cJSON *other=cJSON_GetObjectItem(from,a->string);
-			if (!other)	cJSONUtils_GeneratePatch(patches,"add",path,a->string,a);
-			else
-			{
-				char *newpath=(char*)malloc(strlen(path)+cJSONUtils_PointerEncodedstrlen(a->string)+2);
-				cJSONUtils_PointerEncodedstrcpy(newpath+sprintf(newpath,"%s/",path),a->string);
-				cJSONUtils_CompareToPatch(patches,newpath,other,a);
-				free(newpath);
-			}
+			other=cJSONUtils_FindMember(&fromMembers,a->string);
+			if (!other)	ok=cJSONUtils_GenerateChildPatch(patches,"add",path,a->string,a);
+			else		ok=cJSONUtils_PathPushKey(path,a->string) && cJSONUtils_CompareToPatch(patches,path,other,a);
+			if (ok) cJSONUtils_PathPop(path,len);
 		}
-		return;
+		free(fromMembers.slots);free(toMembers.slots);
+		return ok;
+	}
 
-	default:			break;
+	default:
+		if (cJSONUtils_Type(from)>cJSON_Object && !cJSONUtils_SameExtended(from,to))
+			return cJSONUtils_GeneratePatch(patches,"replace",path->buf,to);
+		return 1;
 	}
 }
 
 
 cJSON* cJSONUtils_GeneratePatches(cJSON *from,cJSON *to)
 {
-	cJSON *patches=cJSON_CreateArray();	
-	cJSONUtils_CompareToPatch(patches,"",from,to);
-	return patches;
+	cJSONUtils_Patches patches={cJSON_CreateArray(),0};cJSONUtils_Path path={0,0,0};
+	if (!patches.array || !cJSONUtils_PathReserve(&path,0))	{cJSON_Delete(patches.array);return 0;}
+	if (!cJSONUtils_CompareToPatch(&patches,&path,from,to))	{cJSON_Delete(patches.array);patches.array=0;}
+	free(path.buf);
+	return patches.array;
 }
-
-
-
@@ -1,10 +1,21 @@
+#ifndef cJSON_Utils__h
+#define cJSON_Utils__h
+
 #include "cJSON.h"
 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
 // Implement RFC6901 (https://tools.ietf.org/html/rfc6901) JSON Pointer spec.
 cJSON *cJSONUtils_GetPointer(cJSON *object,const char *pointer);
+// GetPointer, thawing each array and object on the way (see cJSON_Thaw) so that what it finds can be changed.
+// Returns 0 where the way is frozen (or memory runs out).
+cJSON *cJSONUtils_ThawPointer(cJSON *object,const char *pointer);
 
 // Implement RFC6902 (https://tools.ietf.org/html/rfc6902) JSON Patch spec.
-cJSON* cJSONUtils_GeneratePatches(cJSON *from,cJSON *to);
+cJSON* cJSONUtils_GeneratePatches(cJSON *from,cJSON *to);	// Returns 0 if memory runs out.
 void cJSONUtils_AddPatchToArray(cJSON *array,const char *op,const char *path,cJSON *val);	// Utility for generating patch array entries.
 int cJSONUtils_ApplyPatches(cJSON *object,cJSON *patches);	// Returns 0 for success.
 
@@ -20,3 +31,9 @@ int cJSONUtils_ApplyPatches(cJSON *object,cJSON *patches);	// Returns 0 for succ
 // Code not added to library since this strategy is a LOT slower.
 
 char *cJSONUtils_FindPointerFromObjectTo(cJSON *object,cJSON *target);	// Given a root object and a target object, construct a pointer from one to the other.
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef cJSON_Utils_private__h
+#define cJSON_Utils_private__h
+
+// Shared by cJSON_Utils.c and cJSON_BSON.c so that patches made from trees and from BSON match keys alike. Not installed.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Object members are matched by key ignoring case, as cJSON_GetObjectItem matches them. KeyCompare returns 0 for keys
+// that match, and KeyHash gives keys that match the same hash, for indexing members.
+int cJSONUtils_KeyCompare(const char *a,const char *b);
+size_t cJSONUtils_KeyHash(const char *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,16 +1,43 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cJSON_BSON.h"
+#include "batch.hxx"
+#include "pipeline.hxx"
 
-#include <fstream>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 int usage(int argc, char* argv[], const char* msg, int status)
 {
   std::cerr
     << "\nUsage\n"
     << "=====\n\n"
-    << "  " << (argc > 0 ? argv[0] : "json2bson") << " input.json output.bson\n"
+    << "  " << (argc > 0 ? argv[0] : "json2bson") << " [options] input.json output.bson\n"
+    << "  " << (argc > 0 ? argv[0] : "json2bson") << " [options] --batch [--jobs=N] input... output-directory\n"
+    << "\n"
+    << "  Each top-level value in the input becomes one BSON document.\n"
+    << "  Top-level arrays and objects are converted an element at a\n"
+    << "  time, so the input may be much larger than memory.\n"
+    << "\n"
+    << "  With --extended-json, MongoDB Extended JSON (v2) wrappers such\n"
+    << "  as {\"$oid\": ...}, {\"$date\": ...}, {\"$numberLong\": ...} and\n"
+    << "  {\"$binary\": ...} become the BSON values they stand for.\n"
+    << "\n"
+    << "  With --compact-integers, integers that fit in 32 bits are\n"
+    << "  written as 4-byte Int32 values rather than 8-byte Int64 ones.\n"
+    << "\n"
+    << "  Reading, converting and writing run on threads of their own,\n"
+    << "  passing --buffers=N blocks (default 4) of --buffer-size=BYTES\n"
+    << "  (default 1M; k and M suffixes allowed) between each other.\n"
+    << "\n"
+    << "  With --batch, each input (a file, a directory whose .json files\n"
+    << "  are all converted, or @list naming files one per line) becomes\n"
+    << "  a .bson file in the output directory. --jobs=N threads (default\n"
+    << "  one per core) share the files, and the ones that could not be\n"
+    << "  converted are listed at the end.\n"
     << "\n";
   if (msg)
     std::cerr
@@ -21,35 +48,277 @@ int usage(int argc, char* argv[], const char* msg, int status)
   return status;
 }
 
-int main(int argc, char* argv[])
+// Writes the BSON for each value the stream parser hands over into
+// blocks, which go on to the writing stage as they fill (or, without a
+// writing stage, into one block that grows to hold it all). When the
+// output can't be patched, a document being split stays in its block
+// (which grows to hold it) until its length is known.
+struct Converter
 {
-  if (argc < 3)
-    return usage(argc, argv, "Please specify input and output filenames.", 1);
+  Channel* out;   // NULL in batch mode
+  Block* block;   // being filled
+  size_t base;    // file offset of the block
+  size_t start;   // offset of the length of the document being split
+  size_t index;   // key of the next array element
+  size_t values;  // top-level values written
+  bool hold;      // keep documents being split in memory
+  bool splitting; // a document is being split
+  bool writeFailed;
 
-  std::ifstream file(argv[1]);
-  if (!file.good())
-    return usage(argc, argv, "Could not open input file.", 3);
-  std::string data(
-    (std::istreambuf_iterator<char>(file)),
-    (std::istreambuf_iterator<char>()));
+  // Hand the block on to be written, and start another.
+  bool flush()
+  {
+    this->base += this->block->len;
+    this->block->data = &this->block->buf[0];
+    if (!this->out->put(this->block) || !(this->block = this->out->get()))
+      {
+      this->block = NULL;
+      this->writeFailed = true;
+      }
+    return this->block != NULL;
+  }
 
-  cJSON* node = cJSON_Parse(data.c_str());
-  if (!node)
-    return usage(argc, argv, "Could parse input file.", 5);
+  // Return room for at least \a n more bytes, putting how much there is in \a room.
+  char* reserve(size_t n, size_t* room)
+  {
+    if (!this->block)
+      return NULL;
+    bool keep = !this->out || (this->hold && this->splitting);
+    size_t limit = keep ? (size_t)-1 : this->out->size;
+    if (!keep && this->block->len && this->block->len + n > limit && !this->flush())
+      return NULL;
+    this->block->reserve(this->block->len + n, limit);
+    *room = this->block->buf.size() - this->block->len;
+    return &this->block->buf[this->block->len];
+  }
+
+  bool write(const char* buf, size_t n)
+  {
+    size_t room;
+    char* at = this->reserve(n, &room);
+    if (!at)
+      return false;
+    memcpy(at, buf, n);
+    this->block->len += n;
+    return true;
+  }
+
+  // Encode a document (or an element, when \a element) into the block.
+  bool encode(cJSON* item, bool element)
+  {
+    size_t want = 256;
+    size_t room, needed, sz;
+    for (;;)
+      {
+      char* at = this->reserve(want, &room);
+      if (!at)
+        return false;
+      sz = element ?
+        cJSON_PrintBSONElementInto(item, this->index, at, room, &needed) :
+        cJSON_PrintBSONInto(item, at, room, &needed);
+      if (sz)
+        {
+        this->block->len += sz;
+        return true;
+        }
+      if (!needed)
+        return false; // could not be encoded (nested too deeply)
+      want = needed;
+      }
+  }
+
+  // Fill in the length of the document begun at \a start, in the block
+  // if it is still there and otherwise once the writer is past it.
+  bool patch()
+  {
+    size_t end = this->base + this->block->len;
+    if (end - this->start > 0x7fffffffL)
+      return false;
+    int32_t len = (int32_t)(end - this->start);
+    if (this->start >= this->base)
+      memcpy(&this->block->buf[this->start - this->base], &len, sizeof(len));
+    else
+      this->block->patches.push_back(std::make_pair(this->start, len));
+    return true;
+  }
+
+  static int handle(void* ctx, int event, cJSON* item)
+  {
+    Converter* self = static_cast<Converter*>(ctx);
+    bool ok;
+    switch (event)
+      {
+    case cJSON_StreamOpen:
+      // A document's length is only known once its last element is out,
+      // so a placeholder is written first and filled in at the end.
+      if (!self->write("\0\0\0\0", 4))
+        return 0;
+      self->start = self->base + self->block->len - 4;
+      self->index = 0;
+      self->splitting = true;
+      return 1;
+    case cJSON_StreamClose:
+      ++self->values;
+      ok = self->write("", 1) && self->patch();
+      self->splitting = false;
+      return ok;
+    case cJSON_StreamItem:
+      ok = self->encode(item, true);
+      ++self->index;
+      break;
+    default:
+      ++self->values;
+      ok = self->encode(item, false);
+      break;
+      }
+    cJSON_Delete(item);
+    return ok;
+  }
+};
+
+// Converts the files of a batch one at a time, keeping its buffers and
+// stream from one file to the next.
+struct BatchWorker
+{
+  BatchWorker() : stream(NULL) { }
+  BatchWorker(const BatchWorker&) : stream(NULL) { }
+  ~BatchWorker() { cJSON_DeleteStream(this->stream); }
+
+  void convert(BatchFile& file)
+  {
+    size_t len;
+    FILE* fid = fopen(file.input.c_str(), "rb");
+    if (!fid)
+      return fail(file, "Could not open input file.", 3);
+    bool read = readFile(fid, &this->text, &len);
+    fclose(fid);
+
+    this->block.len = 0;
+    this->block.patches.clear();
+    this->conv.out = NULL;
+    this->conv.block = &this->block;
+    this->conv.base = this->conv.start = this->conv.index = this->conv.values = 0;
+    this->conv.hold = this->conv.splitting = this->conv.writeFailed = false;
+    if (this->stream)
+      cJSON_ResetStream(this->stream);
+    else if (!(this->stream = cJSON_CreateStream(1, Converter::handle, &this->conv)))
+      return fail(file, "Could parse input file.", 5);
+    if (!read || (len && !cJSON_StreamFeed(this->stream, &this->text[0], len)) ||
+      !cJSON_StreamFinish(this->stream) || !this->conv.values)
+      return fail(file, "Could parse input file.", 5);
+
+    // As in a single conversion, an earlier output is only replaced once
+    // the new one is complete.
+    Output output;
+    if (!output.open(file.output.c_str()))
+      return fail(file, "Could not open output file.", 7);
+    bool wrote = output.write(&this->block.buf[0], this->block.len);
+    if (!output.close(wrote) || !wrote)
+      return fail(file, "Could not write output file.", 9);
+  }
+
+  static void fail(BatchFile& file, const char* message, int status)
+  {
+    file.message = message;
+    file.status = status;
+  }
+
+  Converter conv;
+  Block block;
+  std::vector<char> text;
+  cJSON_Stream* stream;
+};
+
+int main(int argc, char* argv[])
+{
+  bool extended = false;
+  bool compact = false;
+  PipelineOptions opts;
+  Batch batch;
+  int arg = 1;
+  for (; arg < argc && !strncmp(argv[arg], "--", 2); ++arg)
+    {
+    if (!strcmp(argv[arg], "--extended-json"))
+      extended = true;
+    else if (!strcmp(argv[arg], "--compact-integers"))
+      compact = true;
+    else if (!opts.parse(argv[arg]) && !batch.parse(argv[arg]))
+      return usage(argc, argv, "Unknown option.", 1);
+    }
+  if (!opts.valid)
+    return usage(argc, argv, "Buffer sizes and counts must be between 1 and 2^30.", 1);
+  if (!batch.valid)
+    return usage(argc, argv, "Jobs must number between 1 and 1024.", 1);
+  if (argc - arg < 2)
+    return usage(argc, argv, "Please specify input and output filenames.", 1);
+  const char* inputName = argv[arg];
+  const char* outputName = argv[arg + 1];
 
   // Ask for UUID strings to be serialized as binary UUIDs:
   cJSON_BSON_SetDetectUUIDs(1);
+  cJSON_BSON_SetReadExtendedJSON(extended ? 1 : 0);
+  cJSON_BSON_SetCompactIntegers(compact ? 1 : 0);
 
-  size_t sz; // will hold returned size of buf
-  char* buf = cJSON_PrintBSON(node, &sz);
+  if (batch.enabled)
+    {
+    for (; arg < argc - 1; ++arg)
+      if (!batch.add(argv[arg], ".json"))
+        return usage(argc, argv, "Could not open input file.", 3);
+    if (!batch.name(argv[argc - 1], ".json", ".bson"))
+      return usage(argc, argv, "No input files.", 3);
+    batch.run(BatchWorker());
+    return batch.report();
+    }
+  if (argc - arg > 2)
+    return usage(argc, argv, "Please specify one input and one output filename, or --batch.", 1);
 
-  cJSON_Delete(node);
-  FILE* fid = fopen(argv[2], "wb");
-  if (!fid)
+  Source input;
+  if (!input.open(inputName))
+    return usage(argc, argv, "Could not open input file.", 3);
+  Output output;
+  if (!output.open(outputName))
+    {
+    input.close();
     return usage(argc, argv, "Could not open output file.", 7);
-  fwrite(buf, sz, 1, fid);
-  fclose(fid);
-  free(buf);
+    }
+
+  Channel inbound(opts.buffers, opts.bufferSize);
+  Channel outbound(opts.buffers, opts.bufferSize);
+  Converter conv;
+  conv.out = &outbound;
+  conv.block = outbound.get();
+  conv.base = conv.start = conv.index = conv.values = 0;
+  conv.hold = !output.seekable;
+  conv.splitting = conv.writeFailed = false;
+  std::thread reader(&Source::run, &input, &inbound);
+  std::thread writer(&Output::run, &output, &outbound);
+
+  // Values lying wholly within a block are parsed where they are, so
+  // with a mapped input most are never copied at all.
+  cJSON_Stream* stream = cJSON_CreateStream(1, Converter::handle, &conv);
+  bool ok = stream != NULL;
+  Block* block;
+  while (ok && (block = inbound.take()))
+    {
+    ok = cJSON_StreamFeed(stream, block->data, block->len) != 0;
+    inbound.give(block);
+    }
+  inbound.abort();
+  reader.join();
+  ok = ok && !input.failed && cJSON_StreamFinish(stream) && conv.values > 0;
+  cJSON_DeleteStream(stream);
+  if (conv.block && conv.block->len)
+    conv.flush();
+  outbound.finish();
+  writer.join();
+  input.close();
+
+  // The output only replaces the file named once all of it is written.
+  bool wrote = !output.failed && !conv.writeFailed;
+  if (!output.close(ok && wrote) || !wrote)
+    return usage(argc, argv, "Could not write output file.", 9);
+  if (!ok)
+    return usage(argc, argv, "Could parse input file.", 5);
 
   return 0;
 }
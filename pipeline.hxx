@@ -0,0 +1,450 @@
+#ifndef __pipeline_hxx
+#define __pipeline_hxx
+
+// The plumbing json2bson and bson2json share: each runs as three stages
+// (reading, converting, writing) on threads of their own, so that disk
+// and CPU time overlap rather than add up. Stages hand each other blocks
+// of bytes through bounded queues; a fixed number of blocks goes round,
+// so a fast stage waits for a slow one instead of running ahead of it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A bounded queue with one producer and one consumer. Neither takes a
+// lock unless the queue is full (or empty) and it has to wait.
+template <typename T>
+struct Queue
+{
+  Queue(size_t depth) : slots(depth), head(0), tail(0), sleepers(0), closed(false) { }
+
+  // Add \a val, waiting while the queue is full. False once closed.
+  bool push(T val)
+  {
+    size_t t = this->tail.load(std::memory_order_relaxed);
+    if (this->closed || !this->await([&] { return t - this->head < this->slots.size(); }))
+      return false;
+    this->slots[t % this->slots.size()] = val;
+    this->tail = t + 1;
+    this->notify();
+    return true;
+  }
+
+  // Take the oldest value, waiting while there is none. False once the
+  // queue is closed and empty.
+  bool pop(T& val)
+  {
+    size_t h = this->head.load(std::memory_order_relaxed);
+    if (!this->await([&] { return this->tail != h; }))
+      return false;
+    val = this->slots[h % this->slots.size()];
+    this->head = h + 1;
+    this->notify();
+    return true;
+  }
+
+  // Stop waiting: the producer has no more, or the consumer wants no more.
+  void close()
+  {
+    this->closed = true;
+    std::lock_guard<std::mutex> hold(this->lock);
+    this->wake.notify_all();
+  }
+
+  // Spin a little before sleeping, since the other side is often about
+  // to move. Both indices and sleepers are sequentially consistent, so a
+  // side going to sleep either sees the other's move or is seen by it.
+  template <typename Ready>
+  bool await(Ready ready)
+  {
+    for (int spin = 0; spin < 64; ++spin)
+      {
+      if (ready())
+        return true;
+      std::this_thread::yield();
+      }
+    std::unique_lock<std::mutex> hold(this->lock);
+    ++this->sleepers;
+    while (!ready() && !this->closed)
+      this->wake.wait(hold);
+    --this->sleepers;
+    return ready();
+  }
+
+  void notify()
+  {
+    if (this->sleepers)
+      {
+      std::lock_guard<std::mutex> hold(this->lock);
+      this->wake.notify_all();
+      }
+  }
+
+  std::vector<T> slots;
+  std::atomic<size_t> head; // moved only by the consumer
+  std::atomic<size_t> tail; // moved only by the producer
+  std::atomic<int> sleepers;
+  std::atomic<bool> closed;
+  std::mutex lock;
+  std::condition_variable wake;
+};
+
+// Bytes on their way from one stage to the next.
+struct Block
+{
+  std::vector<char> buf; // storage, unless data points into a mapped file
+  const char* data;
+  size_t len;
+  std::vector<std::pair<size_t, int32_t> > patches; // lengths to fill in once written
+
+  // Make room for \a need bytes in all, doubling the storage (up to \a
+  // limit, unless more is needed) so that small outputs stay small.
+  void reserve(size_t need, size_t limit)
+  {
+    if (need <= this->buf.size())
+      return;
+    size_t size = this->buf.empty() ? 1 << 16 : 2 * this->buf.size();
+    if (size > limit)
+      size = limit;
+    this->buf.resize(need > size ? need : size);
+  }
+};
+
+// The blocks between two stages: full ones go forward, used ones back.
+// Blocks hold up to size bytes, but their storage grows as they fill,
+// so a small file costs little more than the bytes it holds.
+struct Channel
+{
+  Channel(size_t depth, size_t size) : blocks(depth), full(depth), empty(depth), size(size)
+  {
+    for (size_t i = 0; i < depth; ++i)
+      this->empty.push(&this->blocks[i]);
+  }
+
+  // Producer: wait for a block to fill; NULL once the consumer has stopped.
+  Block* get()
+  {
+    Block* block;
+    if (!this->empty.pop(block))
+      return NULL;
+    block->data = NULL;
+    block->len = 0;
+    block->patches.clear();
+    return block;
+  }
+  bool put(Block* block) { return this->full.push(block); }
+  void finish() { this->full.close(); }
+
+  // Consumer: the next block to use (NULL at the end), and its return.
+  Block* take()
+  {
+    Block* block;
+    return this->full.pop(block) ? block : NULL;
+  }
+  void give(Block* block) { this->empty.push(block); }
+  void abort()
+  {
+    this->full.close();
+    this->empty.close();
+  }
+
+  std::vector<Block> blocks;
+  Queue<Block*> full;
+  Queue<Block*> empty;
+  size_t size; // bytes per block
+};
+
+// The --buffer-size and --buffers options.
+struct PipelineOptions
+{
+  PipelineOptions() : bufferSize(1 << 20), buffers(4), valid(true) { }
+
+  // Take \a arg if it is one of ours, noting whether its value is usable.
+  bool parse(const char* arg)
+  {
+    size_t* dest;
+    if (!strncmp(arg, "--buffer-size=", 14))
+      dest = &this->bufferSize, arg += 14;
+    else if (!strncmp(arg, "--buffers=", 10))
+      dest = &this->buffers, arg += 10;
+    else
+      return false;
+    char* end;
+    unsigned long long val = strtoull(arg, &end, 10);
+    if (dest == &this->bufferSize && (*end == 'k' || *end == 'K'))
+      val <<= 10, ++end;
+    else if (dest == &this->bufferSize && (*end == 'm' || *end == 'M'))
+      val <<= 20, ++end;
+    if (*arg < '0' || *arg > '9' || *end || val < 1 || val > (1ULL << 30))
+      this->valid = false;
+    else
+      *dest = (size_t)val;
+    return true;
+  }
+
+  size_t bufferSize; // bytes per block
+  size_t buffers;    // blocks between each pair of stages
+  bool valid;
+};
+
+// The input file. A regular file is mapped, and the reading stage faults
+// in each block's pages ahead of the converter; anything else is read.
+struct Source
+{
+  bool open(const char* name)
+  {
+    this->map = NULL;
+    this->size = 0;
+    this->failed = false;
+    if (!(this->fid = fopen(name, "rb")))
+      return false;
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(fileno(this->fid), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+      {
+      void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(this->fid), 0);
+      if (map != MAP_FAILED)
+        {
+        this->map = static_cast<const char*>(map);
+        this->size = (size_t)st.st_size;
+        madvise(map, this->size, MADV_SEQUENTIAL);
+        }
+      }
+#endif
+    return true;
+  }
+
+  // The reading stage.
+  void run(Channel* to)
+  {
+    Block* block;
+    size_t at = 0;
+    while ((block = to->get()))
+      {
+      if (this->map)
+        {
+        block->len = this->size - at < to->size ? this->size - at : to->size;
+        block->data = this->map + at;
+        at += block->len;
+        unsigned sum = 0;
+        for (size_t i = 0; i < block->len; i += 4096)
+          sum += static_cast<const volatile char*>(block->data)[i];
+        (void)sum;
+        }
+      else
+        {
+        block->reserve(to->size, to->size);
+        block->data = &block->buf[0];
+        block->len = fread(&block->buf[0], 1, to->size, this->fid);
+        }
+      if (!block->len || !to->put(block))
+        break;
+      }
+    this->failed = !this->map && ferror(this->fid);
+    to->finish();
+  }
+
+  void close()
+  {
+#ifndef _WIN32
+    if (this->map)
+      munmap(const_cast<char*>(this->map), this->size);
+#endif
+    fclose(this->fid);
+  }
+
+  FILE* fid;
+  const char* map;
+  size_t size;
+  bool failed;
+};
+
+// The output file. A regular file named directly (not through a link)
+// is written under a temporary name beside it and only renamed over it
+// once complete, so a conversion that fails leaves an earlier output as
+// it was. That file is mapped into memory, growing (doubling) as blocks
+// arrive, and cut to its final length at the end; anything else is
+// written with stdio. Lengths can only be patched into an output that is
+// seekable, which a pipe is not. Blocks are copied into the mapping rather
+// than converted in place: a window of it handed to the converter would be
+// moved by each remapping as the file grows, and the copy is made here,
+// off the converter's thread.
+struct Output
+{
+  bool open(const char* name)
+  {
+    this->name = name;
+    this->len = 0;
+    this->failed = false;
+    this->seekable = true;
+#ifndef _WIN32
+    this->map = NULL;
+    this->cap = 0;
+    this->fid = NULL;
+    // Only a regular file named directly is replaced: a symbolic link
+    // (to a file elsewhere, or /dev/stdout) is written through in place.
+    struct stat st;
+    bool exists = lstat(name, &st) == 0;
+    if (!exists || S_ISREG(st.st_mode))
+      {
+      this->temp = std::string(name) + ".XXXXXX";
+      if ((this->fd = mkstemp(&this->temp[0])) < 0)
+        return false;
+      // mkstemp makes files only their owner can read. The umask can only
+      // be read by setting it, so that is done once, not on every thread.
+      static const mode_t mask = processUmask();
+      fchmod(this->fd, exists ? st.st_mode & 07777 : 0666 & ~mask);
+      return true;
+      }
+    this->fd = -1;
+#endif
+    if (!(this->fid = fopen(name, "wb")))
+      return false;
+    this->seekable = fseek(this->fid, 0, SEEK_CUR) == 0;
+    return true;
+  }
+
+  bool write(const char* buf, size_t n)
+  {
+#ifndef _WIN32
+    if (this->fd >= 0)
+      {
+      if (this->len + n > this->cap)
+        {
+        size_t cap = 2 * this->cap > this->len + n ? 2 * this->cap : this->len + n;
+        if (cap < (1 << 16))
+          cap = 1 << 16;
+        if (this->map)
+          munmap(this->map, this->cap);
+        this->map = NULL;
+        if (!this->grow(cap))
+          return false;
+        void* map = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+        if (map == MAP_FAILED)
+          return false;
+        this->map = static_cast<char*>(map);
+        this->cap = cap;
+        }
+      memcpy(this->map + this->len, buf, n);
+      this->len += n;
+      return true;
+      }
+#endif
+    this->len += n;
+    return fwrite(buf, 1, n, this->fid) == n;
+  }
+
+#ifndef _WIN32
+  static mode_t processUmask()
+  {
+    mode_t mask = umask(0);
+    umask(mask);
+    return mask;
+  }
+
+  // Extend the file to \a cap bytes. They are allocated on disk before
+  // being mapped, so a full disk fails here rather than with SIGBUS on a
+  // store into the mapping; filesystems that can't allocate ahead (and
+  // systems without posix_fallocate) just have the file extended.
+  bool grow(size_t cap)
+  {
+#ifndef __APPLE__
+    int err = posix_fallocate(this->fd, (off_t)this->cap, (off_t)(cap - this->cap));
+    if (err != EINVAL && err != EOPNOTSUPP)
+      return err == 0;
+#endif
+    return ftruncate(this->fd, (off_t)cap) == 0;
+  }
+#endif
+
+  // Fill in a document length written earlier as a placeholder.
+  bool patch(size_t at, int32_t val)
+  {
+#ifndef _WIN32
+    if (this->fd >= 0)
+      {
+      memcpy(this->map + at, &val, sizeof(val));
+      return true;
+      }
+#endif
+    return fseek(this->fid, (long)at, SEEK_SET) == 0 &&
+      fwrite(&val, sizeof(val), 1, this->fid) == 1 &&
+      fseek(this->fid, (long)this->len, SEEK_SET) == 0;
+  }
+
+  // The writing stage.
+  void run(Channel* from)
+  {
+    Block* block;
+    while ((block = from->take()))
+      {
+      bool ok = this->write(block->data, block->len);
+      for (size_t i = 0; ok && i < block->patches.size(); ++i)
+        ok = this->patch(block->patches[i].first, block->patches[i].second);
+      from->give(block);
+      if (!ok)
+        {
+        this->failed = true;
+        from->abort();
+        break;
+        }
+      }
+  }
+
+  // Finish the output, which replaces the file named if \a keep (and
+  // everything was written) and is thrown away otherwise. False if it
+  // could not be written.
+  bool close(bool keep)
+  {
+#ifndef _WIN32
+    if (this->fd >= 0)
+      {
+      bool ok = (!this->map || munmap(this->map, this->cap) == 0) &&
+        ftruncate(this->fd, (off_t)this->len) == 0;
+      ok = ::close(this->fd) == 0 && ok;
+      if (keep && ok)
+        ok = rename(this->temp.c_str(), this->name) == 0;
+      if (!keep || !ok)
+        remove(this->temp.c_str());
+      return ok;
+      }
+#endif
+    bool ok = fclose(this->fid) == 0;
+#ifdef _WIN32
+    if (!keep || !ok)
+      remove(this->name);
+#endif
+    return ok;
+  }
+
+  const char* name;
+  FILE* fid;
+  size_t len; // bytes written so far
+  bool failed;
+  bool seekable; // whether patch works
+#ifndef _WIN32
+  int fd;     // -1 unless mapped
+  char* map;
+  size_t cap;
+  std::string temp; // the name it is written under until then
+#endif
+};
+
+#endif /* __pipeline_hxx */
@@ -0,0 +1,90 @@
+# bson_batch:
+#
+# Convert a directory holding a copy of a JSON file and a file that is not
+# JSON with json2bson --batch, then convert the BSON back with bson2json
+# --batch from a list that also names a file that does not exist.
+# The test will fail unless:
+#   - each batch exits with status 11, listing the file it could not convert;
+#   - the good file converts as it does on its own, and back to the input;
+#   - an earlier output for the bad file is left as it was.
+#
+# The following variables must be set:
+#   JSON2BSON - the path to the json2bson executable.
+#   BSON2JSON - the path to the bson2json executable.
+#   TESTNAME  - a name for the test that can serve as part of a temporary
+#               directory name unique to this test (so tests can run in parallel).
+#   INPUT     - path to an input JSON file that converts back to itself.
+
+if (NOT JSON2BSON)
+  message(FATAL_ERROR "JSON2BSON must be defined")
+endif()
+if (NOT BSON2JSON)
+  message(FATAL_ERROR "BSON2JSON must be defined")
+endif()
+if (NOT TESTNAME)
+  message(FATAL_ERROR "TESTNAME must be defined")
+endif()
+
+set(IN ${TESTNAME}.in)
+set(OUT ${TESTNAME}.out)
+set(BACK ${TESTNAME}.back)
+file(REMOVE_RECURSE ${IN} ${OUT} ${BACK})
+file(MAKE_DIRECTORY ${IN} ${OUT})
+configure_file(${INPUT} ${IN}/good.json COPYONLY)
+file(WRITE ${IN}/bad.json "{\"not\": json")
+file(WRITE ${OUT}/bad.bson "earlier output")
+
+# Convert the good file on its own, to compare with.
+execute_process(
+  COMMAND ${JSON2BSON} ${INPUT} ${TESTNAME}.single.bson
+  OUTPUT_FILE ${TESTNAME}.json2bson.log
+  ERROR_VARIABLE TEST_ERROR
+  RESULT_VARIABLE TEST_RESULT
+)
+if (TEST_RESULT)
+  message(FATAL_ERROR "Failed ${TESTNAME}: ${JSON2BSON} failed with status ${TEST_RESULT}.\n${TEST_ERROR}")
+endif()
+
+# Convert the directory.
+execute_process(
+  COMMAND ${JSON2BSON} --batch --jobs=2 ${IN} ${OUT}
+  OUTPUT_FILE ${TESTNAME}.json2bson.log
+  ERROR_VARIABLE TEST_ERROR
+  RESULT_VARIABLE TEST_RESULT
+)
+if (NOT TEST_RESULT EQUAL 11 OR NOT TEST_ERROR MATCHES "1 of 2 files converted" OR NOT TEST_ERROR MATCHES "bad.json")
+  message(FATAL_ERROR "Failed ${TESTNAME}: ${JSON2BSON} --batch did not report the bad file (status ${TEST_RESULT}).\n${TEST_ERROR}")
+endif()
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E compare_files ${TESTNAME}.single.bson ${OUT}/good.bson
+  RESULT_VARIABLE TEST_RESULT
+)
+if (TEST_RESULT)
+  message(FATAL_ERROR "Failed ${TESTNAME}: the batch output differs from a single conversion.")
+endif()
+file(READ ${OUT}/bad.bson EARLIER)
+if (NOT EARLIER STREQUAL "earlier output")
+  message(FATAL_ERROR "Failed ${TESTNAME}: the earlier output of the bad file was replaced.")
+endif()
+
+# Convert back from a list naming a file that does not exist.
+file(WRITE ${TESTNAME}.list "${OUT}/good.bson\n${OUT}/missing.bson\n")
+execute_process(
+  COMMAND ${BSON2JSON} --batch @${TESTNAME}.list ${BACK}
+  OUTPUT_FILE ${TESTNAME}.bson2json.log
+  ERROR_VARIABLE TEST_ERROR
+  RESULT_VARIABLE TEST_RESULT
+)
+if (NOT TEST_RESULT EQUAL 11 OR NOT TEST_ERROR MATCHES "1 of 2 files converted" OR NOT TEST_ERROR MATCHES "missing.bson")
+  message(FATAL_ERROR "Failed ${TESTNAME}: ${BSON2JSON} --batch did not report the missing file (status ${TEST_RESULT}).\n${TEST_ERROR}")
+endif()
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E compare_files ${INPUT} ${BACK}/good.json
+  RESULT_VARIABLE TEST_RESULT
+)
+if (TEST_RESULT)
+  message(FATAL_ERROR "Failed ${TESTNAME}: Round trip does not match test input.")
+endif()
+if (EXISTS ${BACK}/missing.json)
+  message(FATAL_ERROR "Failed ${TESTNAME}: an output was written for a missing input.")
+endif()
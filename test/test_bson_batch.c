@@ -0,0 +1,91 @@
+/*
+  test_bson_batch: cJSON_PrintBSONBatch against cJSON_PrintBSON.
+
+  Usage: test_bson_batch file.json...
+
+  Encoding the documents of the files, with many more made up between
+  them, as one batch must give each document as cJSON_PrintBSON does,
+  back to back at the offsets reported, on one thread or many (more
+  threads than documents, or than cBSON_BatchMaxThreads, included). A
+  batch with no documents, or a NULL one, must fail.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "test_util.h"
+
+#define MADE_UP 300
+
+/* A document of a size that varies with n, so the threads get uneven shares. */
+static cJSON *made_up(int n)
+{
+	cJSON *doc=cJSON_CreateObject(),*list=cJSON_CreateArray();int i;
+	cJSON_AddNumberToObject(doc,"n",n);
+	cJSON_AddStringToObject(doc,"name",n%2?"odd":"an even document, with a longer name");
+	for (i=0;i<n%37;i++) cJSON_AddItemToArray(list,i%3?cJSON_CreateNumber(i*0.5):cJSON_CreateString("item"));
+	cJSON_AddItemToObject(doc,"list",list);
+	return doc;
+}
+
+static void check_batch(const char *name,cJSON **items,size_t count,int threads)
+{
+	size_t *offsets=(size_t*)malloc((count+1)*sizeof(size_t)),size,i,len,at=0;
+	char *batch=cJSON_PrintBSONBatch(items,count,offsets,threads,&size),*bson;
+	char what[64];
+	sprintf(what,"differs from cJSON_PrintBSON on %d threads",threads);
+	check(batch!=0,name,"cJSON_PrintBSONBatch failed");
+	for (i=0;batch && i<count;i++)
+	{
+		bson=cJSON_PrintBSON(items[i],&len);
+		if (offsets[i]!=at || at+len>size || !same_bson(batch+at,len,bson,len))
+		{
+			check(0,name,what);
+			cJSON_DeleteBSON(bson);
+			break;
+		}
+		cJSON_DeleteBSON(bson);
+		at+=len;
+	}
+	if (batch) check(offsets[count]==at && size==at,name,"the total size is wrong");
+	cJSON_DeleteBSON(batch);free(offsets);
+}
+
+static void check_failures(cJSON **items,size_t count)
+{
+	size_t offsets[4],size;cJSON *saved=items[1];
+	check(!cJSON_PrintBSONBatch(items,0,offsets,1,&size) && size==0,"empty batch","accepted");
+	items[1]=0;
+	check(!cJSON_PrintBSONBatch(items,count<3?count:3,offsets,2,&size) && size==0,"NULL item","accepted");
+	items[1]=saved;
+}
+
+int main(int argc,char *argv[])
+{
+	static const int threads[]={0,1,2,3,8,cBSON_BatchMaxThreads,1000};
+	cJSON **items=(cJSON**)malloc((argc+MADE_UP)*sizeof(cJSON*));
+	size_t count=0,i;int a,m=0;
+	for (a=1;a<argc;a++)
+	{
+		char *text=read_file(argv[a],0);
+		items[count]=text?cJSON_Parse(text):0;
+		check(items[count]!=0,argv[a],"cannot be parsed");
+		if (items[count]) count++;
+		free(text);
+		/* spread the made-up documents between the files */
+		for (;m<MADE_UP*a/argc;m++) items[count++]=made_up(m);
+	}
+	for (;m<MADE_UP;m++) items[count++]=made_up(m);
+	for (i=0;i<sizeof(threads)/sizeof(threads[0]);i++)
+	{
+		check_batch("all documents",items,count,threads[i]);
+		check_batch("a few documents",items,count<5?count:5,threads[i]);
+	}
+	check_failures(items,count);
+	for (i=0;i<count;i++) cJSON_Delete(items[i]);
+	free(items);
+	return test_failures?1:0;
+}
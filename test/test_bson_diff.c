@@ -0,0 +1,65 @@
+/*
+  test_bson_diff: cBSON_Diff against the trees it compares.
+
+  Usage: test_bson_diff from.json to.json
+
+  The patch cBSON_Diff makes between the BSON of two documents must turn
+  the first into the second when cJSONUtils_ApplyPatches applies it to
+  the decoded first, both ways round, and between pairs of documents
+  chosen for it; a document diffed with itself needs no patch at all.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "cJSON_Utils.h"
+#include "test_util.h"
+
+static void check_diff(const char *name,cJSON *from,cJSON *to)
+{
+	size_t flen,tlen;char *fbson=cJSON_PrintBSON(from,&flen),*tbson=cJSON_PrintBSON(to,&tlen);
+	cJSON *patches=fbson && tbson?cBSON_Diff(fbson,flen,tbson,tlen):0;
+	cJSON *patched=fbson?cJSON_ParseBSON(fbson,flen,cJSON_Object):0,*want=tbson?cJSON_ParseBSON(tbson,tlen,cJSON_Object):0,*same;
+	check(patches!=0,name,"cBSON_Diff failed");
+	check(patched && want,name,"cannot decode the documents");
+	if (patches && patched && want)
+	{
+		check(!cJSONUtils_ApplyPatches(patched,patches),name,"the patch does not apply");
+		check(same_content(patched,want),name,"the patch does not reach the target");
+	}
+	if (fbson)
+	{
+		same=cBSON_Diff(fbson,flen,fbson,flen);
+		check(same && cJSON_GetArraySize(same)==0,name,"a document differs from itself");
+		cJSON_Delete(same);
+	}
+	cJSON_Delete(patches);cJSON_Delete(patched);cJSON_Delete(want);
+	cJSON_DeleteBSON(fbson);cJSON_DeleteBSON(tbson);
+}
+
+static void check_texts(const char *name,const char *from,const char *to)
+{
+	cJSON *a=cJSON_Parse(from),*b=cJSON_Parse(to);
+	check(a && b,name,"cannot be parsed");
+	if (a && b) {check_diff(name,a,b);check_diff(name,b,a);}
+	cJSON_Delete(a);cJSON_Delete(b);
+}
+
+int main(int argc,char *argv[])
+{
+	char *ftext,*ttext;
+	check_texts("scalars, arrays and members","{\"a\":1,\"b\":[1,2,3],\"c\":{\"d\":\"e\"}}","{\"a\":2,\"b\":[1,3],\"c\":{\"d\":\"e\",\"f\":null}}");
+	check_texts("array to object","{\"a\":[1,2]}","{\"a\":{\"0\":1,\"1\":2}}");
+	check_texts("nested arrays","{\"a\":[[1,2],[3,4]]}","{\"a\":[[1,2],[3,4],[5]],\"b\":true}");
+	check_texts("members reordered","{\"x\":\"same\",\"y\":{}}","{\"y\":{},\"x\":\"same\"}");
+	check_texts("escaped keys","{\"a/b\":1,\"c~d\":2}","{\"a/b\":3}");
+	if (argc!=3) {fprintf(stderr,"Usage: %s from.json to.json\n",argv[0]);return 2;}
+	ftext=read_file(argv[1],0);ttext=read_file(argv[2],0);
+	check(ftext && ttext,argv[1],"cannot read the documents");
+	if (ftext && ttext) check_texts(argv[1],ftext,ttext);
+	free(ftext);free(ttext);
+	return test_failures?1:0;
+}
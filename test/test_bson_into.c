@@ -0,0 +1,94 @@
+/*
+  test_bson_into: encoding into the caller's memory and an encoder's.
+
+  Usage: test_bson_into file.json...
+
+  cJSON_PrintBSONInto must fail, reporting the size it needs, when given
+  less room than the document takes (none at all, or no buffer), write
+  no further than the room it is given, and then give what
+  cJSON_PrintBSON gives in exactly that much. cJSON_PrintBSONElementInto
+  must do the same against cJSON_PrintBSONElement, and an encoder used
+  for document after document, growing and not, must keep giving what
+  cJSON_PrintBSON gives.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "test_util.h"
+
+#define GUARD 16
+
+/* Encode with encode(item,buf,cap,&needed) into every short buffer, then into one just big enough. */
+static void check_into(const char *name,const char *want,size_t size,
+	size_t (*encode)(cJSON*,size_t,char*,size_t,size_t*),cJSON *item,size_t index)
+{
+	char *buf=(char*)malloc(size+GUARD);size_t needed=1,cap,i;int guarded=1;
+	check(!encode(item,index,0,0,&needed) && needed==size,name,"no buffer did not report the size needed");
+	for (cap=0;cap<size;cap+=cap<8?1:cap/3)
+	{
+		memset(buf,0x5a,size+GUARD);needed=0;
+		check(!encode(item,index,buf,cap,&needed) && needed==size,name,"a short buffer did not report the size needed");
+		for (i=cap;i<size+GUARD;i++) guarded&=buf[i]==0x5a;
+	}
+	check(guarded,name,"wrote past the room it was given");
+	memset(buf,0x5a,size+GUARD);
+	check(encode(item,index,buf,size,&needed)==size && needed==size && same_bson(buf,size,want,size),name,"differs in a buffer just big enough");
+	for (i=size;i<size+GUARD;i++) guarded&=buf[i]==0x5a;
+	check(guarded,name,"wrote past the document");
+	free(buf);
+}
+
+static size_t doc_into(cJSON *item,size_t index,char *buf,size_t cap,size_t *needed)	{(void)index;return cJSON_PrintBSONInto(item,buf,cap,needed);}
+static size_t element_into(cJSON *item,size_t index,char *buf,size_t cap,size_t *needed)	{return cJSON_PrintBSONElementInto(item,index,buf,cap,needed);}
+
+static void check_document(const char *name,cJSON *doc)
+{
+	size_t size,index=0;char *bson=cJSON_PrintBSON(doc,&size);cJSON *c;
+	check(bson!=0,name,"cannot be encoded");
+	if (bson) check_into(name,bson,size,doc_into,doc,0);
+	cJSON_DeleteBSON(bson);
+	for (c=doc->child;c;c=c->next,index++)
+	{
+		bson=cJSON_PrintBSONElement(c,index,&size);
+		check(bson!=0,name,"an element cannot be encoded");
+		if (bson) check_into(name,bson,size,element_into,c,index);
+		cJSON_DeleteBSON(bson);
+	}
+}
+
+/* One encoder for every document, in order and back again, so its buffer both grows and is reused. */
+static void check_encoder(cJSON **docs,int count)
+{
+	cBSON_Encoder *enc=cBSON_CreateEncoder();int i,round;
+	check(enc!=0,"encoder","cannot be created");
+	for (round=0;enc && round<2;round++) for (i=0;i<count;i++)
+	{
+		cJSON *doc=docs[round?count-1-i:i];
+		size_t size,plen;const char *with=cJSON_PrintBSONWith(enc,doc,&size);char *plain=cJSON_PrintBSON(doc,&plen);
+		check(with && plain && same_bson(with,size,plain,plen),"encoder","differs from cJSON_PrintBSON");
+		cJSON_DeleteBSON(plain);
+	}
+	cBSON_DeleteEncoder(enc);
+}
+
+int main(int argc,char *argv[])
+{
+	cJSON **docs=(cJSON**)malloc((argc+1)*sizeof(cJSON*));int i,count=0;
+	docs[count++]=cJSON_CreateObject();
+	for (i=1;i<argc;i++)
+	{
+		char *text=read_file(argv[i],0);cJSON *doc=text?cJSON_Parse(text):0;
+		check(doc!=0,argv[i],"cannot be parsed");
+		if (doc) {check_document(argv[i],doc);docs[count++]=doc;}
+		free(text);
+	}
+	check_document("empty",docs[0]);
+	check_encoder(docs,count);
+	for (i=0;i<count;i++) cJSON_Delete(docs[i]);
+	free(docs);
+	return test_failures?1:0;
+}
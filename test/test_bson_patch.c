@@ -0,0 +1,88 @@
+/*
+  test_bson_patch: cBSON_ApplyPatches against cJSONUtils_ApplyPatches.
+
+  Usage: test_bson_patch from.json to.json
+
+  Patching the BSON of a document must give the BSON of what patching its
+  tree gives, for the patches cJSONUtils_GeneratePatches and cBSON_Diff
+  make between two documents (both ways round) and for patches written to
+  use each operation. A patch the tree refuses must be refused too, as
+  must one removing what isn't there, which cJSONUtils lets pass but
+  RFC 6902 does not; the document patched is left as it was.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "cJSON_Utils.h"
+#include "test_util.h"
+
+static const char *base="{\"a\":1,\"b\":[1,2,3],\"c\":{\"d\":\"e\",\"f\":[{\"g\":true}]},\"h\":null}";
+
+/* Patch doc both ways: the bytes of its BSON, and its tree, unless the BSON patch must be refused. */
+static void check_patches(const char *name,cJSON *doc,cJSON *patches,int refused)
+{
+	size_t len,plen;char *bson=cJSON_PrintBSON(doc,&len),*before,*patched;
+	cJSON *tree=cJSON_Duplicate(doc,1),*decoded;int treeFailed;
+	if (!bson || !tree) {check(0,name,"cannot set up the test");cJSON_Delete(tree);cJSON_DeleteBSON(bson);return;}
+	before=(char*)malloc(len);memcpy(before,bson,len);
+	patched=cBSON_ApplyPatches(bson,len,patches,&plen);
+	treeFailed=cJSONUtils_ApplyPatches(tree,patches)!=0;
+	check(!memcmp(before,bson,len),name,"the document patched changed");
+	if (refused) check(!patched,name,"cBSON_ApplyPatches removed what isn't there");
+	else check((patched==0)==treeFailed,name,patched?"cBSON_ApplyPatches accepted what the tree refused":"cBSON_ApplyPatches failed");
+	if (patched)
+	{
+		decoded=cJSON_ParseBSON(patched,plen,cJSON_Object);
+		check(decoded && same_content(decoded,tree),name,"the patched document differs from the patched tree");
+		cJSON_Delete(decoded);
+	}
+	free(before);cJSON_DeleteBSON(patched);cJSON_DeleteBSON(bson);cJSON_Delete(tree);
+}
+
+static void check_text(const char *name,const char *patch,int refused)
+{
+	cJSON *doc=cJSON_Parse(base),*patches=cJSON_Parse(patch);
+	check(doc && patches,name,"cannot be parsed");
+	if (doc && patches) check_patches(name,doc,patches,refused);
+	cJSON_Delete(doc);cJSON_Delete(patches);
+}
+
+static void check_between(const char *name,cJSON *from,cJSON *to)
+{
+	size_t flen,tlen;char *fbson=cJSON_PrintBSON(from,&flen),*tbson=cJSON_PrintBSON(to,&tlen);
+	cJSON *generated=cJSONUtils_GeneratePatches(from,to),*diffed=fbson && tbson?cBSON_Diff(fbson,flen,tbson,tlen):0;
+	check(generated && diffed,name,"cannot make the patches");
+	if (generated) check_patches(name,from,generated,0);
+	if (diffed) check_patches(name,from,diffed,0);
+	cJSON_Delete(generated);cJSON_Delete(diffed);
+	cJSON_DeleteBSON(fbson);cJSON_DeleteBSON(tbson);
+}
+
+int main(int argc,char *argv[])
+{
+	char *ftext,*ttext;cJSON *from,*to;
+	check_text("add","[{\"op\":\"add\",\"path\":\"/x\",\"value\":{\"y\":[1]}},{\"op\":\"add\",\"path\":\"/b/1\",\"value\":9},{\"op\":\"add\",\"path\":\"/b/-\",\"value\":\"end\"}]",0);
+	check_text("add over a member","[{\"op\":\"add\",\"path\":\"/a\",\"value\":[1,2]}]",0);
+	check_text("remove","[{\"op\":\"remove\",\"path\":\"/b/0\"},{\"op\":\"remove\",\"path\":\"/c/d\"}]",0);
+	check_text("replace","[{\"op\":\"replace\",\"path\":\"/c/f/0/g\",\"value\":\"deep\"},{\"op\":\"replace\",\"path\":\"/h\",\"value\":2.5}]",0);
+	check_text("move","[{\"op\":\"move\",\"from\":\"/c/f\",\"path\":\"/f\"},{\"op\":\"move\",\"from\":\"/b/0\",\"path\":\"/b/2\"}]",0);
+	check_text("copy","[{\"op\":\"copy\",\"from\":\"/c\",\"path\":\"/b/1\"}]",0);
+	check_text("passing test","[{\"op\":\"test\",\"path\":\"/c/d\",\"value\":\"e\"},{\"op\":\"remove\",\"path\":\"/a\"}]",0);
+	check_text("failing test","[{\"op\":\"remove\",\"path\":\"/a\"},{\"op\":\"test\",\"path\":\"/c/d\",\"value\":\"no\"}]",0);
+	check_text("missing path","[{\"op\":\"remove\",\"path\":\"/nothing/here\"}]",1);
+	check_text("missing member","[{\"op\":\"remove\",\"path\":\"/zz\"}]",1);
+	check_text("replace missing","[{\"op\":\"replace\",\"path\":\"/zz\",\"value\":1}]",0);
+	check_text("move missing","[{\"op\":\"move\",\"from\":\"/zz\",\"path\":\"/y\"}]",0);
+	check_text("index past the end","[{\"op\":\"add\",\"path\":\"/b/7\",\"value\":1}]",0);
+	if (argc!=3) {fprintf(stderr,"Usage: %s from.json to.json\n",argv[0]);return 2;}
+	ftext=read_file(argv[1],0);ttext=read_file(argv[2],0);
+	from=ftext?cJSON_Parse(ftext):0;to=ttext?cJSON_Parse(ttext):0;
+	check(from && to,argv[1],"cannot read the documents");
+	if (from && to) {check_between(argv[1],from,to);check_between(argv[2],to,from);}
+	cJSON_Delete(from);cJSON_Delete(to);free(ftext);free(ttext);
+	return test_failures?1:0;
+}
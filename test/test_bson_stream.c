@@ -0,0 +1,143 @@
+/*
+  test_bson_stream: the BSON push decoder against cJSON_ParseBSON.
+
+  Usage: test_bson_stream file.bson|file.json...
+
+  Each file (a run of BSON documents, or the BSON of a JSON file) is fed to
+  a cBSON_Stream in chunks of many sizes, whole and split into elements,
+  and the documents handed over must be those cJSON_ParseBSON decodes one
+  after another. A stream must also fail on a document whose length is
+  impossible, or that the input ends in the middle of, and stop when its
+  handler says so.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "test_util.h"
+
+typedef struct
+{
+	cJSON *values,*open;
+	int events,stopAfter,badEvent;
+} collected;
+
+static int collect(void *ctx,int event,cJSON *item)
+{
+	collected *c=(collected*)ctx;
+	c->events++;
+	switch (event)
+	{
+		case cJSON_StreamOpen:
+			if (c->open || item->child) c->badEvent=1;
+			c->open=cJSON_CreateObject();
+			break;
+		case cJSON_StreamItem:
+			if (!c->open) {c->badEvent=1;cJSON_Delete(item);break;}
+			{	/* AddItemToObject frees the item's key before copying the one it is given */
+				char *key=(char*)malloc(strlen(item->string)+1);
+				strcpy(key,item->string);cJSON_AddItemToObject(c->open,key,item);free(key);
+			}
+			break;
+		case cJSON_StreamClose:
+			if (!c->open || (item->type&255)!=cJSON_Object) c->badEvent=1;
+			else cJSON_AddItemToArray(c->values,c->open);
+			c->open=0;
+			break;
+		default:
+			cJSON_AddItemToArray(c->values,item);
+			break;
+	}
+	return c->events!=c->stopAfter;
+}
+
+static int32_t doc_length(const char *at)	{int32_t len;memcpy(&len,at,sizeof(len));return len;}
+
+/* The documents cJSON_ParseBSON decodes from bson, one after another. */
+static cJSON *parse_all(const char *bson,size_t size)
+{
+	cJSON *values=cJSON_CreateArray(),*v;size_t at=0;
+	while (size-at>=5 && doc_length(bson+at)>=5 && (size_t)doc_length(bson+at)<=size-at &&
+		(v=cJSON_ParseBSON(bson+at,doc_length(bson+at),cJSON_Object)))
+	{
+		cJSON_AddItemToArray(values,v);
+		at+=doc_length(bson+at);
+	}
+	return values;
+}
+
+/* Decode bson in chunks of size bytes; what Finish returns, or 0 if a Feed failed. */
+static int decode(const char *bson,size_t len,size_t size,int split,collected *c)
+{
+	cBSON_Stream *stream=cJSON_CreateBSONStream(cJSON_Object,split,collect,c);size_t at;int ok=stream!=0;
+	for (at=0;ok && at<len;at+=size) ok=cJSON_BSONStreamFeed(stream,bson+at,len-at<size?len-at:size);
+	ok=ok && cJSON_BSONStreamFinish(stream);
+	cJSON_DeleteBSONStream(stream);
+	return ok;
+}
+
+static void check_file(const char *name,const char *bson,size_t len)
+{
+	static const size_t sizes[]={1,2,3,5,64,65,4096,(size_t)-1};
+	cJSON *want=parse_all(bson,len);size_t i;int split;
+	check(cJSON_GetArraySize(want)>0,name,"holds no documents");
+	for (split=0;split<2;split++) for (i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++)
+	{
+		collected c={0,0,0,0,0};
+		c.values=cJSON_CreateArray();
+		check(decode(bson,len,sizes[i],split,&c),name,split?"split stream failed":"stream failed");
+		check(!c.badEvent && !c.open,name,"events out of order");
+		check(same_tree(c.values,want),name,split?"split stream documents differ":"stream documents differ");
+		cJSON_Delete(c.values);
+	}
+	/* Cut short, the last document never arrives. */
+	{
+		collected c={0,0,0,0,0};
+		c.values=cJSON_CreateArray();
+		check(!decode(bson,len-1,7,1,&c),name,"accepted a document cut short");
+		cJSON_Delete(c.open);cJSON_Delete(c.values);
+	}
+	cJSON_Delete(want);
+}
+
+/* Lengths no document can have, and a handler that stops. */
+static void check_failures(void)
+{
+	static const char tooShort[]={4,0,0,0,0},negative[]={(char)0xff,(char)0xff,(char)0xff,(char)0xff,0},
+		unterminated[]={5,0,0,0,1},twoDocs[]={5,0,0,0,0,5,0,0,0,0};
+	collected c={0,0,0,0,0};
+	c.values=cJSON_CreateArray();
+	check(!decode(tooShort,sizeof(tooShort),2,0,&c),"too short","accepted");
+	check(!decode(negative,sizeof(negative),2,0,&c),"negative length","accepted");
+	check(!decode(unterminated,sizeof(unterminated),2,0,&c),"unterminated","accepted");
+	cJSON_Delete(c.values);c.values=cJSON_CreateArray();c.events=0;
+	check(decode(twoDocs,sizeof(twoDocs),3,0,&c) && cJSON_GetArraySize(c.values)==2,"empty documents","not both decoded");
+	cJSON_Delete(c.values);c.values=cJSON_CreateArray();c.events=0;c.stopAfter=1;
+	check(!decode(twoDocs,sizeof(twoDocs),3,0,&c) && c.events==1,"stopped","the stream went on after its handler stopped it");
+	cJSON_Delete(c.values);
+}
+
+int main(int argc,char *argv[])
+{
+	int i;
+	cJSON_BSON_SetUseExtendedTypes(1);
+	for (i=1;i<argc;i++)
+	{
+		size_t len,n=strlen(argv[i]);char *data=read_file(argv[i],&len),*bson=data;cJSON *tree=0;
+		check(data!=0,argv[i],"cannot be read");
+		if (data && n>5 && !strcmp(argv[i]+n-5,".json"))
+		{
+			tree=cJSON_Parse(data);
+			bson=tree?cJSON_PrintBSON(tree,&len):0;
+			check(bson!=0,argv[i],"cannot be encoded");
+		}
+		if (bson) check_file(argv[i],bson,len);
+		if (tree) cJSON_DeleteBSON(bson);
+		cJSON_Delete(tree);free(data);
+	}
+	check_failures();
+	return test_failures?1:0;
+}
@@ -0,0 +1,92 @@
+/*
+  test_bson_vec: cJSON_PrintBSONVec against cJSON_PrintBSON.
+
+  Usage: test_bson_vec file.json...
+
+  The pieces cJSON_PrintBSONVec gives for each document, put back
+  together, must be what cJSON_PrintBSON gives, whatever the smallest
+  string it leaves in place. Strings at least that long must be pointed
+  at where the tree keeps them rather than copied, and with nothing
+  left in place the document must come in one piece.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "test_util.h"
+
+static const char *strings="{\"short\":\"abc\",\"long\":\"a string long enough to be left where the tree keeps it\","
+	"\"list\":[\"another string long enough to be left in place\",1,{\"k\":\"xyz\"}],\"empty\":\"\"}";
+
+/* Whether a piece points into the string an item of the tree holds. */
+static int points_into_tree(cJSON *item,const char *at)
+{
+	cJSON *c;
+	if (item->valuestring && at>=item->valuestring && at<item->valuestring+strlen(item->valuestring)) return 1;
+	for (c=item->child;c;c=c->next) if (points_into_tree(c,at)) return 1;
+	return 0;
+}
+
+static void check_vec(const char *name,cJSON *doc,size_t minRef)
+{
+	size_t count,size,plen,i,at=0;int inPlace=0;
+	cBSON_IOVec *vec=cJSON_PrintBSONVec(doc,minRef,&count,&size);
+	char *plain=cJSON_PrintBSON(doc,&plen),*joined=(char*)malloc(plen+1);
+	char what[80];
+	sprintf(what,"pieces differ from cJSON_PrintBSON leaving %lu bytes in place",(unsigned long)minRef);
+	check(vec && plain,name,"cannot encode");
+	if (!vec || !plain) goto done;
+	for (i=0;i<count && at+vec[i].iov_len<=plen;i++)
+	{
+		memcpy(joined+at,vec[i].iov_base,vec[i].iov_len);
+		at+=vec[i].iov_len;
+		if (points_into_tree(doc,(const char*)vec[i].iov_base))
+		{
+			inPlace=1;
+			check(vec[i].iov_len>=minRef,name,"a short string was left in place");
+		}
+	}
+	check(i==count && at==size && size==plen && same_bson(joined,at,plain,plen),name,what);
+	if (minRef==(size_t)-1) check(count==1 && !inPlace,name,"leaving nothing in place is not one piece");
+done:
+	cJSON_DeleteBSONVec(vec);cJSON_DeleteBSON(plain);free(joined);
+}
+
+static void check_document(const char *name,cJSON *doc)
+{
+	static const size_t minRefs[]={0,1,4,16,64,4096,(size_t)-1};
+	size_t i;
+	for (i=0;i<sizeof(minRefs)/sizeof(minRefs[0]);i++) check_vec(name,doc,minRefs[i]);
+}
+
+/* Long strings are pointed at, short ones copied. */
+static void check_in_place(void)
+{
+	cJSON *doc=cJSON_Parse(strings);
+	size_t count,size,i;int found=0;cBSON_IOVec *vec=cJSON_PrintBSONVec(doc,32,&count,&size);
+	check(vec!=0,"in place","cannot encode");
+	for (i=0;vec && i<count;i++)
+		if (vec[i].iov_base==(void*)cJSON_GetObjectItem(doc,"long")->valuestring ||
+			vec[i].iov_base==(void*)cJSON_GetArrayItem(cJSON_GetObjectItem(doc,"list"),0)->valuestring) found++;
+	check(found==2,"in place","the long strings were copied");
+	cJSON_DeleteBSONVec(vec);
+	check_document("in place",doc);
+	cJSON_Delete(doc);
+}
+
+int main(int argc,char *argv[])
+{
+	int i;
+	for (i=1;i<argc;i++)
+	{
+		char *text=read_file(argv[i],0);cJSON *doc=text?cJSON_Parse(text):0;
+		check(doc!=0,argv[i],"cannot be parsed");
+		if (doc) check_document(argv[i],doc);
+		cJSON_Delete(doc);free(text);
+	}
+	check_in_place();
+	return test_failures?1:0;
+}
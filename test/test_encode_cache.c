@@ -0,0 +1,96 @@
+/*
+  test_encode_cache: cJSON_PrintBSONCached against cJSON_PrintBSON.
+
+  Usage: test_encode_cache from.json to.json
+
+  A tree encoded again and again through one cache must keep giving what
+  cJSON_PrintBSON gives, unchanged, after cJSONUtils_ApplyPatches turns it
+  into the second document, and after changes made in place by thawing
+  the way down to them. What the cache snapshots must refuse to change.
+  A cache must serve several trees, outlive the ones it has seen, and
+  keep up through enough changes to drop what is no longer used.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "cJSON_Utils.h"
+#include "test_util.h"
+
+static void check_cached(const char *name,cBSON_EncodeCache *cache,cJSON *item,const char *when)
+{
+	size_t clen,plen;char *cached=cJSON_PrintBSONCached(cache,item,&clen),*plain=cJSON_PrintBSON(item,&plen);
+	char what[128];
+	sprintf(what,"cached encoding differs %s",when);
+	check(cached && plain && same_bson(cached,clen,plain,plen),name,what);
+	cJSON_DeleteBSON(cached);cJSON_DeleteBSON(plain);
+}
+
+/* Encode one tree through a cache as it changes. */
+static void check_changes(const char *name,cJSON *from,cJSON *to)
+{
+	cBSON_EncodeCache *cache=cBSON_CreateEncodeCache();
+	cJSON *doc=cJSON_Duplicate(from,1),*patches=cJSONUtils_GeneratePatches(from,to),*item;
+	check(cache && doc && patches,name,"cannot set up the test");
+	if (!cache || !doc || !patches) goto done;
+	check_cached(name,cache,doc,"at first");
+	check_cached(name,cache,doc,"when unchanged");
+	check(!cJSONUtils_ApplyPatches(doc,patches),name,"cJSONUtils_ApplyPatches failed");
+	check(same_content(doc,to),name,"cJSONUtils_ApplyPatches did not reach the target");
+	check_cached(name,cache,doc,"after patching");
+	/* The cache snapshots doc, so what is frozen must stay so and the changes thaw their way down. */
+	check((item=cJSONUtils_GetPointer(doc,"/matrix/1/1"))!=0 && cJSON_SetNumberValue(item,5)!=5,name,"a snapshot item could be changed");
+	check((item=cJSONUtils_ThawPointer(doc,"/owner/address"))!=0 && cJSON_ReplaceItemInObject(item,"city",cJSON_CreateString("Paris")),name,"cannot replace /owner/address/city");
+	check((item=cJSONUtils_ThawPointer(doc,"/matrix/1/1"))!=0 && cJSON_SetNumberValue(item,5)==5,name,"cannot set /matrix/1/1");
+	cJSON_DeleteItemFromObject(doc,"disabled");
+	check(cJSON_GetObjectItem(doc,"disabled")==0,name,"cannot delete /disabled");
+	check(cJSON_AddItemToArray(cJSON_GetObjectItem(doc,"tags"),cJSON_CreateString("zeta")),name,"cannot add to /tags");
+	check_cached(name,cache,doc,"after changes in place");
+	check_cached(name,cache,doc,"when unchanged again");
+done:
+	cJSON_Delete(patches);cJSON_Delete(doc);
+	cBSON_DeleteEncodeCache(cache);
+}
+
+/* Several trees through one cache, deleted before it, and one changed often enough that the cache drops old entries. */
+static void check_lifetimes(const char *name,cJSON *from,cJSON *to)
+{
+	cBSON_EncodeCache *cache=cBSON_CreateEncodeCache();
+	cJSON *a=cJSON_Duplicate(from,1),*b=cJSON_Duplicate(to,1),*list=cJSON_CreateArray(),*item;
+	char path[32];size_t len;int i;
+	check(cache && a && b && list,name,"cannot set up the test");
+	if (!cache || !a || !b || !list) goto done;
+	check_cached(name,cache,a,"for the first of two trees");
+	check_cached(name,cache,b,"for the second of two trees");
+	check_cached(name,cache,a,"for the first tree again");
+	cJSON_Delete(b);b=0;
+	check_cached(name,cache,a,"after another tree was deleted");
+	for (i=0;i<64;i++) cJSON_AddItemToArray(list,cJSON_Duplicate(from,1));
+	for (i=0;i<1000;i++)
+	{
+		sprintf(path,"/%d/history/%d",i%64,i%2);
+		item=cJSONUtils_ThawPointer(list,path);
+		check(item && cJSON_ReplaceItemInObject(item,"at",cJSON_CreateNumber(i)),name,"cannot change an element");
+		if (i%97==0) check_cached(name,cache,list,"while the cache sweeps");
+		else cJSON_DeleteBSON(cJSON_PrintBSONCached(cache,list,&len));
+	}
+	check_cached(name,cache,list,"after many changes");
+done:
+	cJSON_Delete(a);cJSON_Delete(b);cJSON_Delete(list);
+	cBSON_DeleteEncodeCache(cache);
+}
+
+int main(int argc,char *argv[])
+{
+	char *ftext,*ttext;cJSON *from,*to;
+	if (argc!=3) {fprintf(stderr,"Usage: %s from.json to.json\n",argv[0]);return 2;}
+	ftext=read_file(argv[1],0);ttext=read_file(argv[2],0);
+	from=ftext?cJSON_Parse(ftext):0;to=ttext?cJSON_Parse(ttext):0;
+	check(from && to,argv[1],"cannot read the documents");
+	if (from && to) {check_changes(argv[1],from,to);check_lifetimes(argv[1],from,to);}
+	cJSON_Delete(from);cJSON_Delete(to);free(ftext);free(ttext);
+	return test_failures?1:0;
+}
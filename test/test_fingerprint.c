@@ -0,0 +1,87 @@
+/*
+  test_fingerprint: content hashes of trees and of their BSON.
+
+  Usage: test_fingerprint file.json...
+
+  cJSON_Fingerprint of each document must match cBSON_Fingerprint of its
+  BSON, ordered and unordered. Reversing the members of every object must
+  keep the unordered hash and change the ordered one, while changing a
+  value, or the order of an array, must change both.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "test_util.h"
+
+/* Reverse the members of every object in item, leaving arrays in order. */
+static void reverse_objects(cJSON *item)
+{
+	cJSON *c,*next,*first=0;
+	for (c=item->child;c;c=c->next) reverse_objects(c);
+	if ((item->type&255)!=cJSON_Object) return;
+	for (c=item->child;c;c=next) {next=c->next;c->next=first;c->prev=next;first=c;}
+	item->child=first;
+}
+
+static uint64_t tree_hash(const char *name,cJSON *item,int unordered)
+{
+	uint64_t h=0;
+	check(cJSON_Fingerprint(item,unordered,&h),name,"cJSON_Fingerprint failed");
+	return h;
+}
+
+static void check_document(const char *name,cJSON *doc)
+{
+	size_t size;char *bson=cJSON_PrintBSON(doc,&size);
+	uint64_t tree,encoded;int unordered;cJSON *copy,*first;
+	check(bson!=0,name,"cJSON_PrintBSON failed");
+	for (unordered=0;bson && unordered<2;unordered++)
+	{
+		tree=tree_hash(name,doc,unordered);
+		check(cBSON_Fingerprint(bson,size,doc->type&255,unordered,&encoded),name,"cBSON_Fingerprint failed");
+		check(tree==encoded,name,unordered?"unordered fingerprints differ":"ordered fingerprints differ");
+	}
+	cJSON_DeleteBSON(bson);
+
+	copy=cJSON_Duplicate(doc,1);reverse_objects(copy);
+	check(tree_hash(name,copy,1)==tree_hash(name,doc,1),name,"reordering members changed the unordered fingerprint");
+	if (!same_tree(copy,doc))
+		check(tree_hash(name,copy,0)!=tree_hash(name,doc,0),name,"reordering members kept the ordered fingerprint");
+	cJSON_Delete(copy);
+
+	copy=cJSON_Duplicate(doc,1);
+	for (first=copy;first && first->child;first=first->child);
+	if (first && first!=copy)
+	{
+		cJSON_SetValuestringWithLength(first,"changed",7);cJSON_SetNumberValue(first,first->valuedouble+1);
+		check(tree_hash(name,copy,1)!=tree_hash(name,doc,1),name,"changing a value kept the unordered fingerprint");
+		check(tree_hash(name,copy,0)!=tree_hash(name,doc,0),name,"changing a value kept the ordered fingerprint");
+	}
+	cJSON_Delete(copy);
+}
+
+/* Arrays keep their order even in the unordered hash. */
+static void check_arrays(void)
+{
+	cJSON *a=cJSON_Parse("{\"x\":[1,2],\"y\":{\"p\":1,\"q\":2}}"),*b=cJSON_Parse("{\"x\":[2,1],\"y\":{\"q\":2,\"p\":1}}");
+	check(tree_hash("arrays",a,1)!=tree_hash("arrays",b,1),"arrays","reordering an array kept the unordered fingerprint");
+	cJSON_Delete(a);cJSON_Delete(b);
+}
+
+int main(int argc,char *argv[])
+{
+	int i;
+	for (i=1;i<argc;i++)
+	{
+		char *text=read_file(argv[i],0);cJSON *doc=text?cJSON_Parse(text):0;
+		check(doc!=0,argv[i],"cannot be parsed");
+		if (doc) check_document(argv[i],doc);
+		cJSON_Delete(doc);free(text);
+	}
+	check_arrays();
+	return test_failures?1:0;
+}
@@ -0,0 +1,80 @@
+/*
+  test_intern: interned trees against plain ones.
+
+  Usage: test_intern file.json...
+
+  cJSON_ParseInterned, cJSON_Intern and cJSON_ParseBSONInterned must build
+  the trees the plain parsers build, with equal strings and subtrees
+  stored once. Interned trees must outlive their pool, and changing one
+  (thawing its way down) must leave the others as they were.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "cJSON_Utils.h"
+#include "test_util.h"
+
+static const char *repeated="{\"a\":{\"k\":[1,2,{\"s\":\"long enough to be worth sharing\"}]},"
+	"\"b\":{\"k\":[1,2,{\"s\":\"long enough to be worth sharing\"}]},\"c\":[\"x\",\"x\",\"x\"]}";
+
+static void check_file(const char *name,const char *text)
+{
+	cJSON_InternPool *pool=cJSON_CreateInternPool();
+	cJSON *plain=cJSON_Parse(text),*parsed=cJSON_ParseInterned(text,pool),*inPlace=cJSON_Parse(text),*decoded=0;
+	size_t size;char *bson=plain?cJSON_PrintBSON(plain,&size):0;
+	check(pool && plain && parsed && inPlace && bson,name,"cannot set up the test");
+	if (!pool || !plain || !parsed || !inPlace || !bson) goto done;
+	check(cJSON_Intern(pool,inPlace)==inPlace,name,"cJSON_Intern failed");
+	decoded=cJSON_ParseBSONInterned(bson,size,plain->type&255,pool);
+	check(same_tree(parsed,plain),name,"cJSON_ParseInterned differs from cJSON_Parse");
+	check(same_tree(inPlace,plain),name,"cJSON_Intern changed the tree");
+	check(decoded && same_content(decoded,plain),name,"cJSON_ParseBSONInterned differs from the document");
+	/* The trees outlive the pool. */
+	cJSON_DeleteInternPool(pool);pool=0;
+	check(same_tree(parsed,plain) && same_tree(inPlace,plain),name,"interned trees changed with their pool");
+done:
+	cJSON_DeleteInternPool(pool);
+	cJSON_Delete(plain);cJSON_Delete(parsed);cJSON_Delete(inPlace);cJSON_Delete(decoded);cJSON_DeleteBSON(bson);
+}
+
+/* Equal subtrees share one canonical item, and changing one leaves the other alone. */
+static void check_sharing(void)
+{
+	cJSON_InternPool *pool=cJSON_CreateInternPool();
+	cJSON *doc=cJSON_ParseInterned(repeated,pool),*plain=cJSON_Parse(repeated),*a,*b,*item;
+	check(doc && plain,"sharing","cannot parse");
+	if (!doc || !plain) goto done;
+	a=cJSON_GetObjectItem(doc,"a");b=cJSON_GetObjectItem(doc,"b");
+	check(a && b && a->shared && a->shared==b->shared,"sharing","equal subtrees are not shared");
+	item=cJSON_GetObjectItem(doc,"c");
+	check(item && item->child && item->child->next && item->child->valuestring==item->child->next->valuestring,"sharing","equal strings are not shared");
+	cJSON_DeleteInternPool(pool);pool=0;
+	/* Changing a copy means thawing the way down to it; b, and whatever b shares, stays as it was. */
+	item=cJSON_GetArrayItem(cJSON_Thaw(cJSON_GetObjectItem(cJSON_Thaw(cJSON_GetObjectItem(cJSON_Thaw(doc),"a")),"k")),2);
+	check(item && cJSON_ReplaceItemInObject(item,"s",cJSON_CreateString("changed")),"sharing","cannot change /a/k/2/s");
+	item=cJSON_GetArrayItem(cJSON_Thaw(cJSON_GetObjectItem(cJSON_Thaw(cJSON_GetObjectItem(doc,"b")),"k")),0);
+	check(cJSON_SetNumberValue(item,5)==5,"sharing","cannot change /b/k/0");
+	cJSON_ReplaceItemInObject(cJSONUtils_GetPointer(plain,"/a/k/2"),"s",cJSON_CreateString("changed"));
+	cJSON_SetNumberValue(cJSONUtils_GetPointer(plain,"/b/k/0"),5);
+	check(same_tree(doc,plain),"sharing","changing one copy changed another");
+done:
+	cJSON_DeleteInternPool(pool);cJSON_Delete(doc);cJSON_Delete(plain);
+}
+
+int main(int argc,char *argv[])
+{
+	int i;
+	for (i=1;i<argc;i++)
+	{
+		char *text=read_file(argv[i],0);
+		check(text!=0,argv[i],"cannot be read");
+		if (text) check_file(argv[i],text);
+		free(text);
+	}
+	check_sharing();
+	return test_failures?1:0;
+}
@@ -0,0 +1,63 @@
+/*
+  test_parse_indexed: cJSON_ParseIndexed against cJSON_Parse.
+
+  Usage: test_parse_indexed file.json...
+
+  The two-stage parser must build the tree the reference parser builds,
+  from each file named and from texts chosen to straddle the blocks its
+  structural index works in, and reject what the reference rejects.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "test_util.h"
+
+/* Parse text both ways, with and without requiring it to end there. */
+static void check_text(const char *name,const char *text)
+{
+	const char *plainEnd=0,*indexedEnd=0;int require;
+	for (require=0;require<2;require++)
+	{
+		cJSON *plain=cJSON_ParseWithOpts(text,&plainEnd,require),*indexed=cJSON_ParseIndexedWithOpts(text,&indexedEnd,require);
+		check(!plain==!indexed,name,plain?"cJSON_ParseIndexed failed":"cJSON_ParseIndexed accepted what cJSON_Parse rejects");
+		check(!plain || same_tree(plain,indexed),name,"cJSON_ParseIndexed differs from cJSON_Parse");
+		check(!plain || plainEnd==indexedEnd,name,"cJSON_ParseIndexed stopped elsewhere");
+		cJSON_Delete(plain);cJSON_Delete(indexed);
+	}
+}
+
+/* A long string whose quote and escapes fall either side of a 64-byte boundary. */
+static void check_long_strings(void)
+{
+	char text[300];int pad;
+	for (pad=50;pad<80;pad++)
+	{
+		memset(text,0,sizeof(text));
+		strcpy(text,"{\"k\":\"");
+		memset(text+6,'x',pad);
+		strcat(text,"\\\"\\\\\",\"n\":[1,2.5e3,-0,true,null]}");
+		check_text("long string",text);
+	}
+}
+
+int main(int argc,char *argv[])
+{
+	static const char *texts[]={
+		"{}","[]","0","-1.5e-7","\"\"","\"\\u00e9\\ud83d\\ude00\"","[1,[2,[3,{}]]]",
+		"  {\"a\" : [ true , false , null ] , \"b\" : \"c\" }  ","{\"a\":1} trailing",
+		"","{","[1,]","{\"a\"}","{\"a\":}","[\"unterminated","\"\\x\"","[1 2]","nul",0};
+	int i;
+	for (i=0;texts[i];i++) check_text(texts[i],texts[i]);
+	check_long_strings();
+	for (i=1;i<argc;i++)
+	{
+		char *text=read_file(argv[i],0);
+		check(text!=0,argv[i],"cannot be read");
+		if (text) check_text(argv[i],text);
+		free(text);
+	}
+	return test_failures?1:0;
+}
@@ -0,0 +1,130 @@
+/*
+  test_stream: the push parser against cJSON_Parse.
+
+  Usage: test_stream file.json...
+
+  Each file (a run of top-level values) is fed to a cJSON_Stream in chunks
+  of many sizes, whole and split into elements, and the values handed over
+  must be those cJSON_ParseWithOpts finds one after another. A stream must
+  also fail on malformed or unfinished text, stop when its handler says
+  so, and start over cleanly after cJSON_ResetStream.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "test_util.h"
+
+/* What a stream has handed over: each value, with split containers put back together. */
+typedef struct
+{
+	cJSON *values,*open;
+	int events,stopAfter,badEvent;
+} collected;
+
+static int collect(void *ctx,int event,cJSON *item)
+{
+	collected *c=(collected*)ctx;
+	c->events++;
+	switch (event)
+	{
+		case cJSON_StreamOpen:
+			if (c->open || item->child) c->badEvent=1;
+			c->open=(item->type&255)==cJSON_Array?cJSON_CreateArray():cJSON_CreateObject();
+			break;
+		case cJSON_StreamItem:
+			if (!c->open) {c->badEvent=1;cJSON_Delete(item);break;}
+			if ((c->open->type&255)==cJSON_Object)
+			{	/* AddItemToObject frees the item's key before copying the one it is given */
+				char *key=(char*)malloc(strlen(item->string)+1);
+				strcpy(key,item->string);cJSON_AddItemToObject(c->open,key,item);free(key);
+			}
+			else cJSON_AddItemToArray(c->open,item);
+			break;
+		case cJSON_StreamClose:
+			if (!c->open || (c->open->type&255)!=(item->type&255)) c->badEvent=1;
+			else cJSON_AddItemToArray(c->values,c->open);
+			c->open=0;
+			break;
+		default:
+			cJSON_AddItemToArray(c->values,item);
+			break;
+	}
+	return c->events!=c->stopAfter;
+}
+
+/* The values cJSON_ParseWithOpts finds in text, one after another. */
+static cJSON *parse_all(const char *text)
+{
+	cJSON *values=cJSON_CreateArray(),*v;const char *end;
+	for (;;)
+	{
+		while (*text==' ' || *text=='\t' || *text=='\r' || *text=='\n') text++;
+		if (!*text || !(v=cJSON_ParseWithOpts(text,&end,0))) break;
+		cJSON_AddItemToArray(values,v);text=end;
+	}
+	return values;
+}
+
+/* Feed text to stream in chunks of size bytes. Returns what Finish does, or 0 if a Feed failed. */
+static int feed(cJSON_Stream *stream,const char *text,size_t len,size_t size)
+{
+	size_t at;
+	for (at=0;at<len;at+=size) if (!cJSON_StreamFeed(stream,text+at,len-at<size?len-at:size)) return 0;
+	return cJSON_StreamFinish(stream);
+}
+
+static void check_file(const char *name,const char *text)
+{
+	static const size_t sizes[]={1,2,3,7,64,65,4096,(size_t)-1};
+	cJSON *want=parse_all(text);size_t i,len=strlen(text);int split;
+	check(cJSON_GetArraySize(want)>0,name,"holds no values");
+	for (split=0;split<2;split++) for (i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++)
+	{
+		collected c={0,0,0,0,0};cJSON_Stream *stream;
+		c.values=cJSON_CreateArray();
+		stream=cJSON_CreateStream(split,collect,&c);
+		check(stream && feed(stream,text,len,sizes[i]),name,split?"split stream failed":"stream failed");
+		check(!c.badEvent && !c.open,name,"events out of order");
+		check(same_tree(c.values,want),name,split?"split stream values differ":"stream values differ");
+		cJSON_DeleteStream(stream);cJSON_Delete(c.values);
+	}
+	cJSON_Delete(want);
+}
+
+/* Bad text, a handler that stops, and starting over with cJSON_ResetStream. */
+static void check_failures(void)
+{
+	collected c={0,0,0,0,0};cJSON_Stream *stream;cJSON *want;
+	c.values=cJSON_CreateArray();
+	stream=cJSON_CreateStream(1,collect,&c);
+	check(!feed(stream,"[1,2,}",6,2),"malformed","accepted");
+	check(!cJSON_StreamFeed(stream,"1 ",2),"malformed","fed on after failing");
+	cJSON_ResetStream(stream);cJSON_Delete(c.open);c.open=0;
+	check(!feed(stream,"{\"a\":[1,",8,3),"unfinished","accepted");
+	cJSON_ResetStream(stream);cJSON_Delete(c.open);c.open=0;
+	cJSON_Delete(c.values);c.values=cJSON_CreateArray();c.events=0;c.badEvent=0;
+	check(feed(stream,"[1,{\"b\":2}] 3 \"x\"",17,4),"after reset","failed");
+	want=parse_all("[1,{\"b\":2}] 3 \"x\"");
+	check(same_tree(c.values,want),"after reset","values differ");
+	cJSON_Delete(want);
+	cJSON_ResetStream(stream);cJSON_Delete(c.values);c.values=cJSON_CreateArray();c.events=0;c.stopAfter=2;
+	check(!feed(stream,"[1,2,3]",7,1) && c.events==2,"stopped","the stream went on after its handler stopped it");
+	cJSON_DeleteStream(stream);cJSON_Delete(c.open);cJSON_Delete(c.values);
+}
+
+int main(int argc,char *argv[])
+{
+	int i;
+	for (i=1;i<argc;i++)
+	{
+		char *text=read_file(argv[i],0);
+		check(text!=0,argv[i],"cannot be read");
+		if (text) check_file(argv[i],text);
+		free(text);
+	}
+	check_failures();
+	return test_failures?1:0;
+}
@@ -0,0 +1,89 @@
+/*
+  test_tape: tapes against trees.
+
+  Usage: test_tape file.json...
+
+  cJSON_ParseTape of each file (and of texts chosen for it) must hold what
+  cJSON_Parse builds, as seen through the tape accessors, and reject what
+  it rejects; cJSON_ParseBSONTape of the file's BSON must hold what
+  cJSON_ParseBSON builds, and refuse a truncated document.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cJSON_BSON.h"
+#include "test_util.h"
+
+static int same_bytes(const char *a,size_t alen,const char *b,size_t blen)	{return a && b && alen==blen && !memcmp(a,b,alen);}
+
+/* Whether the tape item t holds what item does (and has its key, for a member of an object). */
+static int same_item(const cJSON_Tape *tape,size_t t,cJSON *item,int member)
+{
+	const char *s;size_t len,c;cJSON *child;int i;
+	if (!t || cJSON_TapeType(tape,t)!=(item->type&255)) return 0;
+	if (member && (!(s=cJSON_TapeGetKey(tape,t,&len)) || !same_bytes(s,len,item->string,cJSON_GetKeyLength(item)))) return 0;
+	switch (item->type&255)
+	{
+		case cJSON_Number:	return cJSON_TapeGetNumber(tape,t)==item->valuedouble && cJSON_TapeGetInt(tape,t)==item->valueint;
+		case cJSON_String:	return (s=cJSON_TapeGetString(tape,t,&len)) && same_bytes(s,len,item->valuestring,cJSON_GetValueLength(item));
+		case cJSON_Array: case cJSON_Object: break;
+		default:			return cJSON_TapeChild(tape,t)==0;
+	}
+	if (cJSON_TapeGetArraySize(tape,t)!=cJSON_GetArraySize(item)) return 0;
+	for (c=cJSON_TapeChild(tape,t),child=item->child,i=0;c && child;c=cJSON_TapeNext(tape,c),child=child->next,i++)
+	{
+		if (cJSON_TapeGetArrayItem(tape,t,i)!=c || !same_item(tape,c,child,(item->type&255)==cJSON_Object)) return 0;
+		/* Lookup by key finds the first member that matches it, ignoring case, as in a tree. */
+		if ((item->type&255)==cJSON_Object && strlen(child->string)==cJSON_GetKeyLength(child) &&
+			cJSON_GetObjectItem(item,child->string)==child && cJSON_TapeGetObjectItem(tape,t,child->string)!=c) return 0;
+	}
+	return !c && !child;
+}
+
+static int same_tape(const cJSON_Tape *tape,cJSON *root)
+{
+	return tape && root && cJSON_TapeType(tape,0)==-1 && cJSON_TapeNext(tape,1)==0 && same_item(tape,1,root,0);
+}
+
+static void check_text(const char *name,const char *text)
+{
+	const char *treeEnd=0,*tapeEnd=0;
+	cJSON *tree=cJSON_ParseWithOpts(text,&treeEnd,0);cJSON_Tape *tape=cJSON_ParseTapeWithOpts(text,&tapeEnd,0);
+	check(!tree==!tape,name,tree?"cJSON_ParseTape failed":"cJSON_ParseTape accepted what cJSON_Parse rejects");
+	check(!tree || same_tape(tape,tree),name,"the tape differs from the tree");
+	check(!tree || treeEnd==tapeEnd,name,"cJSON_ParseTape stopped elsewhere");
+	cJSON_DeleteTape(tape);cJSON_Delete(tree);
+}
+
+static void check_bson(const char *name,cJSON *item)
+{
+	size_t size;char *bson=cJSON_PrintBSON(item,&size);
+	cJSON *tree=bson?cJSON_ParseBSON(bson,size,cJSON_Object):0;cJSON_Tape *tape=bson?cJSON_ParseBSONTape(bson,size,cJSON_Object):0;
+	check(tree && tape,name,"cannot parse the BSON");
+	check(!tree || same_tape(tape,tree),name,"the BSON tape differs from the BSON tree");
+	cJSON_DeleteTape(tape);
+	if (bson) {tape=cJSON_ParseBSONTape(bson,size-1,cJSON_Object);check(!tape,name,"cJSON_ParseBSONTape accepted a truncated document");cJSON_DeleteTape(tape);}
+	cJSON_Delete(tree);cJSON_DeleteBSON(bson);
+}
+
+int main(int argc,char *argv[])
+{
+	static const char *texts[]={
+		"{}","[]","1","-2.5e10","9007199254740993","\"a\\u0000b\"","[[],{},[{}]]",
+		"{\"A\":1,\"a\":2,\"b\":{\"c\":[true,false,null]}}","{\"\":\"empty key\"}","[1] trailing",
+		"","[1,","{\"a\" 1}",0};
+	int i;
+	cJSON_BSON_SetUseExtendedTypes(0);
+	for (i=0;texts[i];i++) check_text(texts[i],texts[i]);
+	for (i=1;i<argc;i++)
+	{
+		char *text=read_file(argv[i],0);cJSON *tree=text?cJSON_Parse(text):0;
+		check(tree!=0,argv[i],"cannot be parsed");
+		if (tree) {check_text(argv[i],text);check_bson(argv[i],tree);}
+		cJSON_Delete(tree);free(text);
+	}
+	return test_failures?1:0;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+
+int test_failures=0;
+
+void check(int ok,const char *name,const char *what)
+{
+	if (!ok) {fprintf(stderr,"%s: %s\n",name,what);test_failures++;}
+}
+
+char *read_file(const char *name,size_t *len)
+{
+	FILE *f=fopen(name,"rb");long size;char *data;
+	if (!f) return 0;
+	fseek(f,0,SEEK_END);size=ftell(f);fseek(f,0,SEEK_SET);
+	data=(char*)malloc(size+1);
+	if (data && fread(data,1,size,f)!=(size_t)size) {free(data);data=0;}
+	if (data) data[size]=0;
+	if (data && len) *len=(size_t)size;
+	fclose(f);
+	return data;
+}
+
+int same_tree(cJSON *a,cJSON *b)
+{
+	char *pa=cJSON_PrintUnformatted(a),*pb=cJSON_PrintUnformatted(b);
+	int same=pa && pb && !strcmp(pa,pb);
+	free(pa);free(pb);
+	return same;
+}
+
+static int same_string(const char *a,size_t alen,const char *b,size_t blen)	{return alen==blen && (!alen || !memcmp(a,b,alen));}
+
+int same_content(cJSON *a,cJSON *b)
+{
+	cJSON *c,*d;
+	if (!a || !b || (a->type&255)!=(b->type&255) || a->valuedouble!=b->valuedouble) return 0;
+	if (!a->valuestring!=!b->valuestring || (a->valuestring &&
+		!same_string(a->valuestring,cJSON_GetValueLength(a),b->valuestring,cJSON_GetValueLength(b)))) return 0;
+	if ((a->type&255)!=cJSON_Object)
+	{
+		for (c=a->child,d=b->child;c && d;c=c->next,d=d->next) if (!same_content(c,d)) return 0;
+		return !c && !d;
+	}
+	if (cJSON_GetArraySize(a)!=cJSON_GetArraySize(b)) return 0;
+	for (c=a->child;c;c=c->next)
+	{
+		for (d=b->child;d && !same_string(c->string,cJSON_GetKeyLength(c),d->string,cJSON_GetKeyLength(d));d=d->next);
+		if (!same_content(c,d)) return 0;
+	}
+	return 1;
+}
+
+int same_bson(const char *a,size_t alen,const char *b,size_t blen)
+{
+	return a && b && alen==blen && !memcmp(a,b,alen);
+}
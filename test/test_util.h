@@ -0,0 +1,36 @@
+/*
+  Helpers shared by the test programs, which each check one part of the
+  library and exit with 1 if any check failed.
+*/
+
+#ifndef test_util__h
+#define test_util__h
+
+#include <stddef.h>
+
+#include "cJSON.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Checks that failed so far; each failure is reported on stderr as "name: what". */
+extern int test_failures;
+void check(int ok,const char *name,const char *what);
+
+/* The contents of a file, null terminated (its length in len, if given); 0 if it can't be read. Free with free. */
+char *read_file(const char *name,size_t *len);
+
+/* Trees compare equal when they print the same. */
+int same_tree(cJSON *a,cJSON *b);
+/* Trees hold the same values, whatever the order of the members of their objects (which patching appends). */
+int same_content(cJSON *a,cJSON *b);
+/* Two encodings are the same bytes. */
+int same_bson(const char *a,size_t alen,const char *b,size_t blen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif